@@ -17,6 +17,7 @@
 #import "NCDockProtocolController.h"
 #import "PlugInUtilities.h"
 #import "Utilities.h"
+#import "Benchmarks.h"
 
 extern void	CaptureStdioOutTranslator(const char * inFilename);
 extern void	EndCaptureStdioOutTranslator(void);
@@ -167,6 +168,9 @@ NSDateFormatter * gDateFormatter;
 	[NSValueTransformer setValueTransformer:[[NCCriticalValueTransformer alloc] init] forName:@"NCCriticalValueTransformer"];
 	[NSValueTransformer setValueTransformer:[[NCDateValueTransformer alloc] init] forName:@"NCDateValueTransformer"];
 	[NSValueTransformer setValueTransformer:[[NCArrayIsEmpty alloc] init] forName:@"NCArrayIsEmpty"];
+
+	if ([userDefaults boolForKey:kBenchmarkPref])
+		dispatch_async(dispatch_get_global_queue(QOS_CLASS_UTILITY, 0), ^{ RunBenchmarks(); });
 }
 
 
@@ -10,8 +10,10 @@
 #import "NCDocument.h"
 #import "IdList.h"
 #import "Utilities.h"
+#import "GrowablePipe.h"
 #import "PreferenceKeys.h"
 #import "NCXErrors.h"
+#import "Metrics.h"
 #import "Logging.h"
 
 
@@ -28,6 +30,13 @@ extern "C" void REPflush(void);
 
 #define kFileChunkSize 4*KByte
 
+// bulk soup dump protocol extension
+#define kDBulkSoupDump			'bdmp'
+#define kDBulkEntries			'bent'
+#define kDBulkIds				'bids'
+
+#define kBulkDumpBatchSize		16
+
 
 /*------------------------------------------------------------------------------
 	B a c k u p F i l e H e a d e r
@@ -146,10 +155,96 @@ struct BackupFileHeader
 }
 
 
+/*------------------------------------------------------------------------------
+	Dump a soup using the bdmp protocol extension.
+	Instead of one kDEntry event per entry the Newton sends bent events, each
+	an array of entries flattened together so their symbols and shared
+	objects are sent once per batch; then a kDResult.
+	Each entry is reflattened on its own since that’s the form the document
+	keeps.
+	For a soup we already have, the extension is given the last backup id and
+	sync time, as kDBackupSoup is: only entries added or changed since are
+	sent, and the ids of the rest arrive in bids events so deleted entries can
+	still be found.
+	If the user cancels we can’t interrupt the Newton; we check between
+	batches, stop adding entries and wait for the dump to finish. Likewise if
+	anything unexpected arrives we stop adding entries and drain the dump to
+	its result before falling back -- the soup is upserted, so entries already
+	added are simply replaced when the soup is sent again.
+	Args:		inSoupName
+				inStore			store frame; we need its signature
+				inSoup			soup object to receive entries
+				ioIdList			ids of all entries on the Newton, for an incremental
+									backup; nil => dump the whole soup
+	Return:	kDBackupSoupDone
+				kDOperationCanceled
+				0 => extension failed; fall back to kDBackupSoup or kDSendSoup
+------------------------------------------------------------------------------*/
+
+- (EventType)bulkDumpSoup:(RefArg)inSoupName store:(RefArg)inStore into:(NCSoup *)inSoup ids:(NCIdList *)ioIdList {
+	RefVar args(AllocateFrame());
+	SetFrameSlot(args, SYMA(signature), GetFrameSlot(inStore, SYMA(signature)));
+	SetFrameSlot(args, SYMA(soupName), inSoupName);
+	SetFrameSlot(args, MakeSymbol("count"), MAKEINT(kBulkDumpBatchSize));
+	if (ioIdList) {
+		SetFrameSlot(args, MakeSymbol("lastId"), MAKEINT(inSoup.lastBackupId.intValue));
+		SetFrameSlot(args, MakeSymbol("since"), MAKEINT(inSoup.lastSyncTime));
+	}
+
+	EventType result = 0;
+	BOOL isCancelled = NO;
+	BOOL isAbandoned = NO;
+	CGrowablePipe pipe;
+	NCDockEvent * evt = [self.dock.session callExtension:kDBulkSoupDump with:args];
+	for (;;) {
+		if (evt.tag == kDBulkEntries) {
+			if (!isCancelled && !isAbandoned) {
+				RefVar entries(evt.ref);
+				FOREACH(entries, entry)
+					size_t entrySize = FlattenRefInto(entry, pipe);
+					NCEntry * entryObj = [inSoup addEntry:entry withNSOFData:pipe.data() length:entrySize];
+					[ioIdList addId:entryObj.uniqueId.unsignedIntValue];
+				END_FOREACH
+			}
+		} else if (evt.tag == kDBulkIds) {
+			if (!isCancelled && !isAbandoned) {
+				RefVar ids(evt.ref);
+				FOREACH(ids, uid)
+					[ioIdList addId:RVALUE(uid)];
+				END_FOREACH
+			}
+		} else if (evt.tag == kDResult) {
+			if (isCancelled)
+				result = kDOperationCanceled;
+			else if (evt.value == noErr && !isAbandoned)
+				result = kDBackupSoupDone;
+			break;
+		} else if (evt.tag == kDOperationCanceled) {
+			[self.dock.session sendEvent:kDOpCanceledAck];
+			result = kDOperationCanceled;
+			break;
+		} else if (evt.tag == kDUnknownCommand) {
+			// the extension never ran so nothing more is coming
+			break;
+		} else {
+			// not what we expected; abandon the extension, but the dump may still be running
+			isAbandoned = YES;
+		}
+		// a cancelled dump must not fall back to sending the soup again
+		if (self.progress.isCancelled)
+			isCancelled = YES;
+		evt = [self.dock.session receiveEvent:kDAnyEvent];
+	}
+	return result;
+}
+
+
 - (void) doBackup
 {
 	NewtonErr err = noErr;
+	int canBulkDump = 0;		// bdmp extension: 0 => not yet loaded, > 0 => loaded, < 0 => unavailable
 	NCDocument * document = self.dock.document;
+	[NCMetrics beginSession:@"backup"];
 
 @try
 {
@@ -258,6 +353,7 @@ FULL_LOG {
 }
 						if ([self.dock.session setCurrentSoup:soupName] == noErr)
 						{
+							[gMetrics beginSoup:MakeNSString(soupName) store:storeObjName];
 							NSString * statusStr = [NSString stringWithFormat: NSLocalizedString(@"backing up", nil), storeObjName, appName];
 							if (Length(appSoups) > 1)
 								statusStr = [NSString stringWithFormat:@"%@ : %@ soup", statusStr, MakeNSString(soupName)];
@@ -278,6 +374,7 @@ FULL_LOG {
 							{
 								// soup exists -- update it
 								syncTime = [self.dock.session setLastSyncTime:soupObj.lastSyncTime];
+								[soupObj beginUpsert:document];
 								XTRY
 								{
 									// if soup info has changed, update it
@@ -303,67 +400,81 @@ FULL_LOG {
 									BOOL isPackagesSoup = soupObj.app.isPackages;
 									NCIdList * idList = [[NCIdList alloc] init];
 
-									[self.dock.session sendEvent:kDBackupSoup value:[soupObj.lastBackupId unsignedIntValue]];
-									for (;;)
+									// packages are sent one at a time: batching them would swamp the Newton’s heap
+									if (!isPackagesSoup)
 									{
-										evt = [self.dock.session receiveEvent:kDAnyEvent];
-										// expecting kDSoupNotDirty, kDEntry, kDSetBaseID, kDBackupIDs, kDBackupSoupDone, kDOperationCanceled
-										if (evt.tag == kDEntry)
+										if (canBulkDump == 0)
+											canBulkDump = ([self.dock.session loadExtension:@"bdmp"] == noErr) ? 1 : -1;
+										if (canBulkDump > 0)
 										{
-											if (isPackagesSoup)
+											result = [self bulkDumpSoup:soupName store:store into:soupObj ids:idList];
+											if (result == 0)
+												idList = [[NCIdList alloc] init];
+										}
+									}
+
+									if (result == 0)
+									{
+										[self.dock.session sendEvent:kDBackupSoup value:[soupObj.lastBackupId unsignedIntValue]];
+										for (;;)
+										{
+											evt = [self.dock.session receiveEvent:kDAnyEvent];
+											// expecting kDSoupNotDirty, kDEntry, kDSetBaseID, kDBackupIDs, kDBackupSoupDone, kDOperationCanceled
+											if (evt.tag == kDEntry)
 											{
-												RefVar entry(evt.ref);
-												if (FrameHasSlot(entry, MakeSymbol("pkgRef")))
+												if (isPackagesSoup)
 												{
-													NSString * pkgName = MakeNSString(GetFrameSlot(entry, MakeSymbol("packageName")));
-													self.progress.localizedDescription = [NSString stringWithFormat:NSLocalizedString(@"backing up package", nil), storeObjName, pkgName];
+													RefVar entry(evt.ref);
+													if (FrameHasSlot(entry, MakeSymbol("pkgRef")))
+													{
+														NSString * pkgName = MakeNSString(GetFrameSlot(entry, MakeSymbol("packageName")));
+														self.progress.localizedDescription = [NSString stringWithFormat:NSLocalizedString(@"backing up package", nil), storeObjName, pkgName];
 
-													NCEntry * entryObj = [soupObj addEntry:entry withNSOFData:evt.data length:evt.dataLength];
+														NCEntry * entryObj = [soupObj addEntry:entry withNSOFData:evt.data length:evt.dataLength];
+														[idList addId:[entryObj.uniqueId unsignedIntValue]];
+													}
+												}
+												else
+												{
+													NCEntry * entryObj = [soupObj addEntry:evt.ref withNSOFData:evt.data length:evt.dataLength];
 													[idList addId:[entryObj.uniqueId unsignedIntValue]];
 												}
 											}
-											else
+											else if (evt.tag == kDSetBaseID)
 											{
-												NCEntry * entryObj = [soupObj addEntry:evt.ref withNSOFData:evt.data length:evt.dataLength];
-												[idList addId:[entryObj.uniqueId unsignedIntValue]];
+												// set base for subsequent kDBackupIDs
+												[idList setBaseId:evt.value];
+											}
+											else if (evt.tag == kDBackupIDs)
+											{
+												// add ids to our list - these entries have not been modified or added
+												[idList addEncodedIds:evt.data length:evt.dataLength];
+											}
+											else if (evt.tag == kDBackupSoupDone
+												  ||  evt.tag == kDSoupNotDirty)
+											{
+												result = evt.tag;
+												break;
+											}
+											else if (evt.tag == kDOperationCanceled)
+											{
+												[self.dock.session sendEvent:kDOpCanceledAck];
+												result = evt.tag;
+												break;
+											}
+											if (self.progress.isCancelled)
+											{
+												[self.dock.session sendEvent:kDOperationCanceled /*expecting:kDOpCanceledAck*/];
+												result = kDOperationCanceled;
+												break;
 											}
-										}
-										else if (evt.tag == kDSetBaseID)
-										{
-											// set base for subsequent kDBackupIDs
-											[idList setBaseId:evt.value];
-										}
-										else if (evt.tag == kDBackupIDs)
-										{
-											// add ids to our list - these entries have not been modified or added
-											short * codedId;
-											for (codedId = (short *)evt.data; [idList add:CANONICAL_SHORT(*codedId)]; codedId++)
-												;
-										}
-										else if (evt.tag == kDBackupSoupDone
-											  ||  evt.tag == kDSoupNotDirty)
-										{
-											result = evt.tag;
-											break;
-										}
-										else if (evt.tag == kDOperationCanceled)
-										{
-											[self.dock.session sendEvent:kDOpCanceledAck];
-											result = evt.tag;
-											break;
-										}
-										if (self.progress.isCancelled)
-										{
-											[self.dock.session sendEvent:kDOperationCanceled /*expecting:kDOpCanceledAck*/];
-											result = kDOperationCanceled;
-											break;
 										}
 									}
 
 									NSIndexSet * newtIds = idList.ids;
 	/* ---- delete entries locally that were deleted from Newton ---- */
 									if (result == kDBackupSoupDone)
-										[soupObj cropTo:newtIds];
+										[soupObj cropToIds:idList.idSet mainContext:document.managedObjectContext];
 
 									if (result == kDBackupSoupDone
 									||  result == kDSoupNotDirty)
@@ -475,53 +586,66 @@ FULL_LOG {
 	NSLog(@"---- NCX log ends ----");
 }
 									[document app:appObj addSoup:soupObj];
+									[soupObj beginUpsert:document];
 
 									BOOL isPackagesSoup = soupObj.app.isPackages;
 
-									[self.dock.session sendEvent:kDSendSoup];
-									for (;;)
+									// packages are sent one at a time: batching them would swamp the Newton’s heap
+									if (!isPackagesSoup)
+									{
+										if (canBulkDump == 0)
+											canBulkDump = ([self.dock.session loadExtension:@"bdmp"] == noErr) ? 1 : -1;
+										if (canBulkDump > 0)
+											result = [self bulkDumpSoup:soupName store:store into:soupObj ids:nil];
+									}
+
+									if (result == 0)
 									{
-										evt = [self.dock.session receiveEvent:kDAnyEvent];
-										// expecting kDEntry, kDBackupSoupDone, kDOperationCanceled
-										if (evt.tag == kDEntry)
+										[self.dock.session sendEvent:kDSendSoup];
+										for (;;)
 										{
-											RefVar entry(evt.ref);
+											evt = [self.dock.session receiveEvent:kDAnyEvent];
+											// expecting kDEntry, kDBackupSoupDone, kDOperationCanceled
+											if (evt.tag == kDEntry)
+											{
+												RefVar entry(evt.ref);
 FULL_LOG {
 	REPprintf("\n---- adding new entry ----\n");
 	PrintObject(entry, 0);
 }
-											if (isPackagesSoup)
-											{
-												if (FrameHasSlot(entry, MakeSymbol("pkgRef")))
+												if (isPackagesSoup)
 												{
-													NSString * pkgName = MakeNSString(GetFrameSlot(entry, MakeSymbol("packageName")));
-													self.progress.localizedDescription = [NSString stringWithFormat:NSLocalizedString(@"backing up package", nil), storeObjName, pkgName];
+													if (FrameHasSlot(entry, MakeSymbol("pkgRef")))
+													{
+														NSString * pkgName = MakeNSString(GetFrameSlot(entry, MakeSymbol("packageName")));
+														self.progress.localizedDescription = [NSString stringWithFormat:NSLocalizedString(@"backing up package", nil), storeObjName, pkgName];
 
+														[soupObj addEntry:entry withNSOFData:evt.data length:evt.dataLength];
+														[document savePersistentStore];	// save now so if anything goes wrong we don’t have to sit through a long backup again
+													}
+												}
+												else
+												{
 													[soupObj addEntry:entry withNSOFData:evt.data length:evt.dataLength];
-													[document savePersistentStore];	// save now so if anything goes wrong we don’t have to sit through a long backup again
 												}
 											}
-											else
+											else if (evt.tag == kDBackupSoupDone)
 											{
-												[soupObj addEntry:entry withNSOFData:evt.data length:evt.dataLength];
+												result = evt.tag;
+												break;
+											}
+											else if (evt.tag == kDOperationCanceled)
+											{
+												[self.dock.session sendEvent:kDOpCanceledAck];
+												result = evt.tag;
+												break;
+											}
+											if (self.progress.isCancelled)
+											{
+												[self.dock.session sendEvent:kDOperationCanceled /*expecting:kDOpCanceledAck*/];
+												result = kDOperationCanceled;
+												break;
 											}
-										}
-										else if (evt.tag == kDBackupSoupDone)
-										{
-											result = evt.tag;
-											break;
-										}
-										else if (evt.tag == kDOperationCanceled)
-										{
-											[self.dock.session sendEvent:kDOpCanceledAck];
-											result = evt.tag;
-											break;
-										}
-										if (self.progress.isCancelled)
-										{
-											[self.dock.session sendEvent:kDOperationCanceled /*expecting:kDOpCanceledAck*/];
-											result = kDOperationCanceled;
-											break;
 										}
 									}
 								}
@@ -530,6 +654,8 @@ FULL_LOG {
 
 							// good time to save the document?
 							[document savePersistentStore];
+							[soupObj endUpsert];
+							[gMetrics endSoup];
 FULL_LOG {
 	REPflush();
 }
@@ -577,6 +703,11 @@ else REPprintf("\n#### soup not on store!");
 }
 
 	[document disposeManagedObjectContextForThread];
+	// soups that now have enough entries are compressed once the session is over
+	dispatch_async(dispatch_get_main_queue(), ^{
+		[document compressEntries];
+	});
+	[NCMetrics endSession:err];
 	[self.dock syncDone:err];
 }
 
@@ -856,6 +987,7 @@ else REPprintf("\n#### soup not on store!");
 {
 	NewtonErr err = noErr;
 	NCDocument * document = self.dock.document;
+	[NCMetrics beginSession:@"restore"];
 
 	newton_try
 	{
@@ -922,6 +1054,7 @@ else REPprintf("\n#### soup not on store!");
 			// iterate over soups in app
 			for (NCSoup * soupObj in [document.restoreInfo.sourceStore soupsInApp: appObj])	// storeObj from LIBRARY
 			{
+				[gMetrics beginSoup:soupObj.name store:storeObjName];
 				// if the soup already exists, delete it
 				RefVar soupName(MakeString(soupObj.name));
 				if ([self.dock.session setCurrentSoup:soupName] == noErr)
@@ -945,6 +1078,8 @@ FULL_LOG {
 				for (NCEntry * entry in [soupObj orderedEntries])
 				{
 					[self.dock.session sendEvent:kDAddEntryWithUniqueID data:entry.refData.bytes length:(unsigned int)entry.refData.length];
+					MetricsCount(kMetricsEntries);
+					MetricsCount(kMetricsEntryBytes, entry.refData.length);
 					evt = [self.dock.session receiveEvent:kDAnyEvent];	// kDResult | kDOperationCanceled
 					if (evt.tag == kDResult
 					 && evt.value != noErr)
@@ -1036,6 +1171,7 @@ FULL_LOG {
 	if (restorePath)
 		free(restorePath), restorePath = NULL;
 
+	[NCMetrics endSession:err];
 	[self.dock restoreDone:err];
 }
 
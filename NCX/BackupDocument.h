@@ -43,11 +43,17 @@ struct BackupFileHeader
 - (NCDevice *)makeDevice:(NSString *)inName source:(SourceInfo *)inSource;
 - (NCStore *)makeStore:(RefArg)inStoreRef;
 - (NCApp *)makeApp:(NSString *)inName;
-- (NCSoup *)makeSoup:(NSString *)inName fromData:(CStdIOPipe &)inPipe indexesRange:(NSRange)indexesRange infoRange:(NSRange)infoRange info:(RefArg)info;
+- (NCSoup *)makeSoup:(NSString *)inName fromData:(NSData *)inFile indexesRange:(NSRange)indexesRange infoRange:(NSRange)infoRange info:(RefArg)info;
 
 @end
 
 
 @interface NCSoup (forNCX1)
-- (NCEntry *)addEntry:(RefArg)inEntry fromData:(CStdIOPipe &)inPipe range:(NSRange)inRange;
+- (NCEntry *)addEntry:(RefArg)inEntry fromData:(NSData *)inFile range:(NSRange)inRange;
+@end
+
+
+@interface NCDocument (NBK)
+- (IBAction)exportBackup:(id)sender;
+- (BOOL)writeBackupOfStore:(NCStore *)inStore toURL:(NSURL *)inURL error:(NSError **)outError;
 @end
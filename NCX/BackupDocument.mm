@@ -14,6 +14,9 @@
 #import "BackupDocument.h"
 #import "NCWindowController.h"
 #import "Utilities.h"
+#import "GrowablePipe.h"
+#import "NSOFReader.h"
+#import "Metrics.h"
 
 extern "C" Ref FFindStringInArray(RefArg inRcvr, RefArg inArray, RefArg inStr);
 
@@ -27,6 +30,24 @@ extern NSDictionary * gSlotDict;
 NSString * const NSNewtonErrorDomain = @"NewtonErrorDomain";
 
 
+/* -----------------------------------------------------------------------------
+	Return a range of a (mapped) file without copying it.
+	The slice keeps the file data alive.
+	Args:		inFile
+				inRange
+	Return:	NSData instance
+----------------------------------------------------------------------------- */
+
+static NSData *
+FileSlice(NSData * inFile, NSRange inRange)
+{
+	if (inRange.location == NSNotFound)
+		return [NSData data];
+	void * bytes = (char *)inFile.bytes + inRange.location;
+	return [[NSData alloc] initWithBytesNoCopy:bytes length:inRange.length deallocator:^(void * inBytes, NSUInteger inLength) { (void)inFile; }];
+}
+
+
 /* -----------------------------------------------------------------------------
 	N B D o c u m e n t
 	Created from NCXv1 .nbku file.
@@ -63,22 +84,40 @@ NSString * const NSNewtonErrorDomain = @"NewtonErrorDomain";
 		 NSOF stream	 soupRef				the store contains many soups
 		  NSOF stream	  entryRef			each soup contains many entries
 													each stream of NSOF objects is terminated by a nil object
+	The file is mapped and read in one pass. Entries are not unflattened: only
+	the slots needed to index them are read, and their NSOF data is a slice of
+	the mapped file. The Newton object heap is not thread-safe, so objects are
+	built on this thread, in file order; a CNSOFScanner measures and indexes
+	the entries ahead of us on another thread.
 ----------------------------------------------------------------------------- */
 
 - (BOOL)readFromURL:(NSURL *)url ofType:(NSString *)typeName error:(NSError **)outError
 {
-	const char * filePathStr = url.fileSystemRepresentation;
-	CStdIOPipe pipe(filePathStr, "r");
+	NSData * fileData = [NSData dataWithContentsOfURL:url options:NSDataReadingMappedIfSafe error:outError];
+	if (fileData == nil)
+		return NO;
+	const char * fileBytes = (const char *)fileData.bytes;
+	size_t fileSize = fileData.length;
 	BackupFileHeader header;
-	size_t size = sizeof(header);
-	bool isEOF;
 	NSError * errObj = nil;
 
 	// file must be prefixed with 'backup0'
-	pipe.readChunk(&header, size, isEOF);
+	if (fileSize < sizeof(header))
+		return NO;
+	memcpy(&header, fileBytes, sizeof(header));
 	if (strncmp(header.signature, "backup", 6) != 0)
 		return NO;
 
+	// measure the import like a backup -- unless a dock session is being measured
+	BOOL isMeasured = (gMetrics == nil);
+	if (isMeasured)
+		[NCMetrics beginSession: @"import"];
+
+	CPtrPipe pipe;
+	pipe.init((void *)fileBytes, fileSize, NO, NULL);
+	pipe.readSeek(sizeof(header), SEEK_SET);
+	CNSOFScanner scanner(fileBytes, fileSize, sizeof(header));
+
 #if defined(hasByteSwapping)
 	// this backup file MAY have been created on a (big-endian) PPC machine
 	if ((header.source.machineType & 0xFFFF0000) != 0x10000000
@@ -108,7 +147,7 @@ NSString * const NSNewtonErrorDomain = @"NewtonErrorDomain";
 		RefVar allApps(GetFrameSlot(storeRef, MakeSymbol("apps")));
 		FOREACH(allApps, app)
 			NCApp * appObj = [self makeApp: MakeNSString(GetFrameSlot(app, SYMA(name)))];
-			RefVar soupIndexes, soupInfoRef, soupEntry;
+			RefVar soupIndexes, soupInfoRef, soupEntry, summarySlots;
 			RefVar appSoups(GetFrameSlot(app, MakeSymbol("soups")));
 			FOREACH(appSoups, soupName)
 				NSRange indexesRange;
@@ -121,14 +160,31 @@ NSString * const NSNewtonErrorDomain = @"NewtonErrorDomain";
 				soupInfoRef = UnflattenRef(pipe);
 				infoRange.length = pipe.readPosition() - infoRange.location;
 
-				NCSoup * soupObj = [self makeSoup: MakeNSString(soupName) fromData: pipe indexesRange: indexesRange infoRange: infoRange info: soupInfoRef];
+				NCSoup * soupObj = [self makeSoup: MakeNSString(soupName) fromData: fileData indexesRange: indexesRange infoRange: infoRange info: soupInfoRef];
 				[storeObj addSoupsObject: soupObj];
 				[appObj addSoupsObject: soupObj];
 
+				// package entries are rewritten, so need to be unflattened in full
+				bool isPackages = appObj.isPackages;
+				summarySlots = [soupObj summarySlots];
 				NSRange entryRange;
-				while (entryRange.location = pipe.readPosition(), NOTNIL(soupEntry = UnflattenRef(pipe))) {
-					entryRange.length = pipe.readPosition() - entryRange.location;
-					[soupObj addEntry: soupEntry fromData: pipe range: entryRange];
+				for ( ; ; ) {
+					entryRange.location = pipe.readPosition();
+					CNSOFReader * reader = scanner.take(entryRange.location);
+					if (reader == NULL)
+						reader = new CNSOFReader(fileBytes + entryRange.location, fileSize - entryRange.location);
+					bool isRead = !isPackages && reader->getSlots(summarySlots, soupEntry);
+					entryRange.length = reader->length();
+					delete reader;
+					if (isRead) {
+						pipe.readSeek(entryRange.location + entryRange.length, SEEK_SET);
+					} else {
+						// the nil that ends the soup, or NSOF the reader can’t handle
+						if (ISNIL(soupEntry = UnflattenRef(pipe)))
+							break;
+						entryRange.length = pipe.readPosition() - entryRange.location;
+					}
+					[soupObj addEntry: soupEntry fromData: fileData range: entryRange];
 				}
 
 				// remove this soup from the master list
@@ -147,6 +203,9 @@ NSString * const NSNewtonErrorDomain = @"NewtonErrorDomain";
 		errObj = [NSError errorWithDomain: NSNewtonErrorDomain code: err userInfo: errDict];
 	}
 	end_try;
+	scanner.stop();
+	if (isMeasured)
+		[NCMetrics endSession: errObj ? (NCError)errObj.code : noErr];
 
 	if (errObj) {
 		*outError = errObj;
@@ -159,7 +218,7 @@ NSString * const NSNewtonErrorDomain = @"NewtonErrorDomain";
 		RefVar nothing(AllocateFrame());
 		NSRange noRange = NSMakeRange(NSNotFound, 0);
 		FOREACH(allSoups, soupName)
-			NCSoup * soupObj = [self makeSoup: MakeNSString(soupName) fromData: pipe indexesRange: noRange infoRange: noRange info: nothing];
+			NCSoup * soupObj = [self makeSoup: MakeNSString(soupName) fromData: fileData indexesRange: noRange infoRange: noRange info: nothing];
 			[storeObj addSoupsObject: soupObj];
 		END_FOREACH	// soup
 	}
@@ -243,36 +302,22 @@ NSString * const NSNewtonErrorDomain = @"NewtonErrorDomain";
 /* -----------------------------------------------------------------------------
 	Make a persistent soup object.
 	Args:		inName
-				inPipe
+				inFile			mapped backup file
 				indexesRange
 				infoRange
 				info
 	Return:	NCSoup instance
 ----------------------------------------------------------------------------- */
 
-- (NCSoup *)makeSoup:(NSString *)inName fromData:(CStdIOPipe &)inPipe indexesRange:(NSRange)indexesRange infoRange:(NSRange)infoRange info:(RefArg)info {
+- (NCSoup *)makeSoup:(NSString *)inName fromData:(NSData *)inFile indexesRange:(NSRange)indexesRange infoRange:(NSRange)infoRange info:(RefArg)info {
 
 	NCSoup * soup = [NSEntityDescription insertNewObjectForEntityForName: @"Soup" inManagedObjectContext: self.objContext];
 	soup.name = inName;
 	soup.lastImportId = [NSNumber numberWithUnsignedInt: kImportIdBase];
 
 	if (NOTNIL(info)) {
-		bool isEOF;
-		long savedPosition = inPipe.readPosition();
-
-		size_t len = indexesRange.length;
-		void * nsof = malloc(len);
-		inPipe.readSeek(indexesRange.location, SEEK_SET);
-		inPipe.readChunk(nsof, len, isEOF);
-		soup.indexes = [NSData dataWithBytesNoCopy: nsof length: len];
-
-		len = infoRange.length;
-		nsof = malloc(len);
-		inPipe.readSeek(infoRange.location, SEEK_SET);
-		inPipe.readChunk(nsof, len, isEOF);
-		soup.info = [NSData dataWithBytesNoCopy: nsof length: len];
-
-		inPipe.readSeek(savedPosition, SEEK_SET);
+		soup.indexes = FileSlice(inFile, indexesRange);
+		soup.info = FileSlice(inFile, infoRange);
 
 		// assume there’s no soupDef, or it’s not fully slotted
 		soup.descr = @"No soup definition.";
@@ -324,43 +369,238 @@ NSString * const NSNewtonErrorDomain = @"NewtonErrorDomain";
 @implementation NCSoup (forNCX1)
 /* -----------------------------------------------------------------------------
 	Make a persistent soup entry object.
-	Args:		inEntry
-				inPipe
-				inRange
+	Args:		inEntry			the entry; for all but packages, just its summary slots
+				inFile			mapped backup file
+				inRange			of the entry’s NSOF data in the file
 	Return:	NCEntry instance
 ----------------------------------------------------------------------------- */
 
-- (NCEntry *)addEntry:(RefArg)inEntry fromData:(CStdIOPipe &)inPipe range:(NSRange)inRange {
-	size_t numOfBytes;
-	void * data;
+- (NCEntry *)addEntry:(RefArg)inEntry fromData:(NSData *)inFile range:(NSRange)inRange {
+	NSData * data;
 
 	if (self.app.isPackages) {
 		if (FrameHasSlot(inEntry, MakeSymbol("pkgRef"))) {
 			SetFrameSlot(inEntry, SYMA(class), MakeSymbol("*package*"));
-			numOfBytes = FlattenRefSize(inEntry);
-			data = malloc(numOfBytes);
-
-			CPtrPipe pipe;
-			pipe.init(data, numOfBytes, NO, nil);
-			FlattenRef(inEntry, pipe);
+			CGrowablePipe pipe;
+			size_t numOfBytes = FlattenRefInto(inEntry, pipe);
+			data = [NSData dataWithBytesNoCopy:pipe.detach() length:numOfBytes];
 		} else {
 		// ignore it -- we’re only interested in pkgRef entries
 			return nil;
 		}
 
 	} else {
-		bool isEOF;
-		long savedPosition = inPipe.readPosition();
-		numOfBytes = inRange.length;
-		data = malloc(numOfBytes);
-		inPipe.readSeek(inRange.location, SEEK_SET);
-		inPipe.readChunk(data, numOfBytes, isEOF);
-		inPipe.readSeek(savedPosition, SEEK_SET);
+		data = FileSlice(inFile, inRange);
+	}
+
+	return [self addEntry:inEntry withNSOFData:data];
+}
+
+@end
+
+
+#pragma mark -
+/* -----------------------------------------------------------------------------
+	N C D o c u m e n t   ( N B K )
+	Export a store as a backup file, in the format read by NBDocument.
+	Entries are never unflattened: their stored NSOF is copied straight to the
+	file, a page at a time, so memory use does not grow with the backup.
+----------------------------------------------------------------------------- */
+#define kExportPageSize 500
+
+@implementation NCDocument (NBK)
+
+/* -----------------------------------------------------------------------------
+	Let the user choose where to export the device’s backup.
+	Args:		sender
+	Return:	--
+----------------------------------------------------------------------------- */
+
+- (IBAction)exportBackup:(id)sender {
+	NCStore * storeObj = self.stores.firstObject;	// Internal if we have it
+	if (storeObj == nil)
+		return;
+
+	NSSavePanel * chooser = [NSSavePanel savePanel];
+	chooser.title = @"Export Backup";
+	chooser.allowedFileTypes = @[@"com.newton.backup"];
+	chooser.nameFieldStringValue = self.deviceObj.name;
+	chooser.canCreateDirectories = YES;
+
+	if ([chooser runModal] == NSModalResponseOK) {
+		NSError *__autoreleasing error = nil;
+		if (![self writeBackupOfStore:storeObj toURL:chooser.URL error:&error])
+			[self presentError:error];
 	}
+}
 
-	NCEntry * entry = [self addEntry:inEntry withNSOFData:data length:numOfBytes];
-	free(data);
-	return entry;
+
+/* -----------------------------------------------------------------------------
+	Write a store’s soups and entries as a backup file.
+	Args:		inStore
+				inURL
+				outError
+	Return:	YES => written
+----------------------------------------------------------------------------- */
+
+- (BOOL)writeBackupOfStore:(NCStore *)inStore toURL:(NSURL *)inURL error:(NSError **)outError {
+	NSManagedObjectContext * objContext = self.objContext;
+	// entries are read back from the persistent store in pages, so it must be up to date
+	BOOL hasStore = objContext.persistentStoreCoordinator.persistentStores.count > 0;
+	if (hasStore && objContext.hasChanges)
+		[self savePersistentStore];
+
+	// apps, and their soups on this store, in name order
+	NSSortDescriptor * byName = [NSSortDescriptor sortDescriptorWithKey:@"name" ascending:YES];
+	NSMutableDictionary * appSoups = [NSMutableDictionary dictionary];
+	for (NCSoup * soup in inStore.soups) {
+		if (soup.app) {
+			NSMutableArray * soups = appSoups[soup.app.name];
+			if (soups == nil)
+				appSoups[soup.app.name] = soups = [NSMutableArray array];
+			[soups addObject:soup];
+		}
+	}
+	NSArray * appNames = [appSoups.allKeys sortedArrayUsingSelector:@selector(compare:)];
+	for (NSString * appName in appNames)
+		[appSoups[appName] sortUsingDescriptors:@[byName]];
+
+	FILE * fp = fopen(inURL.fileSystemRepresentation, "w");
+	if (fp == NULL) {
+		if (outError)
+			*outError = [NSError errorWithDomain:NSPOSIXErrorDomain code:errno userInfo:@{ NSURLErrorKey: inURL }];
+		return NO;
+	}
+	setvbuf(fp, NULL, _IOFBF, 1024*1024);
+
+	NSError * errObj = nil;
+	newton_try
+	{
+		// header
+		BackupFileHeader header;
+		memset(&header, 0, sizeof(header));
+		strncpy(header.signature, "backup0", sizeof(header.signature));
+		const NewtonInfo * newtonInfo = (const NewtonInfo *)self.deviceObj.info.bytes;
+		if (newtonInfo) {
+			header.source.version = (newtonInfo->fROMVersion < 0x00020000) ? kOnePointXData : kTwoPointXData;
+			header.source.manufacturer = newtonInfo->fManufacturer;
+			header.source.machineType = newtonInfo->fMachineType;
+		}
+		fwrite(&header, sizeof(header), 1, fp);
+
+		// store info, listing apps and soups
+		RefVar storeRef(inStore.ref);
+		RefVar apps(MakeArray((ArrayIndex)appNames.count));
+		RefVar allSoups(MakeArray((ArrayIndex)inStore.soups.count));
+		ArrayIndex appIndex = 0, soupIndex = 0;
+		for (NSString * appName in appNames) {
+			NSArray * soups = appSoups[appName];
+			RefVar app(AllocateFrame());
+			RefVar soupNames(MakeArray((ArrayIndex)soups.count));
+			ArrayIndex i = 0;
+			for (NCSoup * soup in soups)
+				SetArraySlot(soupNames, i++, MakeString(soup.name));
+			SetFrameSlot(app, SYMA(name), MakeString(appName));
+			SetFrameSlot(app, MakeSymbol("soups"), soupNames);
+			SetArraySlot(apps, appIndex++, app);
+		}
+		for (NCSoup * soup in [inStore.soups sortedArrayUsingDescriptors:@[byName]])
+			SetArraySlot(allSoups, soupIndex++, MakeString(soup.name));
+		SetFrameSlot(storeRef, MakeSymbol("apps"), apps);
+		SetFrameSlot(storeRef, MakeSymbol("soups"), allSoups);
+		NSData * nsof = FlattenRefToData(storeRef);
+		fwrite(nsof.bytes, nsof.length, 1, fp);
+
+		// each soup is its indexes and info, then its entries, then nil
+		NSData * nilData = FlattenRefToData(RA(NILREF));
+		RefVar noIndexesRef(MakeArray(0));
+		RefVar noInfoRef(AllocateFrame());
+		NSData * noIndexes = FlattenRefToData(noIndexesRef);
+		NSData * noInfo = FlattenRefToData(noInfoRef);
+		for (NSString * appName in appNames) {
+			for (NCSoup * soup in appSoups[appName]) {
+				nsof = soup.indexes.length > 0 ? soup.indexes : noIndexes;
+				fwrite(nsof.bytes, nsof.length, 1, fp);
+				nsof = soup.info.length > 0 ? soup.info : noInfo;
+				fwrite(nsof.bytes, nsof.length, 1, fp);
+
+				NSNumber * badId = nil;
+				NSError * fetchError = nil;
+				if (hasStore) {
+					// page by key, not offset, so each page is found from the index
+					NSFetchRequest * request = [NSFetchRequest fetchRequestWithEntityName:@"Entry"];
+					request.sortDescriptors = @[[NSSortDescriptor sortDescriptorWithKey:@"uniqueId" ascending:YES]];
+					request.resultType = NSDictionaryResultType;
+					request.propertiesToFetch = @[@"uniqueId", @"refData"];
+					request.fetchLimit = kExportPageSize;
+					NSNumber * lastId = @(-1);
+					for (NSUInteger count = kExportPageSize; count == kExportPageSize && badId == nil && fetchError == nil; ) {
+						@autoreleasepool {
+							request.predicate = [NSPredicate predicateWithFormat:@"soup = %@ AND uniqueId > %@", soup, lastId];
+							NSError *__autoreleasing error = nil;
+							NSArray * page = [objContext executeFetchRequest:request error:&error];
+							if (page == nil) {
+								// a short page would end the soup early; don’t write a truncated backup
+								fetchError = error ? error : [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileReadUnknownError userInfo:nil];
+								break;
+							}
+							for (NSDictionary * entry in page) {
+								// stored data may be compressed with the soup’s dictionary
+								NSData * refData = [soup decodeRefData:entry[@"refData"]];
+								if (refData == nil) {
+									badId = entry[@"uniqueId"];
+									break;
+								}
+								fwrite(refData.bytes, refData.length, 1, fp);
+							}
+							count = page.count;
+							lastId = page.lastObject[@"uniqueId"];
+						}
+					}
+				} else {
+					// a backup document that has never been saved: its entries are all in memory anyway
+					for (NCEntry * entry in [soup.entries sortedArrayUsingDescriptors:@[[NSSortDescriptor sortDescriptorWithKey:@"uniqueId" ascending:YES]]]) {
+						NSData * refData = entry.refData;
+						if (refData == nil) {
+							badId = entry.uniqueId;
+							break;
+						}
+						fwrite(refData.bytes, refData.length, 1, fp);
+					}
+				}
+				if (fetchError) {
+					errObj = fetchError;
+					break;
+				}
+				if (badId) {
+					errObj = [NSError errorWithDomain:NSCocoaErrorDomain code:NSFileWriteUnknownError userInfo:@{ NSURLErrorKey: inURL,
+									NSLocalizedDescriptionKey: [NSString stringWithFormat:@"Entry %@ of the %@ soup could not be read, so the backup was not written.", badId, soup.name] }];
+					break;
+				}
+				fwrite(nilData.bytes, nilData.length, 1, fp);
+			}
+			if (errObj)
+				break;
+		}
+	}
+	newton_catch_all
+	{
+		NewtonErr err = (NewtonErr)(long)CurrentException()->data;
+		errObj = [NSError errorWithDomain: NSNewtonErrorDomain code: err userInfo: @{ NSLocalizedDescriptionKey: [NSString stringWithFormat: @"Newton error %d occurred when writing the backup.", err] }];
+	}
+	end_try;
+
+	if (errObj == nil && (ferror(fp) || fflush(fp) != 0))
+		errObj = [NSError errorWithDomain:NSPOSIXErrorDomain code:errno userInfo:@{ NSURLErrorKey: inURL }];
+	fclose(fp);
+
+	if (errObj) {
+		unlink(inURL.fileSystemRepresentation);
+		if (outError)
+			*outError = errObj;
+		return NO;
+	}
+	return YES;
 }
 
 @end
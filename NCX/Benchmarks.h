@@ -0,0 +1,22 @@
+/*
+	File:		Benchmarks.h
+
+	Contains:	Timings of the document’s local indexes, sort keys, backup reader
+					and export, entry compression, NSOF flattening and dock event
+					builder on synthetic data, and of backup, restore and pruning
+					with a simulated Newton.
+
+	Written by:	Newton Research Group, 2026.
+*/
+
+/* -----------------------------------------------------------------------------
+	Benchmarks run in the background at launch when the Benchmark default is set,
+	eg
+		NCX.app/Contents/MacOS/NCX -Benchmark YES
+	Results are logged. Replaying captures shares the dock event builder with a
+	live session, so run them with no Newton connected. The simulated sessions
+	back up into, and restore from, the document that is open -- the untitled
+	one the app opens at launch.
+----------------------------------------------------------------------------- */
+
+extern void	RunBenchmarks(void);
@@ -0,0 +1,1060 @@
+/*
+	File:		Benchmarks.mm
+
+	Contains:	Timings of the document’s local indexes, sort keys, backup reader
+					and export, entry compression, NSOF flattening and dock event
+					builder on synthetic data, and of backup, restore and pruning
+					with a simulated Newton.
+
+	Written by:	Newton Research Group, 2026.
+*/
+
+#import <Foundation/Foundation.h>
+#import "Benchmarks.h"
+#import "NewtonKit.h"
+#import "PlugInUtilities.h"
+#import "GrowablePipe.h"
+#import "TextIndex.h"
+#import "SortKey.h"
+#import "BackupDocument.h"
+#import "NSOFReader.h"
+#import "Metrics.h"
+#import "Capture.h"
+#import "Endpoint.h"
+#import "Simulator.h"
+#import "DockErrors.h"
+#import "NCDocument.h"
+#import "IdList.h"
+#import "NCDockProtocolController.h"
+#import <Newton/Unicode.h>
+#import <algorithm>
+#import <vector>
+
+// entries in the synthetic corpus
+#define kNumOfBenchmarkEntries 100000
+
+// queries of each kind timed
+#define kNumOfBenchmarkQueries 1000
+
+// size of the synthetic .nbku backup
+#define kBenchmarkBackupBytes (500 * 1000 * 1000)
+
+// size of the synthetic .nbku exported again
+#define kBenchmarkExportBytes (50 * 1000 * 1000)
+
+// entries saved at a time when writing and compressing a store
+#define kBenchmarkSaveBatchEntries 1000
+
+// longest we wait for a simulated backup or restore, in seconds
+#define kSimulatorTimeout (60 * 60)
+
+
+/* -----------------------------------------------------------------------------
+	D a t a
+----------------------------------------------------------------------------- */
+
+// the same corpus every run
+static uint32_t gSeed;
+
+struct BenchmarkCorpus
+{
+	NSMutableArray *	words;		// NSString, the vocabulary
+	NSMutableArray *	titles;		// NSString
+	NSMutableArray *	texts;		// NSString
+	NSMutableArray *	entries;		// NSData, NSOF of { class:, title:, text:, _uniqueId: }
+};
+
+
+/* -----------------------------------------------------------------------------
+	Return a pseudo-random number.
+	Args:		inRange
+	Return:	0 .. inRange-1
+----------------------------------------------------------------------------- */
+
+static uint32_t
+Random(uint32_t inRange)
+{
+	gSeed = gSeed * 1103515245 + 12345;
+	return (gSeed >> 8) % inRange;
+}
+
+
+static double
+SecondsSince(uint64_t inStartTime)
+{
+	return (double)(MetricsNow() - inStartTime) / 1e9;
+}
+
+
+/* -----------------------------------------------------------------------------
+	Log the spread of some latencies.
+	Args:		inWhat
+				ioTimes			nanoseconds; sorted
+				inNumOfHits		summed over all queries
+	Return:	--
+----------------------------------------------------------------------------- */
+
+static void
+LogLatencies(NSString * inWhat, std::vector<uint64_t> & ioTimes, NSUInteger inNumOfHits)
+{
+	std::sort(ioTimes.begin(), ioTimes.end());
+	size_t count = ioTimes.size();
+	NSLog(@"  %@: median %.1f µs, 99%% %.1f µs, max %.1f µs; %.1f hits per query",
+			inWhat, ioTimes[count/2] / 1e3, ioTimes[count*99/100] / 1e3, ioTimes[count-1] / 1e3, (double)inNumOfHits / count);
+}
+
+
+/* -----------------------------------------------------------------------------
+	Make a corpus of notes: a few words of title and a paragraph of text, drawn
+	from a vocabulary of made-up words, some with accents to be folded.
+	Args:		inCount			number of entries
+	Return:	the corpus
+----------------------------------------------------------------------------- */
+
+static BenchmarkCorpus
+MakeBenchmarkCorpus(NSUInteger inCount)
+{
+	NSArray * syllables = @[@"ba", @"con", @"dé", @"fi", @"gal", @"ho", @"ist", @"ka", @"lö", @"man", @"ne", @"or",
+									@"pe", @"qui", @"ra", @"son", @"ta", @"ul", @"ve", @"wen", @"xo", @"yu", @"zà", @"ch"];
+	BenchmarkCorpus corpus;
+	gSeed = 1;
+
+	corpus.words = [NSMutableArray arrayWithCapacity:5000];
+	for (NSUInteger i = 0; i < 5000; ++i) {
+		NSMutableString * word = [NSMutableString string];
+		for (uint32_t n = 2 + Random(3); n > 0; --n)
+			[word appendString:syllables[Random((uint32_t)syllables.count)]];
+		[corpus.words addObject:word];
+	}
+
+	corpus.titles = [NSMutableArray arrayWithCapacity:inCount];
+	corpus.texts = [NSMutableArray arrayWithCapacity:inCount];
+	corpus.entries = [NSMutableArray arrayWithCapacity:inCount];
+	uint32_t numOfWords = (uint32_t)corpus.words.count;
+	for (NSUInteger i = 0; i < inCount; ++i) {
+		@autoreleasepool {
+			NSMutableArray * title = [NSMutableArray array];
+			for (uint32_t n = 1 + Random(4); n > 0; --n)
+				[title addObject:[corpus.words[Random(numOfWords)] capitalizedString]];
+			NSMutableArray * text = [NSMutableArray array];
+			for (uint32_t n = 20 + Random(40); n > 0; --n)
+				[text addObject:corpus.words[Random(numOfWords)]];
+
+			NSString * titleStr = [title componentsJoinedByString:@" "];
+			NSString * textStr = [text componentsJoinedByString:@" "];
+			RefVar entry(AllocateFrame());
+			SetFrameSlot(entry, SYMA(class), MakeSymbol("paragraph"));
+			SetFrameSlot(entry, MakeSymbol("title"), MakeString(titleStr));
+			SetFrameSlot(entry, MakeSymbol("text"), MakeString(textStr));
+			SetFrameSlot(entry, SYMA(_uniqueId), MAKEINT(i + 1));
+			[corpus.titles addObject:titleStr];
+			[corpus.texts addObject:textStr];
+			[corpus.entries addObject:FlattenRefToData(entry)];
+		}
+	}
+	return corpus;
+}
+
+
+/* -----------------------------------------------------------------------------
+	Time building a text index of the corpus, then querying it for words, word
+	beginnings and phrases.
+	Args:		inCorpus
+	Return:	--
+----------------------------------------------------------------------------- */
+
+static void
+BenchmarkTextIndex(const BenchmarkCorpus & inCorpus)
+{
+	NSUInteger numOfEntries = inCorpus.entries.count;
+	uint64_t numOfBytes = 0;
+	for (NSData * entry in inCorpus.entries)
+		numOfBytes += entry.length;
+
+	NCTextIndex * index = [[NCTextIndex alloc] init];
+	uint64_t startTime = MetricsNow();
+	for (NSUInteger i = 0; i < numOfEntries; ++i)
+		[index addEntryId:i + 1 NSOFData:inCorpus.entries[i]];
+	double secs = SecondsSince(startTime);
+	NSLog(@"Text index: %lu entries, %.1f MB of NSOF, built in %.3f s -- %.0f entries/s, %.1f MB/s",
+			(unsigned long)numOfEntries, numOfBytes / 1e6, secs, numOfEntries / secs, numOfBytes / 1e6 / secs);
+
+	uint32_t numOfWords = (uint32_t)inCorpus.words.count;
+	std::vector<uint64_t> times;
+	NSUInteger numOfHits;
+	for (int kind = 0; kind < 3; ++kind) {
+		times.clear();
+		numOfHits = 0;
+		for (int i = 0; i < kNumOfBenchmarkQueries; ++i) {
+			NSString * query;
+			if (kind == 0) {
+				query = inCorpus.words[Random(numOfWords)];
+			} else if (kind == 1) {
+				NSString * word = inCorpus.words[Random(numOfWords)];
+				query = [[word substringToIndex:MIN(word.length, 3)] stringByAppendingString:@"*"];
+			} else {
+				// two words that are next to each other in some entry
+				NSArray * text = [inCorpus.texts[Random((uint32_t)numOfEntries)] componentsSeparatedByString:@" "];
+				uint32_t at = Random((uint32_t)text.count - 1);
+				query = [NSString stringWithFormat:@"\"%@ %@\"", text[at], text[at+1]];
+			}
+			startTime = MetricsNow();
+			numOfHits += [index entryIdsMatching:query].count;
+			times.push_back(MetricsNow() - startTime);
+		}
+		LogLatencies(kind == 0 ? @"word" : (kind == 1 ? @"prefix" : @"phrase"), times, numOfHits);
+	}
+}
+
+
+/* -----------------------------------------------------------------------------
+	Compare titles as a Newton string index compares them, folding both each time.
+	Args:		inTitle1
+				inTitle2
+	Return:	NSOrderedAscending etc
+----------------------------------------------------------------------------- */
+
+static NSComparisonResult
+CompareTitles(NSString * inTitle1, NSString * inTitle2)
+{
+	UniChar s1[256], s2[256];
+	NSUInteger len1 = MIN(inTitle1.length, 256), len2 = MIN(inTitle2.length, 256);
+	[inTitle1 getCharacters:s1 range:NSMakeRange(0, len1)];
+	[inTitle2 getCharacters:s2 range:NSMakeRange(0, len2)];
+	int result = CompareUnicodeText(s1, (ArrayIndex)len1, s2, (ArrayIndex)len2);
+	return result < 0 ? NSOrderedAscending : (result > 0 ? NSOrderedDescending : NSOrderedSame);
+}
+
+
+/* -----------------------------------------------------------------------------
+	Time sorting the corpus’ titles each way: with a locale-aware compare, as
+	NCArrayController sorted them; with Newton collation on every compare; and
+	by sort keys, counting the time to make them. Also check that sorting by
+	key orders the titles as Newton collation does.
+	Args:		inCorpus
+	Return:	--
+----------------------------------------------------------------------------- */
+
+static void
+BenchmarkTitleSort(const BenchmarkCorpus & inCorpus)
+{
+	NSArray * titles = inCorpus.titles;
+	NSUInteger numOfTitles = titles.count;
+
+	uint64_t startTime = MetricsNow();
+	[titles sortedArrayUsingSelector:@selector(localizedCompare:)];
+	NSLog(@"Title sort: %lu titles; localizedCompare: %.3f s", (unsigned long)numOfTitles, SecondsSince(startTime));
+
+	startTime = MetricsNow();
+	[titles sortedArrayUsingComparator:^(id inTitle1, id inTitle2) { return CompareTitles(inTitle1, inTitle2); }];
+	NSLog(@"  CompareUnicodeText: %.3f s", SecondsSince(startTime));
+
+	startTime = MetricsNow();
+	NSMutableArray * keys = [NSMutableArray arrayWithCapacity:numOfTitles];
+	for (NSString * title in titles)
+		[keys addObject:MakeSortKey(title)];
+	double makeSecs = SecondsSince(startTime);
+	startTime = MetricsNow();
+	NSArray * sortedKeys = [keys sortedArrayUsingComparator:^(id inKey1, id inKey2) { return CompareSortKeys(inKey1, inKey2); }];
+	NSLog(@"  sort keys: %.3f s to make, %.3f s to sort", makeSecs, SecondsSince(startTime));
+
+	// the title is the part of the key after the 0 separator
+	NSUInteger numOfMisorders = 0;
+	NSString * prevTitle = nil;
+	for (NSData * key in sortedKeys) {
+		const UniChar * chars = (const UniChar *)key.bytes;
+		NSUInteger length = key.length / sizeof(UniChar), i = 0;
+		while (i < length && chars[i] != 0)
+			i++;
+		NSMutableString * title = [NSMutableString stringWithCapacity:length - i];
+		for (++i; i < length; ++i) {
+			UniChar ch = CFSwapInt16BigToHost(chars[i]);
+			[title appendString:[NSString stringWithCharacters:&ch length:1]];
+		}
+		if (prevTitle && CompareTitles(prevTitle, title) == NSOrderedDescending)
+			numOfMisorders++;
+		prevTitle = title;
+	}
+	NSLog(@"  %lu titles out of Newton order when sorted by key", (unsigned long)numOfMisorders);
+}
+
+
+/* -----------------------------------------------------------------------------
+	Write a synthetic .nbku backup: one store with one app, whose soups each hold
+	every entry of the corpus; as many soups as make up the size asked for.
+	Args:		inCorpus
+				inURL
+				inSize			bytes
+	Return:	number of entries written; 0 => the file could not be written
+----------------------------------------------------------------------------- */
+
+static void
+WriteRef(FILE * inFile, RefArg inRef)
+{
+	NSData * data = FlattenRefToData(inRef);
+	fwrite(data.bytes, data.length, 1, inFile);
+}
+
+
+static NSUInteger
+WriteBenchmarkBackup(const BenchmarkCorpus & inCorpus, NSURL * inURL, uint64_t inSize)
+{
+	uint64_t corpusSize = 0;
+	for (NSData * entry in inCorpus.entries)
+		corpusSize += entry.length;
+	ArrayIndex numOfSoups = (ArrayIndex)((inSize + corpusSize - 1) / corpusSize);
+
+	FILE * fp = fopen(inURL.fileSystemRepresentation, "wb");
+	if (fp == NULL)
+		return 0;
+
+	BackupFileHeader header;
+	memset(&header, 0, sizeof(header));
+	strncpy(header.signature, "backup0", sizeof(header.signature));
+	header.source.version = 2;
+	header.source.manufacturer = 0x01000000;
+	header.source.machineType = 0x10003000;
+	fwrite(&header, sizeof(header), 1, fp);
+
+	RefVar soupNames(MakeArray(numOfSoups));
+	for (ArrayIndex i = 0; i < numOfSoups; ++i)
+		SetArraySlot(soupNames, i, MakeString([NSString stringWithFormat:@"Benchmark %u", i + 1]));
+	RefVar app(AllocateFrame());
+	SetFrameSlot(app, SYMA(name), MakeString(@"Benchmark"));
+	SetFrameSlot(app, MakeSymbol("soups"), soupNames);
+	RefVar apps(MakeArray(1));
+	SetArraySlot(apps, 0, app);
+	RefVar store(AllocateFrame());
+	SetFrameSlot(store, SYMA(name), MakeString(@"Internal"));
+	SetFrameSlot(store, SYMA(kind), MakeString(@"Internal"));
+	SetFrameSlot(store, MakeSymbol("signature"), MAKEINT(1));
+	SetFrameSlot(store, MakeSymbol("soups"), soupNames);
+	SetFrameSlot(store, MakeSymbol("apps"), apps);
+	WriteRef(fp, store);
+
+	RefVar indexes(MakeArray(0));
+	RefVar info(AllocateFrame());
+	for (ArrayIndex i = 0; i < numOfSoups; ++i) {
+		WriteRef(fp, indexes);
+		WriteRef(fp, info);
+		for (NSData * entry in inCorpus.entries)
+			fwrite(entry.bytes, entry.length, 1, fp);
+		WriteRef(fp, RA(NILREF));
+	}
+	bool isWritten = ferror(fp) == 0;
+	fclose(fp);
+	return isWritten ? numOfSoups * inCorpus.entries.count : 0;
+}
+
+
+/* -----------------------------------------------------------------------------
+	Read every entry of a benchmark backup as NBDocument used to: through a
+	stdio pipe, unflattening each entry in full then seeking back to read its
+	bytes again as its NSOF data.
+	Args:		inURL
+	Return:	number of entries read
+----------------------------------------------------------------------------- */
+
+static NSUInteger
+ReadBackupThroughStdIO(NSURL * inURL)
+{
+	CStdIOPipe pipe(inURL.fileSystemRepresentation, "r");
+	BackupFileHeader header;
+	size_t size = sizeof(header);
+	bool isEOF;
+	pipe.readChunk(&header, size, isEOF);
+
+	NSUInteger numOfEntries = 0;
+	RefVar storeRef(UnflattenRef(pipe));
+	RefVar allApps(GetFrameSlot(storeRef, MakeSymbol("apps")));
+	RefVar soupEntry;
+	FOREACH(allApps, app)
+		RefVar appSoups(GetFrameSlot(app, MakeSymbol("soups")));
+		FOREACH(appSoups, soupName)
+			UnflattenRef(pipe);	// indexes
+			UnflattenRef(pipe);	// info
+			long location;
+			while (location = pipe.readPosition(), NOTNIL(soupEntry = UnflattenRef(pipe))) {
+				long end = pipe.readPosition();
+				@autoreleasepool {
+					NSMutableData * refData = [NSMutableData dataWithLength:end - location];
+					size = refData.length;
+					pipe.readSeek(location, SEEK_SET);
+					pipe.readChunk(refData.mutableBytes, size, isEOF);
+				}
+				numOfEntries++;
+			}
+		END_FOREACH
+	END_FOREACH
+	return numOfEntries;
+}
+
+
+/* -----------------------------------------------------------------------------
+	Read every entry of a benchmark backup as NBDocument reads it now: from the
+	mapped file, building only the summary slots, each entry’s NSOF data a slice
+	of the mapping.
+	Args:		inURL
+	Return:	number of entries read
+----------------------------------------------------------------------------- */
+
+static NSUInteger
+ReadBackupMapped(NSURL * inURL)
+{
+	NSData * fileData = [NSData dataWithContentsOfURL:inURL options:NSDataReadingMappedIfSafe error:nil];
+	const char * fileBytes = (const char *)fileData.bytes;
+	size_t fileSize = fileData.length;
+	CPtrPipe pipe;
+	pipe.init((void *)fileBytes, fileSize, NO, NULL);
+	pipe.readSeek(sizeof(BackupFileHeader), SEEK_SET);
+	CNSOFScanner scanner(fileBytes, fileSize, sizeof(BackupFileHeader));
+
+	// the slots -[NCSoup summarySlots] asks for when slot.plist has no columns
+	static const char * entrySlots[] = { "_uniqueId", "_modTime", "class", "labels", "title", "name", "company", "place" };
+	const ArrayIndex numOfEntrySlots = sizeof(entrySlots) / sizeof(entrySlots[0]);
+	RefVar summarySlots(MakeArray(numOfEntrySlots));
+	for (ArrayIndex i = 0; i < numOfEntrySlots; ++i)
+		SetArraySlot(summarySlots, i, MakeSymbol(entrySlots[i]));
+
+	NSUInteger numOfEntries = 0;
+	RefVar storeRef(UnflattenRef(pipe));
+	RefVar allApps(GetFrameSlot(storeRef, MakeSymbol("apps")));
+	RefVar soupEntry;
+	FOREACH(allApps, app)
+		RefVar appSoups(GetFrameSlot(app, MakeSymbol("soups")));
+		FOREACH(appSoups, soupName)
+			UnflattenRef(pipe);	// indexes
+			UnflattenRef(pipe);	// info
+			for ( ; ; ) {
+				size_t location = pipe.readPosition();
+				CNSOFReader * reader = scanner.take(location);
+				if (reader == NULL)
+					reader = new CNSOFReader(fileBytes + location, fileSize - location);
+				bool isRead = reader->getSlots(summarySlots, soupEntry);
+				size_t length = reader->length();
+				delete reader;
+				if (isRead)
+					pipe.readSeek(location + length, SEEK_SET);
+				else if (ISNIL(soupEntry = UnflattenRef(pipe)))
+					break;
+				else
+					length = pipe.readPosition() - location;
+				@autoreleasepool {
+					NSData * refData = [[NSData alloc] initWithBytesNoCopy:(void *)(fileBytes + location) length:length deallocator:^(void * inBytes, NSUInteger inLength) { (void)fileData; }];
+					(void)refData;
+				}
+				numOfEntries++;
+			}
+		END_FOREACH
+	END_FOREACH
+	scanner.stop();
+	return numOfEntries;
+}
+
+
+/* -----------------------------------------------------------------------------
+	Time importing a synthetic backup: reading it the old way and the new, then
+	opening it as NBDocument does, which adds making the managed objects.
+	Args:		inCorpus
+	Return:	--
+----------------------------------------------------------------------------- */
+
+static void
+BenchmarkBackupImport(const BenchmarkCorpus & inCorpus)
+{
+	NSURL * url = [NSURL fileURLWithPath:[NSTemporaryDirectory() stringByAppendingPathComponent:@"Benchmark.nbku"]];
+	uint64_t startTime = MetricsNow();
+	NSUInteger numOfEntries = WriteBenchmarkBackup(inCorpus, url, kBenchmarkBackupBytes);
+	if (numOfEntries == 0) {
+		NSLog(@"Backup import: could not write %@", url.path);
+		return;
+	}
+	NSNumber * fileSize = nil;
+	[url getResourceValue:&fileSize forKey:NSURLFileSizeKey error:nil];
+	double fileMB = fileSize.unsignedLongLongValue / 1e6;
+	NSLog(@"Backup import: %lu entries, %.1f MB, written in %.3f s", (unsigned long)numOfEntries, fileMB, SecondsSince(startTime));
+
+	// the file is in the page cache for both readers
+	startTime = MetricsNow();
+	NSUInteger numRead = ReadBackupThroughStdIO(url);
+	double secs = SecondsSince(startTime);
+	NSLog(@"  stdio, unflatten twice: %lu entries in %.3f s -- %.1f MB/s", (unsigned long)numRead, secs, fileMB / secs);
+
+	startTime = MetricsNow();
+	numRead = ReadBackupMapped(url);
+	secs = SecondsSince(startTime);
+	NSLog(@"  mapped, summary slots: %lu entries in %.3f s -- %.1f MB/s", (unsigned long)numRead, secs, fileMB / secs);
+
+	// documents are made on the main thread
+	dispatch_sync(dispatch_get_main_queue(), ^{
+		@autoreleasepool {
+			NBDocument * document = [[NBDocument alloc] init];
+			NSError *__autoreleasing error = nil;
+			uint64_t importTime = MetricsNow();
+			BOOL isRead = [document readFromURL:url ofType:@"com.newton.backup" error:&error];
+			double importSecs = SecondsSince(importTime);
+			NSLog(@"  NBDocument: %@ in %.3f s -- %.1f MB/s", isRead ? @"read" : error.localizedDescription, importSecs, fileMB / importSecs);
+			[document close];
+		}
+	});
+	[NSFileManager.defaultManager removeItemAtURL:url error:nil];
+}
+
+
+/* -----------------------------------------------------------------------------
+	Return the size of a file, such as a SQLite store, on disk.
+	Args:		inURL
+	Return:	bytes
+----------------------------------------------------------------------------- */
+
+static uint64_t
+FileSize(NSURL * inURL)
+{
+	NSNumber * fileSize = nil;
+	[inURL getResourceValue:&fileSize forKey:NSURLFileSizeKey error:nil];
+	return fileSize.unsignedLongLongValue;
+}
+
+
+/* -----------------------------------------------------------------------------
+	Time exporting a store as a backup file: a synthetic backup is opened as
+	NBDocument does, exported with its entries in memory, then saved to a
+	SQLite store and exported again, reading its entries back a page at a time.
+	Args:		inCorpus
+	Return:	--
+----------------------------------------------------------------------------- */
+
+static void
+BenchmarkExport(const BenchmarkCorpus & inCorpus)
+{
+	NSString * tmpDir = NSTemporaryDirectory();
+	NSURL * url = [NSURL fileURLWithPath:[tmpDir stringByAppendingPathComponent:@"BenchmarkExport.nbku"]];
+	NSURL * exportURL = [NSURL fileURLWithPath:[tmpDir stringByAppendingPathComponent:@"BenchmarkExported.nbku"]];
+	NSURL * storeURL = [NSURL fileURLWithPath:[tmpDir stringByAppendingPathComponent:@"BenchmarkExport.sqlite"]];
+	NSUInteger numOfEntries = WriteBenchmarkBackup(inCorpus, url, kBenchmarkExportBytes);
+	if (numOfEntries == 0) {
+		NSLog(@"Export: could not write %@", url.path);
+		return;
+	}
+
+	// documents are made on the main thread
+	dispatch_sync(dispatch_get_main_queue(), ^{
+		@autoreleasepool {
+			NBDocument * document = [[NBDocument alloc] init];
+			NSError *__autoreleasing error = nil;
+			if (![document readFromURL:url ofType:@"com.newton.backup" error:&error]) {
+				NSLog(@"Export: could not read %@: %@", url.path, error.localizedDescription);
+				return;
+			}
+			NCStore * store = document.stores.firstObject;
+
+			uint64_t startTime = MetricsNow();
+			BOOL isWritten = [document writeBackupOfStore:store toURL:exportURL error:&error];
+			double secs = SecondsSince(startTime);
+			double fileMB = FileSize(exportURL) / 1e6;
+			NSLog(@"Export: %lu entries; in memory %@ in %.3f s -- %.1f MB/s",
+					(unsigned long)numOfEntries, isWritten ? @"written" : error.localizedDescription, secs, fileMB / secs);
+
+			[NSFileManager.defaultManager removeItemAtURL:storeURL error:nil];
+			NSManagedObjectContext * context = document.objContext;
+			if ([context.persistentStoreCoordinator addPersistentStoreWithType:NSSQLiteStoreType configuration:nil URL:storeURL options:nil error:&error] == nil
+			||  ![context save:&error]) {
+				NSLog(@"  could not save a store: %@", error.localizedDescription);
+			} else {
+				// page from the store, not the objects already in memory
+				for (NSManagedObject * obj in context.registeredObjects)
+					[context refreshObject:obj mergeChanges:NO];
+				startTime = MetricsNow();
+				isWritten = [document writeBackupOfStore:store toURL:exportURL error:&error];
+				secs = SecondsSince(startTime);
+				NSLog(@"  paged from store %@ in %.3f s -- %.1f MB/s", isWritten ? @"written" : error.localizedDescription, secs, fileMB / secs);
+			}
+			[document close];
+		}
+	});
+	[NSFileManager.defaultManager removeItemAtURL:url error:nil];
+	[NSFileManager.defaultManager removeItemAtURL:exportURL error:nil];
+	[NSFileManager.defaultManager removeItemAtURL:storeURL error:nil];
+}
+
+
+/* -----------------------------------------------------------------------------
+	Time reading entries at random from a store, as the inspector does: fetch
+	the entry by uniqueId and read its NSOF data.
+	Args:		inWhat
+				inContext
+				inCount			entries in the store
+	Return:	--
+----------------------------------------------------------------------------- */
+
+static void
+TimeStoreReads(NSString * inWhat, NSManagedObjectContext * inContext, NSUInteger inCount)
+{
+	// start cold: nothing cached in the context
+	[inContext reset];
+	NSFetchRequest * request = [NSFetchRequest fetchRequestWithEntityName:@"Entry"];
+	std::vector<uint64_t> times;
+	NSUInteger numOfHits = 0;
+	gSeed = 1;
+	for (NSUInteger i = 0; i < kNumOfBenchmarkQueries; ++i) {
+		@autoreleasepool {
+			request.predicate = [NSPredicate predicateWithFormat:@"uniqueId = %u", Random((uint32_t)inCount) + 1];
+			uint64_t startTime = MetricsNow();
+			NSError *__autoreleasing error = nil;
+			NSArray * results = [inContext executeFetchRequest:request error:&error];
+			NCEntry * entry = results.firstObject;
+			if (entry.refData.length > 0)
+				++numOfHits;
+			times.push_back(MetricsNow() - startTime);
+			if (entry)
+				[inContext refreshObject:entry mergeChanges:NO];
+		}
+	}
+	LogLatencies(inWhat, times, numOfHits);
+}
+
+
+/* -----------------------------------------------------------------------------
+	Measure the store size and read latency of the corpus as one soup, before
+	and after its entries are compressed -- as the document’s maintenance pass
+	does it, by training the soup’s dictionary then storing them again.
+	The store is written with a rollback journal so its size is that of one
+	file, and is vacuumed after compression so the pages freed are not counted.
+	Args:		inCorpus
+	Return:	--
+----------------------------------------------------------------------------- */
+
+static void
+BenchmarkCompression(const BenchmarkCorpus & inCorpus)
+{
+	NSURL * url = [NSURL fileURLWithPath:[NSTemporaryDirectory() stringByAppendingPathComponent:@"BenchmarkCompression.sqlite"]];
+	[NSFileManager.defaultManager removeItemAtURL:url error:nil];
+	NSManagedObjectModel * model = [NSManagedObjectModel mergedModelFromBundles:nil];
+	NSPersistentStoreCoordinator * coordinator = [[NSPersistentStoreCoordinator alloc] initWithManagedObjectModel:model];
+	NSDictionary * options = @{ NSSQLitePragmasOption:@{ @"journal_mode":@"DELETE" } };
+	NSError *__autoreleasing error = nil;
+	NSPersistentStore * store = [coordinator addPersistentStoreWithType:NSSQLiteStoreType configuration:nil URL:url options:options error:&error];
+	if (store == nil) {
+		NSLog(@"Compression: can’t make a store: %@", error.localizedDescription);
+		return;
+	}
+	NSManagedObjectContext * context = [[NSManagedObjectContext alloc] initWithConcurrencyType:NSPrivateQueueConcurrencyType];
+	context.persistentStoreCoordinator = coordinator;
+	context.undoManager = nil;
+
+	__block BOOL isCompressed = NO;
+	[context performBlockAndWait:^{
+		NSUInteger numOfEntries = inCorpus.entries.count;
+		NCSoup * soup = [NSEntityDescription insertNewObjectForEntityForName:@"Soup" inManagedObjectContext:context];
+		soup.name = @"Benchmark";
+		soup.signature = [NSNumber numberWithInt:0];
+		soup.lastBackupId = [NSNumber numberWithUnsignedInt:0];
+		soup.lastImportId = [NSNumber numberWithUnsignedInt:kImportIdBase];
+		soup.descr = @"Benchmark corpus.";
+		soup.appName = @"--";
+
+		uint64_t numOfBytes = 0;
+		NSMutableArray * batch = [NSMutableArray arrayWithCapacity:kBenchmarkSaveBatchEntries];
+		NSError *__autoreleasing saveError = nil;
+		for (NSUInteger i = 0; i < numOfEntries && saveError == nil; ++i) {
+			@autoreleasepool {
+				NCEntry * entry = [NSEntityDescription insertNewObjectForEntityForName:@"Entry" inManagedObjectContext:context];
+				[soup addEntriesObject:entry];
+				entry.refData = inCorpus.entries[i];
+				entry.refClass = @"paragraph";
+				entry.uniqueId = [NSNumber numberWithUnsignedInteger:i + 1];
+				entry.modTime = [NSDate date];
+				numOfBytes += entry.refData.length;
+				[batch addObject:entry];
+				if (batch.count == kBenchmarkSaveBatchEntries || i == numOfEntries - 1) {
+					[context save:&saveError];
+					for (NCEntry * obj in batch)
+						[context refreshObject:obj mergeChanges:NO];
+					[batch removeAllObjects];
+				}
+			}
+		}
+		if (saveError) {
+			NSLog(@"Compression: can’t save the store: %@", saveError.localizedDescription);
+			return;
+		}
+		double storeMB = FileSize(url) / 1e6;
+		NSLog(@"Compression: %lu entries, %.1f MB of NSOF; store %.1f MB", (unsigned long)numOfEntries, numOfBytes / 1e6, storeMB);
+		TimeStoreReads(@"read, uncompressed", context, numOfEntries);
+
+		// re-fetch the soup: the reads reset the context
+		NSFetchRequest * request = [NSFetchRequest fetchRequestWithEntityName:@"Soup"];
+		soup = [context executeFetchRequest:request error:&saveError].firstObject;
+		uint64_t startTime = MetricsNow();
+		if (![soup trainDictionary]) {
+			NSLog(@"Compression: no dictionary was trained");
+			return;
+		}
+		double trainSecs = SecondsSince(startTime);
+		startTime = MetricsNow();
+		for (NSUInteger offset = 0, count = 1; count > 0; offset += count)
+			count = [soup compressEntriesFrom:offset count:kBenchmarkSaveBatchEntries];
+		NSLog(@"  dictionary trained in %.3f s, entries compressed in %.3f s", trainSecs, SecondsSince(startTime));
+		isCompressed = YES;
+	}];
+
+	// reopen the store to vacuum it on the next save
+	[coordinator removePersistentStore:store error:nil];
+	if (!isCompressed) {
+		[NSFileManager.defaultManager removeItemAtURL:url error:nil];
+		return;
+	}
+	NSMutableDictionary * vacuumOptions = [options mutableCopy];
+	vacuumOptions[NSSQLiteManualVacuumOption] = @YES;
+	store = [coordinator addPersistentStoreWithType:NSSQLiteStoreType configuration:nil URL:url options:vacuumOptions error:&error];
+	[context performBlockAndWait:^{
+		[context reset];
+		NSFetchRequest * request = [NSFetchRequest fetchRequestWithEntityName:@"Soup"];
+		NSError *__autoreleasing saveError = nil;
+		NCSoup * soup = [context executeFetchRequest:request error:&saveError].firstObject;
+		soup.descr = @"Benchmark corpus, compressed.";
+		[context save:&saveError];
+		NSLog(@"  compressed: store %.1f MB", FileSize(url) / 1e6);
+		TimeStoreReads(@"read, compressed", context, inCorpus.entries.count);
+	}];
+	[coordinator removePersistentStore:store error:nil];
+	[NSFileManager.defaultManager removeItemAtURL:url error:nil];
+}
+
+
+/* -----------------------------------------------------------------------------
+	Make a graph whose objects are all shared, so that flattening it looks up
+	every one in the precedent table.
+	Args:		inKind			0 => frames, 1 => binaries (as ink strokes), 2 => symbols
+				inCount			number of distinct objects
+	Return:	an array holding each object twice
+----------------------------------------------------------------------------- */
+
+static Ref
+MakeSharedGraph(int inKind, ArrayIndex inCount)
+{
+	RefVar graph(MakeArray(2 * inCount));
+	RefVar obj;
+	char name[32];
+	for (ArrayIndex i = 0; i < inCount; ++i) {
+		if (inKind == 0) {
+			obj = AllocateFrame();
+			SetFrameSlot(obj, MakeSymbol("x"), MAKEINT(i));
+		} else if (inKind == 1) {
+			obj = AllocateBinary(MakeSymbol("stroke"), 16);
+			memcpy(BinaryData(obj), &i, sizeof(i));
+		} else {
+			snprintf(name, sizeof(name), "sym%u", i);
+			obj = MakeSymbol(name);
+		}
+		SetArraySlot(graph, i, obj);
+		SetArraySlot(graph, inCount + i, obj);
+	}
+	return graph;
+}
+
+
+/* -----------------------------------------------------------------------------
+	Time flattening and unflattening shared graphs of growing size. The time per
+	object stays flat if precedents are found in constant time; it doubles with
+	each doubling of the graph if they are found by linear search.
+	Args:		--
+	Return:	--
+----------------------------------------------------------------------------- */
+
+static void
+BenchmarkFlatten(void)
+{
+	NSLog(@"Flatten shared graphs: µs per object to flatten / unflatten");
+	for (int kind = 0; kind < 3; ++kind) {
+		NSMutableString * line = [NSMutableString stringWithString:kind == 0 ? @"  frames:  " : (kind == 1 ? @"  strokes: " : @"  symbols: ")];
+		for (ArrayIndex count = 1000; count <= 32000; count *= 2) {
+			@autoreleasepool {
+				RefVar graph(MakeSharedGraph(kind, count));
+				uint64_t startTime = MetricsNow();
+				NSData * data = FlattenRefToData(graph);
+				uint64_t flattenTime = MetricsNow() - startTime;
+
+				CPtrPipe pipe;
+				pipe.init((void *)data.bytes, data.length, NO, NULL);
+				startTime = MetricsNow();
+				RefVar copy(UnflattenRef(pipe));
+				uint64_t unflattenTime = MetricsNow() - startTime;
+
+				[line appendFormat:@" %u: %.2f/%.2f", count, flattenTime / 1e3 / count, unflattenTime / 1e3 / count];
+			}
+		}
+		NSLog(@"%@", line);
+	}
+}
+
+
+/* -----------------------------------------------------------------------------
+	Time flattening every entry in the corpus for the document, as a backup does:
+	measured with FlattenRefSize() into a buffer of that size, and in a single
+	pass with FlattenRefInto() a growable pipe that is reused.
+	Args:		inCorpus
+	Return:	--
+----------------------------------------------------------------------------- */
+
+static void
+BenchmarkCorpusFlatten(const BenchmarkCorpus & inCorpus)
+{
+	ArrayIndex numOfEntries = (ArrayIndex)inCorpus.entries.count;
+	RefVar entries(MakeArray(numOfEntries));
+	for (ArrayIndex i = 0; i < numOfEntries; ++i) {
+		NSData * data = inCorpus.entries[i];
+		CPtrPipe pipe;
+		pipe.init((void *)data.bytes, data.length, NO, NULL);
+		SetArraySlot(entries, i, UnflattenRef(pipe));
+	}
+
+	uint64_t numOfBytes = 0;
+	uint64_t startTime = MetricsNow();
+	for (ArrayIndex i = 0; i < numOfEntries; ++i) {
+		RefVar entry(GetArraySlot(entries, i));
+		size_t entrySize = FlattenRefSize(entry);
+		void * buf = malloc(entrySize);
+		CPtrPipe pipe;
+		pipe.init(buf, entrySize, NO, NULL);
+		FlattenRef(entry, pipe);
+		free(buf);
+		numOfBytes += entrySize;
+	}
+	double twoPassSecs = SecondsSince(startTime);
+
+	CGrowablePipe pipe;
+	startTime = MetricsNow();
+	for (ArrayIndex i = 0; i < numOfEntries; ++i) {
+		RefVar entry(GetArraySlot(entries, i));
+		FlattenRefInto(entry, pipe);
+	}
+	double onePassSecs = SecondsSince(startTime);
+
+	NSLog(@"Flatten %u corpus entries, %llu bytes: sized then flattened %.3f s (%.2f µs each), growable pipe %.3f s (%.2f µs each)",
+			numOfEntries, numOfBytes, twoPassSecs, twoPassSecs * 1e6 / numOfEntries, onePassSecs, onePassSecs * 1e6 / numOfEntries);
+}
+
+
+/* -----------------------------------------------------------------------------
+	Time replaying dock sessions through the event builder: a seed capture made
+	from our own protocol extensions, and the last session recorded with the
+	CaptureIO default, if there is one. Only TCP/IP captures are replayed; an MNP
+	endpoint would try to ACK the packets it unframes.
+	Args:		--
+	Return:	--
+----------------------------------------------------------------------------- */
+
+static void
+BenchmarkReplay(void)
+{
+	NSURL * seedURL = [NSURL fileURLWithPath:[NSTemporaryDirectory() stringByAppendingPathComponent:@"Benchmark.ncap"]];
+	NSURL * sessionURL = [ApplicationLogFile().URLByDeletingLastPathComponent URLByAppendingPathComponent:@"NewtonConnection.ncap"];
+	NSMutableArray * captures = [NSMutableArray arrayWithCapacity:2];
+	if ([NCReplay writeSeedCapture:seedURL] == noErr)
+		[captures addObject:seedURL];
+	if ([sessionURL checkResourceIsReachableAndReturnError:nil])
+		[captures addObject:sessionURL];
+
+	for (NSURL * url in captures) {
+		NCReplay * replay = [[NCReplay alloc] initWithURL:url];
+		if (replay == nil) {
+			NSLog(@"Replay %@: not a capture file", url.lastPathComponent);
+		} else if (replay.transport != kCaptureTransportRaw) {
+			NSLog(@"Replay %@: MNP framed, skipped", url.lastPathComponent);
+		} else {
+			NCError err = [replay replay:[[NCEndpoint alloc] init] sink:nil];
+			NSLog(@"Replay %@: %@", url.lastPathComponent, err == noErr ? replay.report : [NSString stringWithFormat:@"error %d", err]);
+		}
+	}
+	[NSFileManager.defaultManager removeItemAtURL:seedURL error:nil];
+}
+
+
+/* -----------------------------------------------------------------------------
+	Start a dock operation and wait for it to finish.
+	Args:		inOperation		kBackupActivity or kRestoreActivity
+				inStart			starts it; returns NO if it could not
+	Return:	error code
+----------------------------------------------------------------------------- */
+
+static NCError
+WaitForDockOperation(int inOperation, BOOL (^inStart)(void))
+{
+	dispatch_semaphore_t done = dispatch_semaphore_create(0);
+	__block NCError err = kDockErrIdleTooLong;
+	id observer = [NSNotificationCenter.defaultCenter addObserverForName:kDockDidOperationNotification object:nil queue:nil usingBlock:^(NSNotification * inNotification) {
+		NCError result = [inNotification.userInfo[@"error"] intValue];
+		if ([inNotification.userInfo[@"operation"] intValue] == inOperation || result == kDockErrDisconnected) {
+			err = result;
+			dispatch_semaphore_signal(done);
+		}
+	}];
+	if (inStart())
+		dispatch_semaphore_wait(done, dispatch_time(DISPATCH_TIME_NOW, kSimulatorTimeout * NSEC_PER_SEC));
+	else
+		err = kDockErrBadConnection;
+	[NSNotificationCenter.defaultCenter removeObserver:observer];
+	return err;
+}
+
+
+/* -----------------------------------------------------------------------------
+	Back up a simulated Newton over TCP/IP, and optionally restore it.
+	The simulator is this app run again as another process (see Simulator.h), so
+	it has a Newton heap of its own. It connects to the dock of the document
+	that is open, asks to be backed up, and is then restored from that backup.
+	Its kSimBitRate paces what it sends like a serial link.
+	Args:		inWhat			name of the run
+				inConfig			simulator configuration
+				outBackupSecs	time to connect and back up
+				outRestoreSecs	time to restore; NULL => don’t restore
+	Return:	error code
+----------------------------------------------------------------------------- */
+
+static NCError
+RunSimulatedSession(NSString * inWhat, NSDictionary * inConfig, double * outBackupSecs, double * outRestoreSecs)
+{
+	NCDockProtocolController * dock = gNCNub;
+	NCDocument * document = dock.document;
+	if (document == nil || dock.isTethered) {
+		NSLog(@"Simulated session, %@: no document is waiting for a Newton", inWhat);
+		return kDockErrBadConnection;
+	}
+
+	NSMutableDictionary * config = [inConfig mutableCopy];
+	config[kSimActions] = @[@"backup"];
+	NSString * configPath = [NSTemporaryDirectory() stringByAppendingPathComponent:@"BenchmarkSimulator.plist"];
+	[config writeToFile:configPath atomically:YES];
+	NSTask * simulator = [[NSTask alloc] init];
+	simulator.executableURL = NSBundle.mainBundle.executableURL;
+	simulator.arguments = @[@"-Simulator", configPath];
+
+	__block NSError * launchError = nil;
+	uint64_t startTime = MetricsNow();
+	NCError err = WaitForDockOperation(kBackupActivity, ^{
+		NSError *__autoreleasing error = nil;
+		BOOL isLaunched = [simulator launchAndReturnError:&error];
+		launchError = error;
+		return isLaunched;
+	});
+	if (launchError) {
+		NSLog(@"Simulated session, %@: can’t launch the simulator: %@", inWhat, launchError.localizedDescription);
+		return kDockErrBadConnection;
+	}
+	*outBackupSecs = SecondsSince(startTime);
+
+	if (outRestoreSecs) {
+		*outRestoreSecs = 0.0;
+		if (err == noErr) {
+			startTime = MetricsNow();
+			err = WaitForDockOperation(kRestoreActivity, ^{
+				dispatch_async(dispatch_get_main_queue(), ^{
+					[document buildRestoreInfo];
+					[dock requestRestore];
+				});
+				return YES;
+			});
+			*outRestoreSecs = SecondsSince(startTime);
+		}
+	}
+
+	dispatch_async(dispatch_get_main_queue(), ^{
+		[dock disconnect];
+	});
+	[simulator waitUntilExit];
+	[NSFileManager.defaultManager removeItemAtPath:configPath error:nil];
+	return err;
+}
+
+
+/* -----------------------------------------------------------------------------
+	Time a backup and a restore with a simulated Newton.
+	Args:		inWhat			name of the run
+				inConfig			simulator configuration
+	Return:	--
+----------------------------------------------------------------------------- */
+
+static void
+BenchmarkSimulatedSession(NSString * inWhat, NSDictionary * inConfig)
+{
+	double backupSecs = 0.0, restoreSecs = 0.0;
+	NCError err = RunSimulatedSession(inWhat, inConfig, &backupSecs, &restoreSecs);
+	if (err == kDockErrBadConnection)
+		return;
+
+	int numOfEntries = [inConfig[kSimSoups] intValue] * [inConfig[kSimEntries] intValue];
+	NSLog(@"Simulated session, %@: %d entries; connect and back up %.3f s, restore %.3f s%@",
+			inWhat, numOfEntries, backupSecs, restoreSecs, err ? [NSString stringWithFormat:@" -- error %d", err] : @"");
+}
+
+
+/* -----------------------------------------------------------------------------
+	Time pruning a soup of entries deleted on the Newton.
+	A simulated Newton is backed up into the open document, then a tenth of
+	its soup’s entries are cropped as though they had been deleted.
+	Args:		inCount			entries in the soup
+	Return:	--
+----------------------------------------------------------------------------- */
+
+static void
+BenchmarkCrop(int inCount)
+{
+	NSString * what = [NSString stringWithFormat:@"crop %d", inCount];
+	double backupSecs = 0.0;
+	NCError err = RunSimulatedSession(what, @{ kSimSoups:@1, kSimEntries:[NSNumber numberWithInt:inCount], kSimEntrySize:@64 }, &backupSecs, NULL);
+	if (err) {
+		if (err != kDockErrBadConnection)
+			NSLog(@"Crop of %d entries: backup failed -- error %d", inCount, err);
+		return;
+	}
+
+	dispatch_sync(dispatch_get_main_queue(), ^{
+		NCDocument * document = gNCNub.document;
+		NCSoup * soup = nil;
+		for (NCStore * store in document.deviceObj.stores)
+			if ((soup = [store findSoup:@"Sim Soup 0"]))
+				break;
+		if (soup == nil) {
+			NSLog(@"Crop of %d entries: the simulated soup wasn’t backed up", inCount);
+			return;
+		}
+		// the simulator’s ids run from 0; keep the first nine tenths
+		NCIdSet * newtonIds = [[NCIdSet alloc] init];
+		[newtonIds addIdsInRange:(NCIdRange){ 0, (NSUInteger)inCount * 9 / 10 }];
+		uint64_t startTime = MetricsNow();
+		[soup cropToIds:newtonIds mainContext:nil];
+		NSLog(@"Crop of %d entries to %lu: %.3f s", inCount, (unsigned long)newtonIds.count, SecondsSince(startTime));
+	});
+}
+
+
+/* -----------------------------------------------------------------------------
+	Run the benchmarks.
+	Args:		--
+	Return:	--
+----------------------------------------------------------------------------- */
+
+void
+RunBenchmarks(void)
+{
+	@autoreleasepool {
+		uint64_t startTime = MetricsNow();
+		BenchmarkCorpus corpus = MakeBenchmarkCorpus(kNumOfBenchmarkEntries);
+		NSLog(@"Benchmark corpus of %d entries made in %.3f s", kNumOfBenchmarkEntries, SecondsSince(startTime));
+
+		BenchmarkTextIndex(corpus);
+		BenchmarkTitleSort(corpus);
+		BenchmarkBackupImport(corpus);
+		BenchmarkExport(corpus);
+		BenchmarkCompression(corpus);
+		BenchmarkFlatten();
+		BenchmarkCorpusFlatten(corpus);
+		BenchmarkReplay();
+		BenchmarkSimulatedSession(@"TCP/IP", @{ kSimSoups:@4, kSimEntries:@2500, kSimEntrySize:@256 });
+		BenchmarkSimulatedSession(@"38.4 kbps", @{ kSimSoups:@4, kSimEntries:@100, kSimEntrySize:@256, kSimBitRate:@38400 });
+		BenchmarkCrop(1000);
+		BenchmarkCrop(10000);
+		BenchmarkCrop(100000);
+	}
+}
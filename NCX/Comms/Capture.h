@@ -0,0 +1,125 @@
+/*
+	File:		Capture.h
+
+	Contains:	Dock session capture and replay interface.
+					A capture records both directions of an endpoint: the raw bytes
+					read from and written to the fd (below any MNP framing) and the
+					dock events built from / sent as that data (above it).
+					A capture can be replayed through the same unframe -> chunk buffer
+					-> event build path a live endpoint uses, for measuring throughput
+					without a Newton device attached.
+
+	Written by:	Newton Research Group, 2026.
+*/
+
+#import <Foundation/Foundation.h>
+
+#import "Comms.h"
+
+@class NCEndpoint;
+@class NCDockEvent;
+
+
+/* -----------------------------------------------------------------------------
+	Capture file format.
+	All fields are big-endian, like everything else on the Newton side.
+		CaptureFileHeader
+		CaptureRecordHeader + data, data padded to long-align
+		...
+----------------------------------------------------------------------------- */
+
+#define kCaptureSignature		"NCXcap01"
+#define kCaptureVersion			1
+
+enum
+{
+	kCaptureTransportRaw,		// TCP/IP, Einstein w/o MNP: raw bytes == dock event stream
+	kCaptureTransportMNP			// serial: raw bytes are MNP framed
+};
+
+enum
+{
+	kCaptureRawIn = '<',			// bytes read() from the endpoint fd
+	kCaptureRawOut = '>',		// bytes write()n to the endpoint fd
+	kCaptureEventIn = 'e',		// dock event built from received data: tag, length, data
+	kCaptureEventOut = 'E'		// dock event sent: tag, length, data
+};
+
+struct CaptureFileHeader
+{
+	char			signature[8];
+	uint32_t		version;
+	uint32_t		transport;
+};
+
+struct CaptureRecordHeader
+{
+	uint64_t		timestamp;		// nanoseconds since capture start
+	uint8_t		kind;
+	uint8_t		reserved[3];
+	uint32_t		length;
+};
+
+
+/* -----------------------------------------------------------------------------
+	N C C a p t u r e
+	Recorder. Like gTraceIO, capture is switched on globally: CaptureIO() is nil
+	unless recording.
+	Records are written to file in a serial dispatch queue, so recording does not
+	block the endpoint’s I/O thread.
+----------------------------------------------------------------------------- */
+
+@interface NCCapture : NSObject
+
++ (NCError)startRecording:(NSURL *)inURL transport:(uint32_t)inTransport;
++ (void)stopRecording;
+
+- (void)record:(uint8_t)inKind data:(const void *)inData length:(unsigned int)inLength;
+- (void)recordEvent:(uint8_t)inKind tag:(uint32_t)inTag length:(unsigned int)inLength data:(const void *)inData dataLength:(unsigned int)inDataLength;
+
+@end
+
+extern NCCapture * CaptureIO(void);
+
+
+/* -----------------------------------------------------------------------------
+	N C R e p l a y S t a t s
+	Result of a replay run.
+----------------------------------------------------------------------------- */
+
+struct NCReplayStats
+{
+	unsigned int	numOfRecords;
+	unsigned int	numOfEvents;
+	uint64_t			numOfBytes;			// raw bytes fed to the endpoint
+	uint64_t			numOfEventBytes;	// event data bytes built
+	uint64_t			elapsedTime;		// nanoseconds
+	uint64_t			numOfAllocations;	// malloc()s, calloc()s and realloc()s during the replay
+	uint64_t			numOfAllocatedBytes;	// bytes they asked for
+	uint64_t			maxSizeInUse;		// malloc high-water mark at end of replay
+};
+
+
+/* -----------------------------------------------------------------------------
+	N C R e p l a y
+	Feeds the received side of a capture through an endpoint’s readPage:into:
+	and NCDockEvent build:, as fast as possible.
+	Completed events are passed to an optional sink -- pass
+		^(NCDockEvent * evt) { [NCDockEventQueue.sharedQueue addEvent:evt]; }
+	to drive an NCSession from the capture.
+----------------------------------------------------------------------------- */
+
+typedef void (^NCReplaySink)(NCDockEvent * inEvent);
+
+@interface NCReplay : NSObject
+
+@property(readonly) uint32_t transport;
+@property(readonly) struct NCReplayStats stats;
+
++ (NCError)writeSeedCapture:(NSURL *)inURL;
+
+- (id)initWithURL:(NSURL *)inURL;
+- (NCError)replay:(NCEndpoint *)inEndpoint sink:(NCReplaySink)inSink;
+- (NSString *)report;
+
+@end
@@ -0,0 +1,391 @@
+/*
+	File:		Capture.mm
+
+	Contains:	Dock session capture and replay implementation.
+
+	Written by:	Newton Research Group, 2026.
+*/
+
+#import <malloc/malloc.h>
+#import <os/lock.h>
+#import <time.h>
+#import <atomic>
+
+#import "Capture.h"
+#import "DockEventQueue.h"
+#import "Logging.h"
+
+extern "C" int REPprintf(const char * inFormat, ...);
+
+
+/* -----------------------------------------------------------------------------
+	D a t a
+----------------------------------------------------------------------------- */
+
+// the endpoint’s I/O thread reads the recorder while the UI starts and stops it
+static NCCapture * gCaptureIO = nil;
+static os_unfair_lock gCaptureLock = OS_UNFAIR_LOCK_INIT;
+
+static inline uint64_t
+Now(void) {
+	return clock_gettime_nsec_np(CLOCK_UPTIME_RAW);
+}
+
+// libmalloc calls malloc_logger, if set, on every allocation and free; it is
+// what MallocStackLogging uses
+typedef void (malloc_logger_t)(uint32_t type, uintptr_t arg1, uintptr_t arg2, uintptr_t arg3, uintptr_t result, uint32_t num_hot_frames_to_skip);
+extern "C" malloc_logger_t * malloc_logger;
+
+#define kMallocLogAllocate		2
+#define kMallocLogDeallocate	4
+
+static std::atomic<uint64_t> gNumOfAllocations;
+static std::atomic<uint64_t> gNumOfAllocatedBytes;
+
+
+/*------------------------------------------------------------------------------
+	Count an allocation.
+	malloc and calloc pass the zone in arg1 and the size in arg2; realloc, which
+	is logged as both allocate and deallocate, passes the old block in arg2 and
+	the new size in arg3.
+------------------------------------------------------------------------------*/
+
+static void
+CountAllocation(uint32_t inType, uintptr_t inArg1, uintptr_t inArg2, uintptr_t inArg3, uintptr_t inResult, uint32_t inNumOfFramesToSkip) {
+	if (inType & kMallocLogAllocate) {
+		gNumOfAllocations.fetch_add(1, std::memory_order_relaxed);
+		gNumOfAllocatedBytes.fetch_add((inType & kMallocLogDeallocate) ? inArg3 : inArg2, std::memory_order_relaxed);
+	}
+}
+
+
+/*------------------------------------------------------------------------------
+	Return the recorder, if recording.
+	The caller holds its own reference, so the recorder stays valid if recording
+	is stopped on another thread.
+	Args:		--
+	Return:	recorder; nil => not recording
+------------------------------------------------------------------------------*/
+
+NCCapture *
+CaptureIO(void) {
+	os_unfair_lock_lock(&gCaptureLock);
+	NCCapture * capture = gCaptureIO;
+	os_unfair_lock_unlock(&gCaptureLock);
+	return capture;
+}
+
+
+/* -----------------------------------------------------------------------------
+	N C C a p t u r e
+----------------------------------------------------------------------------- */
+@interface NCCapture ()
+{
+	FILE * fref;
+	uint64_t startTime;
+	dispatch_queue_t writeQueue;
+}
+- (id)initWithFile:(FILE *)inFile transport:(uint32_t)inTransport;
+- (void)close;
+@end
+
+
+@implementation NCCapture
+
+/*------------------------------------------------------------------------------
+	Start recording all endpoint I/O to file.
+	Args:		inURL				capture file
+				inTransport		kCaptureTransportRaw or kCaptureTransportMNP
+	Return:	error code
+------------------------------------------------------------------------------*/
+
++ (NCError)startRecording:(NSURL *)inURL transport:(uint32_t)inTransport {
+	[self stopRecording];
+
+	FILE * fp = fopen(inURL.fileSystemRepresentation, "w");
+	if (fp == NULL) {
+		return kNCInvalidFile;
+	}
+	NCCapture * capture = [[NCCapture alloc] initWithFile:fp transport:inTransport];
+	os_unfair_lock_lock(&gCaptureLock);
+	gCaptureIO = capture;
+	os_unfair_lock_unlock(&gCaptureLock);
+	return noErr;
+}
+
+
+/*------------------------------------------------------------------------------
+	Stop recording; flush outstanding records to file.
+	Args:		--
+	Return:	--
+------------------------------------------------------------------------------*/
+
++ (void)stopRecording {
+	os_unfair_lock_lock(&gCaptureLock);
+	NCCapture * capture = gCaptureIO;
+	gCaptureIO = nil;
+	os_unfair_lock_unlock(&gCaptureLock);
+	// anyone still holding the recorder finds its file closed and records nothing
+	[capture close];
+}
+
+
+- (id)initWithFile:(FILE *)inFile transport:(uint32_t)inTransport {
+	if (self = [super init]) {
+		fref = inFile;
+		startTime = Now();
+		writeQueue = dispatch_queue_create("com.newton.connection.capture", NULL);
+
+		CaptureFileHeader header;
+		memcpy(header.signature, kCaptureSignature, sizeof(header.signature));
+		header.version = CANONICAL_LONG(kCaptureVersion);
+		header.transport = CANONICAL_LONG(inTransport);
+		fwrite(&header, sizeof(header), 1, fref);
+	}
+	return self;
+}
+
+
+- (void)close {
+	dispatch_sync(writeQueue, ^{
+		if (fref) {
+			fclose(fref), fref = NULL;
+		}
+	});
+}
+
+
+- (void)dealloc {
+	[self close];
+}
+
+
+/*------------------------------------------------------------------------------
+	Record a block of data.
+	The data is copied now and written to file later in our own queue.
+	Args:		inKind			kCaptureRawIn etc
+				inData
+				inLength
+	Return:	--
+------------------------------------------------------------------------------*/
+
+- (void)record:(uint8_t)inKind data:(const void *)inData length:(unsigned int)inLength {
+	uint64_t timestamp = Now() - startTime;
+	NSData * data = inLength > 0 ? [NSData dataWithBytes:inData length:inLength] : nil;
+	dispatch_async(writeQueue, ^{
+		if (fref) {
+			static const char kPadding[4] = { 0,0,0,0 };
+			CaptureRecordHeader header;
+			header.timestamp = CFSwapInt64HostToBig(timestamp);
+			header.kind = inKind;
+			header.reserved[0] = header.reserved[1] = header.reserved[2] = 0;
+			header.length = CANONICAL_LONG(inLength);
+			fwrite(&header, sizeof(header), 1, fref);
+			if (data) {
+				fwrite(data.bytes, data.length, 1, fref);
+				fwrite(kPadding, LONGALIGN(inLength) - inLength, 1, fref);
+			}
+		}
+	});
+}
+
+
+/*------------------------------------------------------------------------------
+	Record a dock event.
+	Data is recorded in the same layout as on the wire, less the newt-dock
+	prefix: tag, length, data.
+	Args:		inKind			kCaptureEventIn or kCaptureEventOut
+				inTag
+				inLength			protocol length word
+				inData
+				inDataLength	actual length of data
+	Return:	--
+------------------------------------------------------------------------------*/
+
+- (void)recordEvent:(uint8_t)inKind tag:(uint32_t)inTag length:(unsigned int)inLength data:(const void *)inData dataLength:(unsigned int)inDataLength {
+	NSMutableData * evt = [NSMutableData dataWithLength:8 + inDataLength];
+	uint32_t * p = (uint32_t *)evt.mutableBytes;
+	p[0] = CANONICAL_LONG(inTag);
+	p[1] = CANONICAL_LONG(inLength);
+	if (inData && inDataLength > 0) {
+		memcpy(p+2, inData, inDataLength);
+	}
+	[self record:inKind data:evt.bytes length:(unsigned int)evt.length];
+}
+
+@end
+
+
+/* -----------------------------------------------------------------------------
+	N C R e p l a y
+----------------------------------------------------------------------------- */
+@interface NCReplay ()
+{
+	NSData * capture;
+}
+@end
+
+
+@implementation NCReplay
+
+/*------------------------------------------------------------------------------
+	Write a seed capture from the protocol extensions in our bundle.
+	Each NTK/*.stream is wrapped in a kDRegProtocolExtension dock event -- the
+	same bytes the desktop sends when it loads the extension -- and recorded as
+	received raw data, so the replay exercises the event builder with a range
+	of realistic NSOF payload sizes.
+	Args:		inURL			capture file to create
+	Return:	error code
+------------------------------------------------------------------------------*/
+
++ (NCError)writeSeedCapture:(NSURL *)inURL {
+	NSArray<NSString *> * streams = [NSBundle.mainBundle pathsForResourcesOfType:@"stream" inDirectory:nil];
+	if (streams.count == 0) {
+		return kNCInvalidFile;
+	}
+	NCError err = [NCCapture startRecording:inURL transport:kCaptureTransportRaw];
+	if (err == noErr) {
+		for (NSString * path in streams) {
+			NSData * stream = [NSData dataWithContentsOfFile:path];
+			unsigned int streamLen = (unsigned int)stream.length;
+			NSMutableData * evt = [NSMutableData dataWithLength:sizeof(DockEventHeader) + LONGALIGN(streamLen)];
+			DockEventHeader * header = (DockEventHeader *)evt.mutableBytes;
+			header->evtClass = CANONICAL_LONG(kNewtEventClass);
+			header->evtId = CANONICAL_LONG(kDockEventId);
+			header->tag = CANONICAL_LONG(kDRegProtocolExtension);
+			header->length = CANONICAL_LONG(streamLen);
+			memcpy(header+1, stream.bytes, streamLen);
+			NCCapture * capture = CaptureIO();
+			[capture record:kCaptureRawIn data:evt.bytes length:(unsigned int)evt.length];
+			[capture recordEvent:kCaptureEventIn tag:kDRegProtocolExtension length:streamLen data:stream.bytes dataLength:streamLen];
+		}
+		[NCCapture stopRecording];
+	}
+	return err;
+}
+
+
+/*------------------------------------------------------------------------------
+	Initialize instance.
+	Args:		inURL			capture file
+	Return:	self
+				nil => not a capture file
+------------------------------------------------------------------------------*/
+
+- (id)initWithURL:(NSURL *)inURL {
+	if (self = [super init]) {
+		capture = [NSData dataWithContentsOfURL:inURL options:NSDataReadingMappedIfSafe error:nil];
+		if (capture == nil || capture.length < sizeof(CaptureFileHeader)) {
+			return nil;
+		}
+		const CaptureFileHeader * header = (const CaptureFileHeader *)capture.bytes;
+		if (memcmp(header->signature, kCaptureSignature, sizeof(header->signature)) != 0
+		||  CANONICAL_LONG(header->version) != kCaptureVersion) {
+			return nil;
+		}
+		_transport = CANONICAL_LONG(header->transport);
+	}
+	return self;
+}
+
+
+/*------------------------------------------------------------------------------
+	Replay received data.
+	Each kCaptureRawIn record is fed, a page at a time, to the endpoint’s
+	readPage:into: -- which for MNP will unframe and ACK the packets -- and the
+	unframed data is built into dock events exactly as the NCDockEventQueue
+	does it.
+	NB -[NCDockEvent build:] keeps its FSM state in statics, so a replay must not
+	run concurrently with a live session.
+	Args:		inEndpoint		endpoint of the captured transport type
+				inSink			block to receive each built event; may be nil
+	Return:	error code
+------------------------------------------------------------------------------*/
+
+- (NCError)replay:(NCEndpoint *)inEndpoint sink:(NCReplaySink)inSink {
+	NCError err = noErr;
+	NCBuffer * frameBuf = [[NCBuffer alloc] init];
+	CChunkBuffer data;
+	NCDockEvent * evt = [[NCDockEvent alloc] init];
+
+	memset(&_stats, 0, sizeof(_stats));
+	// count allocations unless malloc stack logging already owns the hook
+	// NB this counts every thread’s allocations, not just the replay’s
+	bool isCounting = (malloc_logger == NULL);
+	if (isCounting) {
+		gNumOfAllocations = 0;
+		gNumOfAllocatedBytes = 0;
+		malloc_logger = CountAllocation;
+	}
+	uint64_t startTime = Now();
+
+	const char * p = (const char *)capture.bytes + sizeof(CaptureFileHeader);
+	const char * limit = (const char *)capture.bytes + capture.length;
+	while (err == noErr && p + sizeof(CaptureRecordHeader) <= limit) {
+		const CaptureRecordHeader * record = (const CaptureRecordHeader *)p;
+		unsigned int recordLen = CANONICAL_LONG(record->length);
+		const unsigned char * recordData = (const unsigned char *)(record + 1);
+		p = (const char *)recordData + LONGALIGN(recordLen);
+		if (p > limit) {
+			err = kNCInvalidFile;
+			break;
+		}
+		_stats.numOfRecords++;
+		if (record->kind != kCaptureRawIn) {
+			continue;
+		}
+
+		_stats.numOfBytes += recordLen;
+		while (err == noErr && recordLen > 0) {
+			unsigned int count = [frameBuf fill:recordLen from:recordData];
+			recordData += count;
+			recordLen -= count;
+			err = [inEndpoint readPage:frameBuf into:&data];
+			while (err == noErr && [evt build:&data] == noErr) {
+				_stats.numOfEvents++;
+				_stats.numOfEventBytes += evt.dataLength;
+				if (inSink) {
+					inSink(evt);
+				}
+				evt = [[NCDockEvent alloc] init];
+			}
+		}
+	}
+
+	_stats.elapsedTime = Now() - startTime;
+	if (isCounting) {
+		malloc_logger = NULL;
+		_stats.numOfAllocations = gNumOfAllocations;
+		_stats.numOfAllocatedBytes = gNumOfAllocatedBytes;
+	}
+	malloc_statistics_t mallocStats;
+	malloc_zone_statistics(NULL, &mallocStats);
+	_stats.maxSizeInUse = mallocStats.max_size_in_use;
+
+MINIMUM_LOG {
+	REPprintf("%s\n", self.report.UTF8String);
+}
+	return err;
+}
+
+
+/*------------------------------------------------------------------------------
+	Describe the last replay’s throughput.
+	Args:		--
+	Return:	human-readable summary
+------------------------------------------------------------------------------*/
+
+- (NSString *)report {
+	double secs = (double)_stats.elapsedTime / 1e9;
+	if (secs <= 0.0) {
+		secs = 1e-9;
+	}
+	return [NSString stringWithFormat:@"replay: %u records, %u events in %.3f ms -- %.0f events/s, %.0f bytes/s (%llu bytes raw, %llu bytes event data); malloc: %llu allocations, %llu bytes allocated (%.1f per event), %llu bytes high-water",
+				_stats.numOfRecords, _stats.numOfEvents, secs * 1e3,
+				_stats.numOfEvents / secs, _stats.numOfBytes / secs,
+				_stats.numOfBytes, _stats.numOfEventBytes,
+				_stats.numOfAllocations, _stats.numOfAllocatedBytes,
+				_stats.numOfEvents > 0 ? (double)_stats.numOfAllocations / _stats.numOfEvents : 0.0, _stats.maxSizeInUse];
+}
+
+@end
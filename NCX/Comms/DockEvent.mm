@@ -8,6 +8,9 @@
 
 #import "DockEventQueue.h"
 #import "DockErrors.h"
+#import "Capture.h"
+#import "Metrics.h"
+#import "GrowablePipe.h"
 #import "Logging.h"
 
 
@@ -65,8 +68,7 @@
 
 + (NCDockEvent *)makeEvent:(EventType)inCmd ref:(RefArg)inRef {
 	NCDockEvent * evt = [[NCDockEvent alloc] initEvent:inCmd];
-	evt.dataLength = (unsigned int)FlattenRefSize(inRef);
-	evt.ref = inRef;
+	evt.ref = inRef;	// also sets dataLength
 	return evt;
 }
 
@@ -292,25 +294,26 @@ FillIn(char * ioBuf, uint32_t inCmd, char inSeparator) {
 	if (_data) {
 		free(_data), _data = NULL;
 	}
-	self.dataLength = (unsigned int)FlattenRefSize(inRef);
-	if (header.length > kEventBufSize) {
-		_data = malloc(alignedLength);
-	}
-	CPtrPipe pipe;
-	pipe.init(self.data, header.length, NO, NULL);
-	FlattenRef(inRef, pipe);
-
+	// flatten in one pass; the pipe grows as required
+	CGrowablePipe pipe;
+	self.dataLength = (unsigned int)FlattenRefInto(inRef, pipe);
 	// pad with zeroes
-	int delta = alignedLength - header.length;
-	if (delta > 0) {
-		memset((char *)self.data + header.length, 0, delta);
+	pipe.writeSeek(alignedLength, SEEK_SET);
+	if (header.length > kEventBufSize) {
+		// adopt the pipe’s buffer rather than copy it
+		_data = pipe.detach();
+	} else {
+		memcpy(buf, pipe.data(), alignedLength);
 	}
 }
 
 - (Ref)ref {
+	uint64_t startTime = MetricsNow();
 	CPtrPipe pipe;
 	pipe.init(self.data, header.length, NO, NULL);
-	return UnflattenRef(pipe);
+	Ref result = UnflattenRef(pipe);
+	MetricsTime(kMetricsDecode, startTime);
+	return result;
 }
 
 
@@ -318,9 +321,12 @@ FillIn(char * ioBuf, uint32_t inCmd, char inSeparator) {
 	First NSOF-encoded Ref data contained in an event.
 ----------------------------------------------------------------------------- */
 - (Ref)ref1 {
+	uint64_t startTime = MetricsNow();
 	CPtrPipe pipe;
 	pipe.init(((char*)self.data)+4, header.length-4, NO, NULL);	// skip value
-	return UnflattenRef(pipe);
+	Ref result = UnflattenRef(pipe);
+	MetricsTime(kMetricsDecode, startTime);
+	return result;
 }
 
 
@@ -328,10 +334,13 @@ FillIn(char * ioBuf, uint32_t inCmd, char inSeparator) {
 	Second NSOF-encoded Ref data contained in an event.
 ----------------------------------------------------------------------------- */
 - (Ref)ref2 {
+	uint64_t startTime = MetricsNow();
 	CPtrPipe pipe;
 	pipe.init(self.data, header.length, NO, NULL);
 	UnflattenRef(pipe);	// discard first ref
-	return UnflattenRef(pipe);
+	Ref result = UnflattenRef(pipe);
+	MetricsTime(kMetricsDecode, startTime);
+	return result;
 }
 
 
@@ -555,6 +564,12 @@ MINIMUM_LOG {
 	if (header.length == sizeof(int32_t)) { int v = self.value; REPprintf("%d (0x%08X) ", v, v); }
 	else if (header.length > 0) REPprintf("[%d] ", header.length);
 }
+	if (NCCapture * capture = CaptureIO()) {
+		// file data is recorded raw as it is written
+		[capture recordEvent:kCaptureEventOut tag:header.tag length:header.length data:file ? NULL : self.data dataLength:file ? 0 : _dataLength];
+	}
+	MetricsCount(kMetricsEventsOut);
+	MetricsCount(kMetricsBytesOut, sizeof(DockEventHeader) + header.length);
 
 	if (inChunkSize == 0) {
 		// send all in one go
@@ -8,6 +8,8 @@
 
 #import "DockEventQueue.h"
 #import "DockErrors.h"
+#import "Capture.h"
+#import "Metrics.h"
 #import "Logging.h"
 
 
@@ -125,6 +127,11 @@
 
 - (void)readEvent:(CChunkBuffer *)inData {
 	while ([eventUnderConstruction build:inData] == noErr) {
+		if (NCCapture * capture = CaptureIO()) {
+			[capture recordEvent:kCaptureEventIn tag:eventUnderConstruction.tag length:eventUnderConstruction.length data:eventUnderConstruction.data dataLength:eventUnderConstruction.dataLength];
+		}
+		MetricsCount(kMetricsEventsIn);
+		MetricsCount(kMetricsBytesIn, sizeof(DockEventHeader) + eventUnderConstruction.dataLength);
 		// queue up the completed event
 		[self addEvent:eventUnderConstruction];
 		// start building a new event
@@ -145,6 +152,7 @@
 		dispatch_sync(accessQueue, ^{
 			if (inEvt) {
 				[eventQueue addObject:inEvt];
+				MetricsMax(kMetricsMaxQueueDepth, eventQueue.count);
 			}
 			dispatch_semaphore_signal(eventReady);
 		});
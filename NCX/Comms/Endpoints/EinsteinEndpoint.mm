@@ -8,6 +8,7 @@
 
 #import "EinsteinEndpoint.h"
 #import "DockErrors.h"
+#import "Trace.h"
 #import "Logging.h"
 
 #include <string.h>
@@ -38,6 +39,11 @@ extern "C" int REPprintf(const char * inFormat, ...);
 }
 
 
+- (uint8_t)traceEndpoint {
+	return kTraceEndpointEinstein;
+}
+
+
 /* -----------------------------------------------------------------------------
 	Listen to a well-known pipe. Well-known by Einstein anyway.
 ----------------------------------------------------------------------------- */
@@ -70,6 +70,7 @@
 @property(nonatomic,assign) int pipefd;
 @property(nonatomic,assign) int timeout;
 @property(nonatomic,weak) NCDockEventQueue * eventQueue;
+@property(nonatomic,readonly) uint8_t traceEndpoint;	// kTraceEndpointTCPIP etc
 
 // public interface
 + (BOOL)isAvailable;
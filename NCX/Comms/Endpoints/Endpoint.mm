@@ -35,6 +35,10 @@
 
 #import "DockEventQueue.h"
 #import "DockErrors.h"
+#import "Capture.h"
+#import "Trace.h"
+#import "PreferenceKeys.h"
+#import "PlugInUtilities.h"
 #import "Logging.h"
 
 // we need to know all available transports
@@ -64,6 +68,18 @@ BOOL gTraceIO = NO;
 	return NO;
 }
 
+
+/*------------------------------------------------------------------------------
+	Identify the transport in I/O trace records.
+	Subclasses override.
+	Args:		--
+	Return:	kTraceEndpointTCPIP etc
+------------------------------------------------------------------------------*/
+
+- (uint8_t)traceEndpoint {
+	return kTraceEndpointUnknown;
+}
+
 /*------------------------------------------------------------------------------
 	Initialize instance.
 ------------------------------------------------------------------------------*/
@@ -152,14 +168,12 @@ BOOL gTraceIO = NO;
 	// read() into a 1K buffer, and pass it to the transport for unframing/packetising
 	int count = (int)read(self.rfd, rPageBuf.ptr, rPageBuf.freeSpace);
 	if (count > 0) {
-
-MINIMUM_LOG {
-	if (gTraceIO) {
-		REPprintf("<<");
-		for (int i = 0; i < count; ++i) REPprintf(" %02X", rPageBuf.ptr[i]);
-		REPprintf("\n");
-	}
-}
+		if (gTraceIO) {
+			TraceIO(kTraceIn, self.traceEndpoint, kTraceFramePage, 0, rPageBuf.ptr, count);
+		}
+		if (NCCapture * capture = CaptureIO()) {
+			[capture record:kCaptureRawIn data:rPageBuf.ptr length:count];
+		}
 
 		[rPageBuf fill:count];
 		err = [self readPage:rPageBuf into:&rData];
@@ -217,14 +231,12 @@ MINIMUM_LOG {
 	if (wPageBuf.count > 0) {
 		int count = (int)write(_wfd, wPageBuf.ptr, wPageBuf.count);
 		if (count > 0) {
-
-MINIMUM_LOG {
-	if (gTraceIO) {
-		REPprintf(">>");
-		for (int i = 0; i < count; ++i) REPprintf(" %02X", wPageBuf.ptr[i]);
-		REPprintf("\n");
-	}
-}
+			if (gTraceIO) {
+				TraceIO(kTraceOut, self.traceEndpoint, kTraceFramePage, 0, wPageBuf.ptr, count);
+			}
+			if (NCCapture * capture = CaptureIO()) {
+				[capture record:kCaptureRawOut data:wPageBuf.ptr length:count];
+			}
 
 			[wPageBuf drain:count];
 			[self writeDone];
@@ -449,6 +461,8 @@ MINIMUM_LOG {
 			} else {
 				[strongself useEndpoint:nil];
 			}
+			[NCCapture stopRecording];
+			StopTrace();
 		}
 	});
 
@@ -613,6 +627,16 @@ MINIMUM_LOG {
 ------------------------------------------------------------------------------*/
 
 - (NCError)useEndpoint:(NCEndpoint *)inEndpoint {
+	gTraceIO = [NSUserDefaults.standardUserDefaults boolForKey:kTraceIOPref];
+	if (inEndpoint && gTraceIO) {
+		// trace this session’s I/O in binary; decode it offline with DecodeTrace()
+		StartTrace([ApplicationLogFile().URLByDeletingLastPathComponent URLByAppendingPathComponent:@"NewtonConnection.nctrace"]);
+	}
+	if (inEndpoint && [NSUserDefaults.standardUserDefaults boolForKey:kCaptureIOPref]) {
+		// record this session’s I/O alongside the log file for later replay
+		NSURL * url = [ApplicationLogFile().URLByDeletingLastPathComponent URLByAppendingPathComponent:@"NewtonConnection.ncap"];
+		[NCCapture startRecording:url transport:[inEndpoint isKindOfClass:MNPSerialEndpoint.class] ? kCaptureTransportMNP : kCaptureTransportRaw];
+	}
 	for (NCEndpoint * ep in listeners) {
 		if (ep == inEndpoint) {
 			[ep accept];
@@ -9,10 +9,9 @@
 #import "EthernetEndpoint.h"
 #import "PreferenceKeys.h"
 #import "DockErrors.h"
+#import "Trace.h"
 
 
-extern BOOL gTraceIO;
-
 /* -----------------------------------------------------------------------------
 	T C P I P E n d p o i n t
 ----------------------------------------------------------------------------- */
@@ -35,6 +34,11 @@ extern BOOL gTraceIO;
 }
 
 
+- (uint8_t)traceEndpoint {
+	return kTraceEndpointTCPIP;
+}
+
+
 /* -----------------------------------------------------------------------------
 	Initialize.
 ----------------------------------------------------------------------------- */
@@ -11,6 +11,8 @@
 #import "MNPSerialEndpoint.h"
 #import "SerialPrefsViewController.h"
 #import "DockErrors.h"
+#import "Trace.h"
+#import "Metrics.h"
 #import "Logging.h"
 
 #define ERRBASE_SERIAL					(-18000)	// Newton SerialTool errors
@@ -85,8 +87,6 @@ const unsigned char kLAPacket[] =
 	D a t a
 ----------------------------------------------------------------------------- */
 
-extern BOOL gTraceIO;
-
 int doHandshaking = 0;
 
 static unsigned char ltPacketHeader[sizeof(kLTPacket)];
@@ -160,6 +160,11 @@ FindSerialPorts(io_iterator_t * matchingServices) {
 }
 
 
+- (uint8_t)traceEndpoint {
+	return kTraceEndpointSerial;
+}
+
+
 /* -----------------------------------------------------------------------------
 	Return array of strings for names and corresponding /dev paths
 	of all known serial ports.
@@ -545,6 +550,10 @@ MINIMUM_LOG {
 	// second char is packet type
 	int rPacketType = rPacketBuf.ptr[1];
 
+	if (gTraceIO) {
+		TraceIO(kTraceIn, self.traceEndpoint, rPacketType, rPacketBuf.count > 2 ? rPacketBuf.ptr[2] : 0, rPacketBuf.ptr, rPacketBuf.count);
+	}
+
 	switch (rPacketType)
 	{
 	case kLRPacketType:
@@ -616,6 +625,7 @@ MINIMUM_LOG {
 
 	if (rSequence == prevSequence)
 	{
+		MetricsCount(kMetricsRetransmits);
 MINIMUM_LOG {
 	NSLog(@"-[MNPSerialEndpoint rcvLT:] packet %d resent", rSequence);
 }
@@ -661,14 +671,13 @@ for (int y = 0; y < plen; y += 32)
 	}
 	else
 	{
-MINIMUM_LOG {
-	if (gTraceIO)
-		REPprintf(rPacketBuf.ptr[3] != 0 ? "\n     <-- ACK %d" : "\n     <-- NAK %d", rPacketBuf.ptr[2]);
-}
 		if (rPacketBuf.ptr[3] == 1)	// ACK
 			isACKPending = NO;
 		else									// NAK => resend same packet
+		{
+			MetricsCount(kMetricsRetransmits);
 			[wFrameBuf refill];
+		}
 	}
 }
 
@@ -686,10 +695,6 @@ MINIMUM_LOG {
 ----------------------------------------------------------------------------- */
 
 - (void)sendAck:(BOOL)inOK {
-MINIMUM_LOG {
-	if (gTraceIO)
-		REPprintf(inOK ? "\nACK %d --> " : "\nNAK %d --> ", rSequence);
-}
 	laPacketHeader[2] = rSequence;
 	laPacketHeader[3] = inOK;
 	[self sendPacket: laPacketHeader data: NULL length: 0];
@@ -744,6 +749,18 @@ MINIMUM_LOG {
 
 - (void) sendPacket: (const unsigned char *) inHeader data: (const unsigned char *) inBuf length: (unsigned int) inLength
 {
+	if (gTraceIO) {
+		// trace the packet, not the frame: header and data contiguous, as received
+		unsigned char packet[kTraceMaxData];
+		unsigned int headerLen = 1 + inHeader[0];
+		unsigned int dataLen = (inBuf != NULL) ? MIN(inLength, kTraceMaxData - headerLen) : 0;
+		memcpy(packet, inHeader, headerLen);
+		if (dataLen > 0) {
+			memcpy(packet + headerLen, inBuf, dataLen);
+		}
+		TraceIO(kTraceOut, self.traceEndpoint, inHeader[1], headerLen > 2 ? inHeader[2] : 0, packet, headerLen + dataLen);
+	}
+
 	// Create MNP frame from packet data.
 
 	// start the frame
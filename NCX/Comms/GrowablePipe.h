@@ -0,0 +1,57 @@
+/*
+	File:		GrowablePipe.h
+
+	Contains:	A write pipe backed by a buffer that grows as it is filled,
+					so a Ref can be flattened in a single pass without first
+					walking it for FlattenRefSize().
+
+	Written by:	Newton Research Group, 2026.
+*/
+
+#import <Foundation/Foundation.h>
+#import "NewtonKit.h"
+
+/* -----------------------------------------------------------------------------
+	C G r o w a b l e P i p e
+	The buffer is malloc’d; it is freed on destruction unless ownership is
+	taken with detach().
+----------------------------------------------------------------------------- */
+
+class CGrowablePipe : public CPipe
+{
+public:
+				CGrowablePipe(size_t inInitialSize = 256);
+				~CGrowablePipe();
+
+	long		readSeek(long inOffset, int inSelector);
+	long		readPosition(void) const;
+	long		writeSeek(long inOffset, int inSelector);
+	long		writePosition(void) const;
+	void		readChunk(void * outBuf, size_t & ioSize, bool & outEOF);
+	void		writeChunk(const void * inBuf, size_t inSize, bool inFlush);
+	void		flushRead(void);
+	void		flushWrite(void);
+	void		reset(void);
+	void		overflow();
+	void		underflow(long, bool&);
+
+	void *	data(void) const;
+	size_t	size(void) const;
+	void *	detach(void);
+
+private:
+	void		grow(size_t inSize);
+
+	char *	fBuf;
+	size_t	fAllocated;
+	size_t	fEnd;
+	size_t	fReadOffset;
+	size_t	fWriteOffset;
+};
+
+inline void *	CGrowablePipe::data(void) const { return fBuf; }
+inline size_t	CGrowablePipe::size(void) const { return fEnd; }
+
+
+extern NSData *	FlattenRefToData(RefArg inRef);
+extern size_t		FlattenRefInto(RefArg inRef, CGrowablePipe & ioPipe);
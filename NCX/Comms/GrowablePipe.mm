@@ -0,0 +1,212 @@
+/*
+	File:		GrowablePipe.mm
+
+	Contains:	A write pipe backed by a buffer that grows as it is filled.
+
+	Written by:	Newton Research Group, 2026.
+*/
+
+#import "GrowablePipe.h"
+
+/* -----------------------------------------------------------------------------
+	C G r o w a b l e P i p e
+----------------------------------------------------------------------------- */
+
+CGrowablePipe::CGrowablePipe(size_t inInitialSize)
+	:	fBuf(NULL), fAllocated(0), fEnd(0), fReadOffset(0), fWriteOffset(0)
+{
+	grow(inInitialSize);
+}
+
+
+CGrowablePipe::~CGrowablePipe()
+{
+	if (fBuf)
+		free(fBuf);
+}
+
+
+/* -----------------------------------------------------------------------------
+	Make room for at least inSize bytes.
+	The buffer doubles so that a large flatten costs O(log n) reallocations.
+	Args:		inSize			number of bytes required
+	Return:	--
+----------------------------------------------------------------------------- */
+
+void
+CGrowablePipe::grow(size_t inSize)
+{
+	if (inSize <= fAllocated && fBuf != NULL)
+		return;
+	size_t newSize = fAllocated ? fAllocated : 64;
+	while (newSize < inSize)
+		newSize *= 2;
+	char * newBuf = (char *)realloc(fBuf, newSize);
+	if (newBuf == NULL)
+		ThrowErr(exPipe, kOSErrNoMemory);
+	fBuf = newBuf;
+	fAllocated = newSize;
+}
+
+
+/* -----------------------------------------------------------------------------
+	Hand the buffer over to the caller, who must free() it.
+	The pipe is left empty.
+----------------------------------------------------------------------------- */
+
+void *
+CGrowablePipe::detach(void)
+{
+	void * buf = fBuf;
+	fBuf = NULL;
+	fAllocated = fEnd = fReadOffset = fWriteOffset = 0;
+	return buf;
+}
+
+
+static long
+SeekOffset(long inOffset, int inSelector, size_t inCurrent, size_t inEnd)
+{
+	long offset;
+	if (inSelector == SEEK_SET)
+		offset = inOffset;
+	else if (inSelector == SEEK_CUR)
+		offset = inCurrent + inOffset;
+	else
+		offset = inEnd + inOffset;
+	if (offset < 0)
+		ThrowErr(exPipe, kOSErrBadParameters);
+	return offset;
+}
+
+
+long
+CGrowablePipe::readSeek(long inOffset, int inSelector)
+{
+	long offset = SeekOffset(inOffset, inSelector, fReadOffset, fEnd);
+	if (offset > (long)fEnd)
+		ThrowErr(exPipe, kOSErrBadParameters);
+	fReadOffset = offset;
+	return offset;
+}
+
+
+long
+CGrowablePipe::readPosition(void) const
+{
+	return fReadOffset;
+}
+
+
+long
+CGrowablePipe::writeSeek(long inOffset, int inSelector)
+{
+	long offset = SeekOffset(inOffset, inSelector, fWriteOffset, fEnd);
+	if (offset > (long)fEnd) {
+		grow(offset);
+		memset(fBuf + fEnd, 0, offset - fEnd);
+		fEnd = offset;
+	}
+	fWriteOffset = offset;
+	return offset;
+}
+
+
+long
+CGrowablePipe::writePosition(void) const
+{
+	return fWriteOffset;
+}
+
+
+void
+CGrowablePipe::readChunk(void * outBuf, size_t & ioSize, bool & outEOF)
+{
+	size_t available = fEnd - fReadOffset;
+	if (ioSize > available)
+		ioSize = available;
+	memcpy(outBuf, fBuf + fReadOffset, ioSize);
+	fReadOffset += ioSize;
+	outEOF = (fReadOffset == fEnd);
+}
+
+
+void
+CGrowablePipe::writeChunk(const void * inBuf, size_t inSize, bool inFlush)
+{
+	size_t end = fWriteOffset + inSize;
+	grow(end);
+	memcpy(fBuf + fWriteOffset, inBuf, inSize);
+	fWriteOffset = end;
+	if (end > fEnd)
+		fEnd = end;
+}
+
+
+void
+CGrowablePipe::flushRead(void)
+{ }
+
+
+void
+CGrowablePipe::flushWrite(void)
+{ }
+
+
+/* -----------------------------------------------------------------------------
+	Empty the pipe but keep the buffer, so it can be reused for the next Ref.
+----------------------------------------------------------------------------- */
+
+void
+CGrowablePipe::reset(void)
+{
+	fEnd = fReadOffset = fWriteOffset = 0;
+}
+
+
+void
+CGrowablePipe::overflow()
+{ }
+
+
+void
+CGrowablePipe::underflow(long, bool & outEOF)
+{
+	outEOF = true;
+}
+
+
+/* -----------------------------------------------------------------------------
+	F l a t t e n i n g
+----------------------------------------------------------------------------- */
+
+/* -----------------------------------------------------------------------------
+	Flatten a Ref into an NSData object in a single pass.
+	Args:		inRef
+	Return:	NSOF data; the NSData object owns the bytes
+----------------------------------------------------------------------------- */
+
+NSData *
+FlattenRefToData(RefArg inRef)
+{
+	CGrowablePipe pipe;
+	FlattenRef(inRef, pipe);
+	size_t numOfBytes = pipe.size();
+	return [NSData dataWithBytesNoCopy:pipe.detach() length:numOfBytes];
+}
+
+
+/* -----------------------------------------------------------------------------
+	Flatten a Ref into a reusable pipe, replacing its previous contents.
+	Args:		inRef
+				ioPipe
+	Return:	size of the NSOF data, which is at ioPipe.data()
+----------------------------------------------------------------------------- */
+
+size_t
+FlattenRefInto(RefArg inRef, CGrowablePipe & ioPipe)
+{
+	ioPipe.reset();
+	FlattenRef(inRef, ioPipe);
+	return ioPipe.size();
+}
@@ -0,0 +1,87 @@
+/*
+	File:		Metrics.h
+
+	Contains:	Session instrumentation interface.
+					Counters and per-phase wall time for backup, restore and sync
+					sessions, so a slow session can be pinned on the link, NSOF decode,
+					CoreData writes or UI merges.
+					Counters are updated lock-free from any thread and are cheap enough
+					to leave on. At the end of a session a JSON report is written beside
+					the log file; while a session is running the same report is served
+					to any client connecting to a local Unix socket:
+						nc -U ~/Library/Logs/NewtonConnection.metrics
+
+	Written by:	Newton Research Group, 2026.
+*/
+
+#import <Foundation/Foundation.h>
+
+#import "Comms.h"
+
+
+/* -----------------------------------------------------------------------------
+	Counters.
+----------------------------------------------------------------------------- */
+
+enum NCMetricsCounter
+{
+	kMetricsEventsIn,
+	kMetricsEventsOut,
+	kMetricsBytesIn,				// dock event data bytes
+	kMetricsBytesOut,
+	kMetricsRoundTrips,			// replies waited for after sending a command
+	kMetricsRetransmits,			// MNP packets resent, either direction
+	kMetricsEntries,				// soup entries added to the document
+	kMetricsEntryBytes,			// NSOF bytes of those entries
+	kMetricsMaxQueueDepth,		// high-water mark of the dock event queue
+	kMetricsSkippedWrites,		// entries received unchanged, so not stored again
+	kNumOfMetricsCounters
+};
+
+
+/* -----------------------------------------------------------------------------
+	Phases.
+	Wall time spent in each, summed over the session.
+----------------------------------------------------------------------------- */
+
+enum NCMetricsPhase
+{
+	kMetricsLink,					// blocked waiting for an event from the device
+	kMetricsDecode,				// unflattening NSOF
+	kMetricsStore,					// creating/updating Entry objects
+	kMetricsSave,					// saving the managed object context
+	kMetricsMerge,					// merging saved changes into the UI context
+	kMetricsIndex,					// indexing the text of stored entries
+	kNumOfMetricsPhases
+};
+
+
+/* -----------------------------------------------------------------------------
+	F u n c t i o n s
+	Safe to call at any time; they do nothing unless a session is being measured.
+----------------------------------------------------------------------------- */
+
+uint64_t	MetricsNow(void);
+void		MetricsCount(NCMetricsCounter inCounter, uint64_t inValue = 1);
+void		MetricsMax(NCMetricsCounter inCounter, uint64_t inValue);
+void		MetricsTime(NCMetricsPhase inPhase, uint64_t inStartTime);
+
+
+/* -----------------------------------------------------------------------------
+	N C M e t r i c s
+	One per measured session; gMetrics is nil between sessions.
+----------------------------------------------------------------------------- */
+
+@interface NCMetrics : NSObject
+
++ (void)beginSession:(NSString *)inKind;
++ (void)endSession:(NCError)inErr;
+
+- (void)beginSoup:(NSString *)inName store:(NSString *)inStoreName;
+- (void)endSoup;
+
+- (NSDictionary *)report;
+
+@end
+
+extern NCMetrics * gMetrics;
@@ -0,0 +1,339 @@
+/*
+	File:		Metrics.mm
+
+	Contains:	Session instrumentation implementation.
+
+	Written by:	Newton Research Group, 2026.
+*/
+
+#import <atomic>
+#import <sys/socket.h>
+#import <sys/un.h>
+#import <time.h>
+
+#import "Metrics.h"
+#import "PlugInUtilities.h"
+#import "Logging.h"
+
+extern "C" int REPprintf(const char * inFormat, ...);
+
+
+/* -----------------------------------------------------------------------------
+	D a t a
+----------------------------------------------------------------------------- */
+
+NCMetrics * gMetrics = nil;
+
+static std::atomic<bool>		gMetricsActive;
+static std::atomic<uint64_t>	gCounter[kNumOfMetricsCounters];
+static std::atomic<uint64_t>	gPhaseTime[kNumOfMetricsPhases];
+static std::atomic<uint64_t>	gPhaseCount[kNumOfMetricsPhases];
+
+static const char * kCounterName[kNumOfMetricsCounters] =
+{
+	"eventsIn", "eventsOut", "bytesIn", "bytesOut", "roundTrips", "retransmits", "entries", "entryBytes", "maxQueueDepth", "skippedWrites"
+};
+
+static const char * kPhaseName[kNumOfMetricsPhases] =
+{
+	"link", "decode", "store", "save", "merge", "index"
+};
+
+
+/* -----------------------------------------------------------------------------
+	F u n c t i o n s
+----------------------------------------------------------------------------- */
+
+uint64_t
+MetricsNow(void) {
+	return clock_gettime_nsec_np(CLOCK_UPTIME_RAW);
+}
+
+
+void
+MetricsCount(NCMetricsCounter inCounter, uint64_t inValue) {
+	if (gMetricsActive.load(std::memory_order_relaxed)) {
+		gCounter[inCounter].fetch_add(inValue, std::memory_order_relaxed);
+	}
+}
+
+
+void
+MetricsMax(NCMetricsCounter inCounter, uint64_t inValue) {
+	if (gMetricsActive.load(std::memory_order_relaxed)) {
+		uint64_t value = gCounter[inCounter].load(std::memory_order_relaxed);
+		while (inValue > value && !gCounter[inCounter].compare_exchange_weak(value, inValue, std::memory_order_relaxed))
+			;
+	}
+}
+
+
+/*------------------------------------------------------------------------------
+	Add the time since inStartTime to a phase.
+	Args:		inPhase
+				inStartTime		from MetricsNow() at the start of the phase
+	Return:	--
+------------------------------------------------------------------------------*/
+
+void
+MetricsTime(NCMetricsPhase inPhase, uint64_t inStartTime) {
+	if (gMetricsActive.load(std::memory_order_relaxed)) {
+		gPhaseTime[inPhase].fetch_add(MetricsNow() - inStartTime, std::memory_order_relaxed);
+		gPhaseCount[inPhase].fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+
+struct MetricsSnapshot
+{
+	uint64_t	counter[kNumOfMetricsCounters];
+	uint64_t	phaseTime[kNumOfMetricsPhases];
+	uint64_t	phaseCount[kNumOfMetricsPhases];
+	uint64_t	time;
+};
+
+
+/*------------------------------------------------------------------------------
+	Take a snapshot of all counters and phase times.
+	Args:		outSnapshot
+	Return:	--
+------------------------------------------------------------------------------*/
+
+static void
+TakeSnapshot(MetricsSnapshot * outSnapshot) {
+	for (int i = 0; i < kNumOfMetricsCounters; ++i) {
+		outSnapshot->counter[i] = gCounter[i].load(std::memory_order_relaxed);
+	}
+	for (int i = 0; i < kNumOfMetricsPhases; ++i) {
+		outSnapshot->phaseTime[i] = gPhaseTime[i].load(std::memory_order_relaxed);
+		outSnapshot->phaseCount[i] = gPhaseCount[i].load(std::memory_order_relaxed);
+	}
+	outSnapshot->time = MetricsNow();
+}
+
+
+/*------------------------------------------------------------------------------
+	Describe the difference between two snapshots.
+	Args:		inFrom
+				inTo
+	Return:	dictionary suitable for NSJSONSerialization
+------------------------------------------------------------------------------*/
+
+static NSMutableDictionary *
+Describe(const MetricsSnapshot * inFrom, const MetricsSnapshot * inTo) {
+	NSMutableDictionary * counters = [NSMutableDictionary dictionaryWithCapacity:kNumOfMetricsCounters];
+	for (int i = 0; i < kNumOfMetricsCounters; ++i) {
+		uint64_t value = (i == kMetricsMaxQueueDepth) ? inTo->counter[i] : inTo->counter[i] - inFrom->counter[i];
+		counters[@(kCounterName[i])] = [NSNumber numberWithUnsignedLongLong:value];
+	}
+	NSMutableDictionary * phases = [NSMutableDictionary dictionaryWithCapacity:kNumOfMetricsPhases];
+	for (int i = 0; i < kNumOfMetricsPhases; ++i) {
+		phases[@(kPhaseName[i])] = @{ @"ms":[NSNumber numberWithDouble:(double)(inTo->phaseTime[i] - inFrom->phaseTime[i]) / 1e6],
+												@"count":[NSNumber numberWithUnsignedLongLong:inTo->phaseCount[i] - inFrom->phaseCount[i]] };
+	}
+	double secs = (double)(inTo->time - inFrom->time) / 1e9;
+	NSMutableDictionary * result = [NSMutableDictionary dictionaryWithCapacity:8];
+	result[@"ms"] = [NSNumber numberWithDouble:secs * 1e3];
+	result[@"counters"] = counters;
+	result[@"phases"] = phases;
+	if (secs > 0.0) {
+		result[@"bytesPerSec"] = [NSNumber numberWithDouble:(double)(inTo->counter[kMetricsBytesIn] - inFrom->counter[kMetricsBytesIn] + inTo->counter[kMetricsBytesOut] - inFrom->counter[kMetricsBytesOut]) / secs];
+		result[@"entriesPerSec"] = [NSNumber numberWithDouble:(double)(inTo->counter[kMetricsEntries] - inFrom->counter[kMetricsEntries]) / secs];
+	}
+	return result;
+}
+
+
+/* -----------------------------------------------------------------------------
+	N C M e t r i c s
+----------------------------------------------------------------------------- */
+@interface NCMetrics ()
+{
+	NSString * kind;
+	NSDate * startDate;
+	MetricsSnapshot sessionStart;
+	MetricsSnapshot soupStart;
+	NSString * soupName;
+	NSString * storeName;
+	NSMutableArray * soups;
+}
+- (id)initWithKind:(NSString *)inKind;
++ (void)startServer;
+@end
+
+
+@implementation NCMetrics
+
+/*------------------------------------------------------------------------------
+	Start measuring a session.
+	Args:		inKind			@"backup", @"restore" etc
+	Return:	--
+------------------------------------------------------------------------------*/
+
++ (void)beginSession:(NSString *)inKind {
+	[self startServer];
+	for (int i = 0; i < kNumOfMetricsCounters; ++i) {
+		gCounter[i].store(0, std::memory_order_relaxed);
+	}
+	for (int i = 0; i < kNumOfMetricsPhases; ++i) {
+		gPhaseTime[i].store(0, std::memory_order_relaxed);
+		gPhaseCount[i].store(0, std::memory_order_relaxed);
+	}
+	gMetrics = [[NCMetrics alloc] initWithKind:inKind];
+	gMetricsActive.store(true, std::memory_order_release);
+}
+
+
+/*------------------------------------------------------------------------------
+	Finish measuring a session; write its report beside the log file.
+	Args:		inErr				the session’s outcome
+	Return:	--
+------------------------------------------------------------------------------*/
+
++ (void)endSession:(NCError)inErr {
+	NCMetrics * metrics = gMetrics;
+	if (metrics == nil) {
+		return;
+	}
+	[metrics endSoup];
+	gMetricsActive.store(false, std::memory_order_release);
+	gMetrics = nil;
+
+	NSMutableDictionary * report = [[metrics report] mutableCopy];
+	report[@"error"] = [NSNumber numberWithInt:inErr];
+	NSData * json = [NSJSONSerialization dataWithJSONObject:report options:NSJSONWritingPrettyPrinted | NSJSONWritingSortedKeys error:nil];
+	NSString * filename = [NSString stringWithFormat:@"NewtonConnection-%@.json", metrics->kind];
+	[json writeToURL:[ApplicationLogFile().URLByDeletingLastPathComponent URLByAppendingPathComponent:filename] atomically:YES];
+
+MINIMUM_LOG {
+	NSDictionary * counters = report[@"counters"];
+	NSDictionary * phases = report[@"phases"];
+	REPprintf("\n%s: %.0f ms, %llu entries, %llu unchanged, %llu round trips, %llu retransmits; link %.0f ms, decode %.0f ms, store %.0f ms, save %.0f ms, merge %.0f ms\n",
+				metrics->kind.UTF8String, [report[@"ms"] doubleValue],
+				[counters[@"entries"] unsignedLongLongValue], [counters[@"skippedWrites"] unsignedLongLongValue], [counters[@"roundTrips"] unsignedLongLongValue], [counters[@"retransmits"] unsignedLongLongValue],
+				[phases[@"link"][@"ms"] doubleValue], [phases[@"decode"][@"ms"] doubleValue], [phases[@"store"][@"ms"] doubleValue],
+				[phases[@"save"][@"ms"] doubleValue], [phases[@"merge"][@"ms"] doubleValue]);
+}
+}
+
+
+- (id)initWithKind:(NSString *)inKind {
+	if (self = [super init]) {
+		kind = inKind;
+		startDate = [NSDate date];
+		soups = [[NSMutableArray alloc] init];
+		TakeSnapshot(&sessionStart);
+	}
+	return self;
+}
+
+
+/*------------------------------------------------------------------------------
+	Start measuring a soup within the session.
+	Args:		inName
+				inStoreName
+	Return:	--
+------------------------------------------------------------------------------*/
+
+- (void)beginSoup:(NSString *)inName store:(NSString *)inStoreName {
+	[self endSoup];
+	@synchronized(self) {
+		soupName = inName;
+		storeName = inStoreName;
+		TakeSnapshot(&soupStart);
+	}
+}
+
+
+- (void)endSoup {
+	@synchronized(self) {
+		if (soupName) {
+			MetricsSnapshot now;
+			TakeSnapshot(&now);
+			NSMutableDictionary * soup = Describe(&soupStart, &now);
+			soup[@"soup"] = soupName;
+			soup[@"store"] = storeName ? storeName : @"";
+			[soups addObject:soup];
+			soupName = nil;
+		}
+	}
+}
+
+
+/*------------------------------------------------------------------------------
+	Report the session so far.
+	Args:		--
+	Return:	dictionary suitable for NSJSONSerialization
+------------------------------------------------------------------------------*/
+
+- (NSDictionary *)report {
+	MetricsSnapshot now;
+	TakeSnapshot(&now);
+	NSMutableDictionary * report = Describe(&sessionStart, &now);
+	@synchronized(self) {
+		report[@"session"] = kind;
+		report[@"started"] = [startDate description];
+		report[@"soups"] = [soups copy];
+		if (soupName) {
+			report[@"currentSoup"] = soupName;
+		}
+	}
+	return report;
+}
+
+
+#pragma mark Live counters
+/*------------------------------------------------------------------------------
+	Serve live counters over a Unix domain socket.
+	Each client connection is sent the current report as JSON, then closed.
+	The socket is created once and left listening for the life of the app.
+	Args:		--
+	Return:	--
+------------------------------------------------------------------------------*/
+
++ (void)startServer {
+	static dispatch_source_t listenSrc = nil;
+	if (listenSrc) {
+		return;
+	}
+
+	const char * path = [ApplicationLogFile().URLByDeletingLastPathComponent URLByAppendingPathComponent:@"NewtonConnection.metrics"].fileSystemRepresentation;
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		return;
+	}
+	strcpy(addr.sun_path, path);
+	unlink(path);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		return;
+	}
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0
+	||  listen(fd, 4) < 0) {
+		REPprintf("Not serving metrics on %s - %s (%d).\n", path, strerror(errno), errno);
+		close(fd);
+		return;
+	}
+
+	dispatch_queue_t queue = dispatch_queue_create("com.newton.connection.metrics", NULL);
+	listenSrc = dispatch_source_create(DISPATCH_SOURCE_TYPE_READ, fd, 0, queue);
+	dispatch_source_set_event_handler(listenSrc, ^{
+		int clientfd = accept(fd, NULL, NULL);
+		if (clientfd >= 0) {
+			int nosigpipe = 1;
+			setsockopt(clientfd, SOL_SOCKET, SO_NOSIGPIPE, &nosigpipe, sizeof(nosigpipe));
+			NCMetrics * metrics = gMetrics;
+			NSDictionary * report = metrics ? [metrics report] : @{ @"session":[NSNull null] };
+			NSData * json = [NSJSONSerialization dataWithJSONObject:report options:NSJSONWritingPrettyPrinted | NSJSONWritingSortedKeys error:nil];
+			write(clientfd, json.bytes, json.length);
+			write(clientfd, "\n", 1);
+			close(clientfd);
+		}
+	});
+	dispatch_resume(listenSrc);
+}
+
+@end
@@ -0,0 +1,123 @@
+/*
+	File:		NSOFReader.h
+
+	Contains:	A reader that extracts individual slots from flattened NSOF data
+					without unflattening the whole object.
+
+	Written by:	Newton Research Group, 2026.
+*/
+
+#import <Foundation/Foundation.h>
+#import "NewtonKit.h"
+
+/* -----------------------------------------------------------------------------
+	C N S O F R e a d e r
+	The top-level object must be a frame. Its tags and the position of each slot
+	value are indexed in one walk over the bytes; nothing is allocated until a
+	slot is asked for, and then only that slot’s value is built.
+	A slot path is a dot-separated list of slot names, eg "name.first".
+	The data may run on past the frame, eg in a backup file; length() is the
+	size of the frame itself, or of any other object that is not a frame; it is
+	0 if the object could not be measured.
+	Construction makes no Refs, so readers can be built on another thread and
+	handed to the thread that uses the Newton object heap.
+	If the data uses anything the reader does not understand (eg a large binary)
+	getSlot() returns false and the caller should UnflattenRef() instead.
+	fingerprint() hashes the data without building anything, leaving out the
+	values of the given top-level slots, so entries that differ only in eg
+	_modTime have the same fingerprint.
+----------------------------------------------------------------------------- */
+
+class CNSOFReader
+{
+public:
+				CNSOFReader(const void * inData, size_t inSize);
+				~CNSOFReader();
+
+	bool		isValid(void) const;
+	size_t	length(void) const;
+	bool		getSlot(const char * inPath, RefVar & outValue);
+	bool		getSlots(RefArg inTags, RefVar & outFrame);
+	uint64_t	fingerprint(const char * const * inExcludedSlots, ArrayIndex inNumOfExcludedSlots);
+
+private:
+	bool		scan(void);
+	bool		readByte(size_t & ioOffset, unsigned char & outValue);
+	bool		readXLong(size_t & ioOffset, ArrayIndex & outValue);
+	bool		skipObject(size_t & ioOffset, bool inIndex);
+	bool		symbolAt(ArrayIndex inPrecedent, const unsigned char *& outName, ArrayIndex & outLength);
+	long		findTag(const char * inName, size_t inLength);
+	Ref		readObject(size_t & ioOffset);
+	Ref		readPrecedent(ArrayIndex inPrecedent);
+	ArrayIndex	addPrecedent(size_t inOffset);
+
+	const unsigned char *	fData;
+	size_t		fSize;
+	size_t		fLength;				// of the top-level frame
+	bool			fIsValid;
+
+	// offset of every object that can be referred to by a precedent
+	size_t *		fPrecedents;
+	ArrayIndex	fNumOfPrecedents;
+	ArrayIndex	fPrecedentsSize;
+	ArrayIndex	fNextPrecedent;		// used while building objects
+	RefStruct *	fObjects;			// objects built so far, by precedent
+
+	// top-level frame
+	ArrayIndex	fNumOfSlots;
+	ArrayIndex *	fTags;				// precedent of each tag symbol
+	size_t *		fValues;				// offset of each slot value
+	ArrayIndex *	fValuePrecedents;	// precedent of the first object in each slot value
+};
+
+inline bool	CNSOFReader::isValid(void) const { return fIsValid; }
+inline size_t	CNSOFReader::length(void) const { return fLength; }
+
+
+/* -----------------------------------------------------------------------------
+	C N S O F S c a n n e r
+	Scans a stream of flattened objects, eg a backup file, ahead of the thread
+	that builds them. A background thread makes a CNSOFReader for each object in
+	turn and queues it; take() hands over the reader for an offset, or NULL if
+	the scanner did not get there -- the caller then makes the reader itself, so
+	what is built does not depend on how far ahead the scanner is.
+	Scanning stops at the end of the data or at an object it cannot measure.
+----------------------------------------------------------------------------- */
+
+class CNSOFScanner
+{
+public:
+					CNSOFScanner(const void * inData, size_t inSize, size_t inOffset);
+					~CNSOFScanner();
+
+	CNSOFReader *	take(size_t inOffset);
+	void			stop(void);
+
+private:
+	struct Item
+	{
+		size_t			offset;
+		CNSOFReader *	reader;
+	};
+
+	bool			next(void);
+	void			scan(void);
+
+	const unsigned char *	fData;
+	size_t		fSize;
+	size_t		fOffset;
+	Item *		fItems;				// ring buffer of scanned objects
+	ArrayIndex	fHead;				// next item to take
+	ArrayIndex	fTail;				// next item to scan
+	Item			fCurrent;			// item taken but not yet asked for
+	bool			fIsCurrent;
+	bool			fIsDone;				// scanner has finished
+	volatile bool	fIsStopping;
+	dispatch_semaphore_t	fSpace;
+	dispatch_semaphore_t	fFilled;
+};
+
+
+extern Ref	GetFlattenedSlot(NSData * inData, const char * inPath);
+// inText is big-endian
+extern bool	ForEachFlattenedString(NSData * inData, void (^inBlock)(const UniChar * inText, ArrayIndex inLength));
@@ -0,0 +1,1032 @@
+/*
+	File:		NSOFReader.mm
+
+	Contains:	A reader that extracts individual slots from flattened NSOF data
+					without unflattening the whole object.
+
+	Written by:	Newton Research Group, 2026.
+*/
+
+#import "NSOFReader.h"
+#import <algorithm>
+#import <vector>
+
+/* -----------------------------------------------------------------------------
+	N S O F   t y p e s
+----------------------------------------------------------------------------- */
+
+enum
+{
+	kNSOFImmediate,
+	kNSOFCharacter,
+	kNSOFUnicodeCharacter,
+	kNSOFBinaryObject,
+	kNSOFArray,
+	kNSOFPlainArray,
+	kNSOFFrame,
+	kNSOFSymbol,
+	kNSOFString,
+	kNSOFPrecedent,
+	kNSOFNIL,
+	kNSOFSmallRect,
+	kNSOFLargeBinary
+};
+
+#define kNSOFVersion 2
+
+#define kMaxSymbolLength 254
+
+
+/* -----------------------------------------------------------------------------
+	Walk a dot-separated slot path in an object we already have.
+	Args:		inObj
+				inPath
+	Return:	the slot value, NILREF if any slot on the path is missing
+----------------------------------------------------------------------------- */
+
+static Ref
+GetSlotPath(RefArg inObj, const char * inPath)
+{
+	RefVar obj(inObj);
+	char name[kMaxSymbolLength+1];
+	const char * s = inPath;
+	while (*s != 0 && NOTNIL(obj)) {
+		const char * dot = strchr(s, '.');
+		size_t len = dot ? dot - s : strlen(s);
+		if (len > kMaxSymbolLength)
+			return NILREF;
+		memcpy(name, s, len);
+		name[len] = 0;
+		obj = IsFrame(obj) ? GetFrameSlot(obj, MakeSymbol(name)) : NILREF;
+		s += len;
+		if (*s == '.')
+			s++;
+	}
+	return obj;
+}
+
+
+/* -----------------------------------------------------------------------------
+	C N S O F R e a d e r
+----------------------------------------------------------------------------- */
+
+CNSOFReader::CNSOFReader(const void * inData, size_t inSize)
+	:	fData((const unsigned char *)inData), fSize(inSize), fLength(0), fIsValid(false),
+		fPrecedents(NULL), fNumOfPrecedents(0), fPrecedentsSize(0), fNextPrecedent(0),
+		fObjects(NULL), fNumOfSlots(0), fTags(NULL), fValues(NULL), fValuePrecedents(NULL)
+{
+	fIsValid = scan();
+}
+
+
+CNSOFReader::~CNSOFReader()
+{
+	if (fPrecedents)
+		free(fPrecedents);
+	if (fTags)
+		free(fTags);
+	if (fValues)
+		free(fValues);
+	if (fValuePrecedents)
+		free(fValuePrecedents);
+	if (fObjects)
+		delete fObjects;
+}
+
+
+/* -----------------------------------------------------------------------------
+	Index the top-level frame: note where every precedent object starts,
+	which symbol tags each slot and where each slot value starts.
+	Any other top-level object is just measured.
+	No Refs are made, so this is safe on any thread.
+	Args:		--
+	Return:	true => the data is a frame we can read
+----------------------------------------------------------------------------- */
+
+bool
+CNSOFReader::scan(void)
+{
+	size_t offset = 0;
+	unsigned char type;
+	if (!readByte(offset, type) || type != kNSOFVersion)
+		return false;
+
+	size_t frameOffset = offset;
+	if (!readByte(offset, type))
+		return false;
+	if (type != kNSOFFrame) {
+		offset = frameOffset;
+		if (skipObject(offset, true))
+			fLength = offset;
+		return false;
+	}
+	addPrecedent(frameOffset);
+	if (!readXLong(offset, fNumOfSlots) || fNumOfSlots > fSize)
+		return false;
+
+	fTags = (ArrayIndex *)malloc(fNumOfSlots * sizeof(ArrayIndex));
+	fValues = (size_t *)malloc(fNumOfSlots * sizeof(size_t));
+	fValuePrecedents = (ArrayIndex *)malloc(fNumOfSlots * sizeof(ArrayIndex));
+	if (fNumOfSlots > 0 && (fTags == NULL || fValues == NULL || fValuePrecedents == NULL))
+		return false;
+
+	// tags are symbols, or precedents referring to symbols already seen
+	for (ArrayIndex i = 0; i < fNumOfSlots; ++i) {
+		size_t tagOffset = offset;
+		if (!readByte(offset, type))
+			return false;
+		if (type == kNSOFSymbol) {
+			ArrayIndex len;
+			if (!readXLong(offset, len) || len > fSize - offset)
+				return false;
+			offset += len;
+			fTags[i] = addPrecedent(tagOffset);
+		} else if (type == kNSOFPrecedent) {
+			if (!readXLong(offset, fTags[i]) || fTags[i] >= fNumOfPrecedents)
+				return false;
+		} else {
+			return false;
+		}
+	}
+
+	// skip the values, but remember where they are
+	for (ArrayIndex i = 0; i < fNumOfSlots; ++i) {
+		fValues[i] = offset;
+		fValuePrecedents[i] = fNumOfPrecedents;
+		if (!skipObject(offset, true))
+			return false;
+	}
+	fLength = offset;
+	return true;
+}
+
+
+bool
+CNSOFReader::readByte(size_t & ioOffset, unsigned char & outValue)
+{
+	if (ioOffset >= fSize)
+		return false;
+	outValue = fData[ioOffset++];
+	return true;
+}
+
+
+/* -----------------------------------------------------------------------------
+	Read an xlong: one byte if < 255, otherwise 0xFF followed by a big-endian
+	32-bit value.
+----------------------------------------------------------------------------- */
+
+bool
+CNSOFReader::readXLong(size_t & ioOffset, ArrayIndex & outValue)
+{
+	unsigned char b;
+	if (!readByte(ioOffset, b))
+		return false;
+	if (b < 0xFF) {
+		outValue = b;
+		return true;
+	}
+	if (fSize - ioOffset < 4)
+		return false;
+	const unsigned char * p = fData + ioOffset;
+	outValue = ((ArrayIndex)p[0] << 24) | ((ArrayIndex)p[1] << 16) | ((ArrayIndex)p[2] << 8) | p[3];
+	ioOffset += 4;
+	return true;
+}
+
+
+ArrayIndex
+CNSOFReader::addPrecedent(size_t inOffset)
+{
+	if (fNumOfPrecedents == fPrecedentsSize) {
+		ArrayIndex newSize = fPrecedentsSize ? fPrecedentsSize * 2 : 32;
+		size_t * newPrecedents = (size_t *)realloc(fPrecedents, newSize * sizeof(size_t));
+		if (newPrecedents == NULL)
+			OutOfMemory();
+		fPrecedents = newPrecedents;
+		fPrecedentsSize = newSize;
+	}
+	fPrecedents[fNumOfPrecedents] = inOffset;
+	return fNumOfPrecedents++;
+}
+
+
+/* -----------------------------------------------------------------------------
+	Skip an object without building it.
+	Strings, symbols and binaries are skipped by length; arrays and frames have
+	to be walked since the objects inside them are numbered as precedents.
+	Args:		ioOffset			offset of the object; updated to follow it
+				inIndex			true => record precedent offsets (while scanning)
+									false => just count them (while building)
+	Return:	true => object is well-formed
+----------------------------------------------------------------------------- */
+
+bool
+CNSOFReader::skipObject(size_t & ioOffset, bool inIndex)
+{
+	size_t objOffset = ioOffset;
+	unsigned char type;
+	ArrayIndex count;
+
+	if (!readByte(ioOffset, type))
+		return false;
+
+	switch (type) {
+	case kNSOFImmediate:
+		return readXLong(ioOffset, count);
+
+	case kNSOFCharacter:
+		ioOffset += 1;
+		return ioOffset <= fSize;
+
+	case kNSOFUnicodeCharacter:
+		ioOffset += 2;
+		return ioOffset <= fSize;
+
+	case kNSOFPrecedent:
+		return readXLong(ioOffset, count) && (!inIndex || count < fNumOfPrecedents);
+
+	case kNSOFNIL:
+		return true;
+	}
+
+	// everything else can be referred to by a precedent
+	if (inIndex)
+		addPrecedent(objOffset);
+	else
+		fNextPrecedent++;
+
+	switch (type) {
+	case kNSOFSymbol:
+	case kNSOFString:
+		if (!readXLong(ioOffset, count) || count > fSize - ioOffset)
+			return false;
+		ioOffset += count;
+		return true;
+
+	case kNSOFSmallRect:
+		ioOffset += 4;
+		return ioOffset <= fSize;
+
+	case kNSOFBinaryObject:
+		if (!readXLong(ioOffset, count) || !skipObject(ioOffset, inIndex) || count > fSize - ioOffset)
+			return false;
+		ioOffset += count;
+		return true;
+
+	case kNSOFArray:
+		if (!readXLong(ioOffset, count) || !skipObject(ioOffset, inIndex))
+			return false;
+		break;
+
+	case kNSOFPlainArray:
+		if (!readXLong(ioOffset, count))
+			return false;
+		break;
+
+	case kNSOFFrame:
+		if (!readXLong(ioOffset, count) || count > fSize)
+			return false;
+		count *= 2;		// tags, then values
+		break;
+
+	default:
+		// large binaries are not supported
+		return false;
+	}
+
+	// slots of an array or frame
+	if (count > fSize - ioOffset)
+		return false;
+	for (ArrayIndex i = 0; i < count; ++i)
+		if (!skipObject(ioOffset, inIndex))
+			return false;
+	return true;
+}
+
+
+/* -----------------------------------------------------------------------------
+	Return the name of a symbol without making it.
+	Args:		inPrecedent		precedent of the symbol
+				outName			its characters -- NOT nul-terminated
+				outLength
+	Return:	true => it is a symbol
+----------------------------------------------------------------------------- */
+
+bool
+CNSOFReader::symbolAt(ArrayIndex inPrecedent, const unsigned char *& outName, ArrayIndex & outLength)
+{
+	size_t offset = fPrecedents[inPrecedent];
+	unsigned char type;
+	if (!readByte(offset, type) || type != kNSOFSymbol || !readXLong(offset, outLength))
+		return false;
+	outName = fData + offset;
+	while (outLength > 0 && outName[outLength-1] == 0)
+		outLength--;
+	return true;
+}
+
+
+/* -----------------------------------------------------------------------------
+	Find a top-level slot by name. Symbols are case-insensitive.
+	Args:		inName
+				inLength
+	Return:	index of the slot, -1 if there is no such slot
+----------------------------------------------------------------------------- */
+
+long
+CNSOFReader::findTag(const char * inName, size_t inLength)
+{
+	for (ArrayIndex i = 0; i < fNumOfSlots; ++i) {
+		const unsigned char * name;
+		ArrayIndex len;
+		if (symbolAt(fTags[i], name, len)
+		&&  len == inLength
+		&&  strncasecmp((const char *)name, inName, len) == 0)
+			return i;
+	}
+	return -1;
+}
+
+
+/* -----------------------------------------------------------------------------
+	Return the value of a slot.
+	Args:		inPath			dot-separated slot names
+				outValue			the slot value, NILREF if there is no such slot
+	Return:	false => the data could not be read; UnflattenRef() it instead
+----------------------------------------------------------------------------- */
+
+bool
+CNSOFReader::getSlot(const char * inPath, RefVar & outValue)
+{
+	if (!fIsValid)
+		return false;
+
+	const char * dot = strchr(inPath, '.');
+	size_t len = dot ? dot - inPath : strlen(inPath);
+	long slot = findTag(inPath, len);
+	if (slot < 0) {
+		outValue = NILREF;
+		return true;
+	}
+
+	if (fObjects == NULL)
+		fObjects = new RefStruct(MakeArray(fNumOfPrecedents));
+	size_t offset = fValues[slot];
+	fNextPrecedent = fValuePrecedents[slot];
+	RefVar value(readObject(offset));
+	if (!fIsValid)
+		return false;
+
+	outValue = dot ? GetSlotPath(value, dot + 1) : (Ref)value;
+	return true;
+}
+
+
+/* -----------------------------------------------------------------------------
+	Return a frame holding just the given top-level slots.
+	Slots that are missing or nil are left out.
+	Args:		inTags			array of slot symbols
+				outFrame			the frame
+	Return:	false => the data could not be read; UnflattenRef() it instead
+----------------------------------------------------------------------------- */
+
+bool
+CNSOFReader::getSlots(RefArg inTags, RefVar & outFrame)
+{
+	if (!fIsValid)
+		return false;
+
+	if (fObjects == NULL)
+		fObjects = new RefStruct(MakeArray(fNumOfPrecedents));
+	RefVar frame(AllocateFrame());
+	RefVar tag, value;
+	ArrayIndex numOfTags = Length(inTags);
+	for (ArrayIndex i = 0; i < numOfTags; ++i) {
+		tag = GetArraySlot(inTags, i);
+		const char * name = SymbolName(tag);
+		long slot = findTag(name, strlen(name));
+		if (slot < 0)
+			continue;
+
+		size_t offset = fValues[slot];
+		fNextPrecedent = fValuePrecedents[slot];
+		value = readObject(offset);
+		if (!fIsValid)
+			return false;
+		if (NOTNIL(value))
+			SetFrameSlot(frame, tag, value);
+	}
+	outFrame = frame;
+	return true;
+}
+
+
+/* -----------------------------------------------------------------------------
+	Build an object.
+	Objects already built are reused so shared structure stays shared.
+	Args:		ioOffset			offset of the object; updated to follow it
+	Return:	the object; if it cannot be built fIsValid is cleared
+----------------------------------------------------------------------------- */
+
+Ref
+CNSOFReader::readObject(size_t & ioOffset)
+{
+	size_t objOffset = ioOffset;
+	unsigned char type;
+	ArrayIndex count;
+
+	if (!readByte(ioOffset, type)) {
+		fIsValid = false;
+		return NILREF;
+	}
+
+	switch (type) {
+	case kNSOFImmediate:
+		if (readXLong(ioOffset, count)) {
+			switch (count & kRefTagMask) {
+			case kTagInteger:
+				return MAKEINT((int32_t)count >> kRefTagBits);
+			case kTagImmed:
+				count >>= kRefTagBits;
+				return MAKEIMMED(count & ~kRefImmedMask, count >> kRefImmedBits);
+			case kTagMagicPtr:
+				return MAKEMAGICPTR(count >> kRefTagBits);
+			}
+		}
+		break;
+
+	case kNSOFCharacter:
+		if (ioOffset < fSize)
+			return MAKECHAR(fData[ioOffset++]);
+		break;
+
+	case kNSOFUnicodeCharacter:
+		if (fSize - ioOffset >= 2) {
+			UniChar ch = (fData[ioOffset] << 8) | fData[ioOffset+1];
+			ioOffset += 2;
+			return MAKECHAR(ch);
+		}
+		break;
+
+	case kNSOFPrecedent:
+		if (readXLong(ioOffset, count))
+			return readPrecedent(count);
+		break;
+
+	case kNSOFNIL:
+		return NILREF;
+
+	default:
+		{
+			ArrayIndex index = fNextPrecedent;
+			if (index >= fNumOfPrecedents)
+				break;
+			RefVar obj(GetArraySlot(*fObjects, index));
+			if (NOTNIL(obj)) {
+				// already built when a later slot referred back to it
+				ioOffset = objOffset;
+				if (!skipObject(ioOffset, false))
+					break;
+				return obj;
+			}
+			fNextPrecedent++;
+
+			switch (type) {
+			case kNSOFSymbol:
+				{
+					char name[kMaxSymbolLength+1];
+					if (!readXLong(ioOffset, count) || count > fSize - ioOffset || count > kMaxSymbolLength)
+						break;
+					memcpy(name, fData + ioOffset, count);
+					name[count] = 0;
+					ioOffset += count;
+					obj = MakeSymbol(name);
+				}
+				break;
+
+			case kNSOFString:
+			case kNSOFBinaryObject:
+				{
+					RefVar cls(SYMA(string));
+					if (!readXLong(ioOffset, count))
+						break;
+					if (type == kNSOFBinaryObject) {
+						cls = readObject(ioOffset);
+						if (!fIsValid)
+							return NILREF;
+					}
+					if (count > fSize - ioOffset)
+						break;
+					const unsigned char * p = fData + ioOffset;
+					ioOffset += count;
+
+					if (IsSymbol(cls) && IsSubclass(cls, SYMA(string))) {
+						// NSOF strings are big-endian UniChars
+						ArrayIndex numOfChars = count / sizeof(UniChar);
+						UniChar * str = (UniChar *)malloc((numOfChars + 1) * sizeof(UniChar));
+						if (str == NULL)
+							OutOfMemory();
+						for (ArrayIndex i = 0; i < numOfChars; ++i, p += 2)
+							str[i] = (p[0] << 8) | p[1];
+						str[numOfChars] = 0;
+						obj = MakeString(str);
+						free(str);
+						if (type == kNSOFBinaryObject)
+							SetClass(obj, cls);
+
+					} else if (EQ(cls, SYMA(real)) && count == sizeof(double)) {
+						// so are reals
+						uint64_t bits = 0;
+						for (ArrayIndex i = 0; i < sizeof(double); ++i)
+							bits = (bits << 8) | p[i];
+						double d;
+						memcpy(&d, &bits, sizeof(double));
+						obj = MakeReal(d);
+
+					} else {
+						obj = AllocateBinary(cls, count);
+						WITH_LOCKED_BINARY(obj, objPtr)
+						memcpy(objPtr, p, count);
+						END_WITH_LOCKED_BINARY(obj)
+					}
+				}
+				break;
+
+			case kNSOFArray:
+			case kNSOFPlainArray:
+				{
+					RefVar cls;
+					if (!readXLong(ioOffset, count) || count > fSize - ioOffset)
+						break;
+					if (type == kNSOFArray) {
+						cls = readObject(ioOffset);
+						if (!fIsValid)
+							return NILREF;
+					}
+					obj = AllocateArray(cls, count);
+					SetArraySlot(*fObjects, index, obj);
+					for (ArrayIndex i = 0; i < count; ++i) {
+						RefVar item(readObject(ioOffset));
+						if (!fIsValid)
+							return NILREF;
+						SetArraySlot(obj, i, item);
+					}
+				}
+				break;
+
+			case kNSOFFrame:
+				{
+					if (!readXLong(ioOffset, count) || count > fSize - ioOffset)
+						break;
+					// enter the frame before its slots in case they refer back to it
+					obj = AllocateFrame();
+					SetArraySlot(*fObjects, index, obj);
+					RefVar tags(MakeArray(count));
+					for (ArrayIndex i = 0; i < count; ++i) {
+						RefVar tag(readObject(ioOffset));
+						if (!fIsValid)
+							return NILREF;
+						if (!IsSymbol(tag)) {
+							fIsValid = false;
+							return NILREF;
+						}
+						SetArraySlot(tags, i, tag);
+					}
+					for (ArrayIndex i = 0; i < count; ++i) {
+						RefVar item(readObject(ioOffset));
+						if (!fIsValid)
+							return NILREF;
+						SetFrameSlot(obj, GetArraySlot(tags, i), item);
+					}
+				}
+				break;
+
+			case kNSOFSmallRect:
+				if (fSize - ioOffset >= 4) {
+					const unsigned char * p = fData + ioOffset;
+					ioOffset += 4;
+					obj = AllocateFrame();
+					SetFrameSlot(obj, SYMA(top), MAKEINT(p[0]));
+					SetFrameSlot(obj, SYMA(left), MAKEINT(p[1]));
+					SetFrameSlot(obj, SYMA(bottom), MAKEINT(p[2]));
+					SetFrameSlot(obj, SYMA(right), MAKEINT(p[3]));
+				}
+				break;
+			}
+
+			if (ISNIL(obj))
+				break;
+			SetArraySlot(*fObjects, index, obj);
+			return obj;
+		}
+	}
+
+	// unrecognised type or malformed data
+	fIsValid = false;
+	return NILREF;
+}
+
+
+/* -----------------------------------------------------------------------------
+	Return an object referred to by a precedent, building it if necessary.
+	Args:		inPrecedent
+	Return:	the object
+----------------------------------------------------------------------------- */
+
+Ref
+CNSOFReader::readPrecedent(ArrayIndex inPrecedent)
+{
+	if (inPrecedent >= fNumOfPrecedents) {
+		fIsValid = false;
+		return NILREF;
+	}
+	RefVar obj(GetArraySlot(*fObjects, inPrecedent));
+	if (ISNIL(obj)) {
+		// the object is in a slot we haven’t read yet
+		ArrayIndex saveIndex = fNextPrecedent;
+		size_t offset = fPrecedents[inPrecedent];
+		fNextPrecedent = inPrecedent;
+		obj = readObject(offset);
+		fNextPrecedent = saveIndex;
+	}
+	return obj;
+}
+
+
+/* -----------------------------------------------------------------------------
+	Hash the data, 8 bytes at a time, then mix the result so every bit of the
+	input affects every bit of the hash.
+----------------------------------------------------------------------------- */
+
+static inline uint64_t
+RotateLeft(uint64_t inValue, int inBits)
+{
+	return (inValue << inBits) | (inValue >> (64 - inBits));
+}
+
+
+static uint64_t
+HashBytes(uint64_t inHash, const unsigned char * inData, size_t inSize)
+{
+	const uint64_t k1 = 0x9E3779B185EBCA87ULL;
+	const uint64_t k2 = 0xC2B2AE3D27D4EB4FULL;
+	uint64_t h = inHash ^ (inSize * k1);
+	for ( ; inSize >= 8; inData += 8, inSize -= 8) {
+		uint64_t word;
+		memcpy(&word, inData, 8);
+		h = RotateLeft(h ^ (word * k2), 31) * k1;
+	}
+	uint64_t tail = 0;
+	memcpy(&tail, inData, inSize);
+	return RotateLeft(h ^ (tail * k2), 27) * k1;
+}
+
+
+static uint64_t
+MixHash(uint64_t inHash)
+{
+	inHash ^= inHash >> 33;
+	inHash *= 0xFF51AFD7ED558CCDULL;
+	inHash ^= inHash >> 33;
+	inHash *= 0xC4CEB9FE1A85EC53ULL;
+	inHash ^= inHash >> 33;
+	return inHash;
+}
+
+
+/* -----------------------------------------------------------------------------
+	Return a 64-bit fingerprint of the data.
+	The values of excluded slots are left out but their tags are not, so
+	adding or removing one still changes the fingerprint. Which slots are
+	excluded is hashed too: fingerprints made with different exclusions never
+	match.
+	Data that is not a frame we can read is hashed whole.
+	Args:		inExcludedSlots		names of top-level slots
+				inNumOfExcludedSlots
+	Return:	the fingerprint; never 0
+----------------------------------------------------------------------------- */
+
+uint64_t
+CNSOFReader::fingerprint(const char * const * inExcludedSlots, ArrayIndex inNumOfExcludedSlots)
+{
+	uint64_t h = 0;
+	for (ArrayIndex i = 0; i < inNumOfExcludedSlots; ++i)
+		h = HashBytes(h, (const unsigned char *)inExcludedSlots[i], strlen(inExcludedSlots[i]));
+
+	if (!fIsValid) {
+		h = HashBytes(h, fData, fSize);
+	} else {
+		// the slots to leave out, in the order they appear
+		std::vector<ArrayIndex> excluded;
+		for (ArrayIndex i = 0; i < inNumOfExcludedSlots; ++i) {
+			long slot = findTag(inExcludedSlots[i], strlen(inExcludedSlots[i]));
+			if (slot >= 0)
+				excluded.push_back((ArrayIndex)slot);
+		}
+		std::sort(excluded.begin(), excluded.end());
+
+		// hash each run of bytes between them
+		size_t offset = 0;
+		for (ArrayIndex slot : excluded) {
+			if (fValues[slot] < offset)
+				continue;		// named twice
+			h = HashBytes(h, fData + offset, fValues[slot] - offset);
+			offset = (slot + 1 < fNumOfSlots) ? fValues[slot+1] : fLength;
+		}
+		h = HashBytes(h, fData + offset, fLength - offset);
+	}
+	h = MixHash(h);
+	return h != 0 ? h : 1;
+}
+
+
+/* -----------------------------------------------------------------------------
+	C N S O F S c a n n e r
+----------------------------------------------------------------------------- */
+
+#define kScanAhead 64
+
+CNSOFScanner::CNSOFScanner(const void * inData, size_t inSize, size_t inOffset)
+	:	fData((const unsigned char *)inData), fSize(inSize), fOffset(inOffset),
+		fHead(0), fTail(0), fIsCurrent(false), fIsDone(false), fIsStopping(false)
+{
+	fItems = (Item *)calloc(kScanAhead, sizeof(Item));
+	fSpace = dispatch_semaphore_create(kScanAhead);
+	fFilled = dispatch_semaphore_create(0);
+	dispatch_async(dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0), ^{ scan(); });
+}
+
+
+CNSOFScanner::~CNSOFScanner()
+{
+	stop();
+	free(fItems);
+}
+
+
+/* -----------------------------------------------------------------------------
+	Scan objects until the data runs out, an object cannot be measured, or we
+	are stopped. A NULL reader marks the end.
+	Runs on a background thread.
+----------------------------------------------------------------------------- */
+
+void
+CNSOFScanner::scan(void)
+{
+	CNSOFReader * reader;
+	do {
+		reader = NULL;
+		if (!fIsStopping && fOffset < fSize) {
+			reader = new CNSOFReader(fData + fOffset, fSize - fOffset);
+			if (reader->length() == 0) {
+				delete reader;
+				reader = NULL;
+			}
+		}
+		dispatch_semaphore_wait(fSpace, DISPATCH_TIME_FOREVER);
+		fItems[fTail].offset = fOffset;
+		fItems[fTail].reader = reader;
+		fTail = (fTail + 1) % kScanAhead;
+		dispatch_semaphore_signal(fFilled);
+		if (reader)
+			fOffset += reader->length();
+	} while (reader != NULL);
+}
+
+
+/* -----------------------------------------------------------------------------
+	Take the next scanned object from the queue, waiting for it if necessary.
+	Return:	false => the scanner has finished
+----------------------------------------------------------------------------- */
+
+bool
+CNSOFScanner::next(void)
+{
+	if (fIsDone)
+		return false;
+	dispatch_semaphore_wait(fFilled, DISPATCH_TIME_FOREVER);
+	fCurrent = fItems[fHead];
+	fHead = (fHead + 1) % kScanAhead;
+	dispatch_semaphore_signal(fSpace);
+	fIsDone = (fCurrent.reader == NULL);
+	fIsCurrent = !fIsDone;
+	return fIsCurrent;
+}
+
+
+/* -----------------------------------------------------------------------------
+	Return the reader for the object at an offset.
+	Objects before that offset have been read some other way and are dropped.
+	Args:		inOffset
+	Return:	reader, which the caller must delete; NULL if not scanned
+----------------------------------------------------------------------------- */
+
+CNSOFReader *
+CNSOFScanner::take(size_t inOffset)
+{
+	for ( ; ; ) {
+		if (!fIsCurrent && !next())
+			return NULL;
+		if (fCurrent.offset > inOffset)
+			// not the start of a scanned object
+			return NULL;
+		fIsCurrent = false;
+		if (fCurrent.offset == inOffset)
+			return fCurrent.reader;
+		delete fCurrent.reader;
+	}
+}
+
+
+/* -----------------------------------------------------------------------------
+	Stop scanning and wait for the scanner to finish, so the data it is
+	scanning can be released.
+----------------------------------------------------------------------------- */
+
+void
+CNSOFScanner::stop(void)
+{
+	fIsStopping = true;
+	if (fIsCurrent) {
+		delete fCurrent.reader;
+		fIsCurrent = false;
+	}
+	while (next()) {
+		delete fCurrent.reader;
+		fIsCurrent = false;
+	}
+}
+
+
+/* -----------------------------------------------------------------------------
+	F u n c t i o n s
+----------------------------------------------------------------------------- */
+
+/* -----------------------------------------------------------------------------
+	Return a slot from a flattened frame, eg a soup entry’s refData.
+	Only falls back to unflattening the whole frame if the data cannot be read
+	piecemeal.
+	Args:		inData			NSOF data
+				inPath			dot-separated slot names
+	Return:	the slot value
+----------------------------------------------------------------------------- */
+
+Ref
+GetFlattenedSlot(NSData * inData, const char * inPath)
+{
+	if (inData.length == 0)
+		return NILREF;
+
+	RefVar value;
+	CNSOFReader reader(inData.bytes, inData.length);
+	if (reader.getSlot(inPath, value))
+		return value;
+
+	CPtrPipe pipe;
+	pipe.init((void *)inData.bytes, inData.length, NO, NULL);
+	value = UnflattenRef(pipe);
+	return GetSlotPath(value, inPath);
+}
+
+
+static bool
+ReadXLong(const unsigned char * inData, size_t inSize, size_t & ioOffset, ArrayIndex & outValue)
+{
+	if (ioOffset >= inSize)
+		return false;
+	unsigned char b = inData[ioOffset++];
+	if (b < 0xFF) {
+		outValue = b;
+		return true;
+	}
+	if (inSize - ioOffset < 4)
+		return false;
+	const unsigned char * p = inData + ioOffset;
+	outValue = ((ArrayIndex)p[0] << 24) | ((ArrayIndex)p[1] << 16) | ((ArrayIndex)p[2] << 8) | p[3];
+	ioOffset += 4;
+	return true;
+}
+
+
+static void
+YieldText(const unsigned char * inText, ArrayIndex inSize, bool inMustBeText, void (^inBlock)(const UniChar * inText, ArrayIndex inLength))
+{
+	if (inSize < 2 || (inSize & 1) != 0)
+		return;
+	ArrayIndex length = inSize / 2;
+	if (inText[inSize-2] == 0 && inText[inSize-1] == 0)
+		length--;
+	else if (inMustBeText)
+		return;
+	if (inMustBeText) {
+		// any other nul means it’s not a string
+		for (ArrayIndex i = 0; i < length; ++i)
+			if (inText[2*i] == 0 && inText[2*i+1] == 0)
+				return;
+	}
+	if (length > 0)
+		inBlock((const UniChar *)inText, length);
+}
+
+
+static bool
+WalkStrings(const unsigned char * inData, size_t inSize, size_t & ioOffset, void (^inBlock)(const UniChar * inText, ArrayIndex inLength))
+{
+	if (ioOffset >= inSize)
+		return false;
+	unsigned char type = inData[ioOffset++];
+	ArrayIndex count;
+
+	switch (type) {
+	case kNSOFImmediate:
+	case kNSOFPrecedent:
+		return ReadXLong(inData, inSize, ioOffset, count);
+
+	case kNSOFCharacter:
+		ioOffset += 1;
+		return ioOffset <= inSize;
+
+	case kNSOFUnicodeCharacter:
+	case kNSOFSmallRect:
+		ioOffset += (type == kNSOFSmallRect) ? 4 : 2;
+		return ioOffset <= inSize;
+
+	case kNSOFNIL:
+		return true;
+
+	case kNSOFSymbol:
+	case kNSOFString:
+		if (!ReadXLong(inData, inSize, ioOffset, count) || count > inSize - ioOffset)
+			return false;
+		if (type == kNSOFString)
+			YieldText(inData + ioOffset, count, false, inBlock);
+		ioOffset += count;
+		return true;
+
+	case kNSOFBinaryObject:
+		{
+			size_t classOffset;
+			if (!ReadXLong(inData, inSize, ioOffset, count))
+				return false;
+			classOffset = ioOffset;
+			if (!WalkStrings(inData, inSize, ioOffset, inBlock) || count > inSize - ioOffset)
+				return false;
+			// only binaries classed by symbol can be strings
+			unsigned char classType = inData[classOffset];
+			if (classType == kNSOFSymbol || classType == kNSOFPrecedent)
+				YieldText(inData + ioOffset, count, true, inBlock);
+			ioOffset += count;
+		}
+		return true;
+
+	case kNSOFArray:
+		if (!ReadXLong(inData, inSize, ioOffset, count) || !WalkStrings(inData, inSize, ioOffset, inBlock))
+			return false;
+		break;
+
+	case kNSOFPlainArray:
+		if (!ReadXLong(inData, inSize, ioOffset, count))
+			return false;
+		break;
+
+	case kNSOFFrame:
+		if (!ReadXLong(inData, inSize, ioOffset, count) || count > inSize)
+			return false;
+		count *= 2;		// tags, then values
+		break;
+
+	default:
+		// large binaries are not supported
+		return false;
+	}
+
+	if (count > inSize - ioOffset)
+		return false;
+	for (ArrayIndex i = 0; i < count; ++i)
+		if (!WalkStrings(inData, inSize, ioOffset, inBlock))
+			return false;
+	return true;
+}
+
+
+/* -----------------------------------------------------------------------------
+	Walk the strings in flattened NSOF data without building any objects.
+	Besides objects of class 'string, binary objects of other classes that hold
+	nul-terminated Unicode are taken to be strings -- eg 'phone subclasses --
+	since we cannot ask the class hierarchy without making the class symbol.
+	Args:		inData			NSOF data
+				inBlock			called with the big-endian characters of each
+									string, less its terminator
+	Return:	true => the data is well-formed
+----------------------------------------------------------------------------- */
+
+bool
+ForEachFlattenedString(NSData * inData, void (^inBlock)(const UniChar * inText, ArrayIndex inLength))
+{
+	const unsigned char * data = (const unsigned char *)inData.bytes;
+	size_t offset = 0;
+	if (inData.length == 0 || data[offset++] != kNSOFVersion)
+		return false;
+	return WalkStrings(data, inData.length, offset, inBlock);
+}
@@ -12,8 +12,25 @@
 {
 	int cursorId;
 	NCSession *__unsafe_unretained session;
+
+//	batched read-ahead through the cbat protocol extension
+	RefStruct querySoup;
+	RefStruct queryStore;		// signature of the store queried; nil => default store
+	RefStruct querySpec;
+	RefStruct batch;				// array of entries read ahead
+	RefStruct current;			// entry most recently returned from batch
+	int batchId;					// extension cursor id; 0 => not yet opened
+	int batchIndex;				// next entry in batch to return
+	unsigned int batchSize;		// entries to ask for next time
+	int pendingMoves;				// entries returned from batch the dock cursor has not yet moved over
+	BOOL isBatching;
+	BOOL isBatchAtEnd;
+	BOOL isBatchReset;
+	BOOL hasCurrent;
 }
 
+@property (assign) unsigned int readAheadWindow;	// max entries per batch
+
 - (id)	init: (id) inSession;
 - (void)	dealloc;
 - (Ref)	commonCode: (EventType) inCommand reset: (BOOL) inReset;
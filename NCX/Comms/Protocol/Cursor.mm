@@ -8,6 +8,33 @@
 
 #import "Cursor.h"
 
+
+/*------------------------------------------------------------------------------
+	Batched cursors.
+	Stepping through a soup with kDCursorNext costs a round trip per entry.
+	Where the cbat protocol extension can be loaded we open a parallel cursor
+	on the Newton -- on the same soup in the same store as the dock cursor,
+	so both step through the same entries -- and ask it for entries in
+	batches, starting small and doubling up to the read-ahead window so short
+	scans don’t pay for a large transfer. The dock cursor is not moved while entries are served from the
+	batch; before any other positioning command we move it over the entries
+	returned so far and stop batching until the cursor is reset.
+	Devices without the extension (or queries without a soup name, which the
+	extension cannot resolve) use the per-entry commands throughout.
+------------------------------------------------------------------------------*/
+
+#define kDCursorBatch		'cbat'
+
+#define kCursorBatchMin		8
+#define kCursorBatchMax		64
+
+@interface NCCursor ()
+- (Ref)	moveBy: (int) inOffset;
+- (void)	fillBatch;
+- (void)	stopBatching;
+@end
+
+
 /*------------------------------------------------------------------------------
 	N C C u r s o r
 ------------------------------------------------------------------------------*/
@@ -24,6 +51,20 @@
 	{
 		session = (NCSession *) inSession;
 		cursorId = 0;
+		querySoup = NILREF;
+		queryStore = NILREF;
+		querySpec = NILREF;
+		batch = NILREF;
+		current = NILREF;
+		batchId = 0;
+		batchIndex = 0;
+		batchSize = kCursorBatchMin;
+		pendingMoves = 0;
+		isBatching = NO;
+		isBatchAtEnd = NO;
+		isBatchReset = NO;
+		hasCurrent = NO;
+		self.readAheadWindow = kCursorBatchMax;
 	}
 	return self;
 }
@@ -35,6 +76,13 @@
 
 - (void) dealloc
 {
+	if (batchId != 0)
+	{
+		RefVar param(AllocateFrame());
+		SetFrameSlot(param, MakeSymbol("id"), MAKEINT(batchId));
+		SetFrameSlot(param, MakeSymbol("free"), TRUEREF);
+		[session callExtension: kDCursorBatch with: param];
+	}
 	[session sendEvent: kDCursorFree value: cursorId];
 	[session receiveResult];
 }
@@ -55,6 +103,20 @@
 	[session sendEvent: kDQuery ref: param];
 	NCDockEvent * evt = [session receiveEvent: kDLongData];
 	cursorId = evt.value;
+
+	// the extension can only query a named soup
+	if (NOTNIL(inSoupName))
+	{
+		if (session.canBatchCursors == 0)
+			session.canBatchCursors = ([session loadExtension: @"cbat"] == noErr) ? 1 : -1;
+		if (session.canBatchCursors > 0)
+		{
+			querySoup = inSoupName;
+			queryStore = [session currentStoreSignature];
+			querySpec = inSpec;
+			isBatching = YES;
+		}
+	}
 }
 
 
@@ -76,6 +138,8 @@
 
 - (Ref) gotoKey: (RefArg) inKey
 {
+	[self stopBatching];
+
 	unsigned int keySize = (unsigned int)FlattenRefSize(inKey);
 	unsigned int numOfBytes = sizeof(int32_t) + keySize;
 	CPtrPipe pipe;
@@ -100,6 +164,17 @@
 ------------------------------------------------------------------------------*/
 
 - (Ref) move: (int) inOffset
+{
+	[self stopBatching];
+	return [self moveBy: inOffset];
+}
+
+
+/*------------------------------------------------------------------------------
+	Move the dock cursor relative, regardless of batching.
+------------------------------------------------------------------------------*/
+
+- (Ref) moveBy: (int) inOffset
 {
 	int32_t parms[2];
 
@@ -120,6 +195,8 @@
 
 - (Ref) entry
 {
+	if (isBatching && hasCurrent)
+		return current;
 	return [self commonCode: kDCursorEntry reset: NO];
 }
 
@@ -130,6 +207,18 @@
 
 - (Ref) next
 {
+	if (isBatching)
+	{
+		if ((ISNIL(batch) || batchIndex >= Length(batch)) && !isBatchAtEnd)
+			[self fillBatch];
+		if (isBatching)
+		{
+			current = (NOTNIL(batch) && batchIndex < Length(batch)) ? GetArraySlot(batch, batchIndex++) : NILREF;
+			hasCurrent = YES;
+			pendingMoves++;
+			return current;
+		}
+	}
 	return [self commonCode: kDCursorNext reset: NO];
 }
 
@@ -140,6 +229,7 @@
 
 - (Ref) prev
 {
+	[self stopBatching];
 	return [self commonCode: kDCursorPrev reset: NO];
 }
 
@@ -150,6 +240,19 @@
 
 - (Ref) reset
 {
+	if (batchId != 0 || NOTNIL(querySoup))
+	{
+		// the extension cursor is reset with the next batch request
+		batch = NILREF;
+		current = NILREF;
+		batchIndex = 0;
+		batchSize = kCursorBatchMin;
+		pendingMoves = 0;
+		isBatchAtEnd = NO;
+		isBatchReset = (batchId != 0);
+		hasCurrent = NO;
+		isBatching = YES;
+	}
 	return [self commonCode: kDCursorReset reset: YES];
 }
 
@@ -160,6 +263,7 @@
 
 - (Ref) resetToEnd
 {
+	[self stopBatching];
 	return [self commonCode: kDCursorResetToEnd reset: YES];
 }
 
@@ -181,4 +285,77 @@
 }
 
 
+/*------------------------------------------------------------------------------
+	Read the next batch of entries through the cbat extension.
+	Its reply is a frame:
+		{ id: extension cursor id,
+		  entries: [entry, ...],
+		  atEnd: true if the cursor ran out }
+	If anything else comes back we give up batching.
+------------------------------------------------------------------------------*/
+
+- (void) fillBatch
+{
+	RefVar param(AllocateFrame());
+	if (batchId == 0)
+	{
+		if (NOTNIL(queryStore))
+			SetFrameSlot(param, SYMA(signature), queryStore);
+		SetFrameSlot(param, SYMA(soupName), querySoup);
+		SetFrameSlot(param, SYMA(querySpec), querySpec);
+	}
+	else
+	{
+		SetFrameSlot(param, MakeSymbol("id"), MAKEINT(batchId));
+		if (isBatchReset)
+			SetFrameSlot(param, MakeSymbol("reset"), TRUEREF);
+	}
+	SetFrameSlot(param, MakeSymbol("count"), MAKEINT(batchSize));
+
+	NCDockEvent * evt = [session callExtension: kDCursorBatch with: param];
+	RefVar result;
+	if (evt.tag == kDCursorBatch)
+		result = evt.ref;
+	if (!IsFrame(result))
+	{
+		// the dock cursor has not moved over anything we returned from the batch so far
+		[self stopBatching];
+		querySoup = NILREF;
+		batchId = 0;
+		return;
+	}
+
+	batchId = RINT(GetFrameSlot(result, MakeSymbol("id")));
+	batch = GetFrameSlot(result, MakeSymbol("entries"));
+	batchIndex = 0;
+	isBatchAtEnd = NOTNIL(GetFrameSlot(result, MakeSymbol("atEnd")));
+	isBatchReset = NO;
+
+	batchSize *= 2;
+	if (batchSize > self.readAheadWindow)
+		batchSize = self.readAheadWindow;
+}
+
+
+/*------------------------------------------------------------------------------
+	Stop serving entries from the batch.
+	Bring the dock cursor up to the entry last returned so that subsequent
+	positioning commands are relative to it.
+------------------------------------------------------------------------------*/
+
+- (void) stopBatching
+{
+	if (isBatching)
+	{
+		isBatching = NO;
+		if (pendingMoves != 0)
+			[self moveBy: pendingMoves];
+		pendingMoves = 0;
+		batch = NILREF;
+		current = NILREF;
+		hasCurrent = NO;
+	}
+}
+
+
 @end
@@ -38,6 +38,8 @@
 @interface NCSession : NSObject
 
 @property (assign) BOOL isProtocolActive;
+@property (readonly) unsigned int numOfUnhandledEvents;	// events received with no registered handler
+@property (assign) int canBatchCursors;	// cbat extension: 0 => not yet loaded, > 0 => loaded, < 0 => unavailable
 
 /* --- Session functions --- */
 
@@ -78,6 +80,7 @@
 - (Ref)			getDefaultStore;
 
 - (NewtonErr)	setCurrentStore:(RefArg)inStore /* if nil, set default store */ info:(BOOL)inSetStoreInfo;
+- (Ref)			currentStoreSignature;
 
 /* --- Store & soup info functions --- */
 
@@ -9,11 +9,15 @@
 					In practice, that means if nothing received for 30s, no?
 */
 
+#import <unordered_map>
+
 #import "Cursor.h"	// > Session.h
 #import "PreferenceKeys.h"
 #import "NCXPlugIn.h"
 #import "NCXErrors.h"
 #import "PlugInUtilities.h"
+#import "Metrics.h"
+#import "Logging.h"
 #import "Newton/PackageParts.h"
 
 
@@ -33,6 +37,22 @@ DeclareException(exBadArgs, exRootException);
 #define kMinutes1904to1970 34714080
 
 
+/*------------------------------------------------------------------------------
+	Event handler dispatch.
+	Resolved once when a component registers, so dispatching an event is a
+	single hash lookup and a direct call -- no selector building per event.
+------------------------------------------------------------------------------*/
+
+struct DockEventHandler
+{
+	id		component;
+	SEL	selector;
+	IMP	imp;
+};
+
+typedef void (*DockEventHandlerIMP)(id, SEL, NCDockEvent *);
+
+
 /*------------------------------------------------------------------------------
 	N C S e s s i o n
 ------------------------------------------------------------------------------*/
@@ -42,12 +62,20 @@ DeclareException(exBadArgs, exRootException);
 	NCDockEventQueue *__weak dockEventQueue;
 
 //	event handlers
-	NSMutableDictionary * eventHandlers;
+	std::unordered_map<EventType, DockEventHandler> eventHandlers;
 	dispatch_queue_t tickleQ;
    dispatch_source_t tickleTimer;
 	BOOL isProtocolActive;
 	int tHexade;
 	int tDelta;
+	BOOL isAwaitingReply;		// for metrics: next event received completes a round trip
+
+//	store set by -setCurrentStore:info:
+	RefStruct currentStoreSignature;	// nil => default store
+
+//	protocol extensions
+	NSMutableDictionary<NSString *, NSData *> * extensionStreams;	// .stream contents by name, read once
+	NSMutableSet<NSNumber *> * registeredExtensions;					// ids the connected device already holds
 }
 - (void)			waitForEvent;
 - (void)			doDockEventLoop;
@@ -72,7 +100,11 @@ DeclareException(exBadArgs, exRootException);
 
 - (id)init {
 	if (self = [super init]) {
-		eventHandlers = [[NSMutableDictionary alloc] initWithCapacity:32];
+		eventHandlers.reserve(64);
+		_numOfUnhandledEvents = 0;
+		extensionStreams = [[NSMutableDictionary alloc] init];
+		registeredExtensions = [[NSMutableSet alloc] init];
+		currentStoreSignature = NILREF;
 		tickleQ = nil;
 		tickleTimer = nil;
 		dockEventQueue = NCDockEventQueue.sharedQueue;
@@ -84,6 +116,9 @@ DeclareException(exBadArgs, exRootException);
 - (void)open {
 	[dockEventQueue open];
 	isProtocolActive = NO;
+	[registeredExtensions removeAllObjects];
+	self.canBatchCursors = 0;
+	currentStoreSignature = NILREF;
 	tHexade = 0;
 	tDelta = 0;
 	[self waitForEvent];
@@ -100,12 +135,13 @@ DeclareException(exBadArgs, exRootException);
 
 - (void)dealloc {
 	[self close];
-	eventHandlers = nil;
+	eventHandlers.clear();
 }
 
 
 /*------------------------------------------------------------------------------
 	Register a dock event handler component.
+	Each tag it handles is mapped to its do_xxxx: method implementation.
 	Args:		inComponent
 	Return:	--
 ------------------------------------------------------------------------------*/
@@ -114,7 +150,15 @@ DeclareException(exBadArgs, exRootException);
 	NSArray * tags = inComponent.eventTags;
 	NSAssert(tags != nil && tags.count > 0, @"no event ids to register");
 	for (NSString * tag in tags) {
-		eventHandlers[tag] = inComponent;	// dictionary retains component
+		NSAssert(tag.length == 4, @"event tag must be 4 chars");
+		EventType cmd = ([tag characterAtIndex:0] << 24) | ([tag characterAtIndex:1] << 16) | ([tag characterAtIndex:2] << 8) | [tag characterAtIndex:3];
+		SEL selector = NSSelectorFromString([NSString stringWithFormat:@"do_%@:", tag]);
+		NSAssert([(id)inComponent respondsToSelector:selector], @"evtHandler does not handle command");
+		DockEventHandler handler;
+		handler.component = inComponent;	// map retains component
+		handler.selector = selector;
+		handler.imp = [(id)inComponent methodForSelector:selector];
+		eventHandlers[cmd] = handler;
 	}
 }
 
@@ -203,25 +247,26 @@ DeclareException(exBadArgs, exRootException);
 		isProtocolActive = NO;
 		[self resetTickler:kDefaultTimeout];
 		evt = [dockEventQueue getNextEvent];
-//		switch (evt.tag), or…
 		if (evt) {
-			NSString * cmd = evt.command;
-			id evtHandler = eventHandlers[cmd];
-			if (evtHandler) {
-				SEL tag = NSSelectorFromString([NSString stringWithFormat:@"do_%@:", cmd]);
-				NSAssert([evtHandler respondsToSelector:tag], @"evtHandler does not handle command");
+			auto handler = eventHandlers.find(evt.tag);
+			if (handler != eventHandlers.end()) {
 				// stop sending kDHello while transaction in progress
 				[self resetTickler:kNoTimeout];
 				isProtocolActive = YES;
-				[evtHandler performSelector:tag withObject:evt];
+				((DockEventHandlerIMP)handler->second.imp)(handler->second.component, handler->second.selector, evt);
+			} else {
+				_numOfUnhandledEvents++;
+MINIMUM_LOG {
+	REPprintf("\n#### no handler for %s (%u unhandled)\n", evt.command.UTF8String, _numOfUnhandledEvents);
+}
 			}
 		}
 	} while (evt);
 }
 
  - (id)eventHandlerFor:(EventType)inCmd {
-	NSString * cmd = [NSString stringWithFormat:@"%c%c%c%c", (inCmd >> 24) & 0xFF, (inCmd >> 16) & 0xFF, (inCmd >> 8) & 0xFF, inCmd & 0xFF];
-	return eventHandlers[cmd];
+	auto handler = eventHandlers.find(inCmd);
+	return handler != eventHandlers.end() ? handler->second.component : nil;
 }
 
 
@@ -247,6 +292,39 @@ DeclareException(exBadArgs, exRootException);
 }
 
 
+/*------------------------------------------------------------------------------
+	Does the Newton answer a command we send?
+	Replies to the Newton’s own requests, and the few commands it never
+	answers, don’t start a round trip.
+	Args:		inCmd
+	Return:	YES => a reply will follow
+------------------------------------------------------------------------------*/
+
+static BOOL
+ExpectsReply(EventType inCmd) {
+	switch (inCmd) {
+	case kDResult:
+	case kDHello:
+	case kDDisconnect:
+	case kDOperationDone:
+	case kDOpCanceledAck:
+	case kDDesktopInControl:
+	case kDKeyboardChar:
+	case kDKeyboardString:
+	// answers to browsing and importing the Newton started
+	case kDPath:
+	case kDFilesAndFolders:
+	case kDFileInfo:
+	case kDAliasResolved:
+	case kDDevices:
+	case kDFilters:
+	case kDTranslatorList:
+		return NO;
+	}
+	return YES;
+}
+
+
 /*------------------------------------------------------------------------------
 	Send an event over the endpoint.
 	Args:		inCmd
@@ -255,19 +333,19 @@ DeclareException(exBadArgs, exRootException);
 ------------------------------------------------------------------------------*/
 
 - (NewtonErr)sendEvent:(EventType)inCmd
-{ [self resetTickler:kDefaultTimeout]; return [dockEventQueue sendEvent:inCmd]; }
+{ [self resetTickler:kDefaultTimeout]; isAwaitingReply = ExpectsReply(inCmd); return [dockEventQueue sendEvent:inCmd]; }
 
 - (NewtonErr)sendEvent:(EventType)inCmd value:(int)inValue
-{ [self resetTickler:kDefaultTimeout]; return [dockEventQueue sendEvent:inCmd value:inValue]; }
+{ [self resetTickler:kDefaultTimeout]; isAwaitingReply = ExpectsReply(inCmd); return [dockEventQueue sendEvent:inCmd value:inValue]; }
 
 - (NewtonErr)sendEvent:(EventType)inCmd ref:(RefArg)inRef
-{ [self resetTickler:kDefaultTimeout]; return [dockEventQueue sendEvent:inCmd ref:inRef]; }
+{ [self resetTickler:kDefaultTimeout]; isAwaitingReply = ExpectsReply(inCmd); return [dockEventQueue sendEvent:inCmd ref:inRef]; }
 
 - (NewtonErr)sendEvent:(EventType)inCmd data:(const void *)inData length:(unsigned int)inLength
-{ [self resetTickler:kDefaultTimeout]; return [dockEventQueue sendEvent:inCmd length:inLength data:inData length:inLength]; }
+{ [self resetTickler:kDefaultTimeout]; isAwaitingReply = ExpectsReply(inCmd); return [dockEventQueue sendEvent:inCmd length:inLength data:inData length:inLength]; }
 
 - (NewtonErr)sendEvent:(EventType)inCmd length:(unsigned int)inLength data:(const void *)inData length:(unsigned int)inDataLength
-{ [self resetTickler:kDefaultTimeout]; return [dockEventQueue sendEvent:inCmd length:inLength data:inData length:inDataLength]; }
+{ [self resetTickler:kDefaultTimeout]; isAwaitingReply = ExpectsReply(inCmd); return [dockEventQueue sendEvent:inCmd length:inLength data:inData length:inDataLength]; }
 
 
 /*------------------------------------------------------------------------------
@@ -304,12 +382,18 @@ DeclareException(exBadArgs, exRootException);
 - (NCDockEvent *) receiveEvent: (EventType) inCmd
 {
 	NCDockEvent * evt;
+	uint64_t startTime = MetricsNow();
 	do {
 		// -receiveEvent is only ever called within a protocol exchange
 		// so we should NOT reset the tickler
 		// [self resetTickler: kDefaultTimeout];
 		evt = [dockEventQueue getNextEvent];
 	} while (evt && evt.tag == kDHello);
+	MetricsTime(kMetricsLink, startTime);
+	if (isAwaitingReply) {
+		MetricsCount(kMetricsRoundTrips);
+		isAwaitingReply = NO;
+	}
 
 	if (evt == nil)
 	{
@@ -504,6 +588,7 @@ NSLog(@"-[NCSession receiveEvent:] nil event");
 	if (ISNIL(inStore))
 	{
 		[self sendEvent: kDSetStoreToDefault];
+		currentStoreSignature = NILREF;
 	}
 	else
 	{
@@ -515,11 +600,24 @@ NSLog(@"-[NCSession receiveEvent:] nil event");
 			SetFrameSlot(store, SYMA(info), GetFrameSlot(inStore, SYMA(info)));
 
 		[self sendEvent: kDSetCurrentStore ref: store];
+		currentStoreSignature = GetFrameSlot(inStore, SYMA(signature));
 	}
 	return [self receiveResult];
 }
 
 
+/*------------------------------------------------------------------------------
+	Return the signature of the store last set on the Newton device.
+	Args:		--
+	Return:	signature; nil => default store
+------------------------------------------------------------------------------*/
+
+- (Ref) currentStoreSignature
+{
+	return currentStoreSignature;
+}
+
+
 #pragma mark Soup Info
 /*------------------------------------------------------------------------------
 	Return an array of arrays describing the soups on the current store
@@ -940,18 +1038,39 @@ NSLog(@"-[NCSession receiveEvent:] nil event");
 #pragma mark Protocol Extensions
 /*------------------------------------------------------------------------------
 	Load a protocol extension.
-	Args:		inId
-				inFunc
+	The .stream file is read from the bundle once and kept; the extension is
+	sent to the device once per connection -- components can ask for it every
+	time they run.
+	Args:		inExtensionName	name of .stream resource
 	Return:	load result
 ------------------------------------------------------------------------------*/
 
 - (NewtonErr) loadExtension: (NSString *) inExtensionName
 {
-	NSURL * url = [[NSBundle mainBundle] URLForResource: inExtensionName withExtension: @"stream"];
-	// files MUST be prefixed w/ (int32_t) extensionId
+	NSData * stream = extensionStreams[inExtensionName];
+	if (stream == nil)
+	{
+		NSURL * url = [[NSBundle mainBundle] URLForResource: inExtensionName withExtension: @"stream"];
+		if (url)
+			stream = [NSData dataWithContentsOfURL: url];
+		// files MUST be prefixed w/ (int32_t) extensionId
+		if (stream == nil || stream.length < sizeof(int32_t))
+			return kDockErrFileNotFound;
+		extensionStreams[inExtensionName] = stream;
+	}
+
+	NSNumber * extensionId = [NSNumber numberWithUnsignedInt: CANONICAL_LONG(*(const uint32_t *)stream.bytes)];
+	if ([registeredExtensions containsObject: extensionId])
+		return noErr;
+
 	[self resetTickler: kDefaultTimeout];
-	[dockEventQueue sendEvent: kDRegProtocolExtension file: url callback: nil frequency: 0];
-	return [self receiveResult];
+	[dockEventQueue sendEvent: kDRegProtocolExtension data: stream.bytes length: (unsigned int)stream.length callback: nil frequency: 0];
+	NewtonErr err = [self receiveResult];
+	if (err == kDockErrProtocolExtAlreadyRegistered)
+		err = noErr;
+	if (err == noErr)
+		[registeredExtensions addObject: extensionId];
+	return err;
 }
 
 
@@ -987,6 +1106,7 @@ NSLog(@"-[NCSession receiveEvent:] nil event");
 {
 	ASSERT(inId != 0);
 
+	[registeredExtensions removeObject: [NSNumber numberWithUnsignedInt: inId]];
 	[self sendEvent: kDRemoveProtocolExtension value: inId];
 	return [self receiveResult];
 }
@@ -0,0 +1,110 @@
+/*
+	File:		Simulator.h
+
+	Contains:	Headless Newton device simulator interface.
+					NCNewtonSimulator speaks the Newton side of the Dock protocol, so
+					backup, restore, package install and sync can be load-tested without
+					hardware. It serves synthetic soups over any of the transports the
+					desktop listens on:
+						TCP/IP			connects to the desktop’s TCPIPEndpoint
+						Einstein FIFO	opens the named pipe pair EinsteinEndpoint listens on
+						pty				MNP-framed; point the desktop’s SerialPort at the slave
+					Latency, bandwidth and frame loss can be injected on the link.
+
+	Written by:	Newton Research Group, 2026.
+*/
+
+#import <Foundation/Foundation.h>
+
+#import "Comms.h"
+
+
+/* -----------------------------------------------------------------------------
+	Configuration keys.
+	The simulator is scripted by a dictionary (eg read from a plist):
+		newtonName		NSString			user name reported in kDNewtonName
+		stores			NSNumber			number of stores; default 1
+		soups				NSNumber			number of soups per store; default 4
+		entries			NSNumber			number of entries per soup; default 100
+		entrySize		NSNumber			size of binary payload in each entry; default 256
+		latency			NSNumber			ms added before each write; default 0
+		bitRate			NSNumber			link speed in bits/s; 0 => unlimited
+		frameLoss		NSNumber			probability 0..1 an MNP frame is corrupted in transit
+		actions			NSArray			Newton-initiated operations, run in turn whenever
+												the session is idle: @"backup", @"idle", @"disconnect"
+		host				NSString			desktop to connect to over TCP/IP; default localhost
+		port				NSNumber			its port; default kNewtonDockServicePort
+----------------------------------------------------------------------------- */
+
+#define kSimNewtonName		@"newtonName"
+#define kSimStores			@"stores"
+#define kSimSoups				@"soups"
+#define kSimEntries			@"entries"
+#define kSimEntrySize		@"entrySize"
+#define kSimLatency			@"latency"
+#define kSimBitRate			@"bitRate"
+#define kSimFrameLoss		@"frameLoss"
+#define kSimActions			@"actions"
+#define kSimHost				@"host"
+#define kSimPort				@"port"
+
+
+/* -----------------------------------------------------------------------------
+	N C S i m u l a t o r S t a t s
+----------------------------------------------------------------------------- */
+
+struct NCSimulatorStats
+{
+	unsigned int	numOfEventsIn;
+	unsigned int	numOfEventsOut;
+	uint64_t			numOfBytesIn;
+	uint64_t			numOfBytesOut;
+	unsigned int	numOfEntriesSent;
+	unsigned int	numOfEntriesReceived;
+	unsigned int	numOfFramesDropped;
+	unsigned int	numOfRetransmits;
+};
+
+
+/* -----------------------------------------------------------------------------
+	N C N e w t o n S i m u l a t o r
+----------------------------------------------------------------------------- */
+
+@interface NCNewtonSimulator : NSObject
+
+@property(nonatomic,assign) unsigned int latency;		// ms
+@property(nonatomic,assign) unsigned int bitRate;		// bits/s
+@property(nonatomic,assign) double frameLoss;			// 0..1
+@property(nonatomic,readonly) struct NCSimulatorStats stats;
+
+- (id)initWithConfiguration:(NSDictionary *)inConfig;
+
+- (NCError)connectTCP:(NSString *)inHost port:(int)inPort;
+- (NCError)connectEinstein;
+- (NCError)connectPTY:(NSString *__strong *)outSlavePath;
+
+- (NCError)run;		// blocks until disconnected -- dispatch it to a background queue
+- (void)stop;
+
+@end
+
+
+/* -----------------------------------------------------------------------------
+	Run the app as a simulated Newton instead of as the desktop, eg
+		NCX.app/Contents/MacOS/NCX -Simulator ~/Simulator.plist
+	It connects over TCP/IP to the desktop (another instance of the app), runs
+	the plist’s actions, and exits when the session ends. Any value of Simulator
+	that is not a .plist path, eg YES, uses the default configuration.
+	Running in its own process keeps the simulator’s Newton heap apart from the
+	desktop’s.
+----------------------------------------------------------------------------- */
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+extern int	SimulatorMain(NSString * inConfig);
+
+#if defined(__cplusplus)
+}
+#endif
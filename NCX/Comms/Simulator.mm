@@ -0,0 +1,1161 @@
+/*
+	File:		Simulator.mm
+
+	Contains:	Headless Newton device simulator implementation.
+
+	Written by:	Newton Research Group, 2026.
+*/
+
+#import <sys/select.h>
+#import <sys/socket.h>
+#import <netinet/in.h>
+#import <arpa/inet.h>
+#import <netdb.h>
+#import <termios.h>
+#import <fcntl.h>
+
+#import "Simulator.h"
+#import "NewtonKit.h"
+#import "DockEventQueue.h"
+#import "DockErrors.h"
+#import "EthernetEndpoint.h"
+#import "CRC.h"
+#import "DES.h"
+#import "PlugInUtilities.h"
+#import "PreferenceKeys.h"
+#import "Logging.h"
+
+extern "C" int REPprintf(const char * inFormat, ...);
+
+#define kMinutes1904to1970 34714080
+
+// bulk soup dump protocol extension, as BackupComponent uses it
+#define kDBulkSoupDump	'bdmp'
+#define kDBulkEntries	'bent'
+#define kDBulkIds		'bids'
+
+
+/* -----------------------------------------------------------------------------
+	M N P   c o n s t a n t s
+	As in MNPSerialEndpoint, but from the Newton side of the link: we initiate
+	negotiation and we use the same fixed LT/LA header layouts.
+----------------------------------------------------------------------------- */
+
+enum
+{
+	kLRType = 1,
+	kLDType,
+	kLxType,
+	kLTType,
+	kLAType
+};
+
+static const unsigned char kSimLRPacket[] =
+{
+	23, kLRType,
+	0x02,
+	0x01, 0x06, 0x01, 0x00, 0x00, 0x00, 0x00, 0xFF,
+	0x02, 0x01, 0x02,
+	0x03, 0x01, 0x01,
+	0x04, 0x02, 0x40, 0x00,
+	0x08, 0x01, 0x03
+};
+
+#define chSYN	0x16
+#define chDLE	0x10
+#define chSTX	0x02
+#define chETX	0x03
+
+#define kSimPacketSize	256
+
+
+/* -----------------------------------------------------------------------------
+	N C N e w t o n S i m u l a t o r
+----------------------------------------------------------------------------- */
+@interface NCNewtonSimulator ()
+{
+	NSDictionary * config;
+	int rfd, wfd;
+	BOOL isMNP;
+	BOOL isDone;
+
+	// MNP state
+	CRC16 * rFCS;
+	CRC16 * wFCS;
+	int rFrameState;
+	NSMutableData * rPacket;
+	unsigned char wSequence;
+	unsigned char rSequence;
+	NSData * wPendingFrame;
+	BOOL isACKPending;
+
+	// received dock data, not yet built into events
+	NSMutableData * rData;
+
+	// session state
+	SNewtNonce deskNonce;
+	SNewtNonce newtNonce;
+	BOOL isDocked;
+	NSUInteger actionIndex;
+	RefStruct stores;
+	int currentStore;
+	int currentSoup;
+	int nextUniqueId;
+	NSMutableSet<NSNumber *> * extensions;
+}
+- (void)writeBytes:(const void *)inData length:(unsigned int)inLength;
+- (NCError)fillReadBuffer:(int)inTimeoutMs;
+- (void)sendEvent:(EventType)inCmd data:(const void *)inData length:(unsigned int)inLength;
+- (void)sendEvent:(EventType)inCmd value:(int)inValue;
+- (void)sendEvent:(EventType)inCmd ref:(RefArg)inRef;
+- (BOOL)nextEvent:(EventType *)outCmd data:(NSData *__strong *)outData;
+- (void)handleEvent:(EventType)inCmd data:(NSData *)inData;
+@end
+
+
+@implementation NCNewtonSimulator
+
+/*------------------------------------------------------------------------------
+	Initialize instance.
+	Args:		inConfig			see Simulator.h for keys; may be nil
+	Return:	self
+------------------------------------------------------------------------------*/
+
+- (id)initWithConfiguration:(NSDictionary *)inConfig {
+	if (self = [super init]) {
+		config = inConfig ? inConfig : @{};
+		rfd = wfd = -1;
+		self.latency = [config[kSimLatency] unsignedIntValue];
+		self.bitRate = [config[kSimBitRate] unsignedIntValue];
+		self.frameLoss = [config[kSimFrameLoss] doubleValue];
+
+		rFCS = [[CRC16 alloc] init];
+		wFCS = [[CRC16 alloc] init];
+		rPacket = [[NSMutableData alloc] initWithCapacity:kSimPacketSize + 32];
+		rData = [[NSMutableData alloc] init];
+		extensions = [[NSMutableSet alloc] init];
+		memset(&_stats, 0, sizeof(_stats));
+
+		// build the synthetic stores
+		int numOfStores = config[kSimStores] ? [config[kSimStores] intValue] : 1;
+		int numOfSoups = config[kSimSoups] ? [config[kSimSoups] intValue] : 4;
+		stores = MakeArray(0);
+		for (int i = 0; i < numOfStores; ++i) {
+			RefVar store(AllocateFrame());
+			char name[32];
+			snprintf(name, sizeof(name), i == 0 ? "Internal" : "Card %d", i);
+			SetFrameSlot(store, SYMA(name), MakeStringFromCString(name));
+			SetFrameSlot(store, SYMA(kind), MakeStringFromCString(i == 0 ? "Internal" : "Flash"));
+			SetFrameSlot(store, SYMA(signature), MAKEINT(0x10000 + i));
+			SetFrameSlot(store, MakeSymbol("readOnly"), NILREF);
+			RefVar soupNames(MakeArray(numOfSoups));
+			RefVar soupSigs(MakeArray(numOfSoups));
+			for (int j = 0; j < numOfSoups; ++j) {
+				snprintf(name, sizeof(name), "Sim Soup %d", j);
+				SetArraySlot(soupNames, j, MakeStringFromCString(name));
+				SetArraySlot(soupSigs, j, MAKEINT(0x20000 + j));
+			}
+			SetFrameSlot(store, SYMA(soups), soupNames);
+			SetFrameSlot(store, MakeSymbol("signatures"), soupSigs);
+			AddArraySlot(stores, store);
+		}
+		nextUniqueId = [self numOfEntries];
+	}
+	return self;
+}
+
+
+- (void)dealloc {
+	[self stop];
+}
+
+
+- (int)numOfEntries {
+	return config[kSimEntries] ? [config[kSimEntries] intValue] : 100;
+}
+
+
+#pragma mark Transports
+/*------------------------------------------------------------------------------
+	Connect to the desktop’s TCP/IP endpoint.
+	Dock data is not framed over TCP.
+	Args:		inHost			nil => localhost
+				inPort			0 => kNewtonDockServicePort
+	Return:	error code
+------------------------------------------------------------------------------*/
+
+- (NCError)connectTCP:(NSString *)inHost port:(int)inPort {
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(inPort ? inPort : kNewtonDockServicePort);
+	struct hostent * host = gethostbyname(inHost ? inHost.UTF8String : "localhost");
+	if (host == NULL) {
+		return kDockErrDisconnected;
+	}
+	memcpy(&addr.sin_addr, host->h_addr, sizeof(addr.sin_addr));
+
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0) {
+		return kDockErrDisconnected;
+	}
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		close(fd);
+		return kDockErrDisconnected;
+	}
+	rfd = wfd = fd;
+	isMNP = NO;
+	return noErr;
+}
+
+
+/*------------------------------------------------------------------------------
+	Connect to the desktop’s Einstein endpoint.
+	The pipes are named from Einstein’s point of view, so we write to
+	ExtrSerPortSend and read from ExtrSerPortRecv. Data is MNP framed.
+	Args:		--
+	Return:	error code
+------------------------------------------------------------------------------*/
+
+- (NCError)connectEinstein {
+	NSURL * baseURL = [NSFileManager.defaultManager URLForDirectory:NSApplicationSupportDirectory inDomain:NSUserDomainMask appropriateForURL:nil create:YES error:NULL];
+	NSURL * pipeFolder = [baseURL URLByAppendingPathComponent:@"Einstein Emulator" isDirectory:YES];
+	const char * sendPath = [pipeFolder URLByAppendingPathComponent:@"ExtrSerPortSend"].fileSystemRepresentation;
+	const char * recvPath = [pipeFolder URLByAppendingPathComponent:@"ExtrSerPortRecv"].fileSystemRepresentation;
+
+	if ((wfd = open(sendPath, O_RDWR | O_NOCTTY | O_NONBLOCK)) == -1
+	||  (rfd = open(recvPath, O_RDWR | O_NOCTTY | O_NONBLOCK)) == -1) {
+		REPprintf("Simulator: can’t open Einstein pipes - %s (%d). Is the desktop listening?\n", strerror(errno), errno);
+		[self stop];
+		return kDockErrDisconnected;
+	}
+	isMNP = YES;
+	return noErr;
+}
+
+
+/*------------------------------------------------------------------------------
+	Open a pseudo-terminal and talk MNP over it.
+	Args:		outSlavePath	path of the slave device the desktop should open
+	Return:	error code
+------------------------------------------------------------------------------*/
+
+- (NCError)connectPTY:(NSString *__strong *)outSlavePath {
+	int fd = posix_openpt(O_RDWR | O_NOCTTY);
+	if (fd < 0 || grantpt(fd) != 0 || unlockpt(fd) != 0) {
+		if (fd >= 0) {
+			close(fd);
+		}
+		return kDockErrDisconnected;
+	}
+	struct termios attrs;
+	tcgetattr(fd, &attrs);
+	cfmakeraw(&attrs);
+	tcsetattr(fd, TCSANOW, &attrs);
+
+	*outSlavePath = [NSString stringWithUTF8String:ptsname(fd)];
+	rfd = wfd = fd;
+	isMNP = YES;
+	return noErr;
+}
+
+
+- (void)stop {
+	isDone = YES;
+	if (wfd >= 0 && wfd != rfd) {
+		close(wfd);
+	}
+	if (rfd >= 0) {
+		close(rfd);
+	}
+	rfd = wfd = -1;
+}
+
+
+#pragma mark Link
+/*------------------------------------------------------------------------------
+	Write bytes to the link, applying the configured latency and bit rate.
+	Args:		inData
+				inLength
+	Return:	--
+------------------------------------------------------------------------------*/
+
+- (void)writeBytes:(const void *)inData length:(unsigned int)inLength {
+	if (self.latency) {
+		usleep(self.latency * 1000);
+	}
+	const char * p = (const char *)inData;
+	while (inLength > 0 && wfd >= 0) {
+		ssize_t count = write(wfd, p, inLength);
+		if (count < 0) {
+			if (errno == EAGAIN || errno == EINTR) {
+				continue;
+			}
+			isDone = YES;
+			break;
+		}
+		if (self.bitRate) {
+			usleep((useconds_t)((uint64_t)count * 10 * 1000000 / self.bitRate));	// 10 bits per async char
+		}
+		_stats.numOfBytesOut += count;
+		p += count;
+		inLength -= (unsigned int)count;
+	}
+}
+
+
+/*------------------------------------------------------------------------------
+	Build and write an MNP frame.
+	Args:		inHeader			packet header; first byte is its length
+				inData			packet data
+				inLength
+	Return:	the frame, for retransmission
+------------------------------------------------------------------------------*/
+
+- (NSData *)sendFrame:(const unsigned char *)inHeader data:(const unsigned char *)inData length:(unsigned int)inLength {
+	NSMutableData * frame = [NSMutableData dataWithCapacity:(1 + inHeader[0] + inLength)*2 + 8];
+	static const unsigned char kFrameStart[] = { chSYN, chDLE, chSTX };
+	static const unsigned char kFrameEnd[] = { chDLE, chETX };
+	[frame appendBytes:kFrameStart length:sizeof(kFrameStart)];
+	[wFCS reset];
+	for (int part = 0; part < 2; ++part) {
+		const unsigned char * p = part == 0 ? inHeader : inData;
+		unsigned int len = part == 0 ? 1 + inHeader[0] : inLength;
+		for ( ; p != NULL && len > 0; --len, ++p) {
+			[wFCS computeCRC:*p];
+			if (*p == chDLE) {
+				[frame appendBytes:p length:1];
+			}
+			[frame appendBytes:p length:1];
+		}
+	}
+	[frame appendBytes:kFrameEnd length:sizeof(kFrameEnd)];
+	[wFCS computeCRC:chETX];
+	unsigned char fcs[2] = { [wFCS get:0], [wFCS get:1] };
+	[frame appendBytes:fcs length:2];
+
+	if (self.frameLoss > 0.0 && inHeader[1] == kLTType && drand48() < self.frameLoss) {
+		// corrupt the FCS so the desktop NAKs the frame
+		NSMutableData * bad = [frame mutableCopy];
+		((unsigned char *)bad.mutableBytes)[bad.length - 1] ^= 0xFF;
+		[self writeBytes:bad.bytes length:(unsigned int)bad.length];
+		_stats.numOfFramesDropped++;
+	} else {
+		[self writeBytes:frame.bytes length:(unsigned int)frame.length];
+	}
+	return frame;
+}
+
+
+- (void)sendAck:(unsigned char)inSequence {
+	unsigned char header[] = { 3, kLAType, inSequence, 1 };
+	[self sendFrame:header data:NULL length:0];
+}
+
+
+/*------------------------------------------------------------------------------
+	Handle a complete received MNP packet.
+	Args:		--
+	Return:	--
+------------------------------------------------------------------------------*/
+
+- (void)processPacket {
+	const unsigned char * p = (const unsigned char *)rPacket.bytes;
+	if (rPacket.length < 2) {
+		return;
+	}
+	switch (p[1]) {
+	case kLRType:
+		// desktop has responded to our LR: acknowledge it, and the link is up
+		[self sendAck:0];
+		isACKPending = NO;
+		break;
+	case kLDType:
+		isDone = YES;
+		break;
+	case kLTType:
+		if (p[2] != rSequence) {
+			rSequence = p[2];
+			unsigned int headerLen = 1 + p[0];
+			[rData appendBytes:p + headerLen length:rPacket.length - headerLen];
+		}
+		[self sendAck:rSequence];
+		break;
+	case kLAType:
+		if (p[3] != 0) {
+			isACKPending = NO;
+			wPendingFrame = nil;
+		} else if (wPendingFrame) {
+			_stats.numOfRetransmits++;
+			[self writeBytes:wPendingFrame.bytes length:(unsigned int)wPendingFrame.length];
+		}
+		break;
+	}
+}
+
+
+/*------------------------------------------------------------------------------
+	Unframe MNP data -- same FSM as -[MNPSerialEndpoint unframePacket:].
+	Args:		inData
+				inLength
+	Return:	--
+------------------------------------------------------------------------------*/
+
+- (void)unframe:(const unsigned char *)inData length:(unsigned int)inLength {
+	for ( ; inLength > 0; --inLength, ++inData) {
+		unsigned char ch = *inData;
+		switch (rFrameState) {
+		case 0:
+			if (ch == chSYN) {
+				rFrameState = 1;
+			}
+			break;
+		case 1:
+			rFrameState = (ch == chDLE) ? 2 : 0;
+			break;
+		case 2:
+			if (ch == chSTX) {
+				rPacket.length = 0;
+				[rFCS reset];
+				rFrameState = 3;
+			} else {
+				rFrameState = 0;
+			}
+			break;
+		case 3:
+			if (ch == chDLE) {
+				rFrameState = 4;
+			} else {
+				[rPacket appendBytes:&ch length:1];
+				[rFCS computeCRC:ch];
+			}
+			break;
+		case 4:
+			if (ch == chETX) {
+				[rFCS computeCRC:ch];
+				rFrameState = 5;
+			} else {
+				// escaped DLE
+				[rPacket appendBytes:&ch length:1];
+				[rFCS computeCRC:ch];
+				rFrameState = 3;
+			}
+			break;
+		case 5:
+			rFrameState = (ch == [rFCS get:0]) ? 6 : 0;
+			break;
+		case 6:
+			rFrameState = 0;
+			if (ch == [rFCS get:1]) {
+				[self processPacket];
+			}
+			break;
+		}
+	}
+}
+
+
+/*------------------------------------------------------------------------------
+	Read whatever is available from the link into rData.
+	Args:		inTimeoutMs		-1 => wait indefinitely
+	Return:	noErr, kCommsPartialData on timeout, or kDockErrDisconnected
+------------------------------------------------------------------------------*/
+
+- (NCError)fillReadBuffer:(int)inTimeoutMs {
+	fd_set rfds;
+	struct timeval tv;
+	FD_ZERO(&rfds);
+	FD_SET(rfd, &rfds);
+	tv.tv_sec = inTimeoutMs / 1000;
+	tv.tv_usec = (inTimeoutMs % 1000) * 1000;
+	int nfds = select(rfd + 1, &rfds, NULL, NULL, inTimeoutMs < 0 ? NULL : &tv);
+	if (nfds == 0) {
+		return kCommsPartialData;
+	}
+	if (nfds < 0) {
+		return errno == EINTR ? kCommsPartialData : kDockErrDisconnected;
+	}
+
+	unsigned char buf[1024];
+	ssize_t count = read(rfd, buf, sizeof(buf));
+	if (count <= 0) {
+		if (count < 0 && errno == EAGAIN) {
+			return kCommsPartialData;
+		}
+		return kDockErrDisconnected;
+	}
+	_stats.numOfBytesIn += count;
+	if (isMNP) {
+		[self unframe:buf length:(unsigned int)count];
+	} else {
+		[rData appendBytes:buf length:count];
+	}
+	return isDone ? kDockErrDisconnected : noErr;
+}
+
+
+/*------------------------------------------------------------------------------
+	Send data over MNP: one LT packet at a time, waiting for each to be ACKed
+	(the desktop negotiates a window of 1).
+	Args:		inData
+				inLength
+	Return:	--
+------------------------------------------------------------------------------*/
+
+- (void)writeData:(const void *)inData length:(unsigned int)inLength {
+	if (!isMNP) {
+		[self writeBytes:inData length:inLength];
+		return;
+	}
+	const unsigned char * p = (const unsigned char *)inData;
+	while (inLength > 0 && !isDone) {
+		unsigned int count = MIN(inLength, kSimPacketSize);
+		unsigned char header[] = { 2, kLTType, ++wSequence };
+		isACKPending = YES;
+		wPendingFrame = [self sendFrame:header data:p length:count];
+		while (isACKPending && !isDone) {
+			if ([self fillReadBuffer:kDefaultTimeout * 1000] == kDockErrDisconnected) {
+				isDone = YES;
+			}
+		}
+		p += count;
+		inLength -= count;
+	}
+}
+
+
+#pragma mark Events
+/*------------------------------------------------------------------------------
+	Send a dock event.
+	Args:		inCmd
+				inData
+				inLength
+	Return:	--
+------------------------------------------------------------------------------*/
+
+- (void)sendEvent:(EventType)inCmd data:(const void *)inData length:(unsigned int)inLength {
+	NSMutableData * evt = [NSMutableData dataWithLength:sizeof(DockEventHeader) + LONGALIGN(inLength)];
+	DockEventHeader * header = (DockEventHeader *)evt.mutableBytes;
+	header->evtClass = CANONICAL_LONG(kNewtEventClass);
+	header->evtId = CANONICAL_LONG(kDockEventId);
+	header->tag = CANONICAL_LONG(inCmd);
+	header->length = CANONICAL_LONG(inLength);
+	if (inLength > 0) {
+		memcpy(header+1, inData, inLength);
+	}
+	[self writeData:evt.bytes length:(unsigned int)evt.length];
+	_stats.numOfEventsOut++;
+}
+
+
+- (void)sendEvent:(EventType)inCmd value:(int)inValue {
+	int32_t value = CANONICAL_LONG(inValue);
+	[self sendEvent:inCmd data:&value length:sizeof(value)];
+}
+
+
+- (void)sendEvent:(EventType)inCmd ref:(RefArg)inRef {
+	NSMutableData * data = [NSMutableData dataWithLength:FlattenRefSize(inRef)];
+	CPtrPipe pipe;
+	pipe.init(data.mutableBytes, data.length, NO, NULL);
+	FlattenRef(inRef, pipe);
+	[self sendEvent:inCmd data:data.bytes length:(unsigned int)data.length];
+}
+
+
+- (void)sendEvent:(EventType)inCmd ref:(RefArg)inRef1 ref:(RefArg)inRef2 {
+	size_t size1 = FlattenRefSize(inRef1);
+	NSMutableData * data = [NSMutableData dataWithLength:size1 + FlattenRefSize(inRef2)];
+	CPtrPipe pipe;
+	pipe.init(data.mutableBytes, size1, NO, NULL);
+	FlattenRef(inRef1, pipe);
+	pipe.init((char *)data.mutableBytes + size1, data.length - size1, NO, NULL);
+	FlattenRef(inRef2, pipe);
+	[self sendEvent:inCmd data:data.bytes length:(unsigned int)data.length];
+}
+
+
+/*------------------------------------------------------------------------------
+	Extract the next complete dock event from rData.
+	An event of indeterminate length (eg kDCallGlobalFunction) is complete when
+	the link goes quiet.
+	Args:		outCmd
+				outData
+	Return:	YES => an event was extracted
+------------------------------------------------------------------------------*/
+
+- (BOOL)nextEvent:(EventType *)outCmd data:(NSData *__strong *)outData {
+	static const char kDockHeader[8] = { 'n','e','w','t', 'd','o','c','k' };
+	const char * p = (const char *)rData.bytes;
+	NSUInteger len = rData.length;
+
+	// scan for start-of-event
+	NSUInteger start = 0;
+	while (start + 16 <= len && memcmp(p + start, kDockHeader, 8) != 0) {
+		start++;
+	}
+	if (start + 16 > len) {
+		return NO;
+	}
+	const DockEventHeader * header = (const DockEventHeader *)(p + start);
+	uint32_t dataLen = CANONICAL_LONG(header->length);
+	NSUInteger dataStart = start + sizeof(DockEventHeader);
+	NSUInteger eventEnd;
+	if (dataLen == kIndeterminateLength) {
+		if ([self fillReadBuffer:100] != kCommsPartialData) {
+			return NO;	// more data arrived; try again
+		}
+		p = (const char *)rData.bytes;
+		len = rData.length;
+		header = (const DockEventHeader *)(p + start);
+		dataLen = (uint32_t)(len - dataStart);
+		eventEnd = len;
+	} else {
+		eventEnd = dataStart + LONGALIGN(dataLen);
+		if (eventEnd > len) {
+			return NO;
+		}
+	}
+	*outCmd = CANONICAL_LONG(header->tag);
+	*outData = [NSData dataWithBytes:p + dataStart length:dataLen];
+	[rData replaceBytesInRange:NSMakeRange(0, eventEnd) withBytes:NULL length:0];
+	_stats.numOfEventsIn++;
+	return YES;
+}
+
+
+static int
+ValueOf(NSData * inData) {
+	return inData.length >= sizeof(int32_t) ? CANONICAL_LONG(*(const int32_t *)inData.bytes) : 0;
+}
+
+static Ref
+RefOf(NSData * inData, size_t inOffset = 0) {
+	if (inData.length <= inOffset) {
+		return NILREF;
+	}
+	CPtrPipe pipe;
+	pipe.init((char *)inData.bytes + inOffset, inData.length - inOffset, NO, NULL);
+	return UnflattenRef(pipe);
+}
+
+static int
+NewtonTime(void) {
+	return kMinutes1904to1970 + (int)(time(NULL)/60);
+}
+
+
+#pragma mark Session
+/*------------------------------------------------------------------------------
+	Run the simulated device.
+	Request docking, then answer desktop commands; when the link is idle, run
+	the next scripted Newton-initiated action.
+	Args:		--
+	Return:	error code
+------------------------------------------------------------------------------*/
+
+- (NCError)run {
+	NCError err = noErr;
+	isDone = NO;
+	isDocked = NO;
+	actionIndex = 0;
+	srand48(time(NULL));
+
+	if (isMNP) {
+		// negotiate the link
+		isACKPending = YES;
+		wSequence = rSequence = 0;
+		[self sendFrame:kSimLRPacket data:NULL length:0];
+		while (isACKPending && !isDone) {
+			if ((err = [self fillReadBuffer:kDefaultTimeout * 1000]) != noErr) {
+				isDone = YES;
+			}
+		}
+	}
+
+	[self sendEvent:kDRequestToDock value:kBaseProtocolVersion];
+
+	newton_try
+	{
+		while (!isDone) {
+			EventType cmd;
+			NSData * data;
+			while (!isDone && [self nextEvent:&cmd data:&data]) {
+				[self handleEvent:cmd data:data];
+			}
+			if (isDone) {
+				break;
+			}
+			err = [self fillReadBuffer:1000];
+			if (err == kCommsPartialData) {
+				err = noErr;
+				if (isDocked) {
+					// link is idle -- do the next thing
+					NSArray * actions = config[kSimActions];
+					if (actionIndex < actions.count) {
+						NSString * action = actions[actionIndex++];
+						if ([action isEqualToString:@"backup"]) {
+							[self sendEvent:kDRequestToSync data:NULL length:0];
+						} else if ([action isEqualToString:@"disconnect"]) {
+							[self sendEvent:kDDisconnect data:NULL length:0];
+							isDone = YES;
+						}
+					}
+				}
+			} else if (err) {
+				isDone = YES;
+			}
+		}
+	}
+	newton_catch_all
+	{
+		err = (NCError)(long)CurrentException()->data;
+		REPprintf("Simulator: exception %s (%d).\n", CurrentException()->name, err);
+	}
+	end_try;
+
+MINIMUM_LOG {
+	REPprintf("Simulator: %u events in, %u out; %llu bytes in, %llu out; %u entries sent, %u received; %u frames dropped, %u retransmits.\n",
+				_stats.numOfEventsIn, _stats.numOfEventsOut, _stats.numOfBytesIn, _stats.numOfBytesOut,
+				_stats.numOfEntriesSent, _stats.numOfEntriesReceived, _stats.numOfFramesDropped, _stats.numOfRetransmits);
+}
+	[self stop];
+	return err == kDockErrDisconnected ? noErr : err;
+}
+
+
+/*------------------------------------------------------------------------------
+	Make a synthetic soup entry.
+	Args:		inSoup			soup index
+				inId				entry’s unique id
+	Return:	entry frame
+------------------------------------------------------------------------------*/
+
+- (Ref)makeEntry:(int)inSoup id:(int)inId {
+	unsigned int entrySize = config[kSimEntrySize] ? [config[kSimEntrySize] unsignedIntValue] : 256;
+	char title[64];
+	snprintf(title, sizeof(title), "Simulated entry %d in soup %d", inId, inSoup);
+
+	RefVar entry(AllocateFrame());
+	SetFrameSlot(entry, MakeSymbol("class"), MakeSymbol("paragraph"));
+	SetFrameSlot(entry, MakeSymbol("title"), MakeStringFromCString(title));
+	SetFrameSlot(entry, MakeSymbol("labels"), NILREF);
+	RefVar payload(AllocateBinary(MakeSymbol("samples"), entrySize));
+	unsigned char * p = (unsigned char *)BinaryData(payload);
+	for (unsigned int i = 0; i < entrySize; ++i) {
+		p[i] = (unsigned char)(inId + i);
+	}
+	SetFrameSlot(entry, MakeSymbol("data"), payload);
+	SetFrameSlot(entry, SYMA(_uniqueId), MAKEINT(inId));
+	SetFrameSlot(entry, SYMA(_modTime), MAKEINT(NewtonTime()));
+	return entry;
+}
+
+
+/*------------------------------------------------------------------------------
+	Stream the current soup’s entries.
+	Args:		inLastBackupId	entries with ids above this are sent in full;
+										-1 => send all and no id list (kDSendSoup)
+	Return:	--
+------------------------------------------------------------------------------*/
+
+- (void)sendSoup:(int)inLastBackupId {
+	int numOfEntries = [self numOfEntries];
+	for (int uid = 0; uid < numOfEntries && !isDone; ++uid) {
+		if (uid > inLastBackupId) {
+			RefVar entry([self makeEntry:currentSoup id:uid]);
+			[self sendEvent:kDEntry ref:entry];
+			_stats.numOfEntriesSent++;
+		}
+	}
+	if (inLastBackupId >= 0 && numOfEntries > 0) {
+		// encode all ids as runs: base, then {0, -(n-1)} per block of 32K
+		for (int base = 0; base < numOfEntries; base += 0x8000) {
+			int run = MIN(numOfEntries - base, 0x8000);
+			int16_t ids[3];
+			ids[0] = CANONICAL_SHORT(0);
+			ids[1] = CANONICAL_SHORT((int16_t)-(run - 1));
+			ids[2] = CANONICAL_SHORT((int16_t)0x8000);
+			[self sendEvent:kDSetBaseID value:base];
+			[self sendEvent:kDBackupIDs data:ids length:sizeof(ids)];
+		}
+	}
+	[self sendEvent:kDBackupSoupDone data:NULL length:0];
+}
+
+
+/*------------------------------------------------------------------------------
+	Answer the bdmp protocol extension as its NewtonScript would: the soup’s
+	entries in bent batches, then a kDResult. Given lastId, as kDBackupSoup
+	is, only entries with ids above it are sent; the other ids go in bids
+	batches.
+	Args:		inData			flattened {signature:, soupName:, count:, lastId:, since:}
+	Return:	--
+------------------------------------------------------------------------------*/
+
+- (void)dumpSoup:(NSData *)inData {
+	RefVar args(RefOf(inData));
+	RefVar sig(GetFrameSlot(args, SYMA(signature)));
+	NSString * soupName = MakeNSString(GetFrameSlot(args, SYMA(soupName)));
+	RefVar count(GetFrameSlot(args, MakeSymbol("count")));
+	int batchSize = (ISINT(count) && RVALUE(count) > 0) ? (int)RVALUE(count) : 16;
+	RefVar lastIdRef(GetFrameSlot(args, MakeSymbol("lastId")));
+	int lastId = ISINT(lastIdRef) ? (int)RVALUE(lastIdRef) : -1;
+
+	int soup = -1;
+	for (ArrayIndex i = 0; i < Length(stores); ++i) {
+		RefVar store(GetArraySlot(stores, i));
+		if (EQ(GetFrameSlot(store, SYMA(signature)), sig)) {
+			RefVar soupNames(GetFrameSlot(store, SYMA(soups)));
+			for (ArrayIndex j = 0; j < Length(soupNames); ++j) {
+				if ([MakeNSString(GetArraySlot(soupNames, j)) isEqualToString:soupName]) {
+					soup = (int)j;
+				}
+			}
+		}
+	}
+	if (soup < 0) {
+		[self sendEvent:kDResult value:kDockErrSoupNotFound];
+		return;
+	}
+
+	int numOfEntries = [self numOfEntries];
+	RefVar entries(MakeArray(0));
+	RefVar ids(MakeArray(0));
+	for (int uid = 0; uid < numOfEntries && !isDone; ++uid) {
+		if (uid <= lastId) {
+			AddArraySlot(ids, MAKEINT(uid));
+			if (Length(ids) == 1024) {
+				[self sendEvent:kDBulkIds ref:ids];
+				ids = MakeArray(0);
+			}
+			continue;
+		}
+		AddArraySlot(entries, [self makeEntry:soup id:uid]);
+		_stats.numOfEntriesSent++;
+		if (Length(entries) == (ArrayIndex)batchSize) {
+			[self sendEvent:kDBulkEntries ref:entries];
+			entries = MakeArray(0);
+		}
+	}
+	if (Length(entries) > 0) {
+		[self sendEvent:kDBulkEntries ref:entries];
+	}
+	if (Length(ids) > 0) {
+		[self sendEvent:kDBulkIds ref:ids];
+	}
+	[self sendEvent:kDResult value:noErr];
+}
+
+
+/*------------------------------------------------------------------------------
+	Respond to a desktop command.
+	Args:		inCmd
+				inData
+	Return:	--
+------------------------------------------------------------------------------*/
+
+- (void)handleEvent:(EventType)inCmd data:(NSData *)inData {
+	RefVar store(GetArraySlot(stores, currentStore));
+
+	switch (inCmd) {
+// session negotiation
+	case kDInitiateDocking: {
+		NSString * name = config[kSimNewtonName] ? config[kSimNewtonName] : @"Simulator";
+		NSUInteger nameLen = (name.length + 1) * sizeof(UniChar);
+		NSMutableData * info = [NSMutableData dataWithLength:sizeof(int32_t) + sizeof(NewtonInfo) + nameLen];
+		int32_t * p = (int32_t *)info.mutableBytes;
+		NewtonInfo newtonInfo;
+		memset(&newtonInfo, 0, sizeof(newtonInfo));
+		newtonInfo.fNewtonID = 0x51AA51AA;
+		newtonInfo.fManufacturer = 0x01000000;
+		newtonInfo.fMachineType = 0x10003000;
+		newtonInfo.fROMVersion = 0x00020002;
+		newtonInfo.fRAMSize = 4*1024*1024;
+		newtonInfo.fScreenHeight = 480;
+		newtonInfo.fScreenWidth = 320;
+		newtonInfo.fNOSVersion = 2;
+		newtonInfo.fInternalStoreSig = 0x10000;
+		newtonInfo.fScreenResolutionV = newtonInfo.fScreenResolutionH = 100;
+		newtonInfo.fScreenDepth = 4;
+		*p++ = CANONICAL_LONG(sizeof(NewtonInfo));
+		for (int i = 0; i < sizeof(NewtonInfo)/sizeof(int32_t); ++i) {
+			*p++ = CANONICAL_LONG(((int32_t *)&newtonInfo)[i]);
+		}
+		UniChar * s = (UniChar *)p;
+		for (NSUInteger i = 0; i < name.length; ++i) {
+			*s++ = CANONICAL_SHORT([name characterAtIndex:i]);
+		}
+		*s = 0;
+		[self sendEvent:kDNewtonName data:info.bytes length:(unsigned int)info.length];
+		break;
+	}
+
+	case kDDesktopInfo: {
+		const int32_t * p = (const int32_t *)inData.bytes;
+		deskNonce.hi = CANONICAL_LONG(p[2]);
+		deskNonce.lo = CANONICAL_LONG(p[3]);
+		newtNonce.hi = (uint32_t)lrand48();
+		newtNonce.lo = (uint32_t)lrand48();
+		int32_t ninf[3] = { CANONICAL_LONG(kDanteProtocolVersion), (int32_t)CANONICAL_LONG(newtNonce.hi), (int32_t)CANONICAL_LONG(newtNonce.lo) };
+		[self sendEvent:kDNewtonInfo data:ninf length:sizeof(ninf)];
+		break;
+	}
+
+	case kDWhichIcons:
+		[self sendEvent:kDResult value:noErr];
+		break;
+
+	case kDSetTimeout:
+		if (!isDocked) {
+			// answer with the desktop’s key encrypted with our (empty) password
+			UniChar password[1] = { 0 };
+			SNewtNonce key, response = deskNonce;
+			DESCharToKey(password, &key);
+			DESEncodeNonce(&key, &response);
+			response.hi = CANONICAL_LONG(response.hi);
+			response.lo = CANONICAL_LONG(response.lo);
+			[self sendEvent:kDPassword data:&response length:sizeof(response)];
+		}
+		break;
+
+	case kDPassword:
+		isDocked = YES;
+		break;
+
+	case kDSetVBOCompression:
+		// our synthetic binaries are sent as they are whatever the desktop asks for
+		[self sendEvent:kDResult value:noErr];
+		break;
+
+	case kDRequestToRestore:
+	case kDSourceVersion:
+		[self sendEvent:kDResult value:noErr];
+		break;
+
+	case kDPWWrong:
+		REPprintf("Simulator: desktop rejected password -- clear the desktop password to use the simulator.\n");
+		[self sendEvent:kDDisconnect data:NULL length:0];
+		isDone = YES;
+		break;
+
+	case kDHello:
+	case kDOperationDone:
+	case kDDesktopInControl:
+		break;
+
+	case kDDisconnect:
+		isDone = YES;
+		break;
+
+	case kDOperationCanceled:
+		[self sendEvent:kDOpCanceledAck data:NULL length:0];
+		break;
+
+// information
+	case kDLastSyncTime:
+		[self sendEvent:kDCurrentTime value:NewtonTime()];
+		break;
+
+	case kDCallGlobalFunction:
+	case kDCallRootMethod:
+		[self sendEvent:kDCallResult ref:RA(NILREF)];
+		break;
+
+	case kDGetSyncOptions: {
+		RefVar options(AllocateFrame());
+		SetFrameSlot(options, MakeSymbol("packages"), NILREF);
+		SetFrameSlot(options, MakeSymbol("stores"), stores);
+		[self sendEvent:kDSyncOptions ref:options];
+		break;
+	}
+
+// stores
+	case kDGetStoreNames:
+		[self sendEvent:kDStoreNames ref:stores];
+		break;
+
+	case kDGetDefaultStore:
+		[self sendEvent:kDDefaultStore ref:GetArraySlot(stores, 0)];
+		break;
+
+	case kDSetCurrentStore: {
+		RefVar sig(GetFrameSlot(RefOf(inData), SYMA(signature)));
+		currentStore = 0;
+		for (ArrayIndex i = 0; i < Length(stores); ++i) {
+			if (EQ(GetFrameSlot(GetArraySlot(stores, i), SYMA(signature)), sig)) {
+				currentStore = (int)i;
+			}
+		}
+		[self sendEvent:kDResult value:noErr];
+		break;
+	}
+
+	case kDSetStoreToDefault:
+		currentStore = 0;
+		[self sendEvent:kDResult value:noErr];
+		break;
+
+	case kDGetAppNames: {
+		RefVar soupNames(GetFrameSlot(store, SYMA(soups)));
+		RefVar apps(MakeArray(0));
+		FOREACH(soupNames, soupName)
+			RefVar app(AllocateFrame());
+			RefVar appSoups(MakeArray(1));
+			SetArraySlot(appSoups, 0, soupName);
+			SetFrameSlot(app, SYMA(name), soupName);
+			SetFrameSlot(app, SYMA(soups), appSoups);
+			AddArraySlot(apps, app);
+		END_FOREACH
+		[self sendEvent:kDAppNames ref:apps];
+		break;
+	}
+
+// soups
+	case kDGetSoupNames:
+		[self sendEvent:kDSoupNames ref:GetFrameSlot(store, SYMA(soups)) ref:GetFrameSlot(store, MakeSymbol("signatures"))];
+		break;
+
+	case kDSetCurrentSoup: {
+		// soup name is big-endian UniChars
+		NSUInteger nameLen = inData.length / sizeof(UniChar);
+		const UniChar * s = (const UniChar *)inData.bytes;
+		NSMutableString * name = [NSMutableString stringWithCapacity:nameLen];
+		for (NSUInteger i = 0; i < nameLen && s[i] != 0; ++i) {
+			UniChar ch = CANONICAL_SHORT(s[i]);
+			[name appendString:[NSString stringWithCharacters:&ch length:1]];
+		}
+		NewtonErr result = kDockErrSoupNotFound;
+		RefVar soupNames(GetFrameSlot(store, SYMA(soups)));
+		for (ArrayIndex i = 0; i < Length(soupNames); ++i) {
+			if ([MakeNSString(GetArraySlot(soupNames, i)) isEqualToString:name]) {
+				currentSoup = (int)i;
+				result = noErr;
+			}
+		}
+		[self sendEvent:kDResult value:result];
+		break;
+	}
+
+	case kDGetSoupInfo:
+	case kDGetChangedInfo: {
+		RefVar info(AllocateFrame());
+		SetFrameSlot(info, MakeSymbol("simulated"), TRUEREF);
+		[self sendEvent:kDSoupInfo ref:info];
+		break;
+	}
+
+	case kDGetIndexDescription:
+	case kDGetChangedIndex: {
+		RefVar index(AllocateFrame());
+		SetFrameSlot(index, MakeSymbol("structure"), MakeSymbol("slot"));
+		SetFrameSlot(index, MakeSymbol("path"), MakeSymbol("title"));
+		SetFrameSlot(index, MakeSymbol("type"), MakeSymbol("string"));
+		RefVar indexes(MakeArray(1));
+		SetArraySlot(indexes, 0, index);
+		[self sendEvent:kDIndexDescription ref:indexes];
+		break;
+	}
+
+	case kDSetSoupInfo:
+	case kDSetSoupSignature:
+	case kDSetStoreSignature:
+	case kDCreateSoup:
+	case kDEmptySoup:
+	case kDDeleteSoup:
+	case kDDeleteEntries:
+	case kDChangedEntry:
+		[self sendEvent:kDResult value:noErr];
+		break;
+
+	case kDBackupSoup:
+		[self sendSoup:ValueOf(inData)];
+		break;
+
+	case kDSendSoup:
+		[self sendSoup:-1];
+		break;
+
+// entries
+	case kDAddEntry:
+		_stats.numOfEntriesReceived++;
+		[self sendEvent:kDAddedID value:nextUniqueId++];
+		break;
+
+	case kDAddEntryWithUniqueID:
+		// restore: the entry keeps its id
+		_stats.numOfEntriesReceived++;
+		[self sendEvent:kDResult value:noErr];
+		break;
+
+	case kDReturnEntry: {
+		int uid = ValueOf(inData);
+		RefVar entry([self makeEntry:currentSoup id:uid]);
+		[self sendEvent:kDEntry ref:entry];
+		break;
+	}
+
+// packages
+	case kDLoadPackage:
+		[self sendEvent:kDResult value:noErr];
+		break;
+
+// protocol extensions
+	case kDRegProtocolExtension:
+		[extensions addObject:[NSNumber numberWithUnsignedInt:(uint32_t)ValueOf(inData)]];
+		[self sendEvent:kDResult value:noErr];
+		break;
+
+	case kDRemoveProtocolExtension:
+		[extensions removeObject:[NSNumber numberWithUnsignedInt:(uint32_t)ValueOf(inData)]];
+		[self sendEvent:kDResult value:noErr];
+		break;
+
+	default:
+		if (inCmd == kDBulkSoupDump && [extensions containsObject:[NSNumber numberWithUnsignedInt:inCmd]]) {
+			[self dumpSoup:inData];
+		} else if ([extensions containsObject:[NSNumber numberWithUnsignedInt:inCmd]]) {
+			// registered extension: we can’t run its NewtonScript, but we can answer
+			[self sendEvent:kDResult value:noErr];
+		} else {
+			[self sendEvent:kDUnknownCommand value:(int)inCmd];
+		}
+		break;
+	}
+}
+
+@end
+
+
+/*------------------------------------------------------------------------------
+	Run the app as a simulated Newton.
+	Args:		inConfig			path of a .plist of configuration keys;
+									anything else => the default configuration
+	Return:	exit status
+------------------------------------------------------------------------------*/
+
+int
+SimulatorMain(NSString * inConfig) {
+	@autoreleasepool {
+		NSDictionary * config = nil;
+		if ([inConfig.pathExtension isEqualToString:@"plist"]) {
+			config = [NSDictionary dictionaryWithContentsOfFile:inConfig.stringByExpandingTildeInPath];
+			if (config == nil) {
+				REPprintf("Simulator: can’t read %s.\n", inConfig.UTF8String);
+				return 1;
+			}
+		}
+		// always report the session
+		gLogLevel = MAX(1, (int)[NSUserDefaults.standardUserDefaults integerForKey:kLogLevelPref]);
+
+		NCNewtonSimulator * simulator = [[NCNewtonSimulator alloc] initWithConfiguration:config];
+		NCError err = [simulator connectTCP:config[kSimHost] port:[config[kSimPort] intValue]];
+		if (err) {
+			REPprintf("Simulator: can’t connect to the desktop (%d). Is it listening?\n", err);
+		} else {
+			err = [simulator run];
+		}
+		REPflush();
+		return err == noErr ? 0 : 1;
+	}
+}
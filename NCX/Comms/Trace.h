@@ -0,0 +1,90 @@
+/*
+	File:		Trace.h
+
+	Contains:	Binary I/O trace interface.
+					When gTraceIO is set, endpoints post every page read/written and
+					every MNP packet to a fixed-size lock-free ring instead of
+					formatting it as text on the I/O thread. A background queue drains
+					the ring to file; DecodeTrace() pretty-prints the file offline.
+
+	Written by:	Newton Research Group, 2026.
+*/
+
+#import <Foundation/Foundation.h>
+
+#import "Comms.h"
+
+
+/* -----------------------------------------------------------------------------
+	Trace file format.
+	All fields are big-endian.
+		TraceFileHeader
+		TraceRecord, data truncated to recordLength, padded to long-align
+		...
+----------------------------------------------------------------------------- */
+
+#define kTraceSignature			"NCXtrc01"
+#define kTraceVersion			1
+
+#define kTraceRingSize			1024		// records; must be a power of 2
+#define kTraceMaxData			320		// bytes of data kept per record: a full MNP frame
+
+enum
+{
+	kTraceIn = '<',
+	kTraceOut = '>'
+};
+
+enum
+{
+	kTraceEndpointUnknown,
+	kTraceEndpointTCPIP,
+	kTraceEndpointSerial,
+	kTraceEndpointEinstein
+};
+
+enum
+{
+	kTraceFramePage = 0			// raw fd data; otherwise an MNP packet type (kLRPacketType...)
+};
+
+struct TraceFileHeader
+{
+	char			signature[8];
+	uint32_t		version;
+	uint32_t		numOfDropped;		// records lost because the ring was full; filled in on close
+};
+
+struct TraceRecord
+{
+	uint64_t		timestamp;			// nanoseconds since trace start
+	uint8_t		direction;			// kTraceIn / kTraceOut
+	uint8_t		endpoint;			// kTraceEndpointTCPIP...
+	uint8_t		frameType;			// kTraceFramePage or MNP packet type
+	uint8_t		sequence;			// MNP sequence number
+	uint32_t		length;				// original length of data
+	uint32_t		recordLength;		// length of data recorded
+};
+
+
+/* -----------------------------------------------------------------------------
+	F u n c t i o n s
+----------------------------------------------------------------------------- */
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+extern BOOL gTraceIO;
+
+NCError	StartTrace(NSURL * inURL);
+void		StopTrace(void);
+void		TraceIO(uint8_t inDirection, uint8_t inEndpoint, uint8_t inFrameType, uint8_t inSequence, const void * inData, unsigned int inLength);
+
+// the app decodes a trace to stdout, and quits, when run as eg
+//		NCX.app/Contents/MacOS/NCX -DecodeTrace ~/Library/Logs/NewtonConnection.nctrace
+NCError	DecodeTrace(NSURL * inURL, FILE * inOutput);
+
+#if defined(__cplusplus)
+}
+#endif
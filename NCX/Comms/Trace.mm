@@ -0,0 +1,407 @@
+/*
+	File:		Trace.mm
+
+	Contains:	Binary I/O trace implementation.
+
+	Written by:	Newton Research Group, 2026.
+*/
+
+#import <atomic>
+#import <sched.h>
+#import <time.h>
+
+#import "Trace.h"
+#import "DockProtocol.h"
+
+
+/* -----------------------------------------------------------------------------
+	T r a c e   r i n g
+	A bounded multi-producer queue (after Vyukov): each slot carries a sequence
+	number that says whether it is free for the producer at that position or
+	ready for the consumer. Producers claim a position with a CAS on the enqueue
+	index; there is only ever one consumer, the drain queue.
+	If the ring is full the record is dropped and counted -- we never block the
+	I/O thread.
+	Producers are counted in and out, so the ring can be drained and reset once
+	tracing is switched off and the last of them has left.
+----------------------------------------------------------------------------- */
+
+struct TraceSlot
+{
+	std::atomic<uint64_t>	sequence;
+	TraceRecord					record;			// host-endian until written
+	uint8_t						data[kTraceMaxData];
+};
+
+static TraceSlot					gTraceRing[kTraceRingSize];
+static std::atomic<uint64_t>	gTraceEnqueuePos;
+static uint64_t					gTraceDequeuePos;
+static std::atomic<uint32_t>	gTraceDropped;
+static std::atomic<bool>		gTraceActive;
+static std::atomic<uint32_t>	gTraceProducers;	// in TraceIO() now
+
+static uint64_t					gTraceStartTime;
+static FILE *						gTraceFile;
+static dispatch_queue_t			gTraceQueue;
+static dispatch_source_t		gTraceTimer;
+
+#define kTraceDrainInterval	(10 * NSEC_PER_MSEC)
+
+
+static inline uint64_t
+Now(void) {
+	return clock_gettime_nsec_np(CLOCK_UPTIME_RAW);
+}
+
+
+/*------------------------------------------------------------------------------
+	Wait for producers to leave the ring once gTraceActive is cleared.
+	A producer counts itself in before it tests gTraceActive (both sequentially
+	consistent), so any that saw it set are counted here.
+	Args:		--
+	Return:	--
+------------------------------------------------------------------------------*/
+
+static void
+QuiesceTrace(void) {
+	while (gTraceProducers.load() != 0) {
+		sched_yield();
+	}
+}
+
+
+/*------------------------------------------------------------------------------
+	Post a record to the trace ring.
+	Safe to call from any thread; never blocks.
+	Args:		inDirection		kTraceIn / kTraceOut
+				inEndpoint		kTraceEndpointTCPIP...
+				inFrameType		kTraceFramePage or MNP packet type
+				inSequence		MNP sequence number
+				inData
+				inLength
+	Return:	--
+------------------------------------------------------------------------------*/
+
+void
+TraceIO(uint8_t inDirection, uint8_t inEndpoint, uint8_t inFrameType, uint8_t inSequence, const void * inData, unsigned int inLength) {
+	gTraceProducers.fetch_add(1);
+	if (!gTraceActive.load()) {
+		gTraceProducers.fetch_sub(1, std::memory_order_release);
+		return;
+	}
+
+	TraceSlot * slot;
+	uint64_t pos = gTraceEnqueuePos.load(std::memory_order_relaxed);
+	for ( ; ; ) {
+		slot = &gTraceRing[pos & (kTraceRingSize - 1)];
+		int64_t diff = (int64_t)slot->sequence.load(std::memory_order_acquire) - (int64_t)pos;
+		if (diff == 0) {
+			if (gTraceEnqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+				break;
+			}
+		} else if (diff < 0) {
+			// ring is full
+			gTraceDropped.fetch_add(1, std::memory_order_relaxed);
+			gTraceProducers.fetch_sub(1, std::memory_order_release);
+			return;
+		} else {
+			pos = gTraceEnqueuePos.load(std::memory_order_relaxed);
+		}
+	}
+
+	unsigned int recordLen = MIN(inLength, kTraceMaxData);
+	slot->record.timestamp = Now() - gTraceStartTime;
+	slot->record.direction = inDirection;
+	slot->record.endpoint = inEndpoint;
+	slot->record.frameType = inFrameType;
+	slot->record.sequence = inSequence;
+	slot->record.length = inLength;
+	slot->record.recordLength = recordLen;
+	if (recordLen > 0) {
+		memcpy(slot->data, inData, recordLen);
+	}
+	slot->sequence.store(pos + 1, std::memory_order_release);
+	gTraceProducers.fetch_sub(1, std::memory_order_release);
+}
+
+
+/*------------------------------------------------------------------------------
+	Drain the trace ring to file.
+	Only ever called in gTraceQueue.
+	Args:		--
+	Return:	--
+------------------------------------------------------------------------------*/
+
+static void
+DrainTrace(void) {
+	static const char kPadding[4] = { 0,0,0,0 };
+	for ( ; ; ) {
+		TraceSlot * slot = &gTraceRing[gTraceDequeuePos & (kTraceRingSize - 1)];
+		if (slot->sequence.load(std::memory_order_acquire) != gTraceDequeuePos + 1) {
+			break;
+		}
+		if (gTraceFile) {
+			TraceRecord record = slot->record;
+			unsigned int recordLen = record.recordLength;
+			record.timestamp = CFSwapInt64HostToBig(record.timestamp);
+			record.length = CANONICAL_LONG(record.length);
+			record.recordLength = CANONICAL_LONG(record.recordLength);
+			fwrite(&record, sizeof(record), 1, gTraceFile);
+			fwrite(slot->data, recordLen, 1, gTraceFile);
+			fwrite(kPadding, LONGALIGN(recordLen) - recordLen, 1, gTraceFile);
+		}
+		slot->sequence.store(gTraceDequeuePos + kTraceRingSize, std::memory_order_release);
+		gTraceDequeuePos++;
+	}
+}
+
+
+/*------------------------------------------------------------------------------
+	Start tracing to file.
+	Args:		inURL			trace file
+	Return:	error code
+------------------------------------------------------------------------------*/
+
+NCError
+StartTrace(NSURL * inURL) {
+	StopTrace();
+
+	FILE * fp = fopen(inURL.fileSystemRepresentation, "w");
+	if (fp == NULL) {
+		return kNCInvalidFile;
+	}
+	TraceFileHeader header;
+	memcpy(header.signature, kTraceSignature, sizeof(header.signature));
+	header.version = CANONICAL_LONG(kTraceVersion);
+	header.numOfDropped = 0;
+	fwrite(&header, sizeof(header), 1, fp);
+
+	// tracing is off, but a producer that saw it on may still be writing a slot
+	QuiesceTrace();
+	for (uint64_t i = 0; i < kTraceRingSize; ++i) {
+		gTraceRing[i].sequence.store(i, std::memory_order_relaxed);
+	}
+	gTraceEnqueuePos.store(0, std::memory_order_relaxed);
+	gTraceDequeuePos = 0;
+	gTraceDropped.store(0, std::memory_order_relaxed);
+	gTraceStartTime = Now();
+	gTraceFile = fp;
+
+	if (gTraceQueue == nil) {
+		gTraceQueue = dispatch_queue_create("com.newton.connection.trace", DISPATCH_QUEUE_SERIAL);
+	}
+	gTraceTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, gTraceQueue);
+	dispatch_source_set_timer(gTraceTimer, dispatch_time(DISPATCH_TIME_NOW, kTraceDrainInterval), kTraceDrainInterval, kTraceDrainInterval / 2);
+	dispatch_source_set_event_handler(gTraceTimer, ^{ DrainTrace(); });
+	dispatch_resume(gTraceTimer);
+
+	gTraceActive.store(true, std::memory_order_release);
+	return noErr;
+}
+
+
+/*------------------------------------------------------------------------------
+	Stop tracing; drain the ring and close the file.
+	Args:		--
+	Return:	--
+------------------------------------------------------------------------------*/
+
+void
+StopTrace(void) {
+	if (gTraceFile == NULL) {
+		return;
+	}
+	gTraceActive.store(false);
+	QuiesceTrace();
+	dispatch_source_cancel(gTraceTimer);
+	gTraceTimer = nil;
+	dispatch_sync(gTraceQueue, ^{
+		DrainTrace();
+		uint32_t numOfDropped = CANONICAL_LONG(gTraceDropped.load(std::memory_order_relaxed));
+		fseek(gTraceFile, offsetof(TraceFileHeader, numOfDropped), SEEK_SET);
+		fwrite(&numOfDropped, sizeof(numOfDropped), 1, gTraceFile);
+		fclose(gTraceFile), gTraceFile = NULL;
+	});
+}
+
+
+#pragma mark Decoder
+/* -----------------------------------------------------------------------------
+	D e c o d e r
+----------------------------------------------------------------------------- */
+
+static const char * kEndpointName[] = { "?", "tcp", "serial", "einstein" };
+static const char * kPacketName[] = { "??", "LR", "LD", "Lx", "LT", "LA", "LN", "LNA" };
+
+
+static void
+DumpHex(FILE * inOutput, const uint8_t * inData, unsigned int inLength) {
+	for (unsigned int i = 0; i < inLength; i += 16) {
+		fprintf(inOutput, "\t\t%04X ", i);
+		for (unsigned int j = i; j < i + 16 && j < inLength; ++j) {
+			fprintf(inOutput, " %02X", inData[j]);
+		}
+		fprintf(inOutput, "\n");
+	}
+}
+
+
+static void
+PrintTag(FILE * inOutput, uint32_t inTag) {
+	for (int shift = 24; shift >= 0; shift -= 8) {
+		char ch = (inTag >> shift) & 0xFF;
+		fputc(isprint(ch) ? ch : '.', inOutput);
+	}
+}
+
+
+/*------------------------------------------------------------------------------
+	Print any complete dock events in a direction’s data stream.
+	Args:		inOutput
+				ioStream		unframed dock data; consumed events are removed
+	Return:	--
+------------------------------------------------------------------------------*/
+
+static void
+DecodeDockEvents(FILE * inOutput, NSMutableData * ioStream) {
+	static const char kDockHeader[8] = { 'n','e','w','t', 'd','o','c','k' };
+	for ( ; ; ) {
+		const uint8_t * p = (const uint8_t *)ioStream.bytes;
+		NSUInteger len = ioStream.length;
+		NSUInteger start = 0;
+		while (start + sizeof(DockEventHeader) <= len && memcmp(p + start, kDockHeader, 8) != 0) {
+			start++;
+		}
+		if (start + sizeof(DockEventHeader) > len) {
+			return;
+		}
+		const DockEventHeader * header = (const DockEventHeader *)(p + start);
+		uint32_t tag = CANONICAL_LONG(header->tag);
+		uint32_t dataLen = CANONICAL_LONG(header->length);
+		NSUInteger eventLen = sizeof(DockEventHeader);
+		if (dataLen != kIndeterminateLength) {
+			eventLen += LONGALIGN(dataLen);
+			if (start + eventLen > len) {
+				// wait for the rest of the event
+				return;
+			}
+		}
+		fprintf(inOutput, "\t\t");
+		if (start > 0) {
+			fprintf(inOutput, "(%lu bytes skipped) ", (unsigned long)start);
+		}
+		fprintf(inOutput, "event ");
+		PrintTag(inOutput, tag);
+		if (dataLen == kIndeterminateLength) {
+			// data is a stream of refs to follow; just skip the header
+			fprintf(inOutput, " length indeterminate\n");
+		} else {
+			fprintf(inOutput, " length %u\n", dataLen);
+			DumpHex(inOutput, p + start + sizeof(DockEventHeader), MIN(dataLen, 32));
+		}
+		[ioStream replaceBytesInRange:NSMakeRange(0, start + eventLen) withBytes:NULL length:0];
+	}
+}
+
+
+/*------------------------------------------------------------------------------
+	Skip the data a truncated record did not keep.
+	Whatever event was being reassembled can’t be completed, so it is dropped;
+	DecodeDockEvents() then resyncs at the next newt-dock header.
+	Args:		inOutput
+				ioStream		unframed dock data
+				inGap			bytes not recorded
+	Return:	--
+------------------------------------------------------------------------------*/
+
+static void
+DropDockEvents(FILE * inOutput, NSMutableData * ioStream, unsigned int inGap) {
+	fprintf(inOutput, "\t\t-- gap: %u bytes not recorded", inGap);
+	if (ioStream.length > 0) {
+		fprintf(inOutput, ", %lu bytes of an incomplete event dropped", (unsigned long)ioStream.length);
+	}
+	fprintf(inOutput, "; resync at the next event\n");
+	ioStream.length = 0;
+}
+
+
+/*------------------------------------------------------------------------------
+	Pretty-print a trace file.
+	Raw pages are hex-dumped. MNP packets are decoded, and the dock events
+	carried in LT packets -- or in raw pages, for endpoints that don’t use MNP --
+	are reassembled per direction and listed by tag.
+	Args:		inURL			trace file
+				inOutput		eg stdout
+	Return:	error code
+------------------------------------------------------------------------------*/
+
+NCError
+DecodeTrace(NSURL * inURL, FILE * inOutput) {
+	NSData * trace = [NSData dataWithContentsOfURL:inURL options:NSDataReadingMappedIfSafe error:nil];
+	if (trace == nil || trace.length < sizeof(TraceFileHeader)) {
+		return kNCInvalidFile;
+	}
+	const TraceFileHeader * header = (const TraceFileHeader *)trace.bytes;
+	if (memcmp(header->signature, kTraceSignature, sizeof(header->signature)) != 0
+	||  CANONICAL_LONG(header->version) != kTraceVersion) {
+		return kNCInvalidFile;
+	}
+	fprintf(inOutput, "trace %s: %u records dropped\n", inURL.fileSystemRepresentation, CANONICAL_LONG(header->numOfDropped));
+
+	NSMutableData * inStream = [NSMutableData data];
+	NSMutableData * outStream = [NSMutableData data];
+	int lastSequence[2] = { -1, -1 };
+	const char * p = (const char *)trace.bytes + sizeof(TraceFileHeader);
+	const char * limit = (const char *)trace.bytes + trace.length;
+	while (p + sizeof(TraceRecord) <= limit) {
+		const TraceRecord * record = (const TraceRecord *)p;
+		uint64_t timestamp = CFSwapInt64BigToHost(record->timestamp);
+		unsigned int length = CANONICAL_LONG(record->length);
+		unsigned int recordLen = CANONICAL_LONG(record->recordLength);
+		const uint8_t * data = (const uint8_t *)(record + 1);
+		p = (const char *)data + LONGALIGN(recordLen);
+		if (p > limit) {
+			return kNCInvalidFile;
+		}
+
+		NSMutableData * stream = record->direction == kTraceIn ? inStream : outStream;
+		bool isTruncated = recordLen < length;
+		fprintf(inOutput, "%10.3f %c %-8s ", (double)timestamp / 1e6, record->direction, kEndpointName[record->endpoint < 4 ? record->endpoint : 0]);
+		if (record->frameType == kTraceFramePage) {
+			fprintf(inOutput, "page %u bytes%s\n", length, isTruncated ? " (truncated)" : "");
+			DumpHex(inOutput, data, recordLen);
+			if (record->endpoint == kTraceEndpointTCPIP) {
+				[stream appendBytes:data length:recordLen];
+				DecodeDockEvents(inOutput, stream);
+				if (isTruncated) {
+					DropDockEvents(inOutput, stream, length - recordLen);
+				}
+			}
+		} else {
+			const char * name = kPacketName[record->frameType < 8 ? record->frameType : 0];
+			unsigned int headerLen = recordLen > 0 ? 1 + data[0] : 0;
+			switch (record->frameType) {
+			case 4:	// LT
+				fprintf(inOutput, "%s seq %u, %u bytes data\n", name, record->sequence, length - headerLen);
+				if (headerLen < recordLen && lastSequence[stream == outStream] != record->sequence) {
+					// a resent packet’s data has already been seen
+					lastSequence[stream == outStream] = record->sequence;
+					[stream appendBytes:data + headerLen length:recordLen - headerLen];
+					DecodeDockEvents(inOutput, stream);
+					if (isTruncated) {
+						DropDockEvents(inOutput, stream, length - recordLen);
+					}
+				}
+				break;
+			case 5:	// LA
+				fprintf(inOutput, "%s seq %u %s\n", name, record->sequence, (recordLen > 3 && data[3] == 0) ? "NAK" : "ACK");
+				break;
+			default:
+				fprintf(inOutput, "%s\n", name);
+				DumpHex(inOutput, data, recordLen);
+				break;
+			}
+		}
+	}
+	return noErr;
+}
@@ -8,6 +8,47 @@
 
 #import <Cocoa/Cocoa.h>
 
+/* -----------------------------------------------------------------------------
+	N C I d S e t
+	A set of soup entry ids held as sorted, disjoint runs.
+	Entry ids on a Newton are allocated sequentially so a soup’s ids collapse
+	to a handful of runs however many entries it holds. Runs can be inserted
+	in bulk, sets are combined by merging their runs, and the set serialises
+	to a few bytes per run.
+----------------------------------------------------------------------------- */
+
+typedef struct
+{
+	NSUInteger	first;
+	NSUInteger	count;
+} NCIdRange;
+
+
+@interface NCIdSet : NSObject <NSCopying>
+{
+	NCIdRange *	runs;
+	NSUInteger	numOfRuns;
+	NSUInteger	runsSize;
+};
+@property (readonly) NSUInteger count;			// number of ids
+@property (readonly) NSUInteger numOfRuns;
+@property (readonly) const NCIdRange * runs;
+@property (readonly) NSIndexSet * indexSet;
+@property (readonly) NSData * data;				// compact serialisation
+
+- (id)	init;
+- (id)	initWithIndexSet: (NSIndexSet *) inSet;
+- (id)	initWithData: (NSData *) inData;		// nil if data is not a serialised NCIdSet
++ (BOOL)	isIdSetData: (NSData *) inData;
+
+- (void)	addId: (NSUInteger) inId;
+- (void)	addIdsInRange: (NCIdRange) inRange;
+- (BOOL)	containsId: (NSUInteger) inId;
+
+- (NCIdSet *)	setByRemovingIds: (NCIdSet *) inSet;		// difference
+@end
+
+
 /* -----------------------------------------------------------------------------
 	N C I d L i s t
 	A set of soup entry ids created from the encoded/compressed list sent in
@@ -18,12 +59,14 @@
 {
 	NSUInteger	baseId;
 	NSUInteger	runBaseId;
-	NSMutableIndexSet *	ids;
+	NCIdSet *	idSet;
 };
-@property (readonly) NSMutableIndexSet * ids;
+@property (readonly) NCIdSet * idSet;
+@property (readonly) NSIndexSet * ids;
 
 - (id)	init;
 - (void)	setBaseId: (NSUInteger) inId;
 - (void)	addId: (NSUInteger) inId;
 - (BOOL)	add: (short) inId;
+- (void)	addEncodedIds: (const void *) inData length: (NSUInteger) inLength;
 @end
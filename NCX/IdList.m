@@ -8,6 +8,318 @@
 
 #import "IdList.h"
 
+/* -----------------------------------------------------------------------------
+	Serialised NCIdSet.
+		char[4]	kIdSetSignature
+		then for each run, as unsigned LEB128 varints:
+			gap from end of previous run (from 0 for the first)
+			count - 1
+----------------------------------------------------------------------------- */
+
+#define kIdSetSignature "NCis"
+#define kIdSetSignatureSize 4
+
+// end of kDBackupIDs list
+#define kEndOfIds ((short)0x8000)
+
+static inline NSUInteger
+RunEnd(const NCIdRange * inRun)
+{
+	return inRun->first + inRun->count;
+}
+
+
+/* -----------------------------------------------------------------------------
+	N C I d S e t
+----------------------------------------------------------------------------- */
+
+@implementation NCIdSet
+
+@synthesize numOfRuns;
+
+- (id) init
+{
+	if (self = [super init])
+	{
+		runs = NULL;
+		numOfRuns = 0;
+		runsSize = 0;
+	}
+	return self;
+}
+
+
+- (id) initWithIndexSet: (NSIndexSet *) inSet
+{
+	if (self = [self init])
+	{
+		[inSet enumerateRangesUsingBlock:^(NSRange range, BOOL * stop) {
+			[self addIdsInRange: (NCIdRange){ range.location, range.length }];
+		}];
+	}
+	return self;
+}
+
+
+- (id) initWithData: (NSData *) inData
+{
+	if (![NCIdSet isIdSetData: inData])
+		return nil;
+
+	if (self = [self init])
+	{
+		const uint8_t * p = (const uint8_t *)inData.bytes + kIdSetSignatureSize;
+		const uint8_t * limit = (const uint8_t *)inData.bytes + inData.length;
+		NSUInteger prevEnd = 0;
+		while (p < limit)
+		{
+			NSUInteger value[2];
+			for (int i = 0; i < 2; i++)
+			{
+				NSUInteger v = 0;
+				unsigned int shift = 0;
+				uint8_t byte;
+				do {
+					if (p >= limit)
+						return self;	// truncated; keep what we have
+					byte = *p++;
+					v |= (NSUInteger)(byte & 0x7F) << shift;
+					shift += 7;
+				} while (byte & 0x80);
+				value[i] = v;
+			}
+			NCIdRange run = { prevEnd + value[0], value[1] + 1 };
+			[self addIdsInRange: run];
+			prevEnd = RunEnd(&run);
+		}
+	}
+	return self;
+}
+
+
++ (BOOL) isIdSetData: (NSData *) inData
+{
+	return inData.length >= kIdSetSignatureSize
+		 && memcmp(inData.bytes, kIdSetSignature, kIdSetSignatureSize) == 0;
+}
+
+
+- (void) dealloc
+{
+	if (runs)
+		free(runs);
+}
+
+
+- (id) copyWithZone: (NSZone *) inZone
+{
+	NCIdSet * theCopy = [[NCIdSet alloc] init];
+	for (NSUInteger i = 0; i < numOfRuns; i++)
+		[theCopy addIdsInRange: runs[i]];
+	return theCopy;
+}
+
+
+- (const NCIdRange *) runs
+{
+	return runs;
+}
+
+
+/* -----------------------------------------------------------------------------
+	Return the number of ids in the set.
+----------------------------------------------------------------------------- */
+
+- (NSUInteger) count
+{
+	NSUInteger n = 0;
+	for (NSUInteger i = 0; i < numOfRuns; i++)
+		n += runs[i].count;
+	return n;
+}
+
+
+/* -----------------------------------------------------------------------------
+	Return the ids as an index set; NSIndexSet also keeps ranges so this is
+	one insertion per run.
+----------------------------------------------------------------------------- */
+
+- (NSIndexSet *) indexSet
+{
+	NSMutableIndexSet * indexSet = [NSMutableIndexSet indexSet];
+	for (NSUInteger i = 0; i < numOfRuns; i++)
+		[indexSet addIndexesInRange: NSMakeRange(runs[i].first, runs[i].count)];
+	return indexSet;
+}
+
+
+/* -----------------------------------------------------------------------------
+	Serialise the set.
+----------------------------------------------------------------------------- */
+
+- (NSData *) data
+{
+	NSMutableData * data = [NSMutableData dataWithCapacity: kIdSetSignatureSize + numOfRuns * 4];
+	[data appendBytes: kIdSetSignature length: kIdSetSignatureSize];
+	NSUInteger prevEnd = 0;
+	for (NSUInteger i = 0; i < numOfRuns; i++)
+	{
+		NSUInteger value[2] = { runs[i].first - prevEnd, runs[i].count - 1 };
+		for (int j = 0; j < 2; j++)
+		{
+			uint8_t buf[10], * p = buf;
+			NSUInteger v = value[j];
+			do {
+				uint8_t byte = v & 0x7F;
+				v >>= 7;
+				if (v)
+					byte |= 0x80;
+				*p++ = byte;
+			} while (v);
+			[data appendBytes: buf length: p - buf];
+		}
+		prevEnd = RunEnd(&runs[i]);
+	}
+	return data;
+}
+
+
+/* -----------------------------------------------------------------------------
+	Add ids.
+	Ids usually arrive in ascending order, so extending or appending to the
+	last run is the fast path; otherwise the new run is merged with any runs
+	it overlaps or abuts.
+----------------------------------------------------------------------------- */
+
+- (void) addId: (NSUInteger) inId
+{
+	[self addIdsInRange: (NCIdRange){ inId, 1 }];
+}
+
+
+- (void) addIdsInRange: (NCIdRange) inRange
+{
+	if (inRange.count == 0)
+		return;
+
+	NSUInteger first = inRange.first;
+	NSUInteger end = RunEnd(&inRange);
+
+	if (numOfRuns > 0)
+	{
+		NCIdRange * last = &runs[numOfRuns - 1];
+		if (first > RunEnd(last))
+			;	// append
+		else if (first >= last->first)
+		{
+			// extend last run
+			if (end > RunEnd(last))
+				last->count = end - last->first;
+			return;
+		}
+		else
+		{
+			// find first run that ends at or after first
+			NSUInteger lo = 0, hi = numOfRuns;
+			while (lo < hi)
+			{
+				NSUInteger mid = (lo + hi) / 2;
+				if (RunEnd(&runs[mid]) < first)
+					lo = mid + 1;
+				else
+					hi = mid;
+			}
+			// and the runs that start at or before end
+			NSUInteger upper = lo;
+			while (upper < numOfRuns && runs[upper].first <= end)
+				upper++;
+			if (upper > lo)
+			{
+				// merge runs [lo, upper) with the new run
+				if (runs[lo].first < first)
+					first = runs[lo].first;
+				if (RunEnd(&runs[upper - 1]) > end)
+					end = RunEnd(&runs[upper - 1]);
+				runs[lo].first = first;
+				runs[lo].count = end - first;
+				memmove(&runs[lo + 1], &runs[upper], (numOfRuns - upper) * sizeof(NCIdRange));
+				numOfRuns -= (upper - lo - 1);
+				return;
+			}
+			// insert a new run at lo
+			if (numOfRuns == runsSize)
+			{
+				runsSize = runsSize ? runsSize * 2 : 8;
+				runs = (NCIdRange *)realloc(runs, runsSize * sizeof(NCIdRange));
+			}
+			memmove(&runs[lo + 1], &runs[lo], (numOfRuns - lo) * sizeof(NCIdRange));
+			runs[lo] = inRange;
+			numOfRuns++;
+			return;
+		}
+	}
+
+	if (numOfRuns == runsSize)
+	{
+		runsSize = runsSize ? runsSize * 2 : 8;
+		runs = (NCIdRange *)realloc(runs, runsSize * sizeof(NCIdRange));
+	}
+	runs[numOfRuns++] = inRange;
+}
+
+
+- (BOOL) containsId: (NSUInteger) inId
+{
+	NSUInteger lo = 0, hi = numOfRuns;
+	while (lo < hi)
+	{
+		NSUInteger mid = (lo + hi) / 2;
+		if (RunEnd(&runs[mid]) <= inId)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo < numOfRuns && runs[lo].first <= inId;
+}
+
+
+/* -----------------------------------------------------------------------------
+	The ids of this set that are not in another, found by walking both lists
+	of runs together.
+----------------------------------------------------------------------------- */
+
+- (NCIdSet *) setByRemovingIds: (NCIdSet *) inSet
+{
+	NCIdSet * result = [[NCIdSet alloc] init];
+	NSUInteger j = 0;
+	for (NSUInteger i = 0; i < numOfRuns; i++)
+	{
+		NSUInteger first = runs[i].first;
+		NSUInteger end = RunEnd(&runs[i]);
+		// skip runs of inSet that end before this run starts
+		while (j < inSet->numOfRuns && RunEnd(&inSet->runs[j]) <= first)
+			j++;
+		NSUInteger k = j;
+		while (first < end)
+		{
+			if (k >= inSet->numOfRuns || inSet->runs[k].first >= end)
+			{
+				[result addIdsInRange: (NCIdRange){ first, end - first }];
+				break;
+			}
+			const NCIdRange * hole = &inSet->runs[k];
+			if (hole->first > first)
+				[result addIdsInRange: (NCIdRange){ first, hole->first - first }];
+			if (RunEnd(hole) > first)
+				first = RunEnd(hole);
+			k++;
+		}
+	}
+	return result;
+}
+
+@end
+
 
 /* -----------------------------------------------------------------------------
 	N C I d L i s t
@@ -17,7 +329,7 @@
 
 @implementation NCIdList
 
-@synthesize ids;
+@synthesize idSet;
 
 - (id) init
 {
@@ -25,12 +337,18 @@
 	{
 		baseId = 0;
 		runBaseId = 0;
-		ids = [NSMutableIndexSet indexSet];
+		idSet = [[NCIdSet alloc] init];
 	}
 	return self;
 }
 
 
+- (NSIndexSet *) ids
+{
+	return idSet.indexSet;
+}
+
+
 - (void)	setBaseId: (NSUInteger) inId
 {
 	baseId = inId;
@@ -39,28 +357,47 @@
 
 - (void)	addId: (NSUInteger) inId
 {
-	[ids addIndex: inId];
+	[idSet addId: inId];
 }
 
 
+/* -----------------------------------------------------------------------------
+	Add one code from a kDBackupIDs list.
+	A positive code is an id offset from the base; a negative code -n is the
+	n ids following the last positive code.
+	Args:		inId			code, already in host byte order
+	Return:	NO => end of list
+----------------------------------------------------------------------------- */
+
 - (BOOL)	add: (short) inId
 {
-	if (inId == (short)0x8000)
+	if (inId == kEndOfIds)
 		return NO;
 
 	if (inId < 0)
-	{
-		int i;
-		for (i = 1; i <= -inId; i++)
-			[self addId:baseId + runBaseId + i];
-	}
+		[idSet addIdsInRange: (NCIdRange){ baseId + runBaseId + 1, (NSUInteger)-inId }];
 	else
 	{
 		runBaseId = inId;
-		[self addId:baseId + inId];
+		[idSet addId: baseId + inId];
 	}
 	return YES;
 }
 
-@end
 
+/* -----------------------------------------------------------------------------
+	Add a whole kDBackupIDs list straight from the event data.
+	Args:		inData		big-endian shorts
+				inLength		length of data in bytes
+	Return:	--
+----------------------------------------------------------------------------- */
+
+- (void)	addEncodedIds: (const void *) inData length: (NSUInteger) inLength
+{
+	const short * codedId = (const short *)inData;
+	const short * limit = codedId + inLength / sizeof(short);
+	for ( ; codedId < limit && [self add: (short)CFSwapInt16BigToHost(*codedId)]; codedId++)
+		;
+}
+
+@end
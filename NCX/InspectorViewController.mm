@@ -11,6 +11,7 @@
 #import "Newton/NewtonPackage.h"
 #import "PkgPart.h"
 #import "Utilities.h"
+#import "NSOFReader.h"
 #import "NCXPlugIn.h"
 #import <Quartz/Quartz.h>	// for QuickLookUI
 //@import Quartz
@@ -166,10 +167,7 @@ extern void	RedirectStdioOutTranslator(FILE * inFRef);
 	NCEntry * entry = (NCEntry *)inEntries[0];
 
 	if ([entry.refClass isEqualToString:kPackageRefClass]) {
-		CPtrPipe pipe;
-		pipe.init((void *)entry.refData.bytes, entry.refData.length, NO, NULL);
-		RefVar refEntry(UnflattenRef(pipe));
-		RefVar pkgRef(GetFrameSlot(refEntry, MakeSymbol("pkgRef")));
+		RefVar pkgRef(GetFlattenedSlot(entry.refData, "pkgRef"));
 		if (IsBinary(pkgRef)) {
 			CDataPtr pkgPtr(pkgRef);
 			NewtonPackage pkg((void *)(char *)pkgPtr);
@@ -25,6 +25,8 @@
 	// housekeeping
 	NSManagedObjectContext * savedObjContext;
 	NSPersistentStore * objStore;
+	NSMutableArray * maintenancePasses;	// upkeep waiting to run; see -performMaintenance:
+	id maintenanceObserver;					// waits for the dock to disconnect
 
 	// transient data
 	// existing document chooser
@@ -37,6 +39,10 @@
 
 	// state of the connection
 	NewtonErr operationError;
+
+	// entries stored since the last save
+	NSUInteger numOfUnsavedEntries;
+	NSUInteger numOfUnsavedBytes;
 }
 
 @property(nonatomic,strong)	NCWindowController * windowController;
@@ -71,6 +77,12 @@
 // state
 @property(nonatomic,strong)	NSString * exceptionStr;
 
+// save every so many entries or bytes received while backing up
+@property(nonatomic,assign)	NSUInteger saveBatchEntries;
+@property(nonatomic,assign)	NSUInteger saveBatchBytes;
+// slots left out of entry fingerprints, so a changed entry that differs only in these is not stored again
+@property(nonatomic,strong)	NSArray * volatileSlots;
+
 
 - (void)makeManagedObjectContextForThread;
 - (void)disposeManagedObjectContextForThread;
@@ -96,6 +108,9 @@
 - (IBAction)docChosen:(id)sender;
 //- (void) usePersistentStore: (NSURL *) inURL;
 - (void)savePersistentStore;
+- (void)refreshSummaries;
+- (void)compressEntries;
+- (BOOL)entryStored:(NSUInteger)inLength;
 
 // user info
 - (NSDictionary *)makeFontAttribute:(RefArg)inStyle;
@@ -125,11 +140,20 @@
 - (void)updateInfo:(RefArg)info;
 - (void)updateIndex:(RefArg)index;
 - (Ref)entryWithId:(NSUInteger)inId;
+- (void)beginUpsert:(NCDocument *)inDocument;
+- (void)endUpsert;
 - (NCEntry *)addEntry:(RefArg)inEntry;
 - (NCEntry *)addEntry:(RefArg)inEntry withNSOFData:(void *)inData length:(NSUInteger)inLength;
+- (NCEntry *)addEntry:(RefArg)inEntry withNSOFData:(NSData *)inData;
+- (uint64_t)fingerprintOf:(NSData *)inData;
+- (Ref)summarySlots;
+- (BOOL)trainDictionary;
+- (NSUInteger)compressEntriesFrom:(NSUInteger)inOffset count:(NSUInteger)inCount;
+- (void)enumerateEntryDataUsingBlock:(void (^)(NSUInteger inId, NSData * inData))inBlock;
 @end
 
 @interface NCEntry(ref)
 - (Ref)ref;
+- (void)updateSummary:(RefArg)inEntry;
 - (void)update:(RefArg)inAddedEntry;
 @end
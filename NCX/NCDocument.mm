@@ -12,20 +12,51 @@
 #import <SyncServices/SyncServices.h>
 
 #import "NCDocument.h"
+#import "BackupDocument.h"
 #import "NCWindowController.h"
 #import "Session.h"
 #import "Utilities.h"
+#import "GrowablePipe.h"
 #import "NCXErrors.h"
+#import "RefDataCodec.h"
+#import "TextIndex.h"
+#import "SoupQuery.h"
+#import "SortKey.h"
+#import "NSOFReader.h"
 #import "PreferenceKeys.h"
 #import "NCXPlugIn.h"
 #import "NCSlot.h"
+#import "Metrics.h"
 #import "Logging.h"
+#import <vector>
 
 
 NSDictionary * gSlotDict;
+int32_t gSummaryVersion;
 
 #define kMinutesSince1904 34714080
 
+// bump this when the code that derives entry summaries changes
+// (changes to slot.plist or appslot.plist are picked up automatically)
+#define kSummaryRulesVersion 2
+
+// save a backup in progress every 500 entries or 4MB, whichever comes first
+#define kDefaultSaveBatchEntries 500
+#define kDefaultSaveBatchBytes (4*1024*1024)
+
+// entries whose NSOF differs only in these slots are not stored again
+#define kDefaultVolatileSlots @[@"_modTime"]
+
+// read entries for indexing this many at a time
+#define kEntryDataPageSize 500
+
+// train a soup’s refData dictionary once it has this many entries, from this many of them
+#define kDictionaryMinEntries 64
+#define kDictionarySampleEntries 256
+
+// upkeep runs on the main thread this many entries at a time
+#define kMaintenanceBatchEntries 100
+
 
 /* -----------------------------------------------------------------------------
 	Return the id of the Newton device.
@@ -166,13 +197,7 @@ DeviceId(const NewtonInfo * info) {
 
 - (void) updateInfo: (RefArg) info
 {
-	CPtrPipe pipe;
-
-	NSUInteger numOfBytes = FlattenRefSize(info);
-	void * data = malloc(numOfBytes);
-	pipe.init(data, numOfBytes, NO, nil);
-	FlattenRef(info, pipe);
-	self.info = [NSData dataWithBytesNoCopy: data length: numOfBytes];
+	self.info = FlattenRefToData(info);
 
 	Ref timeRef = NILREF;
 	if (NOTNIL(info))
@@ -195,19 +220,19 @@ DeviceId(const NewtonInfo * info) {
 
 - (void) updateIndex: (RefArg) index
 {
-	CPtrPipe pipe;
-
-	NSUInteger numOfBytes = FlattenRefSize(index);
-	void * data = malloc(numOfBytes);
-	pipe.init(data, numOfBytes, NO, nil);
-	FlattenRef(index, pipe);
-	self.indexes = [NSData dataWithBytesNoCopy: data length: numOfBytes];
+	self.indexes = FlattenRefToData(index);
+	[self discardQueryIndexes];
 }
 
 
 - (Ref) entryWithId: (NSUInteger) inId
 {
 	NSManagedObjectContext * objContext = self.managedObjectContext;
+	if (entryIds)
+	{
+		NCEntry * entry = [self upsertedEntry:[NSNumber numberWithUnsignedInteger:inId]];
+		return entry ? entry.ref : NILREF;
+	}
 	NSFetchRequest * request = [[NSFetchRequest alloc] init];
 	request.entity = [NSEntityDescription entityForName:@"Entry" inManagedObjectContext:objContext];
 	request.predicate = [NSPredicate predicateWithFormat:@"soup = %@ AND uniqueId = %d", self, inId];
@@ -223,6 +248,112 @@ DeviceId(const NewtonInfo * info) {
 }
 
 
+/* -----------------------------------------------------------------------------
+	Prepare to add many entries, as during backup.
+	Rather than fetch each entry by uniqueId as it arrives we fetch all
+	uniqueIds and objectIDs in the soup once and look them up in a dictionary.
+	Their fingerprints come too, so an entry received unchanged can be passed
+	over without being faulted in.
+	Entries are saved in batches as they’re added -- see NCDocument
+	-entryStored:.
+	Args:		inDocument		document to save
+	Return:	--
+----------------------------------------------------------------------------- */
+
+- (void) beginUpsert: (NCDocument *) inDocument
+{
+	NSManagedObjectContext * objContext = self.managedObjectContext;
+
+	NSExpressionDescription * objectIdDesc = [[NSExpressionDescription alloc] init];
+	objectIdDesc.name = @"objectID";
+	objectIdDesc.expression = [NSExpression expressionForEvaluatedObject];
+	objectIdDesc.expressionResultType = NSObjectIDAttributeType;
+
+	NSFetchRequest * request = [[NSFetchRequest alloc] init];
+	request.entity = [NSEntityDescription entityForName:@"Entry" inManagedObjectContext:objContext];
+	request.predicate = [NSPredicate predicateWithFormat:@"soup = %@", self];
+	request.resultType = NSDictionaryResultType;
+	request.propertiesToFetch = @[@"uniqueId", @"fingerprint", objectIdDesc];
+
+	NSError *__autoreleasing error = nil;
+	NSArray * results = [objContext executeFetchRequest:request error:&error];
+
+	entryIds = [[NSMutableDictionary alloc] initWithCapacity:results.count];
+	entryFingerprints = [[NSMutableDictionary alloc] initWithCapacity:results.count];
+	for (NSDictionary * item in results)
+	{
+		entryIds[item[@"uniqueId"]] = item[@"objectID"];
+		if ([item[@"fingerprint"] unsignedLongLongValue] != 0)
+			entryFingerprints[item[@"uniqueId"]] = item[@"fingerprint"];
+	}
+	unsavedEntries = [[NSMutableArray alloc] init];
+	upsertDocument = inDocument;
+}
+
+
+- (void) endUpsert
+{
+	entryIds = nil;
+	unsavedEntries = nil;
+	entryFingerprints = nil;
+	upsertDocument = nil;
+}
+
+
+/* -----------------------------------------------------------------------------
+	Return the entry with a given uniqueId while upserting.
+	Args:		inId
+	Return:	the entry; nil => not in this soup
+----------------------------------------------------------------------------- */
+
+- (NCEntry *) upsertedEntry: (NSNumber *) inId
+{
+	id entry = entryIds[inId];
+	if ([entry isKindOfClass:NSManagedObjectID.class])
+		entry = [self.managedObjectContext objectWithID:entry];
+	return entry;
+}
+
+
+/* -----------------------------------------------------------------------------
+	The document has saved entries we added.
+	They now have permanent objectIDs; remember those instead and let the
+	entries turn back into faults so a long backup doesn’t hold them all.
+	Args:		--
+	Return:	--
+----------------------------------------------------------------------------- */
+
+- (void) didSaveUpserts
+{
+	NSManagedObjectContext * objContext = self.managedObjectContext;
+	for (NCEntry * entry in unsavedEntries)
+	{
+		entryIds[entry.uniqueId] = entry.objectID;
+		[objContext refreshObject:entry mergeChanges:NO];
+	}
+	[unsavedEntries removeAllObjects];
+}
+
+
+/* -----------------------------------------------------------------------------
+	Return the fingerprint of an entry’s NSOF data, leaving out the slots the
+	document is told are volatile -- see kVolatileSlotsPref.
+	Args:		inData			NSOF data
+	Return:	the fingerprint; never 0
+----------------------------------------------------------------------------- */
+
+- (uint64_t) fingerprintOf: (NSData *) inData
+{
+	NSArray * slots = upsertDocument ? ((NCDocument *)upsertDocument).volatileSlots : kDefaultVolatileSlots;
+	std::vector<const char *> names;
+	for (id slot in slots)
+		if ([slot isKindOfClass:NSString.class])
+			names.push_back([slot UTF8String]);
+	CNSOFReader reader(inData.bytes, inData.length);
+	return reader.fingerprint(names.data(), (ArrayIndex)names.size());
+}
+
+
 /* -----------------------------------------------------------------------------
 	Add an entry object to a soup.
 	For cases where we have modified the soup entry frame after receiving it
@@ -255,17 +386,11 @@ FULL_LOG {
 	}
 
 	// build the NSOF data
-	unsigned int numOfBytes = (unsigned int)FlattenRefSize(inEntry);
-	void * data = malloc(numOfBytes);
-	CPtrPipe pipe;
-	pipe.init(data, numOfBytes, NO, nil);
-	FlattenRef(inEntry, pipe);
+	CGrowablePipe pipe;
+	size_t numOfBytes = FlattenRefInto(inEntry, pipe);
 
-	// add it as usual
-	NCEntry * entry = [self addEntry:inEntry withNSOFData:data length:numOfBytes];
-	// entry has a copy of the data, so free what we alloc’d
-	free(data);
-	return entry;
+	// add it as usual -- entry takes a copy of the data, the pipe frees its buffer
+	return [self addEntry:inEntry withNSOFData:pipe.data() length:numOfBytes];
 }
 
 
@@ -275,7 +400,8 @@ FULL_LOG {
 	kDEntry event during backup/synch -- so we already have the NSOF data for
 	creating an NCEntry object.
 	However, we do test whether an entry with the given uniqueId already exists,
-	and if so just update it.
+	and if so just update it -- unless its fingerprint shows nothing but its
+	volatile slots has changed, in which case it is left as it is.
 	Args:		inEntry
 				inData
 				inLength
@@ -284,29 +410,76 @@ FULL_LOG {
 
 - (NCEntry *) addEntry: (RefArg) inEntry withNSOFData: (void *) inData length: (NSUInteger) inLength
 {
+	return [self addEntry:inEntry withNSOFData:[NSData dataWithBytes:inData length:inLength]];
+}
+
+
+/* -----------------------------------------------------------------------------
+	Add an entry object to a soup, adopting its NSOF data without copying it.
+	inEntry need only have the slots listed by -summarySlots.
+	Args:		inEntry
+				inData			NSOF data; may be a slice of a mapped file
+	Return:	the entry, which has been added to this soup.
+----------------------------------------------------------------------------- */
+
+- (NCEntry *) addEntry: (RefArg) inEntry withNSOFData: (NSData *) inData
+{
+	NSUInteger inLength = inData.length;
+	uint64_t startTime = MetricsNow();
 	NSManagedObjectContext * objContext = self.managedObjectContext;
-	NSFetchRequest * request = [[NSFetchRequest alloc] init];
-	request.entity = [NSEntityDescription entityForName:@"Entry" inManagedObjectContext:objContext];
 
 	Ref idRef = GetFrameSlot(inEntry, SYMA(_uniqueId));
 	NSUInteger idValue = ((unsigned int)idRef) >> kRefTagBits;	// RVALUE() performs signed conversion
 	NSNumber * uid = [NSNumber numberWithUnsignedInteger:idValue];
 
-	request.predicate = [NSPredicate predicateWithFormat:@"uniqueId = %@ AND soup = %@", uid, self];
+	uint64_t fingerprint = [self fingerprintOf:inData];
+	NCEntry * entry = nil;
+	if (entryIds)
+	{
+		NSNumber * storedFingerprint = entryFingerprints[uid];
+		if (storedFingerprint && storedFingerprint.unsignedLongLongValue == fingerprint)
+		{
+			MetricsCount(kMetricsSkippedWrites);
+			MetricsTime(kMetricsStore, startTime);
+			return [self upsertedEntry:uid];
+		}
+		entry = [self upsertedEntry:uid];
+	}
+	else
+	{
+		NSFetchRequest * request = [[NSFetchRequest alloc] init];
+		request.entity = [NSEntityDescription entityForName:@"Entry" inManagedObjectContext:objContext];
+		request.predicate = [NSPredicate predicateWithFormat:@"uniqueId = %@ AND soup = %@", uid, self];
 
-	NSError *__autoreleasing error = nil;
-	NSArray * results = [objContext executeFetchRequest:request error:&error];
+		NSError *__autoreleasing error = nil;
+		NSArray * results = [objContext executeFetchRequest:request error:&error];
+		if (results.count > 0)
+			// we have an existing entry
+			entry = (NCEntry *)results[0];
+	}
 
-	NCEntry * entry;
-	if (results.count > 0)
-		// we have an existing entry
-		entry = (NCEntry *)results[0];
-	else
+	// stored earlier in this session, or not upserting
+	if (entry && entry.fingerprint.unsignedLongLongValue == fingerprint)
+	{
+		MetricsCount(kMetricsSkippedWrites);
+		MetricsTime(kMetricsStore, startTime);
+		return entry;
+	}
+
+	BOOL isNewEntry = (entry == nil);
+	if (isNewEntry)
+	{
 		// entry does not exist on this soup
 		entry = [NSEntityDescription insertNewObjectForEntityForName: @"Entry"
 											  inManagedObjectContext: objContext];
+		// add it before setting its data, so it is compressed with our dictionary
+		[self addEntriesObject:entry];
+	}
 
-	entry.refData = [NSData dataWithBytes: inData length: inLength];
+	entry.refData = inData;
+	entry.fingerprint = [NSNumber numberWithUnsignedLongLong:fingerprint];
+	if (entryFingerprints)
+		entryFingerprints[uid] = entry.fingerprint;
 //PrintObject(inEntry, 0);
 
 	RefVar entryClass(GetFrameSlot(inEntry, SYMA(class)));
@@ -315,11 +488,289 @@ FULL_LOG {
 	else if (FrameHasSlot(inEntry, MakeSymbol("pkgRef")))
 		entry.refClass = kPackageRefClass;
 
+	// remember the highest _uniqueId we have, for incremental backup
+	if (idValue < kImportIdBase
+	&&  [self.lastBackupId compare: uid] == NSOrderedAscending)
+		self.lastBackupId = uid;
+	entry.uniqueId = uid;
+
+	NSDate * modTime = MakeNSDate(GetFrameSlot(inEntry, SYMA(_modTime)));
+	entry.modTime = modTime ? modTime : [NSDate date];
+
+// could add size of each entry using:
+//extern "C" Ref	FEntrySize(RefArg inRcvr, RefArg inEntry);
+
+	if (isNewEntry && entryIds)	// entry was not already in soup
+	{
+		entryIds[uid] = entry;
+		[unsavedEntries addObject:entry];
+	}
+	// derive the title and table view columns now, so views need not unflatten the entry
+	[entry updateSummary:inEntry];
+	[self indexEntryId:idValue NSOFData:inData];
+
+	MetricsCount(kMetricsEntries);
+	MetricsCount(kMetricsEntryBytes, inLength);
+	MetricsTime(kMetricsStore, startTime);
+
+	if ([upsertDocument entryStored:inLength])
+		[self didSaveUpserts];
+	return entry;
+}
+
+
+/* -----------------------------------------------------------------------------
+	Return the slots of an entry that are needed to add it to this soup:
+	those read by -addEntry:withNSOFData: and -[NCEntry updateSummary:].
+	Readers that can extract slots piecemeal need build no more than these.
+	Args:		--
+	Return:	array of symbols
+----------------------------------------------------------------------------- */
+
+- (Ref) summarySlots
+{
+	static const char * entrySlots[] = { "_uniqueId", "_modTime", "class", "labels", "title", "name", "company", "place" };
+	const ArrayIndex numOfEntrySlots = sizeof(entrySlots) / sizeof(entrySlots[0]);
+
+	NSArray * colDefs = [gSlotDict objectForKey: self.name];
+	RefVar slots(MakeArray(numOfEntrySlots + (ArrayIndex)colDefs.count));
+	ArrayIndex i = 0;
+	for ( ; i < numOfEntrySlots; ++i)
+		SetArraySlot(slots, i, MakeSymbol(entrySlots[i]));
+	// columns defined in slot.plist
+	for (NSDictionary * colDef in colDefs)
+	{
+		NSString * slot = [colDef objectForKey: @"slot"];
+		SetArraySlot(slots, i++, slot ? MakeSymbol([slot UTF8String]) : SYMA(class));
+	}
+	return slots;
+}
+
+
+/* -----------------------------------------------------------------------------
+	Pass the NSOF data of every entry in the soup to a block, without making
+	managed objects of them: a page at a time from the persistent store, then
+	the entries the context has inserted or changed but not yet saved. Entries
+	the context has deleted are passed with nil data.
+	Args:		inBlock
+	Return:	--
+----------------------------------------------------------------------------- */
+
+- (void) enumerateEntryDataUsingBlock: (void (^)(NSUInteger inId, NSData * inData)) inBlock
+{
+	NSManagedObjectContext * objContext = self.managedObjectContext;
+	if (!self.objectID.isTemporaryID)
+	{
+		NSFetchRequest * request = [NSFetchRequest fetchRequestWithEntityName:@"Entry"];
+		request.predicate = [NSPredicate predicateWithFormat:@"soup = %@", self];
+		request.sortDescriptors = @[[NSSortDescriptor sortDescriptorWithKey:@"uniqueId" ascending:YES]];
+		request.resultType = NSDictionaryResultType;
+		request.propertiesToFetch = @[@"uniqueId", @"refData"];
+		request.fetchLimit = kEntryDataPageSize;
+		for (NSUInteger offset = 0; ; )
+		{
+			NSUInteger count;
+			@autoreleasepool {
+				request.fetchOffset = offset;
+				NSError *__autoreleasing error = nil;
+				NSArray * page = [objContext executeFetchRequest:request error:&error];
+				for (NSDictionary * entry in page)
+				{
+					NSData * refData = [self decodeRefData:entry[@"refData"]];
+					if (refData)
+						inBlock([entry[@"uniqueId"] unsignedIntegerValue], refData);
+				}
+				count = page.count;
+			}
+			if (count < kEntryDataPageSize)
+				break;
+			offset += count;
+		}
+	}
+
+	// dictionary fetches only see what has been saved
+	for (NCEntry * entry in objContext.insertedObjects)
+		if ([entry isKindOfClass:NCEntry.class] && entry.soup == self)
+			inBlock(entry.uniqueId.unsignedIntegerValue, entry.refData);
+	for (NCEntry * entry in objContext.updatedObjects)
+		if ([entry isKindOfClass:NCEntry.class] && entry.soup == self)
+			inBlock(entry.uniqueId.unsignedIntegerValue, entry.refData);
+	for (NCEntry * entry in objContext.deletedObjects)
+		if ([entry isKindOfClass:NCEntry.class] && [entry committedValuesForKeys:@[@"soup"]][@"soup"] == self)
+			inBlock([[entry committedValuesForKeys:@[@"uniqueId"]][@"uniqueId"] unsignedIntegerValue], nil);
+}
+
+
+/* -----------------------------------------------------------------------------
+	Save a batch of changed entries, then turn the batch’s objects back into
+	faults so their data is not held in memory for the rest of a long pass.
+	Args:		inContext
+				ioBatch			objects changed since the last save; emptied
+	Return:	YES => saved
+----------------------------------------------------------------------------- */
+
+static BOOL
+SaveEntryBatch(NSManagedObjectContext * inContext, NSMutableArray * ioBatch)
+{
+	// not timed: maintenance is not part of any dock session’s metrics
+	NSError *__autoreleasing error = nil;
+	[inContext save:&error];
+	if (error) {
+		NSLog(@"save error: %@", error.description);
+		if (error.userInfo)
+			NSLog(@"%@", error.userInfo.description);
+	}
+	for (NSManagedObject * obj in ioBatch)
+		[inContext refreshObject:obj mergeChanges:NO];
+	[ioBatch removeAllObjects];
+	return error == nil;
+}
+
+
+/* -----------------------------------------------------------------------------
+	Train the soup’s refData dictionary on a sample of its entries.
+	The dictionary is trained once, when the soup has enough entries for it to
+	be representative; entries stored after that are compressed as they are
+	stored -- see -[NCEntry setRefData:]. Entries stored before it must then be
+	compressed -- see -compressEntriesFrom:count:. Both are done by the
+	document’s maintenance pass, between dock sessions.
+	Args:		--
+	Return:	YES => the dictionary was trained
+----------------------------------------------------------------------------- */
+
+- (BOOL) trainDictionary
+{
+	if (self.dictionaryId.unsignedIntValue != 0)
+		return NO;
+
+	NSManagedObjectContext * objContext = self.managedObjectContext;
+	NSFetchRequest * request = [[NSFetchRequest alloc] init];
+	request.entity = [NSEntityDescription entityForName:@"Entry" inManagedObjectContext:objContext];
+	request.predicate = [NSPredicate predicateWithFormat:@"soup = %@", self];
+
+	NSError *__autoreleasing error = nil;
+	NSUInteger count = [objContext countForFetchRequest:request error:&error];
+	if (count == NSNotFound || count < kDictionaryMinEntries)
+		return NO;
+
+	// sample entries from across the soup, fetching only their data
+	NSMutableArray * samples = [NSMutableArray arrayWithCapacity:kDictionarySampleEntries];
+	request.resultType = NSDictionaryResultType;
+	request.propertiesToFetch = @[@"refData"];
+	request.sortDescriptors = @[[NSSortDescriptor sortDescriptorWithKey:@"uniqueId" ascending:YES]];
+	request.fetchLimit = 1;
+	NSUInteger numOfSamples = MIN(count, kDictionarySampleEntries);
+	for (NSUInteger i = 0; i < numOfSamples; ++i)
+	{
+		request.fetchOffset = i * count / numOfSamples;
+		NSArray * results = [objContext executeFetchRequest:request error:&error];
+		NSData * refData = results.count > 0 ? results[0][@"refData"] : nil;
+		if (refData.length > 0)
+			[samples addObject:refData];
+	}
+
+	NSData * dictionary = TrainRefDataDictionary(samples);
+	if (dictionary == nil)
+		return NO;
+	self.dictionary = dictionary;
+	self.dictionaryId = [NSNumber numberWithUnsignedInt:RefDataDictionaryId(dictionary)];
+	return YES;
+}
+
+
+/* -----------------------------------------------------------------------------
+	Store a run of the soup’s entries again, in uniqueId order, so NCEntry
+	compresses them with the soup’s dictionary; then save them.
+	Args:		inOffset			index of the first entry
+				inCount			number of entries
+	Return:	number of entries stored; < inCount => that was the last of them,
+				or they could not be saved
+----------------------------------------------------------------------------- */
+
+- (NSUInteger) compressEntriesFrom: (NSUInteger) inOffset count: (NSUInteger) inCount
+{
+	NSManagedObjectContext * objContext = self.managedObjectContext;
+	NSFetchRequest * request = [[NSFetchRequest alloc] init];
+	request.entity = [NSEntityDescription entityForName:@"Entry" inManagedObjectContext:objContext];
+	request.predicate = [NSPredicate predicateWithFormat:@"soup = %@", self];
+	request.sortDescriptors = @[[NSSortDescriptor sortDescriptorWithKey:@"uniqueId" ascending:YES]];
+	request.fetchOffset = inOffset;
+	request.fetchLimit = inCount;
+
+	NSError *__autoreleasing error = nil;
+	NSArray * results = [objContext executeFetchRequest:request error:&error];
+
+	NSMutableArray * batch = [NSMutableArray arrayWithCapacity:results.count];
+	for (NCEntry * entry in results)
+	{
+		@autoreleasepool {
+			NSData * refData = entry.refData;
+			entry.refData = refData;
+		}
+		// setting refData keeps the NSOF data; fault the entry once saved
+		[batch addObject:entry];
+	}
+	if (!SaveEntryBatch(objContext, batch))
+		return 0;
+	return results.count;
+}
+
+@end
+
+
+#pragma mark NCEntry
+/* -----------------------------------------------------------------------------
+	Transform a slot value for display, using the transform named by its type
+	in slot.plist.
+	Args:		inEntry
+				inValue
+				inType
+	Return:	NSString* or NSDate*
+----------------------------------------------------------------------------- */
+
+static id
+TransformSlot(NCEntry * inEntry, RefArg inValue, NSString * inType)
+{
+	SEL transform = NSSelectorFromString([NSString stringWithFormat:@"transform%@:",[inType capitalizedString]]);
+	if ([inEntry respondsToSelector: transform])
+	{
+		NCSlot * slotObj = [[NCSlot alloc] init];
+		slotObj.ref = inValue;
+		return [inEntry performSelector:transform withObject: slotObj];
+	}
+	if (IsString(inValue))
+		return MakeNSString(inValue);
+	return @"";
+}
+
+
+@implementation NCEntry(ref)
+
+- (Ref) ref
+{
+	CPtrPipe pipe;
+	pipe.init((void *)self.refData.bytes, self.refData.length, NO, nil);
+	return UnflattenRef(pipe);
+}
+
+
+/* -----------------------------------------------------------------------------
+	Derive the values shown in the soup entries table view:
+		title - info1 - info2 - labels
+	and store them with the entry, tagged with the version of the rules that
+	derived them. Entries summarized under other rules are brought up to date
+	by -[NCDocument refreshSummaries].
+	Args:		inEntry			the entry frame
+	Return:	--
+----------------------------------------------------------------------------- */
+
+- (void) updateSummary: (RefArg) inEntry
+{
 	// determine slot to display as title for entries in this soup; default is 'title
 	NSString * str = @"";
 	NSString * titleSlot = nil;
 	NSString * titleType = nil;
-	NSArray * colDef = [gSlotDict objectForKey: self.name];
+	NSArray * colDef = [gSlotDict objectForKey: self.soup.name];
 	if (colDef)
 	{
 		NSDictionary * titleDef = [colDef objectAtIndex:0];
@@ -352,50 +803,38 @@ FULL_LOG {
 		}
 	}
 
-	NCSlot * slotObj = [[NCSlot alloc] init];
 	RefVar title(GetFrameSlot(inEntry, MakeSymbol([titleSlot UTF8String])));
 	if (NOTNIL(title))
-	{
 		// transform title using titleDef
-		SEL transform = NSSelectorFromString([NSString stringWithFormat:@"transform%@:",[titleType capitalizedString]]);
-		if ([entry respondsToSelector: transform])
+		str = TransformSlot(self, title, titleType);
+	self.title = str;
+	self.titleKey = [str isKindOfClass:NSString.class] ? MakeSortKey(str) : nil;
+
+	// labels are stored as the folder symbol; the folder name is looked up when displayed
+	RefVar labels(GetFrameSlot(inEntry, SYMA(labels)));
+	self.labelTag = IsSymbol(labels) ? [NSString stringWithCString:SymbolName(labels) encoding:NSMacOSRomanStringEncoding] : nil;
+
+	// optional info columns
+	id info1 = nil, info2 = nil;
+	for (NSDictionary * colDef in [gSlotDict objectForKey: self.soup.name])
+	{
+		NSString * tag = [colDef objectForKey: @"tag"];
+		if ([tag isEqualToString:@"info1"] || [tag isEqualToString:@"info2"])
 		{
-			slotObj.ref = title;
-			str = [entry performSelector:transform withObject: slotObj];
+			RefVar slot(GetFrameSlot(inEntry, MakeSymbol([[colDef objectForKey: @"slot"] UTF8String])));
+			id info = TransformSlot(self, slot, [colDef objectForKey: @"type"]);
+			if ([tag isEqualToString:@"info1"])
+				info1 = info;
+			else
+				info2 = info;
 		}
-		else if (IsString(title))
-			str = MakeNSString(title);
 	}
-	entry.title = str;
-
-	// remember the highest _uniqueId we have, for incremental backup
-	if (idValue < kImportIdBase
-	&&  [self.lastBackupId compare: uid] == NSOrderedAscending)
-		self.lastBackupId = uid;
-	entry.uniqueId = uid;
+	self.info1Date = [info1 isKindOfClass:NSDate.class] ? info1 : nil;
+	self.info1Text = [info1 isKindOfClass:NSString.class] ? info1 : nil;
+	self.info2Date = [info2 isKindOfClass:NSDate.class] ? info2 : nil;
+	self.info2Text = [info2 isKindOfClass:NSString.class] ? info2 : nil;
 
-	NSDate * modTime = MakeNSDate(GetFrameSlot(inEntry, SYMA(_modTime)));
-	entry.modTime = modTime ? modTime : [NSDate date];
-
-// could add size of each entry using:
-//extern "C" Ref	FEntrySize(RefArg inRcvr, RefArg inEntry);
-
-	if (results.count == 0)	// entry is not already in soup
-		[self addEntriesObject:entry];
-	return entry;
-}
-
-@end
-
-
-#pragma mark NCEntry
-@implementation NCEntry(ref)
-
-- (Ref) ref
-{
-	CPtrPipe pipe;
-	pipe.init((void *)self.refData.bytes, self.refData.length, NO, nil);
-	return UnflattenRef(pipe);
+	self.summaryVersion = [NSNumber numberWithInt:gSummaryVersion];
 }
 
 
@@ -404,27 +843,22 @@ FULL_LOG {
 // we need to reflect those changes in our db
 - (void) update: (RefArg) inAddedEntry
 {
-	// rebuild the NSOF data
-	unsigned int numOfBytes = (unsigned int)FlattenRefSize(inAddedEntry);
-	void * data = malloc(numOfBytes);
-
-	CPtrPipe pipe;
-	pipe.init(data, numOfBytes, NO, nil);
-	FlattenRef(inAddedEntry, pipe);
-
-	// update the entry object
-	self.refData = [NSData dataWithBytesNoCopy: data length: numOfBytes];
-	// no need to free(data), the NSData object owns it now
+	// rebuild the NSOF data and update the entry object
+	self.refData = FlattenRefToData(inAddedEntry);
+	self.fingerprint = [NSNumber numberWithUnsignedLongLong:[self.soup fingerprintOf:self.refData]];
 
 	// update our attributes
 	Ref idRef = GetFrameSlot(inAddedEntry, SYMA(_uniqueId));
 	NSNumber * uid = [NSNumber numberWithUnsignedInteger:RVALUE(idRef)];
+	[self.soup unindexEntryId:self.uniqueId.unsignedIntegerValue];
+	[self.soup indexEntryId:uid.unsignedIntegerValue NSOFData:self.refData];
 	// remember the highest _uniqueId in our db
 	if ([self.soup.lastBackupId compare: uid] == NSOrderedAscending)
 		self.soup.lastBackupId = uid;
 
 	self.uniqueId = uid;
 	self.modTime = MakeNSDate(GetFrameSlot(inAddedEntry, SYMA(_modTime)));
+	[self updateSummary:inAddedEntry];
 }
 
 @end
@@ -451,8 +885,18 @@ FULL_LOG {
 
 + (void)initialize {
 	NSString * path = [[NSBundle mainBundle] resourcePath];
-	path = [path stringByAppendingPathComponent: @"slot.plist"];
-	gSlotDict = [NSDictionary dictionaryWithContentsOfFile: path];
+	gSlotDict = [NSDictionary dictionaryWithContentsOfFile: [path stringByAppendingPathComponent: @"slot.plist"]];
+
+	// entry summaries are versioned by the rules that derive them: our code and the slot plists
+	uint32_t hash = 2166136261U ^ kSummaryRulesVersion;	// FNV-1a
+	for (NSString * rules in @[@"slot.plist", @"appslot.plist"]) {
+		NSData * rulesData = [NSData dataWithContentsOfFile: [path stringByAppendingPathComponent: rules]];
+		const unsigned char * p = (const unsigned char *)rulesData.bytes;
+		for (NSUInteger i = 0; i < rulesData.length; ++i)
+			hash = (hash ^ p[i]) * 16777619U;
+	}
+	// zero is the default for entries that have never been summarized
+	gSummaryVersion = (hash & 0x7FFFFFFF) | 1;
 }
 
 
@@ -526,7 +970,8 @@ FULL_LOG {
 
 //	NSDictionary * options = @{ NSReadOnlyPersistentStoreOption:[NSNumber numberWithBool:NO] };
 //	the store is not readonly, since we allow import to untethered device
-	NSDictionary * options = @{ };
+	NSDictionary * options = @{ NSMigratePersistentStoresAutomaticallyOption:@YES,
+										  NSInferMappingModelAutomaticallyOption:@YES };
 	if (outError)
 		*outError = nil;
 	objStore = [self.objContext.persistentStoreCoordinator addPersistentStoreWithType:NSSQLiteStoreType
@@ -556,6 +1001,8 @@ FULL_LOG {
 		for (NCSoup * soup in store.soups)
 			soup.lastImportId = [NSNumber numberWithUnsignedInt:kImportIdBase];
 //----
+	[self refreshSummaries];
+	[self compressEntries];
 	return YES;
 }
 
@@ -588,6 +1035,13 @@ FULL_LOG {
 		self.dock = nil;
 		[NCDockProtocolController unbind];
 	}
+	[maintenancePasses removeAllObjects];
+	if (maintenanceObserver) {
+		[NSNotificationCenter.defaultCenter removeObserver:maintenanceObserver];
+		maintenanceObserver = nil;
+	}
+	[self discardTextIndexes];
+	[self discardQueryIndexes];
 	[super close];
 }
 
@@ -625,6 +1079,13 @@ FULL_LOG {
 {
 	savedObjContext = self.objContext;
 
+	NSUserDefaults * defaults = NSUserDefaults.standardUserDefaults;
+	self.saveBatchEntries = [defaults objectForKey:kSaveBatchEntriesPref] ? [defaults integerForKey:kSaveBatchEntriesPref] : kDefaultSaveBatchEntries;
+	self.saveBatchBytes = [defaults objectForKey:kSaveBatchBytesPref] ? [defaults integerForKey:kSaveBatchBytesPref] : kDefaultSaveBatchBytes;
+	self.volatileSlots = [defaults arrayForKey:kVolatileSlotsPref] ?: kDefaultVolatileSlots;
+	numOfUnsavedEntries = 0;
+	numOfUnsavedBytes = 0;
+
 	self.objContext = [[NSManagedObjectContext alloc] initWithConcurrencyType:NSPrivateQueueConcurrencyType];
 	[self.objContext setUndoManager:nil];
 	[self.objContext setPersistentStoreCoordinator: [savedObjContext persistentStoreCoordinator]];
@@ -644,9 +1105,11 @@ FULL_LOG {
 
 - (void) mergeChanges: (NSNotification *) inNotification
 {
+	uint64_t startTime = MetricsNow();
 	[savedObjContext performSelectorOnMainThread:@selector(mergeChangesFromContextDidSaveNotification:)
 												 withObject:inNotification
 											 waitUntilDone:YES];
+	MetricsTime(kMetricsMerge, startTime);
 }
 
 
@@ -770,10 +1233,14 @@ FULL_LOG {
 
 - (void)savePersistentStore {
 //NSLog(@"-[document savePersistentStore] objContext=%@\n %@", self.objContext, NSThread.callStackSymbols);
+	numOfUnsavedEntries = 0;
+	numOfUnsavedBytes = 0;
 	NSDictionary * metadata = @{ @"NewtonName":self.deviceObj.name, @"NewtonId":self.deviceObj.visibleId };
 	[self.objContext.persistentStoreCoordinator setMetadata:metadata forPersistentStore:objStore];
 	NSError *__autoreleasing error = nil;
+	uint64_t startTime = MetricsNow();
 	[self.objContext save:&error];
+	MetricsTime(kMetricsSave, startTime);
 	if (error) {
 		NSLog(@"save error: %@", error.description);
 		if (error.userInfo)
@@ -782,6 +1249,163 @@ FULL_LOG {
 }
 
 
+/* -----------------------------------------------------------------------------
+	Queue a pass of upkeep. Passes run one after another, in the order asked
+	for, a batch at a time on the main thread: while no Newton is connected no
+	other thread uses the Newton heap, and the document’s own context can be
+	used so there is nothing to merge. While a dock session is in progress
+	passes are held until it ends, so they neither slow it down nor save over
+	what the dock is storing.
+	Args:		inBatch			does the next batch of the pass; returns YES if there’s
+									more to do
+	Return:	--
+----------------------------------------------------------------------------- */
+
+- (void)performMaintenance:(BOOL (^)(NSManagedObjectContext * inContext))inBatch {
+	if (maintenancePasses == nil)
+		maintenancePasses = [[NSMutableArray alloc] init];
+	[maintenancePasses addObject:inBatch];
+	if (maintenancePasses.count == 1)
+		[self continueMaintenance];
+}
+
+
+- (void)continueMaintenance {
+	dispatch_async(dispatch_get_main_queue(), ^{
+		if (maintenancePasses.count == 0)
+			return;
+		if (gNCNub.isTethered) {
+			// the heap is in use; carry on once the dock has disconnected
+			if (maintenanceObserver == nil)
+				maintenanceObserver = [NSNotificationCenter.defaultCenter addObserverForName:kDockDidDisconnectNotification object:nil queue:nil usingBlock:^(NSNotification * inNotification) {
+					[NSNotificationCenter.defaultCenter removeObserver:maintenanceObserver];
+					maintenanceObserver = nil;
+					[self continueMaintenance];
+				}];
+			return;
+		}
+		BOOL (^pass)(NSManagedObjectContext *) = maintenancePasses.firstObject;
+		BOOL isMore;
+		@autoreleasepool {
+			isMore = pass(self.managedObjectContext);
+		}
+		if (!isMore)
+			[maintenancePasses removeObjectAtIndex:0];
+		[self continueMaintenance];
+	});
+}
+
+
+/* -----------------------------------------------------------------------------
+	Bring stored entry summaries up to date with the current rules.
+	This only does any work the first time a document is opened after the
+	rules (our code, slot.plist or appslot.plist) change. It runs as
+	maintenance -- until an entry is refreshed its getters read the slot from
+	its NSOF data -- and builds only the slots a summary is made from.
+	Args:		--
+	Return:	--
+----------------------------------------------------------------------------- */
+
+- (void)refreshSummaries {
+	if (self.deviceObj == nil)
+		return;
+
+	[self performMaintenance:^BOOL (NSManagedObjectContext * inContext) {
+		NSFetchRequest * request = [[NSFetchRequest alloc] init];
+		request.entity = [NSEntityDescription entityForName:@"Entry" inManagedObjectContext:inContext];
+		request.predicate = [NSPredicate predicateWithFormat:@"summaryVersion != %d", gSummaryVersion];
+		// the slots needed depend only on the soup’s name
+		request.sortDescriptors = @[[NSSortDescriptor sortDescriptorWithKey:@"soup.name" ascending:YES]];
+		request.fetchLimit = kMaintenanceBatchEntries;
+
+		NSError *__autoreleasing error = nil;
+		NSArray * results = [inContext executeFetchRequest:request error:&error];
+
+		// refreshed entries drop out of the fetch, so each batch starts at the top
+		NSString * soupName = nil;
+		RefVar summarySlots;
+		RefVar entryRef;
+		NSMutableArray * batch = [NSMutableArray arrayWithCapacity:results.count];
+		for (NCEntry * entry in results) {
+			if (soupName == nil || ![entry.soup.name isEqualToString:soupName]) {
+				soupName = entry.soup.name;
+				summarySlots = [entry.soup summarySlots];
+			}
+			NSData * refData = entry.refData;
+			CNSOFReader reader(refData.bytes, refData.length);
+			if (!reader.getSlots(summarySlots, entryRef))
+				entryRef = entry.ref;
+			[entry updateSummary:entryRef];
+			[batch addObject:entry];
+		}
+		// entries that can’t be saved would be fetched again; give up
+		return SaveEntryBatch(inContext, batch) && results.count == kMaintenanceBatchEntries;
+	}];
+}
+
+
+/* -----------------------------------------------------------------------------
+	Compress the entries of soups that don’t yet have a refData dictionary.
+	This only does any work once for each soup. It runs as maintenance: a
+	batch trains one soup’s dictionary, then batches of its entries are stored
+	again.
+	Args:		--
+	Return:	--
+----------------------------------------------------------------------------- */
+
+- (void)compressEntries {
+	if (self.deviceObj == nil)
+		return;
+
+	__block NSMutableArray * soups = nil;
+	__block NCSoup * soup = nil;
+	__block NSUInteger offset = 0;
+	[self performMaintenance:^BOOL (NSManagedObjectContext * inContext) {
+		if (soups == nil) {
+			soups = [NSMutableArray array];
+			for (NCStore * store in self.deviceObj.stores)
+				for (NCSoup * storeSoup in store.soups)
+					if (storeSoup.dictionaryId.unsignedIntValue == 0)
+						[soups addObject:storeSoup];
+		}
+		if (soup == nil) {
+			NCSoup * nextSoup = soups.lastObject;
+			[soups removeLastObject];
+			if ([nextSoup trainDictionary]) {
+				soup = nextSoup;
+				offset = 0;
+			}
+		} else {
+			NSUInteger count = [soup compressEntriesFrom:offset count:kMaintenanceBatchEntries];
+			offset += count;
+			if (count < kMaintenanceBatchEntries) {
+				DEVELOPER_LOG NSLog(@"-[NCDocument compressEntries] %@: %lu entries", soup.name, (unsigned long)offset);
+				soup = nil;
+			}
+		}
+		return soup != nil || soups.count > 0;
+	}];
+}
+
+
+/* -----------------------------------------------------------------------------
+	Note an entry added to the context; save if enough have accumulated.
+	Args:		inLength			size of entry’s NSOF data
+	Return:	YES => the store was saved
+----------------------------------------------------------------------------- */
+
+- (BOOL)entryStored:(NSUInteger)inLength {
+	numOfUnsavedEntries++;
+	numOfUnsavedBytes += inLength;
+	if ((self.saveBatchEntries > 0 && numOfUnsavedEntries >= self.saveBatchEntries)
+	||  (self.saveBatchBytes > 0 && numOfUnsavedBytes >= self.saveBatchBytes)) {
+		[self savePersistentStore];
+		return YES;
+	}
+	return NO;
+}
+
+
 /* -----------------------------------------------------------------------------
 	The doc chooser was dismissed. End the sheet.
 	Args:		sender
@@ -941,7 +1565,8 @@ FULL_LOG {
 	else
 		self.fileURL = ApplicationSupportFile([reqdId stringByAppendingPathExtension:@"newtondevice"]);
 
-	NSDictionary * options = @{ };
+	NSDictionary * options = @{ NSMigratePersistentStoresAutomaticallyOption:@YES,
+										  NSInferMappingModelAutomaticallyOption:@YES };
 	NSError *__autoreleasing error = nil;
 	objStore = [self.objContext.persistentStoreCoordinator addPersistentStoreWithType:NSSQLiteStoreType
 																		  configuration:nil
@@ -973,6 +1598,9 @@ FULL_LOG {
 	self.deviceObj.name = inName;
 	self.deviceObj.info = [NSData dataWithBytes:info length:sizeof(NewtonInfo)];
 	self.deviceObj.tetheredStores = nil;
+
+	if (existingURL)
+		[self refreshSummaries];
 }
 
 
@@ -1367,6 +1995,7 @@ FULL_LOG {
 		New					only allow new document if none already open
 		Install Package	choose .pkg files and install them
 		Dump Newton ROM	choose file to contain ROM dump, dump it
+		Export Backup		write the (Internal) store as a backup file
 	Edit
 		Copy					copy screenshot (if available)
 		Paste					pass through pasteboard text
@@ -1399,6 +2028,9 @@ FULL_LOG {
 	// we can dump the ROM if we’re not doing anything else
 	if (inItem.action == @selector(dumpROM:))
 		return self.dock.isTethered && self.dock.operationInProgress == kNoActivity;
+	// we can export a backup if we have a store and aren’t updating it
+	if (inItem.action == @selector(exportBackup:))
+		return self.stores.count > 0 && (self.dock == nil || self.dock.operationInProgress == kNoActivity);
 
 // Edit menu
 	// we can copy if we have a screenshot image
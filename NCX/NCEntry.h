@@ -15,9 +15,19 @@
 @property(nonatomic,retain) NSData * refData;
 @property(nonatomic,retain) NSString * refClass;
 @property(nonatomic,retain) NSString * title;
+@property(nonatomic,retain) NSData * titleKey;		// sorts as the title; see SortKey.h
 @property(nonatomic,retain) NSNumber * uniqueId;
 @property(nonatomic,retain) NSDate * modTime;
 @property(nonatomic,retain) NCSoup * soup;
+// persisted summary of the entry frame, derived when the entry is stored
+@property(nonatomic,retain) NSString * labelTag;
+@property(nonatomic,retain) NSString * info1Text;
+@property(nonatomic,retain) NSDate * info1Date;
+@property(nonatomic,retain) NSString * info2Text;
+@property(nonatomic,retain) NSDate * info2Date;
+@property(nonatomic,retain) NSNumber * summaryVersion;
+// of refData, less volatile slots; 0 => not known
+@property(nonatomic,retain) NSNumber * fingerprint;
 
 @property(nonatomic,readonly) id labels;
 // transient properties for table view -- will be NSString* or NSDate*
@@ -12,6 +12,7 @@
 #import "NCSlot.h"
 #import "NCEntry.h"
 #import "NCSoup.h"
+#import "NSOFReader.h"
 
 
 @implementation NCSlot
@@ -29,22 +30,69 @@
 	id _info1;
 	id _info2;
 	NSString * _labels;
+	NSData * _refData;		// decompressed
 }
+@property(nonatomic,readonly) BOOL hasSummary;
 - (id)transformSlot:(NSUInteger)inSlot;
 @end
 
 
 @implementation NCEntry
 
-@dynamic refData;
 @dynamic refClass;
 @dynamic title;
+@dynamic titleKey;
 @dynamic uniqueId;
 @dynamic modTime;
 @dynamic soup;
+@dynamic labelTag;
+@dynamic info1Text;
+@dynamic info1Date;
+@dynamic info2Text;
+@dynamic info2Date;
+@dynamic summaryVersion;
+@dynamic fingerprint;
 
 @synthesize isSelected;
 
+/* -----------------------------------------------------------------------------
+	refData is stored compressed with its soup’s dictionary, if it has one;
+	see -[NCSoup(ref) trainDictionary]. Readers always see NSOF data.
+	It is decompressed once for as long as the entry is not a fault, since the
+	summary and inspector read it slot by slot.
+----------------------------------------------------------------------------- */
+
+- (NSData *) refData
+{
+	if (_refData == nil)
+	{
+		[self willAccessValueForKey:@"refData"];
+		NSData * data = [self primitiveValueForKey:@"refData"];
+		[self didAccessValueForKey:@"refData"];
+		_refData = self.soup ? [self.soup decodeRefData:data] : data;
+	}
+	return _refData;
+}
+
+
+- (void) setRefData: (NSData *) inData
+{
+	NCSoup * soup = self.soup;
+	NSData * data = soup ? [soup encodeRefData:inData] : inData;
+	[self willChangeValueForKey:@"refData"];
+	[self setPrimitiveValue:data forKey:@"refData"];
+	[self didChangeValueForKey:@"refData"];
+	_refData = inData;
+}
+
+
+- (void) didTurnIntoFault
+{
+	_refData = nil;
+	[super didTurnIntoFault];
+}
+
+
 /* -----------------------------------------------------------------------------
 	NSPasteboardItemDataProvider protocol
 ----------------------------------------------------------------------------- */
@@ -71,6 +119,21 @@ NSLog(@"-pasteboard:item:provideDataForType:%@",inType);
 }
 
 
+/* -----------------------------------------------------------------------------
+	Table view columns are derived when the entry is stored; see
+	-[NCEntry(ref) updateSummary:]. If the rules have changed since then we read
+	the column’s slot from the NSOF data instead.
+	Args:		--
+	Return:	YES => persisted summary is current
+----------------------------------------------------------------------------- */
+extern int32_t gSummaryVersion;
+
+- (BOOL) hasSummary
+{
+	return self.summaryVersion.intValue == gSummaryVersion;
+}
+
+
 /* -----------------------------------------------------------------------------
 	The labels slot is used by Newton for filing.
 	Args:		--
@@ -81,7 +144,18 @@ NSDictionary * gUserFolders;
 - (id) labels
 {
 	if (_labels == nil) {
-		_labels = [self transformSlot:0];
+		if (self.hasSummary) {
+			NSString * tag = self.labelTag;
+			if (tag) {
+				// map symbol -> string using document’s userFolders dictionary
+				NSString * label = [gUserFolders objectForKey:tag];
+				_labels = label ? label : tag;
+			} else {
+				_labels = @"Unfiled";
+			}
+		} else {
+			_labels = [self transformSlot:0];
+		}
 	}
 	return _labels;
 }
@@ -98,7 +172,11 @@ NSDictionary * gUserFolders;
 - (id) info1
 {
 	if (_info1 == nil) {
-		_info1 = [self transformSlot:2];
+		if (self.hasSummary) {
+			_info1 = self.info1Date ? self.info1Date : self.info1Text;
+		} else {
+			_info1 = [self transformSlot:2];
+		}
 	}
 	return _info1;
 }
@@ -107,28 +185,23 @@ NSDictionary * gUserFolders;
 - (id) info2
 {
 	if (_info2 == nil) {
-		_info2 = [self transformSlot:3];
+		if (self.hasSummary) {
+			_info2 = self.info2Date ? self.info2Date : self.info2Text;
+		} else {
+			_info2 = [self transformSlot:3];
+		}
 	}
 	return _info2;
 }
 
 
+// for entries not yet summarized under the current rules:
+// read only the slot we want from the NSOF data rather than unflattening the entire entry
 - (id) transformSlot: (NSUInteger) inSlot
 {
-	static RefStruct * entryRef = nil;
-	static NCEntry * entryCache = nil;
-	if (entryCache != self) {
-		CPtrPipe pipe;
-		pipe.init((void *)self.refData.bytes, self.refData.length, NO, nil);
-		if (entryRef == nil)
-			entryRef = new RefStruct;
-		*entryRef = UnflattenRef(pipe);
-		entryCache = self;
-	}
-
 	id str;
 	if (inSlot == 0) {
-		RefVar labelSlot(GetFrameSlot(*entryRef, SYMA(labels)));
+		RefVar labelSlot(GetFlattenedSlot(self.refData, "labels"));
 		if (IsSymbol(labelSlot)) {
 		// map symbol -> string using document’s userFolders dictionary
 			NSString * tag = [NSString stringWithCString:SymbolName(labelSlot) encoding:NSMacOSRomanStringEncoding];
@@ -141,7 +214,7 @@ NSDictionary * gUserFolders;
 	} else {
 
 		NSDictionary * infoDict = [self.soup.columnInfo objectAtIndex:inSlot];
-		RefVar slot(GetFrameSlot(*entryRef, MakeSymbol([[infoDict objectForKey:@"slot"] UTF8String])));
+		RefVar slot(GetFlattenedSlot(self.refData, [[infoDict objectForKey:@"slot"] UTF8String]));
 		// transform it
 		NCSlot * slotObj = [[NCSlot alloc] init];
 		SEL transform = NSSelectorFromString([NSString stringWithFormat:@"transform%@:",[[infoDict objectForKey:@"type"] capitalizedString]]);
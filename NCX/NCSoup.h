@@ -30,12 +30,18 @@ typedef uint32_t NewtonTime;
 #define kImportIdBase 1070000000
 
 
-@class NCApp, NCStore;
+@class NCApp, NCStore, NCIdSet;
 
 @interface NCSoup : NSManagedObject <NCSourceItem>
 {
 //	NCInfoController * viewController;
 	NSArray * columnInfo;
+
+	// while backing up: uniqueId -> NSManagedObjectID, or NCEntry not yet saved
+	NSMutableDictionary * entryIds;
+	NSMutableArray * unsavedEntries;
+	NSMutableDictionary * entryFingerprints;
+	__weak id upsertDocument;
 }
 
 @property(nonatomic,retain) NSString * name;
@@ -49,6 +55,8 @@ typedef uint32_t NewtonTime;
 @property(nonatomic,retain) NSNumber * lastImportId;		// for desktop import
 @property(nonatomic,retain) NSDate * prevSynchTime;
 @property(nonatomic,retain) NSData * prevSynchIdData;
+@property(nonatomic,retain) NSData * dictionary;			// for compressing entry refData
+@property(nonatomic,retain) NSNumber * dictionaryId;		// 0 => no dictionary
 @property(nonatomic,retain) NSMutableSet * entries;
 @property(nonatomic,retain) NCApp * app;
 @property(nonatomic,retain) NCStore * store;
@@ -73,10 +81,17 @@ typedef uint32_t NewtonTime;
 - (NSArray *) importedEntries;
 // return new/modified entries (ordered by uniqueId)
 - (NSArray *) entriesLaterThan: (NSDate *) inTime withIdGreaterThan: (NSUInteger) inId;
+// return entries whose titles sort from inFirst up to but not including inLast
+- (NSArray *) entriesWithTitleFrom: (NSString *) inFirst to: (NSString *) inLast;
 // delete all entries not in indexSet
-- (void) cropTo: (NSIndexSet *) indexSet;
+- (void) cropTo: (NSIndexSet *) indexSet mainContext: (NSManagedObjectContext *) inMainContext;
+- (void) cropToIds: (NCIdSet *) inSet mainContext: (NSManagedObjectContext *) inMainContext;
 
 - (void) deleteEntryId: (NSUInteger) inId;
+
+// compress/decompress entry refData using the soup’s dictionary
+- (NSData *) encodeRefData: (NSData *) inData;
+- (NSData *) decodeRefData: (NSData *) inData;
 @end
 
 
@@ -8,6 +8,10 @@
 */
 
 #import "NCSoup.h"
+#import "IdList.h"
+#import "RefDataCodec.h"
+#import "TextIndex.h"
+#import "SortKey.h"
 #import "Logging.h"
 
 extern int	REPprintf(const char * inFormat, ...);
@@ -33,6 +37,8 @@ extern int	REPprintf(const char * inFormat, ...);
 @dynamic lastImportId;
 @dynamic prevSynchTime;
 @dynamic prevSynchIdData;
+@dynamic dictionary;
+@dynamic dictionaryId;
 @dynamic entries;
 @dynamic app;
 @dynamic store;
@@ -49,9 +55,10 @@ extern int	REPprintf(const char * inFormat, ...);
 }
 
 //@property(nonatomic,retain) -- will need to encode/decode to NSData
+//	stored as a run-length NCIdSet; stores written before that hold a keyed archive
 - (void) setPrevSynchIds: (NSIndexSet *) inIds
 {
-	self.prevSynchIdData = [NSKeyedArchiver archivedDataWithRootObject:inIds];
+	self.prevSynchIdData = [[NCIdSet alloc] initWithIndexSet:inIds].data;
 }
 
 - (NSIndexSet *) prevSynchIds
@@ -59,6 +66,8 @@ extern int	REPprintf(const char * inFormat, ...);
 	NSData * idData = self.prevSynchIdData;
 	if (idData == nil || idData.length == 0)
 		return [NSIndexSet indexSet];
+	if ([NCIdSet isIdSetData:idData])
+		return [[NCIdSet alloc] initWithData:idData].indexSet;
 	return [NSKeyedUnarchiver unarchiveObjectWithData:idData];
 }
 
@@ -147,6 +156,40 @@ extern int	REPprintf(const char * inFormat, ...);
 }
 
 
+/* -----------------------------------------------------------------------------
+	Return entries in the soup in title order, within a range of titles.
+	The range is found from the titleKey index, so titles are compared as the
+	Newton compares them -- ignoring case and diacritics -- without being
+	read from the store.
+	Both ends are inclusive: titles that fold the same as inLast are in range.
+	Args:		inFirst			nil => from the first title
+				inLast			nil => to the last title
+	Return:	NSArray *
+----------------------------------------------------------------------------- */
+
+- (NSArray *) entriesWithTitleFrom: (NSString *) inFirst to: (NSString *) inLast
+{
+	NSManagedObjectContext * objContext = [self managedObjectContext];
+	NSFetchRequest * request = [[NSFetchRequest alloc] init];
+	[request setEntity:[NSEntityDescription entityForName:@"Entry" inManagedObjectContext:objContext]];
+
+	NSMutableArray * conditions = [NSMutableArray arrayWithObject:[NSPredicate predicateWithFormat:@"soup = %@", self]];
+	if (inFirst)
+		[conditions addObject:[NSPredicate predicateWithFormat:@"titleKey >= %@", MakeSortKeyBound(inFirst)]];
+	if (inLast)
+		[conditions addObject:[NSPredicate predicateWithFormat:@"titleKey < %@", MakeSortKeyLimit(inLast)]];
+	[request setPredicate:[NSCompoundPredicate andPredicateWithSubpredicates:conditions]];
+
+	NSSortDescriptor * sorter = [[NSSortDescriptor alloc] initWithKey:kTitleSortKey ascending:YES];
+	[request setSortDescriptors:[NSArray arrayWithObject:sorter]];
+
+	NSError *__autoreleasing error = nil;
+	NSArray * results = [objContext executeFetchRequest:request error:&error];
+
+	return results;
+}
+
+
 /* -----------------------------------------------------------------------------
 	Delete the soup entry with the given id.
 	Args:		inSoup
@@ -165,51 +208,136 @@ extern int	REPprintf(const char * inFormat, ...);
 	NSArray * results = [objContext executeFetchRequest:request error:&error];
 
 	if (results.count > 0)
+	{
 		[objContext deleteObject:[results objectAtIndex:0]];
+		[self unindexEntryId:inId];
+	}
 }
 
 
 /* -----------------------------------------------------------------------------
-	Remove entries from a soup whose _uniqueId does not exist in the given set
-	of NSNumbers.
+	Remove entries from a soup whose _uniqueId does not exist in the given set.
 	This enables our NCSoup to be pruned to match a Newton soup.
-	Args:		inSoup
-				inSet
+	We fetch only the uniqueId and objectID of our entries, in uniqueId order,
+	and remove the Newton’s ids from ours; what is left is deleted in one
+	batch, in the store, without the entries being faulted in. The deletions
+	are then merged into our context and the document’s main context.
+	Entries imported on the desktop (id >= kImportIdBase) are never pruned.
+	Args:		inSet
+				inMainContext	the document’s main context, if not ours
 	Return:	--
 ----------------------------------------------------------------------------- */
 
-- (void) cropTo: (NSIndexSet *) indexSet
+- (void) cropTo: (NSIndexSet *) indexSet mainContext: (NSManagedObjectContext *) inMainContext
 {
-	// first create a set of NSNumber*s from the indexSet
-	NSMutableSet * theSet = [NSMutableSet setWithCapacity:[indexSet count]];
-	NSUInteger uid;
-	for (uid = [indexSet firstIndex]; uid != NSNotFound; uid = [indexSet indexGreaterThanIndex:uid])
-	{
-		[theSet addObject:[NSNumber numberWithUnsignedInteger:uid]];
-	}
-//NSLog(@" cropping to ids: %@", theSet);
+	[self cropToIds:[[NCIdSet alloc] initWithIndexSet:indexSet] mainContext:inMainContext];
+}
+
 
+- (void) cropToIds: (NCIdSet *) inSet mainContext: (NSManagedObjectContext *) inMainContext
+{
 	NSManagedObjectContext * objContext = [self managedObjectContext];
+
+	NSExpressionDescription * objectIdDesc = [[NSExpressionDescription alloc] init];
+	objectIdDesc.name = @"objectID";
+	objectIdDesc.expression = [NSExpression expressionForEvaluatedObject];
+	objectIdDesc.expressionResultType = NSObjectIDAttributeType;
+
 	NSFetchRequest * request = [[NSFetchRequest alloc] init];
 	[request setEntity:[NSEntityDescription entityForName:@"Entry" inManagedObjectContext:objContext]];
-	[request setPredicate:[NSPredicate predicateWithFormat:@"soup = %@ AND uniqueId < %@ AND NOT uniqueId IN %@", self, [NSNumber numberWithUnsignedInt:kImportIdBase], theSet]];
+	[request setPredicate:[NSPredicate predicateWithFormat:@"soup = %@ AND uniqueId < %@", self, [NSNumber numberWithUnsignedInt:kImportIdBase]]];
+	[request setSortDescriptors:@[[[NSSortDescriptor alloc] initWithKey:@"uniqueId" ascending:YES]]];
+	[request setResultType:NSDictionaryResultType];
+	[request setPropertiesToFetch:@[@"uniqueId", objectIdDesc]];
 
 	NSError *__autoreleasing error = nil;
 	NSArray * results = [objContext executeFetchRequest:request error:&error];
-//NSLog(@" found entries: %@", results);
 
-	// we now have an array of entries that have an id NOT in the given set; ie thay no longer exist in the set
-	if (results.count > 0)
+	NCIdSet * localIds = [[NCIdSet alloc] init];
+	for (NSDictionary * item in results)
+		[localIds addId:[item[@"uniqueId"] unsignedIntegerValue]];
+	NCIdSet * goneIds = [localIds setByRemovingIds:inSet];
+	if (goneIds.count == 0)
+		return;
+
+	// pick out the objectIDs of ids that are no longer on the Newton
+	const NCIdRange * run = goneIds.runs;
+	const NCIdRange * lastRun = run + goneIds.numOfRuns;
+	NSMutableArray * deletions = [NSMutableArray arrayWithCapacity:goneIds.count];
+	for (NSDictionary * item in results)
 	{
-		for (NCEntry * entry in results)
+		NSUInteger uid = [item[@"uniqueId"] unsignedIntegerValue];
+		while (run < lastRun && run->first + run->count <= uid)
+			run++;
+		if (run == lastRun)
+			break;
+		if (uid >= run->first)
 		{
 FULL_LOG {
-	//NSLog(@" pruning %@", entry);
-	REPprintf("\npruning entry id = %u", [entry.uniqueId unsignedIntValue]);
+	REPprintf("\npruning entry id = %u", (unsigned int)uid);
 }
-			[self removeEntriesObject:entry];
+			[deletions addObject:item[@"objectID"]];
+			[self unindexEntryId:uid];
 		}
 	}
+
+	NSBatchDeleteRequest * deleteRequest = [[NSBatchDeleteRequest alloc] initWithObjectIDs:deletions];
+	deleteRequest.resultType = NSBatchDeleteResultTypeObjectIDs;
+	NSBatchDeleteResult * deleteResult = [objContext executeRequest:deleteRequest error:&error];
+	if (deleteResult == nil)
+	{
+		NSLog(@"crop error: %@", error.description);
+		return;
+	}
+
+	NSDictionary * changes = @{ NSDeletedObjectsKey:deleteResult.result };
+	[NSManagedObjectContext mergeChangesFromRemoteContextSave:changes intoContexts:@[objContext]];
+	if (inMainContext != nil && inMainContext != objContext)
+	{
+		if (NSThread.isMainThread)
+			[NSManagedObjectContext mergeChangesFromRemoteContextSave:changes intoContexts:@[inMainContext]];
+		else
+			dispatch_sync(dispatch_get_main_queue(), ^{
+				[NSManagedObjectContext mergeChangesFromRemoteContextSave:changes intoContexts:@[inMainContext]];
+			});
+	}
+}
+
+
+/* -----------------------------------------------------------------------------
+	Compress an entry’s NSOF data with the soup’s dictionary, if it has one.
+	See -[NCSoup(ref) trainDictionary].
+	Args:		inData			NSOF data
+	Return:	data to store
+----------------------------------------------------------------------------- */
+
+- (NSData *) encodeRefData: (NSData *) inData
+{
+	uint32_t dictId = self.dictionaryId.unsignedIntValue;
+	if (dictId == 0)
+		return inData;
+	return CompressRefData(inData, self.dictionary, dictId);
+}
+
+
+/* -----------------------------------------------------------------------------
+	Recover an entry’s NSOF data as stored.
+	Args:		inData			stored data
+	Return:	NSOF data
+				nil => the data was compressed with a dictionary we don’t have
+----------------------------------------------------------------------------- */
+
+- (NSData *) decodeRefData: (NSData *) inData
+{
+	if (!IsCompressedRefData(inData))
+		return inData;
+	uint32_t dictId = CompressedRefDataDictionaryId(inData);
+	if (dictId != self.dictionaryId.unsignedIntValue)
+	{
+		NSLog(@"soup %@ has no dictionary %08X to decompress entry", self.name, dictId);
+		return nil;
+	}
+	return DecompressRefData(inData, self.dictionary);
 }
 
 @end
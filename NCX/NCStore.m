@@ -8,6 +8,7 @@
 */
 
 #import "NCStore.h"
+#import "SortKey.h"
 
 #define KByte 1024
 
@@ -141,7 +142,7 @@ extern NSNumberFormatter * gNumberFormatter;
 	[request setEntity:[NSEntityDescription entityForName:@"Entry" inManagedObjectContext:objContext]];
 	[request setPredicate:[NSPredicate predicateWithFormat:@"soup.store = %@ AND soup.app.name = 'Packages'", self]];
 
-	NSSortDescriptor * sorter = [[NSSortDescriptor alloc] initWithKey:@"title" ascending:YES];
+	NSSortDescriptor * sorter = [[NSSortDescriptor alloc] initWithKey:kTitleSortKey ascending:YES];
 	[request setSortDescriptors:[NSArray arrayWithObject:sorter]];
 
 	NSError *__autoreleasing error = nil;
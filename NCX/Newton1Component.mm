@@ -322,7 +322,7 @@ FULL_LOG {
 
 							if (lastSyncTime != 0 && result != kDOperationCanceled) {
 	/* ---- delete entries locally that were deleted from Newton ---- */
-								[soupObj cropTo:allIds];
+								[soupObj cropTo:allIds mainContext:document.managedObjectContext];
 
 	/* ---- delete entries that were deleted locally ---- */
 								NSIndexSet * localIds = soupObj.currIds;
@@ -29,6 +29,11 @@
 // Security
 #define kPasswordPref			@"Password"
 
+// Transfer
+#define kSaveBatchEntriesPref	@"SaveBatchEntries"
+#define kSaveBatchBytesPref	@"SaveBatchBytes"
+#define kVolatileSlotsPref		@"VolatileSlots"
+
 // Software Update
 #define kAutoUpdatePref			@"SUPerformScheduledCheck"
 #define kUpdateFreqPref			@"SUScheduledCheckInterval"
@@ -40,6 +45,11 @@
 // Debug
 #define kLogToFilePref			@"LogToFile"
 #define kLogLevelPref			@"LogLevel"
+#define kCaptureIOPref			@"CaptureIO"
+#define kTraceIOPref			@"TraceIO"
+#define kDecodeTracePref		@"DecodeTrace"
+#define kBenchmarkPref			@"Benchmark"
+#define kSimulatorPref			@"Simulator"
 
 
 // Not preference keys:
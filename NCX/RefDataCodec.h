@@ -0,0 +1,38 @@
+/*
+	File:		RefDataCodec.h
+
+	Contains:	Compression of soup entry NSOF data with a dictionary trained on
+					the entries of its soup.
+
+	Written by:	Newton Research Group, 2026.
+*/
+
+#import <Foundation/Foundation.h>
+
+/* -----------------------------------------------------------------------------
+	Entries in a soup share most of their NSOF: slot and class symbols, frame
+	maps, style runs. A dictionary of the byte runs that recur across a sample of
+	entries is given to deflate as a preset dictionary, so each entry can refer
+	to it rather than spell it out again.
+	Compressed data starts with a RefDataHeader; NSOF data always starts with
+	its version byte, 2, so the two can be told apart.
+	The header is in host byte order.
+----------------------------------------------------------------------------- */
+
+#define kRefDataDictionarySize	(32*1024)	// largest deflate window
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern BOOL			IsCompressedRefData(NSData * inData);
+extern uint32_t	CompressedRefDataDictionaryId(NSData * inData);
+extern NSData *	CompressRefData(NSData * inData, NSData * inDictionary, uint32_t inDictionaryId);
+extern NSData *	DecompressRefData(NSData * inData, NSData * inDictionary);
+
+extern NSData *	TrainRefDataDictionary(NSArray * inSamples);
+extern uint32_t	RefDataDictionaryId(NSData * inDictionary);
+
+#ifdef __cplusplus
+}
+#endif
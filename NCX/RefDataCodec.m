@@ -0,0 +1,306 @@
+/*
+	File:		RefDataCodec.m
+
+	Contains:	Compression of soup entry NSOF data with a dictionary trained on
+					the entries of its soup.
+
+	Written by:	Newton Research Group, 2026.
+*/
+
+#import "RefDataCodec.h"
+#import <zlib.h>
+
+/* -----------------------------------------------------------------------------
+	Compressed refData.
+		RefDataHeader
+		then raw deflate data, compressed with the soup’s dictionary
+----------------------------------------------------------------------------- */
+
+#define kRefDataMagic	0xCD
+#define kRefDataVersion	1
+
+typedef struct
+{
+	uint8_t	magic;
+	uint8_t	version;
+	uint16_t	reserved;
+	uint32_t	dictionaryId;
+	uint32_t	length;			// of the NSOF data
+} RefDataHeader;
+
+// dictionary training
+#define kGramSize			8			// bytes hashed as one gram
+#define kGramTableBits	18
+#define kSegmentSize		64			// unit of the dictionary
+
+
+BOOL
+IsCompressedRefData(NSData * inData)
+{
+	return inData.length > sizeof(RefDataHeader)
+		 && ((const RefDataHeader *)inData.bytes)->magic == kRefDataMagic;
+}
+
+
+uint32_t
+CompressedRefDataDictionaryId(NSData * inData)
+{
+	if (!IsCompressedRefData(inData))
+		return 0;
+	return ((const RefDataHeader *)inData.bytes)->dictionaryId;
+}
+
+
+/* -----------------------------------------------------------------------------
+	Compress NSOF data using a dictionary.
+	Args:		inData			NSOF data
+				inDictionary
+				inDictionaryId	recorded in the header
+	Return:	compressed data
+				inData => compression would not make it any smaller
+----------------------------------------------------------------------------- */
+
+NSData *
+CompressRefData(NSData * inData, NSData * inDictionary, uint32_t inDictionaryId)
+{
+	if (inData.length == 0 || inDictionary.length == 0 || IsCompressedRefData(inData))
+		return inData;
+
+	z_stream z;
+	memset(&z, 0, sizeof(z));
+	if (deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+		return inData;
+
+	NSData * result = inData;
+	if (deflateSetDictionary(&z, (const Bytef *)inDictionary.bytes, (uInt)inDictionary.length) == Z_OK)
+	{
+		// anything that won’t fit in the size of the original is no use to us
+		NSUInteger limit = inData.length;
+		uint8_t * buf = (uint8_t *)malloc(limit);
+		if (buf && limit > sizeof(RefDataHeader))
+		{
+			z.next_in = (Bytef *)inData.bytes;
+			z.avail_in = (uInt)inData.length;
+			z.next_out = buf + sizeof(RefDataHeader);
+			z.avail_out = (uInt)(limit - sizeof(RefDataHeader));
+			if (deflate(&z, Z_FINISH) == Z_STREAM_END)
+			{
+				RefDataHeader * header = (RefDataHeader *)buf;
+				header->magic = kRefDataMagic;
+				header->version = kRefDataVersion;
+				header->reserved = 0;
+				header->dictionaryId = inDictionaryId;
+				header->length = (uint32_t)inData.length;
+				result = [NSData dataWithBytesNoCopy:buf length:sizeof(RefDataHeader) + z.total_out freeWhenDone:YES];
+				buf = NULL;
+			}
+		}
+		if (buf)
+			free(buf);
+	}
+	deflateEnd(&z);
+	return result;
+}
+
+
+/* -----------------------------------------------------------------------------
+	Decompress NSOF data.
+	Args:		inData			compressed data
+				inDictionary	the dictionary it was compressed with
+	Return:	NSOF data
+				nil => the data is damaged or the dictionary is wrong
+----------------------------------------------------------------------------- */
+
+NSData *
+DecompressRefData(NSData * inData, NSData * inDictionary)
+{
+	if (!IsCompressedRefData(inData))
+		return inData;
+
+	const RefDataHeader * header = (const RefDataHeader *)inData.bytes;
+	if (header->version != kRefDataVersion || inDictionary.length == 0)
+		return nil;
+
+	z_stream z;
+	memset(&z, 0, sizeof(z));
+	if (inflateInit2(&z, -MAX_WBITS) != Z_OK)
+		return nil;
+
+	NSMutableData * result = nil;
+	// raw inflate takes its dictionary up front
+	if (inflateSetDictionary(&z, (const Bytef *)inDictionary.bytes, (uInt)inDictionary.length) == Z_OK)
+	{
+		result = [NSMutableData dataWithLength:header->length];
+		z.next_in = (Bytef *)inData.bytes + sizeof(RefDataHeader);
+		z.avail_in = (uInt)(inData.length - sizeof(RefDataHeader));
+		z.next_out = (Bytef *)result.mutableBytes;
+		z.avail_out = header->length;
+		if (inflate(&z, Z_FINISH) != Z_STREAM_END || z.total_out != header->length)
+			result = nil;
+	}
+	inflateEnd(&z);
+	return result;
+}
+
+
+/* -----------------------------------------------------------------------------
+	Train a dictionary.
+	Every kGramSize run of bytes is counted once for each sample it appears in.
+	The samples are cut into kSegmentSize segments, each scored by how common
+	its grams are; the best segments make up the dictionary. Once a segment is
+	chosen its grams score nothing, so the dictionary does not fill up with
+	copies of the same frame map.
+	deflate reaches the end of the dictionary most cheaply, so the best segments
+	go last.
+	Args:		inSamples		array of NSOF NSData
+	Return:	the dictionary
+				nil => there is nothing worth sharing
+----------------------------------------------------------------------------- */
+
+typedef struct
+{
+	const uint8_t *	bytes;
+	uint32_t			length;
+	uint32_t			score;
+} Segment;
+
+
+static inline uint32_t
+GramHash(const uint8_t * inBytes)
+{
+	uint64_t gram;
+	memcpy(&gram, inBytes, kGramSize);
+	return (uint32_t)((gram * 0x9E3779B97F4A7C15ULL) >> (64 - kGramTableBits));
+}
+
+
+static uint32_t
+SegmentScore(const uint32_t * inCounts, const Segment * inSegment)
+{
+	uint32_t score = 0;
+	for (uint32_t i = 0; i + kGramSize <= inSegment->length; ++i)
+	{
+		uint32_t count = inCounts[GramHash(inSegment->bytes + i)];
+		// a gram in only one sample is not worth sharing
+		if (count > 1)
+			score += count - 1;
+	}
+	return score;
+}
+
+
+static int
+CompareSegmentScores(const void * inA, const void * inB)
+{
+	uint32_t a = ((const Segment *)inA)->score;
+	uint32_t b = ((const Segment *)inB)->score;
+	return (a < b) - (a > b);
+}
+
+
+NSData *
+TrainRefDataDictionary(NSArray * inSamples)
+{
+	const size_t tableSize = 1 << kGramTableBits;
+	uint32_t * counts = (uint32_t *)calloc(tableSize, sizeof(uint32_t));
+	uint32_t * lastSample = (uint32_t *)calloc(tableSize, sizeof(uint32_t));
+	if (counts == NULL || lastSample == NULL)
+	{
+		free(counts);
+		free(lastSample);
+		return nil;
+	}
+
+	// count the samples each gram appears in
+	uint32_t sampleNo = 0;
+	size_t numOfSegments = 0;
+	for (NSData * sample in inSamples)
+	{
+		const uint8_t * bytes = (const uint8_t *)sample.bytes;
+		++sampleNo;
+		for (NSUInteger i = 0; i + kGramSize <= sample.length; ++i)
+		{
+			uint32_t h = GramHash(bytes + i);
+			if (lastSample[h] != sampleNo)
+			{
+				lastSample[h] = sampleNo;
+				counts[h]++;
+			}
+		}
+		numOfSegments += (sample.length + kSegmentSize - 1) / kSegmentSize;
+	}
+	free(lastSample);
+
+	// score each segment of each sample
+	Segment * segments = (Segment *)malloc(numOfSegments * sizeof(Segment));
+	size_t n = 0;
+	if (segments)
+	{
+		for (NSData * sample in inSamples)
+		{
+			const uint8_t * bytes = (const uint8_t *)sample.bytes;
+			for (NSUInteger offset = 0; offset + kGramSize <= sample.length; offset += kSegmentSize)
+			{
+				Segment * seg = &segments[n];
+				seg->bytes = bytes + offset;
+				seg->length = (uint32_t)MIN(kSegmentSize, sample.length - offset);
+				seg->score = SegmentScore(counts, seg);
+				if (seg->score > 0)
+					++n;
+			}
+		}
+		qsort(segments, n, sizeof(Segment), CompareSegmentScores);
+	}
+
+	// choose the best segments, rescoring each against the grams still unclaimed
+	const Segment ** chosen = (const Segment **)malloc((n > 0 ? n : 1) * sizeof(Segment *));
+	size_t numOfChosen = 0, dictSize = 0;
+	for (size_t i = 0; chosen && i < n && dictSize < kRefDataDictionarySize; ++i)
+	{
+		Segment * seg = &segments[i];
+		uint32_t score = SegmentScore(counts, seg);
+		// half its worth has already been taken by better segments
+		if (score == 0 || score < seg->score / 2)
+			continue;
+		for (uint32_t j = 0; j + kGramSize <= seg->length; ++j)
+			counts[GramHash(seg->bytes + j)] = 0;
+		seg->length = MIN(seg->length, (uint32_t)(kRefDataDictionarySize - dictSize));
+		chosen[numOfChosen++] = seg;
+		dictSize += seg->length;
+	}
+	free(counts);
+
+	NSMutableData * dictionary = nil;
+	if (dictSize > 0)
+	{
+		dictionary = [NSMutableData dataWithCapacity:dictSize];
+		while (numOfChosen > 0)
+		{
+			const Segment * seg = chosen[--numOfChosen];
+			[dictionary appendBytes:seg->bytes length:seg->length];
+		}
+	}
+	free(chosen);
+	free(segments);
+	return dictionary;
+}
+
+
+/* -----------------------------------------------------------------------------
+	Identify a dictionary by its content: the FNV-1a hash of its bytes.
+	Args:		inDictionary
+	Return:	non-zero id
+----------------------------------------------------------------------------- */
+
+uint32_t
+RefDataDictionaryId(NSData * inDictionary)
+{
+	const uint8_t * p = (const uint8_t *)inDictionary.bytes;
+	uint32_t hash = 2166136261u;
+	for (NSUInteger i = 0; i < inDictionary.length; ++i)
+	{
+		hash ^= p[i];
+		hash *= 16777619u;
+	}
+	return hash != 0 ? hash : 1;
+}
@@ -0,0 +1,40 @@
+/*
+	File:		SortKey.h
+
+	Contains:	Binary sort keys for entry titles.
+
+	Written by:	Newton Research Group, 2026.
+*/
+
+#import <Foundation/Foundation.h>
+
+/* -----------------------------------------------------------------------------
+	A sort key is made once, when an entry is summarized, and stored with its
+	title; keys then sort with memcmp() -- by Core Data in the store or by
+	CompareSortKeys() in memory -- in the order a Newton string index would
+	sort the titles.
+	The key is the title folded as CompareUnicodeText() folds it -- combining
+	marks dropped, upper-cased without diacritics -- then a 0 separator, then
+	the title as it is, to order titles that fold alike. Characters are
+	big-endian so byte order is character order.
+	A bound is the folded part alone: it sorts before the key of every title
+	that folds the same, so it can start a range of titles. A limit is the bound
+	followed by 0x0001: it sorts after them, so it can end a range that includes
+	them.
+----------------------------------------------------------------------------- */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern NSData *				MakeSortKey(NSString * inText);
+extern NSData *				MakeSortKeyBound(NSString * inText);
+extern NSData *				MakeSortKeyLimit(NSString * inText);
+extern NSComparisonResult	CompareSortKeys(NSData * inKey1, NSData * inKey2);
+
+#ifdef __cplusplus
+}
+#endif
+
+// sort by this rather than by title
+#define kTitleSortKey @"titleKey"
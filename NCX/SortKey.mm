@@ -0,0 +1,116 @@
+/*
+	File:		SortKey.mm
+
+	Contains:	Binary sort keys for entry titles.
+
+	Written by:	Newton Research Group, 2026.
+*/
+
+#import "SortKey.h"
+#import "NewtonKit.h"
+#import <Newton/UStringUtils.h>
+
+
+/* -----------------------------------------------------------------------------
+	Make the sort key for some text.
+	Args:		inText
+	Return:	the key; empty for empty text
+----------------------------------------------------------------------------- */
+
+NSData *
+MakeSortKey(NSString * inText)
+{
+	static CFCharacterSetRef combiningMarks = NULL;
+	static dispatch_once_t once;
+	dispatch_once(&once, ^{
+		combiningMarks = CFCharacterSetGetPredefined(kCFCharacterSetNonBase);
+	});
+
+	NSUInteger length = inText.length;
+	if (length == 0)
+		return [NSData data];
+
+	// folded text, separator, text as is
+	NSMutableData * key = [NSMutableData dataWithLength:(2*length + 1) * sizeof(UniChar)];
+	UniChar * text = (UniChar *)key.mutableBytes + length + 1;
+	[inText getCharacters:text range:NSMakeRange(0, length)];
+
+	UniChar * folded = (UniChar *)key.mutableBytes;
+	ArrayIndex foldedLength = 0;
+	for (NSUInteger i = 0; i < length; ++i)
+	{
+		if (!CFCharacterSetIsCharacterMember(combiningMarks, text[i]))
+			folded[foldedLength++] = text[i];
+	}
+	UpperCaseNoDiacriticsText(folded, foldedLength);
+
+	// close up any gap left by dropped marks
+	if (foldedLength < length)
+	{
+		memmove(folded + foldedLength + 1, text, length * sizeof(UniChar));
+		text = folded + foldedLength + 1;
+	}
+	folded[foldedLength] = 0;
+
+	for (ArrayIndex i = 0; i < foldedLength; ++i)
+		folded[i] = CFSwapInt16HostToBig(folded[i]);
+	for (NSUInteger i = 0; i < length; ++i)
+		text[i] = CFSwapInt16HostToBig(text[i]);
+	key.length = (foldedLength + 1 + length) * sizeof(UniChar);
+	return key;
+}
+
+
+/* -----------------------------------------------------------------------------
+	Make the bound of a range of titles.
+	Args:		inText
+	Return:	the folded part of its sort key
+----------------------------------------------------------------------------- */
+
+NSData *
+MakeSortKeyBound(NSString * inText)
+{
+	NSData * key = MakeSortKey(inText);
+	const UniChar * folded = (const UniChar *)key.bytes;
+	NSUInteger length = key.length / sizeof(UniChar);
+	NSUInteger foldedLength = 0;
+	while (foldedLength < length && folded[foldedLength] != 0)
+		foldedLength++;
+	return [key subdataWithRange:NSMakeRange(0, foldedLength * sizeof(UniChar))];
+}
+
+
+/* -----------------------------------------------------------------------------
+	Make the limit of a range of titles.
+	Args:		inText
+	Return:	the bound followed by 0x0001 -- after the key of every title that
+				folds to the same bound, before any that folds to more
+----------------------------------------------------------------------------- */
+
+NSData *
+MakeSortKeyLimit(NSString * inText)
+{
+	NSMutableData * limit = [MakeSortKeyBound(inText) mutableCopy];
+	const UniChar after = CFSwapInt16HostToBig(0x0001);
+	[limit appendBytes:&after length:sizeof(UniChar)];
+	return limit;
+}
+
+
+/* -----------------------------------------------------------------------------
+	Compare sort keys in memory as the store compares them.
+	A missing key sorts first.
+	Args:		inKey1
+				inKey2
+	Return:	NSOrderedAscending etc
+----------------------------------------------------------------------------- */
+
+NSComparisonResult
+CompareSortKeys(NSData * inKey1, NSData * inKey2)
+{
+	NSUInteger len1 = inKey1.length, len2 = inKey2.length;
+	int result = MIN(len1, len2) > 0 ? memcmp(inKey1.bytes, inKey2.bytes, MIN(len1, len2)) : 0;
+	if (result == 0)
+		result = (len1 > len2) - (len1 < len2);
+	return result < 0 ? NSOrderedAscending : (result > 0 ? NSOrderedDescending : NSOrderedSame);
+}
@@ -0,0 +1,144 @@
+/*
+	File:		SoupQuery.h
+
+	Contains:	Newton soup queries run against the entries stored in a document.
+
+	Written by:	Newton Research Group, 2026.
+*/
+
+#import <set>
+#import <string>
+#import <unordered_map>
+#import <vector>
+#import "NCDocument.h"
+#import "NSOFReader.h"
+
+
+/* -----------------------------------------------------------------------------
+	S o u p K e y
+	A key value held without Refs, so keys can be kept for every entry without
+	holding on to the Newton heap. A multi-slot key has a part for each slot.
+----------------------------------------------------------------------------- */
+
+struct SoupKeyPart
+{
+	int				type;			// kSoupKeyString etc
+	double			number;		// int or real
+	std::u16string	text;			// string, char or symbol
+};
+
+typedef std::vector<SoupKeyPart> SoupKey;
+
+extern bool	MakeSoupKey(RefArg inValue, const std::vector<int> & inTypes, SoupKey & outKey);
+extern int	CompareSoupKeys(const SoupKey & inKey1, const SoupKey & inKey2);
+
+
+/* -----------------------------------------------------------------------------
+	C S o u p I n d e x
+	A local copy of one of a soup’s indexes, built from its index description:
+		{ structure: 'slot, path: 'name, type: 'string }
+		{ structure: 'multiSlot, path: ['date, 'name], type: ['int, 'string] }
+		{ structure: 'slot, path: 'labels, type: 'tags }
+	Entries are kept in key order, ties broken by uniqueId, as on the Newton.
+	Strings compare as CompareUnicodeText() compares them; symbols ignore case.
+	Entries whose key slot is missing or of the wrong type are not in the index.
+	A tags index instead keeps the tags of each entry.
+----------------------------------------------------------------------------- */
+
+class CSoupIndex
+{
+public:
+	struct Item
+	{
+		SoupKey		key;
+		uint32_t		id;
+	};
+	struct ItemLess
+	{
+		typedef void is_transparent;	// so the set can be searched by key alone
+		bool operator()(const Item & inItem1, const Item & inItem2) const;
+		bool operator()(const Item & inItem, const SoupKey & inKey) const;
+		bool operator()(const SoupKey & inKey, const Item & inItem) const;
+	};
+	typedef std::set<Item, ItemLess> Items;
+
+					CSoupIndex();			// the _uniqueId index every soup has
+					CSoupIndex(RefArg inDesc);
+					~CSoupIndex();
+
+	bool			isValid(void) const;
+	bool			isTags(void) const;
+	bool			hasPath(RefArg inPath) const;
+	const std::vector<int> &	types(void) const;
+
+	void			add(uint32_t inId, CNSOFReader & inReader, NSData * inData, RefVar & ioFrame);
+	void			remove(uint32_t inId);
+
+	const Items &	items(void) const;
+	Items::const_iterator	find(const SoupKey & inKey, bool inAfter) const;
+	const std::vector<std::string> *	tagsOf(uint32_t inId) const;
+
+private:
+	Ref			valueAt(ArrayIndex inPart, CNSOFReader & inReader, NSData * inData, RefVar & ioFrame) const;
+
+	RefStruct	fPaths;				// array, one path per key part
+	std::vector<int>			fTypes;
+	std::vector<std::string>	fSlotPaths;	// dotted, for CNSOFReader; empty => unflatten
+	bool			fIsValid;
+	bool			fIsUniqueId;
+	bool			fIsTags;
+
+	Items			fItems;
+	std::unordered_map<uint32_t, SoupKey>	fKeys;
+	std::unordered_map<uint32_t, std::vector<std::string> >	fTags;
+};
+
+inline bool	CSoupIndex::isValid(void) const { return fIsValid; }
+inline bool	CSoupIndex::isTags(void) const { return fIsTags; }
+inline const std::vector<int> &	CSoupIndex::types(void) const { return fTypes; }
+inline const CSoupIndex::Items &	CSoupIndex::items(void) const { return fItems; }
+
+
+/* -----------------------------------------------------------------------------
+	N C S o u p C u r s o r
+	Steps through the entries matching a query spec, in index order, as NCCursor
+	does for a query on the Newton. The entries in range are found from the
+	index when the query is made; each is fetched as it is stepped onto.
+	validTest and indexValidTest functions are not supported -- they would need
+	the NewtonScript interpreter -- and are ignored.
+----------------------------------------------------------------------------- */
+
+@interface NCSoupCursor : NSObject
+
+- (unsigned int)countEntries;
+- (Ref)gotoKey:(RefArg)inKey;
+- (Ref)move:(int)inOffset;
+- (Ref)entry;
+- (Ref)next;
+- (Ref)prev;
+- (Ref)reset;
+- (Ref)resetToEnd;
+- (NSArray *)entryIds;
+
+@end
+
+
+/* -----------------------------------------------------------------------------
+	Queries on a soup.
+	The soup’s indexes are built from its index descriptions the first time it
+	is queried, then kept up to date as entries are stored and deleted -- see
+	-[NCSoup(TextIndex) indexEntryId:NSOFData:].
+	Like Query() on the Newton, -query: throws if the spec names an index the
+	soup does not have.
+----------------------------------------------------------------------------- */
+
+@interface NCSoup (Query)
+- (NCSoupCursor *)query:(RefArg)inSpec;
+- (void)indexQueryEntryId:(NSUInteger)inId NSOFData:(NSData *)inData;
+- (void)unindexQueryEntryId:(NSUInteger)inId;
+- (void)discardQueryIndexes;
+@end
+
+@interface NCDocument (Query)
+- (void)discardQueryIndexes;
+@end
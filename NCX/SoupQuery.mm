@@ -0,0 +1,923 @@
+/*
+	File:		SoupQuery.mm
+
+	Contains:	Newton soup queries run against the entries stored in a document.
+
+	Written by:	Newton Research Group, 2026.
+*/
+
+#import "SoupQuery.h"
+#import "TextIndex.h"
+#import <algorithm>
+
+extern NSString *	MakeNSString(RefArg inStr);
+
+enum
+{
+	kSoupKeyNone,
+	kSoupKeyString,
+	kSoupKeyInt,
+	kSoupKeyReal,
+	kSoupKeyChar,
+	kSoupKeySymbol,
+	kSoupKeyTags
+};
+
+
+/* -----------------------------------------------------------------------------
+	S o u p K e y
+----------------------------------------------------------------------------- */
+
+static int
+KeyType(RefArg inType)
+{
+	if (EQ(inType, SYMA(string)))
+		return kSoupKeyString;
+	if (EQ(inType, SYMA(int)))
+		return kSoupKeyInt;
+	if (EQ(inType, SYMA(real)))
+		return kSoupKeyReal;
+	if (EQ(inType, SYMA(char)))
+		return kSoupKeyChar;
+	if (EQ(inType, SYMA(symbol)))
+		return kSoupKeySymbol;
+	if (EQ(inType, SYMA(tags)))
+		return kSoupKeyTags;
+	return kSoupKeyNone;
+}
+
+
+static std::u16string
+SymbolText(Ref inSymbol)
+{
+	const char * name = SymbolName(inSymbol);
+	std::u16string text;
+	while (*name)
+		text.push_back((char16_t)(unsigned char)*name++);
+	return text;
+}
+
+
+/* -----------------------------------------------------------------------------
+	Make one part of a key from a slot value.
+	Args:		inValue
+				inType
+				outPart
+	Return:	true => the value has the type the index wants
+----------------------------------------------------------------------------- */
+
+static bool
+MakeSoupKeyPart(RefArg inValue, int inType, SoupKeyPart & outPart)
+{
+	outPart.type = inType;
+	outPart.number = 0;
+	outPart.text.clear();
+	switch (inType)
+	{
+	case kSoupKeyString:
+		if (IsString(inValue))
+		{
+			const UniChar * s = GetUString(inValue);
+			ArrayIndex len = Length(inValue) / sizeof(UniChar);
+			while (len > 0 && s[len-1] == 0)
+				len--;
+			outPart.text.assign((const char16_t *)s, len);
+			return true;
+		}
+		break;
+	case kSoupKeyInt:
+		if (ISINT(inValue))
+		{
+			outPart.number = RVALUE(inValue);
+			return true;
+		}
+		break;
+	case kSoupKeyReal:
+		if (ISINT(inValue) || IsReal(inValue))
+		{
+			outPart.number = CoerceToDouble(inValue);
+			return true;
+		}
+		break;
+	case kSoupKeyChar:
+		if (ISCHAR(inValue))
+		{
+			outPart.text.push_back((char16_t)RCHAR(inValue));
+			return true;
+		}
+		break;
+	case kSoupKeySymbol:
+		if (IsSymbol(inValue))
+		{
+			outPart.text = SymbolText(inValue);
+			return true;
+		}
+		break;
+	}
+	return false;
+}
+
+
+/* -----------------------------------------------------------------------------
+	Make a key from a slot value, or from an array of them for a multi-slot key.
+	A query key for a multi-slot index may have fewer parts than the index.
+	Args:		inValue
+				inTypes			type of each part
+				outKey
+	Return:	true => the value makes a key
+----------------------------------------------------------------------------- */
+
+bool
+MakeSoupKey(RefArg inValue, const std::vector<int> & inTypes, SoupKey & outKey)
+{
+	outKey.clear();
+	if (inTypes.size() == 1)
+	{
+		outKey.resize(1);
+		return MakeSoupKeyPart(inValue, inTypes[0], outKey[0]);
+	}
+	if (!IsArray(inValue))
+		return false;
+	ArrayIndex numOfParts = std::min((ArrayIndex)inTypes.size(), Length(inValue));
+	outKey.resize(numOfParts);
+	RefVar part;
+	for (ArrayIndex i = 0; i < numOfParts; ++i)
+	{
+		part = GetArraySlot(inValue, i);
+		if (!MakeSoupKeyPart(part, inTypes[i], outKey[i]))
+			return false;
+	}
+	return numOfParts > 0;
+}
+
+
+static int
+CompareSymbolText(const std::u16string & inText1, const std::u16string & inText2)
+{
+	size_t len = std::min(inText1.size(), inText2.size());
+	for (size_t i = 0; i < len; ++i)
+	{
+		char16_t c1 = inText1[i], c2 = inText2[i];
+		if (c1 >= 'A' && c1 <= 'Z')
+			c1 += 'a' - 'A';
+		if (c2 >= 'A' && c2 <= 'Z')
+			c2 += 'a' - 'A';
+		if (c1 != c2)
+			return c1 < c2 ? -1 : 1;
+	}
+	return (inText1.size() > len) - (inText2.size() > len);
+}
+
+
+/* -----------------------------------------------------------------------------
+	Compare keys part by part. A key that runs out of parts first compares equal,
+	so a partial key matches every key that begins with it.
+	Args:		inKey1
+				inKey2
+	Return:	<0, 0, >0
+----------------------------------------------------------------------------- */
+
+int
+CompareSoupKeys(const SoupKey & inKey1, const SoupKey & inKey2)
+{
+	size_t numOfParts = std::min(inKey1.size(), inKey2.size());
+	for (size_t i = 0; i < numOfParts; ++i)
+	{
+		const SoupKeyPart & part1 = inKey1[i];
+		const SoupKeyPart & part2 = inKey2[i];
+		int result = 0;
+		switch (part1.type)
+		{
+		case kSoupKeyString:
+		case kSoupKeyChar:
+			result = CompareUnicodeText((const UniChar *)part1.text.data(), (ArrayIndex)part1.text.size(),
+												 (const UniChar *)part2.text.data(), (ArrayIndex)part2.text.size());
+			break;
+		case kSoupKeySymbol:
+			result = CompareSymbolText(part1.text, part2.text);
+			break;
+		default:
+			result = (part1.number > part2.number) - (part1.number < part2.number);
+			break;
+		}
+		if (result != 0)
+			return result;
+	}
+	return 0;
+}
+
+
+/* -----------------------------------------------------------------------------
+	Paths.
+	A path is a slot symbol or a 'pathExpr array of them.
+----------------------------------------------------------------------------- */
+
+static bool
+IsPathExpr(RefArg inPath)
+{
+	return IsArray(inPath) && EQ(ClassOf(inPath), SYMA(pathExpr));
+}
+
+
+// the dotted form CNSOFReader wants; empty if the path has anything but symbols
+static std::string
+SlotPath(RefArg inPath)
+{
+	if (IsSymbol(inPath))
+		return SymbolName(inPath);
+	std::string path;
+	if (IsPathExpr(inPath))
+	{
+		RefVar element;
+		for (ArrayIndex i = 0, count = Length(inPath); i < count; ++i)
+		{
+			element = GetArraySlot(inPath, i);
+			if (!IsSymbol(element))
+				return std::string();
+			if (i > 0)
+				path += '.';
+			path += SymbolName(element);
+		}
+	}
+	return path;
+}
+
+
+static bool
+PathsEqual(RefArg inPath1, RefArg inPath2)
+{
+	if (IsSymbol(inPath1) && IsSymbol(inPath2))
+		return strcasecmp(SymbolName(inPath1), SymbolName(inPath2)) == 0;
+	std::string path1 = SlotPath(inPath1);
+	return !path1.empty() && strcasecmp(path1.c_str(), SlotPath(inPath2).c_str()) == 0;
+}
+
+
+// the value at a path in a frame; nil if any slot on the path is missing
+static Ref
+PathValue(RefArg inFrame, RefArg inPath)
+{
+	if (!IsPathExpr(inPath))
+		return IsFrame(inFrame) && IsSymbol(inPath) ? GetFrameSlot(inFrame, inPath) : NILREF;
+	RefVar obj(inFrame);
+	RefVar element;
+	for (ArrayIndex i = 0, count = Length(inPath); i < count && NOTNIL(obj); ++i)
+	{
+		element = GetArraySlot(inPath, i);
+		obj = IsFrame(obj) && IsSymbol(element) ? GetFrameSlot(obj, element) : NILREF;
+	}
+	return obj;
+}
+
+
+// tag symbols, folded to lower case
+static void
+GetTags(RefArg inValue, std::vector<std::string> & outTags)
+{
+	outTags.clear();
+	RefVar tag;
+	ArrayIndex count = IsArray(inValue) ? Length(inValue) : 1;
+	for (ArrayIndex i = 0; i < count; ++i)
+	{
+		tag = IsArray(inValue) ? GetArraySlot(inValue, i) : (Ref)inValue;
+		if (IsSymbol(tag))
+		{
+			std::string name(SymbolName(tag));
+			std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+			outTags.push_back(name);
+		}
+	}
+}
+
+
+/* -----------------------------------------------------------------------------
+	C S o u p I n d e x
+----------------------------------------------------------------------------- */
+
+bool
+CSoupIndex::ItemLess::operator()(const Item & inItem1, const Item & inItem2) const
+{
+	int result = CompareSoupKeys(inItem1.key, inItem2.key);
+	if (result == 0)
+		return inItem1.id < inItem2.id;
+	return result < 0;
+}
+
+bool
+CSoupIndex::ItemLess::operator()(const Item & inItem, const SoupKey & inKey) const
+{
+	return CompareSoupKeys(inItem.key, inKey) < 0;
+}
+
+bool
+CSoupIndex::ItemLess::operator()(const SoupKey & inKey, const Item & inItem) const
+{
+	return CompareSoupKeys(inKey, inItem.key) < 0;
+}
+
+
+CSoupIndex::CSoupIndex()
+	:	fIsValid(true), fIsUniqueId(true), fIsTags(false)
+{
+	fPaths = MakeArray(1);
+	SetArraySlot(fPaths, 0, SYMA(_uniqueId));
+	fTypes.push_back(kSoupKeyInt);
+	fSlotPaths.push_back("_uniqueId");
+}
+
+
+CSoupIndex::CSoupIndex(RefArg inDesc)
+	:	fIsValid(false), fIsUniqueId(false), fIsTags(false)
+{
+	RefVar structure(GetFrameSlot(inDesc, SYMA(structure)));
+	RefVar path(GetFrameSlot(inDesc, SYMA(path)));
+	RefVar type(GetFrameSlot(inDesc, SYMA(type)));
+
+	if (EQ(structure, SYMA(multiSlot)))
+	{
+		if (!IsArray(path) || !IsArray(type) || Length(path) != Length(type) || Length(path) == 0)
+			return;
+		fPaths = path;
+		for (ArrayIndex i = 0, count = Length(path); i < count; ++i)
+			fTypes.push_back(KeyType(GetArraySlot(type, i)));
+	}
+	else
+	{
+		fPaths = MakeArray(1);
+		SetArraySlot(fPaths, 0, path);
+		fTypes.push_back(KeyType(type));
+	}
+
+	for (ArrayIndex i = 0; i < fTypes.size(); ++i)
+	{
+		if (fTypes[i] == kSoupKeyNone)
+			return;
+		fSlotPaths.push_back(SlotPath(GetArraySlot(fPaths, i)));
+	}
+	fIsTags = (fTypes[0] == kSoupKeyTags);
+	fIsUniqueId = !fIsTags && fTypes.size() == 1 && PathsEqual(path, SYMA(_uniqueId));
+	fIsValid = true;
+}
+
+
+CSoupIndex::~CSoupIndex()
+{ }
+
+
+/* -----------------------------------------------------------------------------
+	Does a query’s indexPath name this index?
+	Args:		inPath			a path, or array of them for a multi-slot index
+	Return:	true => it does
+----------------------------------------------------------------------------- */
+
+bool
+CSoupIndex::hasPath(RefArg inPath) const
+{
+	if (fTypes.size() == 1)
+		return PathsEqual(GetArraySlot(fPaths, 0), inPath);
+	if (!IsArray(inPath) || IsPathExpr(inPath) || Length(inPath) != fTypes.size())
+		return false;
+	for (ArrayIndex i = 0; i < fTypes.size(); ++i)
+		if (!PathsEqual(GetArraySlot(fPaths, i), GetArraySlot(inPath, i)))
+			return false;
+	return true;
+}
+
+
+/* -----------------------------------------------------------------------------
+	Read the value of one key slot from an entry; only unflatten the entry if
+	the reader cannot get at it.
+	Args:		inPart
+				inReader			reader of the entry’s NSOF data
+				inData			the data
+				ioFrame			the whole entry, once unflattened
+	Return:	the slot value
+----------------------------------------------------------------------------- */
+
+Ref
+CSoupIndex::valueAt(ArrayIndex inPart, CNSOFReader & inReader, NSData * inData, RefVar & ioFrame) const
+{
+	RefVar value;
+	const std::string & slotPath = fSlotPaths[inPart];
+	if (!slotPath.empty() && inReader.getSlot(slotPath.c_str(), value))
+		return value;
+	if (ISNIL(ioFrame))
+	{
+		CPtrPipe pipe;
+		pipe.init((void *)inData.bytes, inData.length, NO, NULL);
+		ioFrame = UnflattenRef(pipe);
+	}
+	return PathValue(ioFrame, GetArraySlot(fPaths, inPart));
+}
+
+
+/* -----------------------------------------------------------------------------
+	Index an entry, replacing any earlier version of it.
+	Args:		inId
+				inReader			reader of the entry’s NSOF data
+				inData			the data
+				ioFrame			the whole entry, once unflattened
+	Return:	--
+----------------------------------------------------------------------------- */
+
+void
+CSoupIndex::add(uint32_t inId, CNSOFReader & inReader, NSData * inData, RefVar & ioFrame)
+{
+	remove(inId);
+
+	if (fIsTags)
+	{
+		RefVar value(valueAt(0, inReader, inData, ioFrame));
+		std::vector<std::string> tags;
+		GetTags(value, tags);
+		if (!tags.empty())
+			fTags[inId] = tags;
+		return;
+	}
+
+	Item item;
+	item.id = inId;
+	if (fIsUniqueId)
+	{
+		item.key.resize(1);
+		item.key[0].type = kSoupKeyInt;
+		item.key[0].number = inId;
+	}
+	else
+	{
+		item.key.resize(fTypes.size());
+		RefVar value;
+		for (ArrayIndex i = 0; i < fTypes.size(); ++i)
+		{
+			value = valueAt(i, inReader, inData, ioFrame);
+			if (!MakeSoupKeyPart(value, fTypes[i], item.key[i]))
+				return;
+		}
+	}
+	fKeys[inId] = item.key;
+	fItems.insert(item);
+}
+
+
+void
+CSoupIndex::remove(uint32_t inId)
+{
+	fTags.erase(inId);
+	auto key = fKeys.find(inId);
+	if (key == fKeys.end())
+		return;
+	Item item;
+	item.key = key->second;
+	item.id = inId;
+	fItems.erase(item);
+	fKeys.erase(key);
+}
+
+
+/* -----------------------------------------------------------------------------
+	Find the first item at or after a key.
+	Args:		inKey
+				inAfter			true => skip items whose key equals inKey
+	Return:	iterator
+----------------------------------------------------------------------------- */
+
+CSoupIndex::Items::const_iterator
+CSoupIndex::find(const SoupKey & inKey, bool inAfter) const
+{
+	return inAfter ? fItems.upper_bound(inKey) : fItems.lower_bound(inKey);
+}
+
+
+const std::vector<std::string> *
+CSoupIndex::tagsOf(uint32_t inId) const
+{
+	auto tags = fTags.find(inId);
+	return tags != fTags.end() ? &tags->second : NULL;
+}
+
+
+#pragma mark -
+/* -----------------------------------------------------------------------------
+	T a g S p e c
+	{ equal: [...], all: [...], any: [...], none: [...] }
+	Each may be a single tag rather than an array.
+----------------------------------------------------------------------------- */
+
+struct TagSpec
+{
+	bool		hasEqual;
+	std::vector<std::string>	equal, all, any, none;
+
+	TagSpec(RefArg inSpec);
+	bool		matches(const std::vector<std::string> * inTags) const;
+};
+
+
+TagSpec::TagSpec(RefArg inSpec)
+{
+	RefVar tags(GetFrameSlot(inSpec, SYMA(equal)));
+	hasEqual = NOTNIL(tags);
+	GetTags(tags, equal);
+	tags = GetFrameSlot(inSpec, SYMA(all));
+	GetTags(tags, all);
+	tags = GetFrameSlot(inSpec, SYMA(any));
+	GetTags(tags, any);
+	tags = GetFrameSlot(inSpec, SYMA(none));
+	GetTags(tags, none);
+}
+
+
+bool
+TagSpec::matches(const std::vector<std::string> * inTags) const
+{
+	static const std::vector<std::string> noTags;
+	const std::vector<std::string> & tags = inTags ? *inTags : noTags;
+	auto has = [&tags](const std::string & inTag) { return std::find(tags.begin(), tags.end(), inTag) != tags.end(); };
+
+	if (hasEqual)
+	{
+		if (!std::all_of(equal.begin(), equal.end(), has))
+			return false;
+		for (const std::string & tag : tags)
+			if (std::find(equal.begin(), equal.end(), tag) == equal.end())
+				return false;
+	}
+	if (!std::all_of(all.begin(), all.end(), has))
+		return false;
+	if (!any.empty() && !std::any_of(any.begin(), any.end(), has))
+		return false;
+	return std::none_of(none.begin(), none.end(), has);
+}
+
+
+#pragma mark -
+/* -----------------------------------------------------------------------------
+	N C Q u e r y I n d e x e s
+	The indexes of one soup, shared like its NCTextIndex by every managed object
+	context that has the soup. Lock it while using its indexes.
+----------------------------------------------------------------------------- */
+
+// soup objectID -> NCQueryIndexes
+static NSMutableDictionary * gQueryIndexes;
+
+@interface NCQueryIndexes : NSObject
+{
+@public
+	std::vector<CSoupIndex *> indexes;
+}
+- (void)addEntryId:(NSUInteger)inId NSOFData:(NSData *)inData;
+- (void)removeEntryId:(NSUInteger)inId;
+- (CSoupIndex *)indexWithPath:(RefArg)inPath;
+- (CSoupIndex *)tagsIndex;
+@end
+
+
+@implementation NCQueryIndexes
+
+- (void)dealloc {
+	for (CSoupIndex * index : indexes)
+		delete index;
+}
+
+
+- (void)addEntryId:(NSUInteger)inId NSOFData:(NSData *)inData {
+	@synchronized(self) {
+		// reading the entry may throw; catch it here so the lock is released
+		newton_try
+		{
+			CNSOFReader reader(inData.bytes, inData.length);
+			RefVar frame;
+			for (CSoupIndex * index : indexes)
+				index->add((uint32_t)inId, reader, inData, frame);
+		}
+		newton_catch_all
+		{
+			for (CSoupIndex * index : indexes)
+				index->remove((uint32_t)inId);
+		}
+		end_try;
+	}
+}
+
+
+- (void)removeEntryId:(NSUInteger)inId {
+	@synchronized(self) {
+		for (CSoupIndex * index : indexes)
+			index->remove((uint32_t)inId);
+	}
+}
+
+
+- (CSoupIndex *)indexWithPath:(RefArg)inPath {
+	for (CSoupIndex * index : indexes)
+		if (ISNIL(inPath) ? index->hasPath(SYMA(_uniqueId)) : (!index->isTags() && index->hasPath(inPath)))
+			return index;
+	return NULL;
+}
+
+
+- (CSoupIndex *)tagsIndex {
+	for (CSoupIndex * index : indexes)
+		if (index->isTags())
+			return index;
+	return NULL;
+}
+
+@end
+
+
+#pragma mark -
+/* -----------------------------------------------------------------------------
+	N C S o u p C u r s o r
+----------------------------------------------------------------------------- */
+
+@interface NCSoupCursor ()
+{
+	NCSoup * soup;
+	std::vector<CSoupIndex::Item> items;	// entries matching the query, in index order
+	std::vector<int> keyTypes;
+	long position;
+}
+- (id)initWithSoup:(NCSoup *)inSoup keyTypes:(const std::vector<int> &)inTypes;
+- (std::vector<CSoupIndex::Item> &)items;
+@end
+
+
+@implementation NCSoupCursor
+
+- (id)initWithSoup:(NCSoup *)inSoup keyTypes:(const std::vector<int> &)inTypes {
+	if (self = [super init]) {
+		soup = inSoup;
+		keyTypes = inTypes;
+		position = 0;
+	}
+	return self;
+}
+
+
+- (std::vector<CSoupIndex::Item> &)items {
+	return items;
+}
+
+
+- (unsigned int)countEntries {
+	return (unsigned int)items.size();
+}
+
+
+/* -----------------------------------------------------------------------------
+	Move to the first entry whose key is at or after a key.
+	Args:		inKey
+	Return:	the entry; NILREF => none
+----------------------------------------------------------------------------- */
+
+- (Ref)gotoKey:(RefArg)inKey {
+	SoupKey key;
+	if (!MakeSoupKey(inKey, keyTypes, key))
+		return NILREF;
+	auto item = std::lower_bound(items.begin(), items.end(), key, [](const CSoupIndex::Item & i, const SoupKey & k) { return CompareSoupKeys(i.key, k) < 0; });
+	position = item - items.begin();
+	return [self entry];
+}
+
+
+- (Ref)move:(int)inOffset {
+	position = std::max(-1L, std::min((long)items.size(), position + inOffset));
+	return [self entry];
+}
+
+
+- (Ref)entry {
+	if (position < 0 || position >= (long)items.size())
+		return NILREF;
+	return [soup entryWithId:items[position].id];
+}
+
+
+- (Ref)next {
+	return [self move:1];
+}
+
+
+- (Ref)prev {
+	return [self move:-1];
+}
+
+
+- (Ref)reset {
+	position = 0;
+	return [self entry];
+}
+
+
+- (Ref)resetToEnd {
+	position = (long)items.size() - 1;
+	return [self entry];
+}
+
+
+/* -----------------------------------------------------------------------------
+	Return the ids of all the matching entries without fetching them.
+	Args:		--
+	Return:	NSArray of NSNumber, in index order
+----------------------------------------------------------------------------- */
+
+- (NSArray *)entryIds {
+	NSMutableArray * ids = [NSMutableArray arrayWithCapacity:items.size()];
+	for (const CSoupIndex::Item & item : items)
+		[ids addObject:[NSNumber numberWithUnsignedInt:item.id]];
+	return ids;
+}
+
+@end
+
+
+#pragma mark -
+/* -----------------------------------------------------------------------------
+	N C S o u p
+----------------------------------------------------------------------------- */
+
+@implementation NCSoup (Query)
+
+/* -----------------------------------------------------------------------------
+	Return the soup’s query indexes, building them if need be.
+	Every soup has a _uniqueId index even if its index descriptions don’t say so.
+	Args:		--
+	Return:	the indexes
+----------------------------------------------------------------------------- */
+
+- (NCQueryIndexes *)queryIndexes {
+	NSManagedObjectID * soupId = self.objectID;
+	NCQueryIndexes * queryIndexes;
+	@synchronized(NCQueryIndexes.class) {
+		queryIndexes = gQueryIndexes[soupId];
+	}
+	if (queryIndexes)
+		return queryIndexes;
+
+	queryIndexes = [[NCQueryIndexes alloc] init];
+	RefVar descs(self.indexArray);
+	RefVar desc;
+	for (ArrayIndex i = 0, count = IsArray(descs) ? Length(descs) : 0; i < count; ++i) {
+		desc = GetArraySlot(descs, i);
+		if (!IsFrame(desc))
+			continue;
+		CSoupIndex * index = new CSoupIndex(desc);
+		if (index->isValid())
+			queryIndexes->indexes.push_back(index);
+		else
+			delete index;
+	}
+	if ([queryIndexes indexWithPath:RA(NILREF)] == NULL)
+		queryIndexes->indexes.push_back(new CSoupIndex());
+
+	[self enumerateEntryDataUsingBlock:^(NSUInteger inId, NSData * inData) {
+		if (inData)
+			[queryIndexes addEntryId:inId NSOFData:inData];
+		else
+			[queryIndexes removeEntryId:inId];
+	}];
+
+	if (!soupId.isTemporaryID) {
+		@synchronized(NCQueryIndexes.class) {
+			if (gQueryIndexes == nil)
+				gQueryIndexes = [[NSMutableDictionary alloc] init];
+			// another context may have beaten us to it
+			if (gQueryIndexes[soupId])
+				queryIndexes = gQueryIndexes[soupId];
+			else
+				gQueryIndexes[soupId] = queryIndexes;
+		}
+	}
+	return queryIndexes;
+}
+
+
+/* -----------------------------------------------------------------------------
+	Query the soup.
+	The spec is as for Query() on the Newton:
+		indexPath						path of the index to use; default _uniqueId
+		beginKey, beginExclKey		start of the range of keys
+		endKey, endExclKey			end of the range
+		tagSpec							{ equal:, all:, any:, none: }
+		words, entireWords			strings the entry must contain
+	Only the entries in the key range are visited; tags and words filter them.
+	Args:		inSpec
+	Return:	a cursor over the matching entries
+----------------------------------------------------------------------------- */
+
+- (NCSoupCursor *)query:(RefArg)inSpec {
+	NCQueryIndexes * queryIndexes = [self queryIndexes];
+
+	// words are found from the text index, as word-beginnings unless entireWords
+	NSIndexSet * wordIds = nil;
+	RefVar words(GetFrameSlot(inSpec, SYMA(words)));
+	if (NOTNIL(words)) {
+		BOOL isEntire = NOTNIL(GetFrameSlot(inSpec, SYMA(entireWords)));
+		NSMutableString * textQuery = [NSMutableString string];
+		RefVar word;
+		for (ArrayIndex i = 0, count = IsArray(words) ? Length(words) : 1; i < count; ++i) {
+			word = IsArray(words) ? GetArraySlot(words, i) : (Ref)words;
+			if (IsString(word))
+				[textQuery appendFormat:isEntire ? @"%@ " : @"%@* ", MakeNSString(word)];
+		}
+		wordIds = [self entryIdsMatchingText:textQuery];
+	}
+
+	// read the spec and find the indexes before taking the lock -- a Newton
+	// exception would longjmp out of @synchronized without releasing it
+	// (the set of indexes is fixed once built; only their contents change)
+	RefVar indexPath(GetFrameSlot(inSpec, SYMA(indexPath)));
+	CSoupIndex * index = [queryIndexes indexWithPath:indexPath];
+	if (index == NULL)
+		ThrowErr(exStore, kNSErrNoSuchIndex);
+
+	RefVar tagSpecRef(GetFrameSlot(inSpec, SYMA(tagSpec)));
+	CSoupIndex * tagsIndex = NULL;
+	if (NOTNIL(tagSpecRef) && (tagsIndex = [queryIndexes tagsIndex]) == NULL)
+		ThrowErr(exStore, kNSErrNoSuchIndex);
+	TagSpec tagSpec(tagSpecRef);
+
+	// the range of keys
+	SoupKey beginKey, endKey;
+	bool hasBegin = false, isBeginExcl = false, hasEnd = false, isEndExcl = false;
+	RefVar key(GetFrameSlot(inSpec, SYMA(beginExclKey)));
+	if (NOTNIL(key) && MakeSoupKey(key, index->types(), beginKey))
+		hasBegin = isBeginExcl = true;
+	else if (NOTNIL(key = GetFrameSlot(inSpec, SYMA(beginKey))) && MakeSoupKey(key, index->types(), beginKey))
+		hasBegin = true;
+	key = GetFrameSlot(inSpec, SYMA(endExclKey));
+	if (NOTNIL(key) && MakeSoupKey(key, index->types(), endKey))
+		hasEnd = isEndExcl = true;
+	else if (NOTNIL(key = GetFrameSlot(inSpec, SYMA(endKey))) && MakeSoupKey(key, index->types(), endKey))
+		hasEnd = true;
+
+	NCSoupCursor * cursor = [[NCSoupCursor alloc] initWithSoup:self keyTypes:index->types()];
+	std::vector<CSoupIndex::Item> & items = cursor.items;
+	@synchronized(queryIndexes) {
+		CSoupIndex::Items::const_iterator first = hasBegin ? index->find(beginKey, isBeginExcl) : index->items().begin();
+		CSoupIndex::Items::const_iterator last = hasEnd ? index->find(endKey, !isEndExcl) : index->items().end();
+		// an empty range if the end comes before the beginning
+		if (first == index->items().end() || (last != index->items().end() && CSoupIndex::ItemLess()(*last, *first)))
+			last = first;
+		for (auto item = first; item != last; ++item) {
+			if (tagsIndex && !tagSpec.matches(tagsIndex->tagsOf(item->id)))
+				continue;
+			if (wordIds && ![wordIds containsIndex:item->id])
+				continue;
+			items.push_back(*item);
+		}
+	}
+	return cursor;
+}
+
+
+/* -----------------------------------------------------------------------------
+	Keep the soup’s query indexes, if it has any, up to date.
+	Args:		inId
+				inData			NSOF data
+	Return:	--
+----------------------------------------------------------------------------- */
+
+- (void)indexQueryEntryId:(NSUInteger)inId NSOFData:(NSData *)inData {
+	NCQueryIndexes * queryIndexes;
+	@synchronized(NCQueryIndexes.class) {
+		queryIndexes = gQueryIndexes[self.objectID];
+	}
+	[queryIndexes addEntryId:inId NSOFData:inData];
+}
+
+
+- (void)unindexQueryEntryId:(NSUInteger)inId {
+	NCQueryIndexes * queryIndexes;
+	@synchronized(NCQueryIndexes.class) {
+		queryIndexes = gQueryIndexes[self.objectID];
+	}
+	[queryIndexes removeEntryId:inId];
+}
+
+
+// the soup’s index descriptions have changed
+- (void)discardQueryIndexes {
+	@synchronized(NCQueryIndexes.class) {
+		[gQueryIndexes removeObjectForKey:self.objectID];
+	}
+}
+
+@end
+
+
+@implementation NCDocument (Query)
+
+- (void)discardQueryIndexes {
+	NSPersistentStoreCoordinator * coordinator = self.objContext.persistentStoreCoordinator;
+	@synchronized(NCQueryIndexes.class) {
+		NSMutableArray * soupIds = [NSMutableArray array];
+		for (NSManagedObjectID * soupId in gQueryIndexes)
+			if (soupId.persistentStore.persistentStoreCoordinator == coordinator)
+				[soupIds addObject:soupId];
+		[gQueryIndexes removeObjectsForKeys:soupIds];
+	}
+}
+
+@end
@@ -20,10 +20,12 @@
 {
 	IBOutlet NCArrayController * _entries;
 	IBOutlet NSTableView * _tableView;
+	IBOutlet NSSearchField * _searchField;
 }
 @property(readonly) NCSoup * soup;
 @property(readonly) NCArrayController * entries;
 
 - (void) import: (NSArray *) inURLs;
+- (IBAction) search: (id) sender;
 
 @end
@@ -12,6 +12,9 @@
 #import "NCXPlugIn.h"
 #import "PreferenceKeys.h"
 #import "Utilities.h"
+#import "SortKey.h"
+#import "TextIndex.h"
+#import "SoupQuery.h"
 
 extern NSDateFormatter * gDateFormatter;
 
@@ -20,6 +23,7 @@ extern NSDateFormatter * gDateFormatter;
 	N C S o u p V i e w C o n t r o l l e r
 	The Soup Info view contains an NSTableView of soup entries.
 	Selected soup entries can be exported by dragging to the Finder.
+	The search field below the table narrows it to the entries found.
 
 	Using an NSArrayController to supply the entries from a persistent document:
 	NSArrayController needs
@@ -74,6 +78,9 @@ extern NSString *	MakeNSString(RefArg inStr);
 
 //NSLog(@"-[NCSoupInfoController viewWillAppear] setting soup");
 	[self setValue:self.representedObject forKey:@"soup"];
+	// a search is of one soup
+	_searchField.stringValue = @"";
+	entries.filterPredicate = nil;
 
 	gUserFolders = self.document.userFolders;
 
@@ -121,7 +128,10 @@ extern NSString *	MakeNSString(RefArg inStr);
 		if ([colType isEqualToString:@"date"]
 		||  [colType isEqualToString:@"dateRef"])
 			[[colm dataCell] setFormatter:gDateFormatter];
-		NSSortDescriptor * sorter = [NSSortDescriptor sortDescriptorWithKey:tag ascending:YES];
+		// titles sort by their precomputed keys, as the Newton sorts them
+		NSSortDescriptor * sorter = [tag isEqualToString:@"title"]
+			? [NSSortDescriptor sortDescriptorWithKey:kTitleSortKey ascending:YES comparator:^(id inKey1, id inKey2) { return CompareSortKeys(inKey1, inKey2); }]
+			: [NSSortDescriptor sortDescriptorWithKey:tag ascending:YES];
 		[colm setSortDescriptorPrototype:sorter];
 		[_tableView addTableColumn:colm];
 		// bind column’s value to entries.arrangedObjects.(tag)
@@ -248,6 +258,94 @@ NSLog(@"will delete %@",nameList);
 }
 
 
+/* -----------------------------------------------------------------------------
+	Search the soup’s entries; the table shows only those found.
+	The search field takes
+		title:A..M		entries whose titles are in a range, as the Newton orders
+							them; either end may be left out; title:Name alone
+							finds titles that differ from it only in case or accents
+		folder:Name		entries filed in the named folder, or Unfiled
+		anything else	entries containing all the words and "quoted phrases"
+							given; a word ending in * matches any word it begins
+	Args:		sender			the search field
+	Return:	--
+----------------------------------------------------------------------------- */
+
+- (IBAction)search:(id)sender
+{
+	NSString * query = [[sender stringValue] stringByTrimmingCharactersInSet:NSCharacterSet.whitespaceCharacterSet];
+	if (query.length == 0) {
+		entries.filterPredicate = nil;
+		return;
+	}
+
+	if ([query hasPrefix:@"title:"]) {
+		NSString * first = [query substringFromIndex:6], * last;
+		NSRange dots = [first rangeOfString:@".."];
+		if (dots.location != NSNotFound) {
+			last = [first substringFromIndex:dots.location + dots.length];
+			first = [first substringToIndex:dots.location];
+		} else
+			last = first;
+		first = [first stringByTrimmingCharactersInSet:NSCharacterSet.whitespaceCharacterSet];
+		last = [last stringByTrimmingCharactersInSet:NSCharacterSet.whitespaceCharacterSet];
+		NSArray * found = [self.soup entriesWithTitleFrom:first.length > 0 ? first : nil to:last.length > 0 ? last : nil];
+		entries.filterPredicate = [NSPredicate predicateWithFormat:@"SELF IN %@", [NSSet setWithArray:found]];
+	} else if ([query hasPrefix:@"folder:"]) {
+		NSArray * ids = [self entryIdsInFolder:[[query substringFromIndex:7] stringByTrimmingCharactersInSet:NSCharacterSet.whitespaceCharacterSet]];
+		entries.filterPredicate = [NSPredicate predicateWithFormat:@"uniqueId IN %@", [NSSet setWithArray:ids]];
+	} else {
+		NSArray * found = [self.soup entriesMatchingText:query];
+		entries.filterPredicate = [NSPredicate predicateWithFormat:@"SELF IN %@", [NSSet setWithArray:found]];
+	}
+}
+
+
+/* -----------------------------------------------------------------------------
+	Return the ids of the entries filed in a folder.
+	They are found by querying the soup with a tagSpec, as a Newton app would.
+	Args:		inFolder			the folder’s name as the user sees it; Unfiled => none
+	Return:	NSArray of NSNumber; empty if the soup isn’t filed
+----------------------------------------------------------------------------- */
+
+- (NSArray *)entryIdsInFolder:(NSString *)inFolder
+{
+	// the folder’s tag is the symbol the device knows it by
+	NSString * tag = nil;
+	if ([inFolder caseInsensitiveCompare:@"Unfiled"] != NSOrderedSame) {
+		tag = inFolder;
+		NSDictionary * folders = self.document.userFolders;
+		for (NSString * key in folders) {
+			if ([folders[key] caseInsensitiveCompare:inFolder] == NSOrderedSame) {
+				tag = key;
+				break;
+			}
+		}
+	}
+
+	NSMutableArray * ids = [NSMutableArray array];
+	newton_try
+	{
+		RefVar tags(MakeArray(0));
+		if (tag)
+			AddArraySlot(tags, MakeSymbol(tag.UTF8String));
+		RefVar tagSpec(AllocateFrame());
+		SetFrameSlot(tagSpec, tag ? SYMA(any) : SYMA(equal), tags);
+		RefVar spec(AllocateFrame());
+		SetFrameSlot(spec, SYMA(tagSpec), tagSpec);
+		[ids addObjectsFromArray:[[self.soup query:spec] entryIds]];
+	}
+	newton_catch_all
+	{
+		// the soup has no tags index
+		NewtonErr err = (NewtonErr)(long)CurrentException()->data;
+		NSLog(@"-[NCSoupViewController entryIdsInFolder:] %@ soup can’t be queried by folder (%d)", self.soup.name, err);
+	}
+	end_try;
+	return ids;
+}
+
+
 /* -----------------------------------------------------------------------------
 	Import soup entries.
 	Args:		sender
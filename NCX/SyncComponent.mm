@@ -791,9 +791,7 @@ else NSLog(@"SyncService does not want to give us any changes for %@", entityNam
 						else if (evt.tag == kDBackupIDs)
 						{
 							// add ids to our list - these entries have not been modified or added
-							short * codedId;
-							for (codedId = (short *)evt.data; [idList add:CANONICAL_SHORT(*codedId)]; codedId++)
-								;
+							[idList addEncodedIds:evt.data length:evt.dataLength];
 						}
 						else if (evt.tag == kDBackupSoupDone
 							  ||  evt.tag == kDSoupNotDirty)
@@ -819,7 +817,7 @@ else NSLog(@"SyncService does not want to give us any changes for %@", entityNam
 					{
 						// calc delta with prev ids
 						// delete entries with ids in the delta
-						[soupObj cropTo:idList.ids];
+						[soupObj cropToIds:idList.idSet mainContext:dock.document.managedObjectContext];
 					}
 				}
 				XENDTRY;
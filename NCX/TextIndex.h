@@ -0,0 +1,123 @@
+/*
+	File:		TextIndex.h
+
+	Contains:	A full-text index of the strings in soup entries.
+
+	Written by:	Newton Research Group, 2026.
+*/
+
+#import <Foundation/Foundation.h>
+#import "NCSoup.h"
+#import "NCStore.h"
+
+
+#ifdef __cplusplus
+#import <map>
+#import <string>
+#import <unordered_map>
+#import <vector>
+#import "NewtonKit.h"
+
+/* -----------------------------------------------------------------------------
+	C T e x t I n d e x
+	An inverted index: each word in an entry’s strings maps to the entries, and
+	the positions within them, where it occurs.
+	Words are folded the way CompareUnicodeText() compares them: combining marks
+	are dropped and the rest is upper-cased without diacritics.
+	Entries are indexed and removed one at a time. Removing an entry just retires
+	its postings; they are swept out once they outnumber the live ones.
+	A query is a list of words and "quoted phrases", all of which must match;
+	a word ending in * matches any word it begins.
+----------------------------------------------------------------------------- */
+
+class CTextIndex
+{
+public:
+					CTextIndex();
+
+	void			add(uint32_t inId, NSData * inData);
+	void			remove(uint32_t inId);
+	void			search(const UniChar * inQuery, ArrayIndex inLength, std::vector<uint32_t> & outIds);
+
+	ArrayIndex	count(void) const;
+
+private:
+	struct Posting
+	{
+		uint32_t	id;
+		uint32_t	generation;		// of the entry when indexed
+		uint32_t	position;		// of the word in the entry
+	};
+	struct Entry
+	{
+		uint32_t	generation;
+		uint32_t	numOfPostings;
+	};
+	struct Term
+	{
+		std::u16string	word;
+		bool				isPrefix;
+	};
+
+	bool			isLive(const Posting & inPosting) const;
+	void			match(const std::vector<Term> & inPhrase, std::vector<uint32_t> & outIds);
+	void			sweep(void);
+
+	std::map<std::u16string, std::vector<Posting> >	fWords;
+	std::unordered_map<uint32_t, Entry>	fEntries;
+	uint32_t		fNextGeneration;
+	size_t		fNumOfPostings;
+	size_t		fNumOfDeadPostings;
+};
+
+inline ArrayIndex	CTextIndex::count(void) const { return (ArrayIndex)fEntries.size(); }
+
+#endif
+
+
+/* -----------------------------------------------------------------------------
+	N C T e x t I n d e x
+	The index of one soup, shared by every managed object context that has the
+	soup so entries stored on a background context are found from the UI.
+	Safe to use from any thread.
+----------------------------------------------------------------------------- */
+
+@interface NCTextIndex : NSObject
+
+@property(nonatomic,readonly) NSUInteger count;
+
+- (void)addEntryId:(NSUInteger)inId NSOFData:(NSData *)inData;
+- (void)removeEntryId:(NSUInteger)inId;
+- (NSIndexSet *)entryIdsMatching:(NSString *)inQuery;
+
++ (void)discardIndexesForCoordinator:(NSPersistentStoreCoordinator *)inCoordinator;
+
+@end
+
+
+/* -----------------------------------------------------------------------------
+	Text search at each level of the document.
+	A soup’s index is built the first time it is searched, then kept up to date
+	as entries are stored and deleted.
+----------------------------------------------------------------------------- */
+
+@interface NCSoup (TextIndex)
+@property(nonatomic,readonly) NCTextIndex * textIndex;
+- (void)indexEntryId:(NSUInteger)inId NSOFData:(NSData *)inData;
+- (void)unindexEntryId:(NSUInteger)inId;
+- (NSIndexSet *)entryIdsMatchingText:(NSString *)inQuery;
+- (NSArray *)entriesMatchingText:(NSString *)inQuery;
+@end
+
+@interface NCStore (TextIndex)
+- (NSArray *)entriesMatchingText:(NSString *)inQuery;
+@end
+
+#ifdef __cplusplus
+#import "NCDocument.h"
+
+@interface NCDocument (TextIndex)
+- (NSArray *)entriesMatchingText:(NSString *)inQuery;
+- (void)discardTextIndexes;
+@end
+#endif
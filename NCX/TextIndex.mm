@@ -0,0 +1,470 @@
+/*
+	File:		TextIndex.mm
+
+	Contains:	A full-text index of the strings in soup entries.
+
+	Written by:	Newton Research Group, 2026.
+*/
+
+#import "TextIndex.h"
+#import "NCDocument.h"
+#import "NSOFReader.h"
+#import "SoupQuery.h"
+#import "Metrics.h"
+#import <Newton/UStringUtils.h>
+#import <objc/objc-sync.h>
+#import <algorithm>
+#import <unordered_set>
+
+// sweep out retired postings once there are this many, and more than live ones
+#define kMinDeadPostings 4096
+
+// words longer than this are truncated
+#define kMaxWordLength 64
+
+
+/* -----------------------------------------------------------------------------
+	Break text into words, folded for comparison.
+	Args:		inText
+				inLength
+				inIsBigEndian	true => text is straight out of NSOF
+				inBlock			called with each word and the character that
+									follows it, or 0 at the end of the text
+	Return:	--
+----------------------------------------------------------------------------- */
+
+static void
+ForEachWord(const UniChar * inText, ArrayIndex inLength, bool inIsBigEndian, void (^inBlock)(const std::u16string & inWord, UniChar inNext))
+{
+	static CFCharacterSetRef wordChars = NULL;
+	static CFCharacterSetRef combiningMarks = NULL;
+	static dispatch_once_t once;
+	dispatch_once(&once, ^{
+		wordChars = CFCharacterSetGetPredefined(kCFCharacterSetAlphaNumeric);
+		combiningMarks = CFCharacterSetGetPredefined(kCFCharacterSetNonBase);
+	});
+
+	UniChar word[kMaxWordLength];
+	ArrayIndex wordLength = 0;
+	bool isInWord = false;
+	for (ArrayIndex i = 0; i <= inLength; ++i)
+	{
+		UniChar ch = 0;
+		if (i < inLength)
+			ch = inIsBigEndian ? CFSwapInt16BigToHost(inText[i]) : inText[i];
+		if (ch != 0 && CFCharacterSetIsCharacterMember(combiningMarks, ch))
+			// normalise decomposed characters: the base character alone is what we fold
+			continue;
+		if (ch != 0 && CFCharacterSetIsCharacterMember(wordChars, ch))
+		{
+			if (wordLength < kMaxWordLength)
+				word[wordLength++] = ch;
+			isInWord = true;
+		}
+		else if (isInWord)
+		{
+			UpperCaseNoDiacriticsText(word, wordLength);
+			inBlock(std::u16string((const char16_t *)word, wordLength), ch);
+			wordLength = 0;
+			isInWord = false;
+		}
+	}
+}
+
+
+/* -----------------------------------------------------------------------------
+	C T e x t I n d e x
+----------------------------------------------------------------------------- */
+
+CTextIndex::CTextIndex()
+	:	fNextGeneration(1), fNumOfPostings(0), fNumOfDeadPostings(0)
+{ }
+
+
+inline bool
+CTextIndex::isLive(const Posting & inPosting) const
+{
+	auto entry = fEntries.find(inPosting.id);
+	return entry != fEntries.end() && entry->second.generation == inPosting.generation;
+}
+
+
+/* -----------------------------------------------------------------------------
+	Index an entry, replacing any earlier version of it.
+	Args:		inId				the entry’s uniqueId
+				inData			its NSOF data
+	Return:	--
+----------------------------------------------------------------------------- */
+
+void
+CTextIndex::add(uint32_t inId, NSData * inData)
+{
+	remove(inId);
+
+	Entry & entry = fEntries[inId];
+	entry.generation = fNextGeneration++;
+	entry.numOfPostings = 0;
+
+	__block uint32_t position = 0;
+	Entry * entryp = &entry;
+	ForEachFlattenedString(inData, ^(const UniChar * inText, ArrayIndex inLength) {
+		ForEachWord(inText, inLength, true, ^(const std::u16string & inWord, UniChar inNext) {
+			fWords[inWord].push_back((Posting){ inId, entryp->generation, position++ });
+			entryp->numOfPostings++;
+		});
+		// phrases don’t run from one string into the next
+		position++;
+	});
+	fNumOfPostings += entry.numOfPostings;
+}
+
+
+/* -----------------------------------------------------------------------------
+	Remove an entry from the index.
+	Args:		inId
+	Return:	--
+----------------------------------------------------------------------------- */
+
+void
+CTextIndex::remove(uint32_t inId)
+{
+	auto entry = fEntries.find(inId);
+	if (entry == fEntries.end())
+		return;
+	fNumOfPostings -= entry->second.numOfPostings;
+	fNumOfDeadPostings += entry->second.numOfPostings;
+	fEntries.erase(entry);
+	if (fNumOfDeadPostings >= kMinDeadPostings && fNumOfDeadPostings > fNumOfPostings)
+		sweep();
+}
+
+
+void
+CTextIndex::sweep(void)
+{
+	for (auto word = fWords.begin(); word != fWords.end(); )
+	{
+		std::vector<Posting> & postings = word->second;
+		postings.erase(std::remove_if(postings.begin(), postings.end(), [this](const Posting & p) { return !isLive(p); }), postings.end());
+		if (postings.empty())
+			word = fWords.erase(word);
+		else
+			++word;
+	}
+	fNumOfDeadPostings = 0;
+}
+
+
+/* -----------------------------------------------------------------------------
+	Find entries matching a query.
+	Args:		inQuery
+				inLength
+				outIds			uniqueIds of the matching entries, ascending
+	Return:	--
+----------------------------------------------------------------------------- */
+
+void
+CTextIndex::search(const UniChar * inQuery, ArrayIndex inLength, std::vector<uint32_t> & outIds)
+{
+	outIds.clear();
+
+	// split the query into phrases; a word outside quotes is a phrase of one
+	std::vector<std::vector<Term> > phrases;
+	ArrayIndex start = 0;
+	bool isQuoted = false;
+	for (ArrayIndex i = 0; i <= inLength; ++i)
+	{
+		if (i == inLength || inQuery[i] == '"')
+		{
+			std::vector<std::vector<Term> > * phrasesp = &phrases;
+			__block std::vector<Term> phrase;
+			bool isPhrase = isQuoted;
+			ForEachWord(inQuery + start, i - start, false, ^(const std::u16string & inWord, UniChar inNext) {
+				Term term = { inWord, inNext == '*' };
+				if (isPhrase)
+					phrase.push_back(term);
+				else
+					phrasesp->push_back(std::vector<Term>(1, term));
+			});
+			if (!phrase.empty())
+				phrases.push_back(phrase);
+			isQuoted = !isQuoted;
+			start = i + 1;
+		}
+	}
+	if (phrases.empty())
+		return;
+
+	// every phrase must match
+	std::vector<uint32_t> ids, common;
+	for (auto phrase = phrases.begin(); phrase != phrases.end(); ++phrase)
+	{
+		match(*phrase, ids);
+		if (phrase == phrases.begin())
+			outIds.swap(ids);
+		else
+		{
+			common.clear();
+			std::set_intersection(outIds.begin(), outIds.end(), ids.begin(), ids.end(), std::back_inserter(common));
+			outIds.swap(common);
+		}
+		if (outIds.empty())
+			break;
+	}
+}
+
+
+/* -----------------------------------------------------------------------------
+	Find entries containing a phrase: its words at consecutive positions.
+	Args:		inPhrase
+				outIds			uniqueIds of the matching entries, ascending
+	Return:	--
+----------------------------------------------------------------------------- */
+
+void
+CTextIndex::match(const std::vector<Term> & inPhrase, std::vector<uint32_t> & outIds)
+{
+	// candidates are (id, position of the phrase’s first word)
+	std::unordered_set<uint64_t> candidates, matches;
+	for (size_t k = 0; k < inPhrase.size(); ++k)
+	{
+		const Term & term = inPhrase[k];
+		matches.clear();
+		auto word = term.isPrefix ? fWords.lower_bound(term.word) : fWords.find(term.word);
+		for ( ; word != fWords.end(); ++word)
+		{
+			if (term.isPrefix && word->first.compare(0, term.word.size(), term.word) != 0)
+				break;
+			for (const Posting & p : word->second)
+			{
+				if (p.position < k || !isLive(p))
+					continue;
+				uint64_t key = ((uint64_t)p.id << 32) | (p.position - k);
+				if (k == 0 || candidates.count(key) > 0)
+					matches.insert(key);
+			}
+			if (!term.isPrefix)
+				break;
+		}
+		candidates.swap(matches);
+		if (candidates.empty())
+			break;
+	}
+
+	outIds.clear();
+	for (uint64_t key : candidates)
+		outIds.push_back((uint32_t)(key >> 32));
+	std::sort(outIds.begin(), outIds.end());
+	outIds.erase(std::unique(outIds.begin(), outIds.end()), outIds.end());
+}
+
+
+#pragma mark -
+/* -----------------------------------------------------------------------------
+	N C T e x t I n d e x
+----------------------------------------------------------------------------- */
+
+// soup objectID -> NCTextIndex
+static NSMutableDictionary * gTextIndexes;
+
+@interface NCTextIndex ()
+{
+	CTextIndex index;
+}
+@end
+
+
+@implementation NCTextIndex
+
+- (NSUInteger)count {
+	@synchronized(self) {
+		return index.count();
+	}
+}
+
+
+- (void)addEntryId:(NSUInteger)inId NSOFData:(NSData *)inData {
+	uint64_t startTime = MetricsNow();
+	@synchronized(self) {
+		index.add((uint32_t)inId, inData);
+	}
+	MetricsTime(kMetricsIndex, startTime);
+}
+
+
+- (void)removeEntryId:(NSUInteger)inId {
+	@synchronized(self) {
+		index.remove((uint32_t)inId);
+	}
+}
+
+
+- (NSIndexSet *)entryIdsMatching:(NSString *)inQuery {
+	NSUInteger length = inQuery.length;
+	UniChar * query = (UniChar *)malloc(length * sizeof(UniChar) + 1);
+	[inQuery getCharacters:query range:NSMakeRange(0, length)];
+
+	std::vector<uint32_t> ids;
+	@synchronized(self) {
+		index.search(query, (ArrayIndex)length, ids);
+	}
+	free(query);
+
+	NSMutableIndexSet * result = [NSMutableIndexSet indexSet];
+	for (uint32_t uid : ids)
+		[result addIndex:uid];
+	return result;
+}
+
+
+/* -----------------------------------------------------------------------------
+	Forget the indexes of a document’s soups when it is closed.
+	Args:		inCoordinator	the document’s persistent store coordinator
+	Return:	--
+----------------------------------------------------------------------------- */
+
++ (void)discardIndexesForCoordinator:(NSPersistentStoreCoordinator *)inCoordinator {
+	@synchronized(self) {
+		NSMutableArray * soupIds = [NSMutableArray array];
+		for (NSManagedObjectID * soupId in gTextIndexes)
+			if (soupId.persistentStore.persistentStoreCoordinator == inCoordinator)
+				[soupIds addObject:soupId];
+		[gTextIndexes removeObjectsForKeys:soupIds];
+	}
+}
+
+@end
+
+
+#pragma mark -
+/* -----------------------------------------------------------------------------
+	N C S o u p
+----------------------------------------------------------------------------- */
+
+@implementation NCSoup (TextIndex)
+
+/* -----------------------------------------------------------------------------
+	Return the soup’s index, building it if need be.
+	A new index is registered before it is built, and held locked until it is,
+	so an entry stored meanwhile in another context is indexed after the build
+	rather than lost, and a search from another context waits for it.
+	A soup that has never been saved has no lasting identity to share its index
+	by, so it is indexed afresh each time.
+	Args:		--
+	Return:	the index
+----------------------------------------------------------------------------- */
+
+- (NCTextIndex *)textIndex {
+	NSManagedObjectID * soupId = self.objectID;
+	NCTextIndex * textIndex;
+	@synchronized(NCTextIndex.class) {
+		textIndex = gTextIndexes[soupId];
+		if (textIndex)
+			return textIndex;
+
+		textIndex = [[NCTextIndex alloc] init];
+		objc_sync_enter(textIndex);
+		if (!soupId.isTemporaryID) {
+			if (gTextIndexes == nil)
+				gTextIndexes = [[NSMutableDictionary alloc] init];
+			gTextIndexes[soupId] = textIndex;
+		}
+	}
+
+	[self enumerateEntryDataUsingBlock:^(NSUInteger inId, NSData * inData) {
+		if (inData)
+			[textIndex addEntryId:inId NSOFData:inData];
+		else
+			[textIndex removeEntryId:inId];
+	}];
+	objc_sync_exit(textIndex);
+	return textIndex;
+}
+
+
+/* -----------------------------------------------------------------------------
+	Keep the soup’s local indexes -- text and query -- up to date, if it has them.
+	Args:		inId
+				inData			NSOF data
+	Return:	--
+----------------------------------------------------------------------------- */
+
+- (void)indexEntryId:(NSUInteger)inId NSOFData:(NSData *)inData {
+	NCTextIndex * textIndex;
+	@synchronized(NCTextIndex.class) {
+		textIndex = gTextIndexes[self.objectID];
+	}
+	[textIndex addEntryId:inId NSOFData:inData];
+	[self indexQueryEntryId:inId NSOFData:inData];
+}
+
+
+- (void)unindexEntryId:(NSUInteger)inId {
+	NCTextIndex * textIndex;
+	@synchronized(NCTextIndex.class) {
+		textIndex = gTextIndexes[self.objectID];
+	}
+	[textIndex removeEntryId:inId];
+	[self unindexQueryEntryId:inId];
+}
+
+
+- (NSIndexSet *)entryIdsMatchingText:(NSString *)inQuery {
+	return [self.textIndex entryIdsMatching:inQuery];
+}
+
+
+/* -----------------------------------------------------------------------------
+	Return the entries matching a query.
+	Args:		inQuery
+	Return:	array of NCEntry, ordered by uniqueId
+----------------------------------------------------------------------------- */
+
+- (NSArray *)entriesMatchingText:(NSString *)inQuery {
+	NSIndexSet * ids = [self entryIdsMatchingText:inQuery];
+	if (ids.count == 0)
+		return @[];
+
+	NSMutableArray * idNumbers = [NSMutableArray arrayWithCapacity:ids.count];
+	[ids enumerateIndexesUsingBlock:^(NSUInteger uid, BOOL * stop) {
+		[idNumbers addObject:[NSNumber numberWithUnsignedInteger:uid]];
+	}];
+	NSFetchRequest * request = [NSFetchRequest fetchRequestWithEntityName:@"Entry"];
+	request.predicate = [NSPredicate predicateWithFormat:@"soup = %@ AND uniqueId IN %@", self, idNumbers];
+	request.sortDescriptors = @[[NSSortDescriptor sortDescriptorWithKey:@"uniqueId" ascending:YES]];
+
+	NSError *__autoreleasing error = nil;
+	NSArray * results = [self.managedObjectContext executeFetchRequest:request error:&error];
+	return results ? results : @[];
+}
+
+@end
+
+
+@implementation NCStore (TextIndex)
+
+- (NSArray *)entriesMatchingText:(NSString *)inQuery {
+	NSMutableArray * results = [NSMutableArray array];
+	for (NCSoup * soup in self.soups)
+		[results addObjectsFromArray:[soup entriesMatchingText:inQuery]];
+	return results;
+}
+
+@end
+
+
+@implementation NCDocument (TextIndex)
+
+- (NSArray *)entriesMatchingText:(NSString *)inQuery {
+	NSMutableArray * results = [NSMutableArray array];
+	for (NCStore * store in self.stores)
+		[results addObjectsFromArray:[store entriesMatchingText:inQuery]];
+	return results;
+}
+
+
+- (void)discardTextIndexes {
+	[NCTextIndex discardIndexesForCoordinator:self.objContext.persistentStoreCoordinator];
+}
+
+@end
@@ -1,5 +1,8 @@
 
 #import "AppDelegate.h"
+#import "PreferenceKeys.h"
+#import "Simulator.h"
+#import "Trace.h"
 
 #import <mach/mach_port.h>
 #import <mach/mach_interface.h>
@@ -39,6 +42,24 @@ int main(int argc, const char * argv[]) {
 	IONotificationPortRef notify;
 	io_object_t anIterator;
 
+	// -Simulator runs the app as a simulated Newton instead
+	// -DecodeTrace prints an I/O trace file
+	NSString * simulatorConfig, * tracePath;
+	@autoreleasepool {
+		simulatorConfig = [NSUserDefaults.standardUserDefaults stringForKey:kSimulatorPref];
+		tracePath = [NSUserDefaults.standardUserDefaults stringForKey:kDecodeTracePref];
+	}
+	if (simulatorConfig)
+		return SimulatorMain(simulatorConfig);
+	if (tracePath) {
+		@autoreleasepool {
+			NCError err = DecodeTrace([NSURL fileURLWithPath:tracePath.stringByExpandingTildeInPath], stdout);
+			if (err)
+				fprintf(stderr, "%s is not a trace file (%d)\n", tracePath.fileSystemRepresentation, err);
+			return err ? 1 : 0;
+		}
+	}
+
 	gRootPort = IORegisterForSystemPower(0, &notify, callback, &anIterator);
 	CFRunLoopAddSource(CFRunLoopGetCurrent(),
 							IONotificationPortGetRunLoopSource(notify),